@@ -292,6 +292,15 @@ Result BinaryReaderLogging::BeginFunctionBody(Index value, Offset size) {
   return reader_->BeginFunctionBody(value, size);
 }
 
+Result BinaryReaderLogging::OnSkippedFunctionBody(Index index,
+                                                  Offset offset,
+                                                  Offset size) {
+  LOGF("OnSkippedFunctionBody(%" PRIindex ", offset:%" PRIzd ", size:%" PRIzd
+       ")\n",
+       index, offset, size);
+  return reader_->OnSkippedFunctionBody(index, offset, size);
+}
+
 Result BinaryReaderLogging::OnLocalDecl(Index decl_index,
                                         Index count,
                                         Type type) {
@@ -168,6 +168,11 @@ class BinaryReaderNop : public BinaryReaderDelegate {
   Result BeginFunctionBody(Index index, Offset size) override {
     return Result::Ok;
   }
+  Result OnSkippedFunctionBody(Index index,
+                               Offset offset,
+                               Offset size) override {
+    return Result::Ok;
+  }
   Result OnLocalDeclCount(Index count) override { return Result::Ok; }
   Result OnLocalDecl(Index decl_index, Index count, Type type) override {
     return Result::Ok;
@@ -72,6 +72,10 @@ class BinaryReader {
                const ReadBinaryOptions& options);
 
   Result ReadModule();
+  Result ReadSkippedFunction(Index func_index,
+                             Offset offset,
+                             Offset body_size,
+                             const FunctionBodyContext& context);
 
  private:
   template <typename T, T BinaryReader::*member>
@@ -128,6 +132,7 @@ class BinaryReader {
   Result ReadAddress(Address* out_value,
                      Index memory,
                      const char* desc) WABT_WARN_UNUSED;
+  Result ReadFunction(Index func_index, Offset end_offset) WABT_WARN_UNUSED;
   Result ReadFunctionBody(Offset end_offset) WABT_WARN_UNUSED;
   // ReadInstructions either until and END instruction, or until
   // the given end_offset.
@@ -2641,32 +2646,44 @@ Result BinaryReader::ReadCodeSection(Offset section_size) {
     CHECK_RESULT(ReadU32Leb128(&body_size, "function body size"));
     Offset body_start_offset = state_.offset;
     Offset end_offset = body_start_offset + body_size;
-    CALLBACK(BeginFunctionBody, func_index, body_size);
-
-    uint64_t total_locals = 0;
-    Index num_local_decls;
-    CHECK_RESULT(ReadCount(&num_local_decls, "local declaration count"));
-    CALLBACK(OnLocalDeclCount, num_local_decls);
-    for (Index k = 0; k < num_local_decls; ++k) {
-      Index num_local_types;
-      CHECK_RESULT(ReadIndex(&num_local_types, "local type count"));
-      total_locals += num_local_types;
-      ERROR_UNLESS(total_locals < UINT32_MAX,
-                   "local count must be < 0x10000000");
-      Type local_type;
-      CHECK_RESULT(ReadType(&local_type, "local type"));
-      ERROR_UNLESS(IsConcreteType(local_type), "expected valid local type");
-      CALLBACK(OnLocalDecl, k, num_local_types, local_type);
+    if (options_.skip_function_bodies) {
+      ERROR_UNLESS(end_offset <= read_end_,
+                   "function body extends past end of section");
+      CALLBACK(OnSkippedFunctionBody, func_index, body_start_offset,
+               body_size);
+      state_.offset = end_offset;
+    } else {
+      CHECK_RESULT(ReadFunction(func_index, end_offset));
     }
-
-    CHECK_RESULT(ReadFunctionBody(end_offset));
-
-    CALLBACK(EndFunctionBody, func_index);
   }
   CALLBACK0(EndCodeSection);
   return Result::Ok;
 }
 
+Result BinaryReader::ReadFunction(Index func_index, Offset end_offset) {
+  CALLBACK(BeginFunctionBody, func_index, end_offset - state_.offset);
+
+  uint64_t total_locals = 0;
+  Index num_local_decls;
+  CHECK_RESULT(ReadCount(&num_local_decls, "local declaration count"));
+  CALLBACK(OnLocalDeclCount, num_local_decls);
+  for (Index k = 0; k < num_local_decls; ++k) {
+    Index num_local_types;
+    CHECK_RESULT(ReadIndex(&num_local_types, "local type count"));
+    total_locals += num_local_types;
+    ERROR_UNLESS(total_locals < UINT32_MAX, "local count must be < 0x10000000");
+    Type local_type;
+    CHECK_RESULT(ReadType(&local_type, "local type"));
+    ERROR_UNLESS(IsConcreteType(local_type), "expected valid local type");
+    CALLBACK(OnLocalDecl, k, num_local_types, local_type);
+  }
+
+  CHECK_RESULT(ReadFunctionBody(end_offset));
+
+  CALLBACK(EndFunctionBody, func_index);
+  return Result::Ok;
+}
+
 Result BinaryReader::ReadDataSection(Offset section_size) {
   CALLBACK(BeginDataSection, section_size);
   Index num_data_segments;
@@ -2873,6 +2890,19 @@ Result BinaryReader::ReadModule() {
   return Result::Ok;
 }
 
+Result BinaryReader::ReadSkippedFunction(Index func_index,
+                                         Offset offset,
+                                         Offset body_size,
+                                         const FunctionBodyContext& context) {
+  ERROR_UNLESS(offset <= read_end_ && body_size <= read_end_ - offset,
+               "function body extends past end of data");
+  state_.offset = offset;
+  read_end_ = offset + body_size;
+  data_count_ = context.data_count;
+  memories = context.memories;
+  return ReadFunction(func_index, read_end_);
+}
+
 }  // end anonymous namespace
 
 Result ReadBinary(const void* data,
@@ -2883,4 +2913,16 @@ Result ReadBinary(const void* data,
   return reader.ReadModule();
 }
 
+Result ReadBinaryFunctionBody(const void* data,
+                              size_t size,
+                              Index func_index,
+                              Offset offset,
+                              Offset body_size,
+                              const FunctionBodyContext& context,
+                              BinaryReaderDelegate* delegate,
+                              const ReadBinaryOptions& options) {
+  BinaryReader reader(data, size, delegate, options);
+  return reader.ReadSkippedFunction(func_index, offset, body_size, context);
+}
+
 }  // namespace wabt
@@ -49,6 +49,9 @@ struct ReadBinaryOptions {
   bool read_debug_names = false;
   bool stop_on_first_error = true;
   bool fail_on_custom_section_error = true;
+  // Report each function body with OnSkippedFunctionBody instead of reading
+  // it. The body can be read later with ReadBinaryFunctionBody.
+  bool skip_function_bodies = false;
 };
 
 // TODO: Move somewhere else?
@@ -185,6 +188,12 @@ class BinaryReaderDelegate {
   virtual Result BeginCodeSection(Offset size) = 0;
   virtual Result OnFunctionBodyCount(Index count) = 0;
   virtual Result BeginFunctionBody(Index index, Offset size) = 0;
+  // Called instead of BeginFunctionBody..EndFunctionBody when
+  // ReadBinaryOptions::skip_function_bodies is set. `offset` is the start of
+  // the body, after its size.
+  virtual Result OnSkippedFunctionBody(Index index,
+                                       Offset offset,
+                                       Offset size) = 0;
   virtual Result OnLocalDeclCount(Index count) = 0;
   virtual Result OnLocalDecl(Index decl_index, Index count, Type type) = 0;
 
@@ -469,6 +478,28 @@ Result ReadBinary(const void* data,
                   BinaryReaderDelegate* reader,
                   const ReadBinaryOptions& options);
 
+// The parts of the rest of the module that are needed to read a function
+// body on its own.
+struct FunctionBodyContext {
+  // The count from the DataCount section, or kInvalidIndex if there is none.
+  Index data_count = kInvalidIndex;
+  std::vector<Limits> memories;  // Includes imported and defined.
+};
+
+// Reads a function body that was skipped with
+// ReadBinaryOptions::skip_function_bodies, calling BeginFunctionBody through
+// EndFunctionBody. `data` must contain the body at the `offset` and `size`
+// that OnSkippedFunctionBody reported, adjusted if only part of the module
+// was kept.
+Result ReadBinaryFunctionBody(const void* data,
+                              size_t size,
+                              Index func_index,
+                              Offset offset,
+                              Offset body_size,
+                              const FunctionBodyContext& context,
+                              BinaryReaderDelegate* reader,
+                              const ReadBinaryOptions& options);
+
 size_t ReadU32Leb128(const uint8_t* ptr,
                      const uint8_t* end,
                      uint32_t* out_value);
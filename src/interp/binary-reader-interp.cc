@@ -16,8 +16,11 @@
 
 #include "src/interp/binary-reader-interp.h"
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
+#include <thread>
 
 #include "src/binary-reader-nop.h"
 #include "src/feature.h"
@@ -71,12 +74,30 @@ struct FixupMap {
   std::map<Index, Fixups> map;
 };
 
+// A function body compiled on a worker thread by CompileFuncsInParallel. Its
+// istream offsets are relative to the start of the fragment until it is
+// linked into the module.
+struct FuncFragment {
+  FuncDesc func{FuncType({}, {}), {}, Istream::kInvalidOffset, {}, {}, {}};
+  Istream istream;
+  std::vector<Istream::Offset> relocs;  // Offset immediates in `istream`.
+  FixupMap func_fixups;  // By defined function index; never resolved here.
+  Errors errors;
+  Result result = Result::Error;
+};
+
 class BinaryReaderInterp : public BinaryReaderNop {
  public:
   BinaryReaderInterp(ModuleDesc* module,
                      string_view filename,
                      Errors* errors,
-                     const Features& features);
+                     const Features& features,
+                     const CompileOptions& compile_options);
+  // A reader for function bodies only, on a thread other than that of
+  // `parent`. It shares the parent's ModuleDesc, which must not change while
+  // this reader is in use, and has its own copy of the rest of the
+  // module-level state.
+  BinaryReaderInterp(const BinaryReaderInterp& parent, Errors* errors);
 
   ValueType GetType(InitExpr);
 
@@ -146,7 +167,11 @@ class BinaryReaderInterp : public BinaryReaderNop {
 
   Result OnStartFunction(Index func_index) override;
 
+  Result BeginCodeSection(Offset size) override;
   Result BeginFunctionBody(Index index, Offset size) override;
+  Result OnSkippedFunctionBody(Index index,
+                               Offset offset,
+                               Offset size) override;
   Result OnLocalDeclCount(Index count) override;
   Result OnLocalDecl(Index decl_index, Index count, Type type) override;
 
@@ -277,7 +302,32 @@ class BinaryReaderInterp : public BinaryReaderNop {
                            const void* data,
                            Address size) override;
 
+  Result OnFunctionName(Index function_index,
+                        string_view function_name) override;
+
+  // Reads the body of a function that was skipped with CompileOptions::lazy,
+  // appending it to `module`. This may be a copy of the ModuleDesc that was
+  // originally read.
+  Result CompileFunc(ModuleDesc* module,
+                     Index func_index,
+                     const ReadBinaryOptions& options,
+                     std::string* out_message);
+
+  // Reads the function bodies that were skipped (see
+  // CompileOptions::num_threads) on several threads, and appends them to the
+  // module in order.
+  Result CompileFuncsInParallel(const void* data,
+                                size_t size,
+                                const ReadBinaryOptions& options);
+
  private:
+  Result CompileFragment(const void* data,
+                         size_t size,
+                         Index func_index,
+                         const ReadBinaryOptions& options,
+                         FuncFragment* fragment);
+  void LinkFragment(Index func_index, FuncFragment* fragment);
+
   Location GetLocation() const;
   Label* GetLabel(Index depth);
   Label* GetNearestTryLabel(Index depth);
@@ -310,14 +360,29 @@ class BinaryReaderInterp : public BinaryReaderNop {
               Index catch_drop_count);
   void FixupTopLabel();
   u32 GetFuncOffset(Index func_index);
+  void EmitOffset(Istream::Offset);
+  Istream::Offset EmitOffsetFixup();
+  void Rewind(Istream::Offset);
+  void AddStackMap(Index result_count);
+
+  void EmitConsumeFuel();
+  void ResolveConsumeFuel();
 
-  Index TranslateLocalIndex(Index local_index);
+  static bool IsFusionOpcode(Opcode);
+  void AddToFusionWindow(Istream::Offset);
+  bool PeekFusionWindow(Index depth, Instr* out_instr, Istream::Offset*);
+  Istream::Offset EmitBrUnless();
+
+  Index GetTypeStackSlotCount(size_t type_stack_limit = 0);
+  void AddLocalSlots(Index count, Type type);
+  Index GetLocalSlotCount() const;
+  Index TranslateLocalIndex(Index local_index, Index* out_slot_count = nullptr);
 
   Index num_func_imports() const;
 
   Errors* errors_ = nullptr;
-  ModuleDesc& module_;
-  Istream& istream_;
+  ModuleDesc* module_;
+  Istream* istream_;
 
   SharedValidator validator_;
 
@@ -326,17 +391,55 @@ class BinaryReaderInterp : public BinaryReaderNop {
   FixupMap depth_fixups_;
   FixupMap func_fixups_;
 
+  CompileOptions compile_options_;
+  // Start offsets of the most recently emitted instructions that may still be
+  // fused with the instruction that follows them. The instructions are
+  // adjacent in the istream and no branch target points between them.
+  std::vector<Istream::Offset> fusion_window_;
+  // With CompileOptions::fuel_metering, the immediate of the consume_fuel
+  // instruction that starts the current basic block, and the number of
+  // instructions read since. The fixup is invalid after an unconditional
+  // branch, until the next block starts.
+  Istream::Offset fuel_fixup_ = Istream::kInvalidOffset;
+  u32 fuel_cost_ = 0;
+
   bool reading_init_expr_ = false;
   InitExpr init_expr_;
   u32 local_decl_count_;
   u32 local_count_;
 
+  // The value stack slots used by the parameters and locals of the current
+  // function. Like LocalDesc, each entry covers a run of locals of the same
+  // type, so a local's slot can be found with a binary search.
+  struct LocalSlots {
+    Index end;         // One past the last local index in this run.
+    Index slot_end;    // One past the last slot used by this run.
+    Index slot_count;  // Slots used by each local in this run.
+  };
+  std::vector<LocalSlots> local_slots_;
+  Index param_slot_count_;
+
   std::vector<FuncType> func_types_;      // Includes imported and defined.
   std::vector<TableType> table_types_;    // Includes imported and defined.
   std::vector<MemoryType> memory_types_;  // Includes imported and defined.
   std::vector<GlobalType> global_types_;  // Includes imported and defined.
   std::vector<TagType> tag_types_;        // Includes imported and defined.
 
+  // The location of each defined function's body in the module, when the
+  // bodies are skipped and compiled later. For CompileOptions::lazy, the
+  // reader also keeps a copy of the code section.
+  struct FuncBody {
+    Offset offset;
+    Offset size;
+  };
+  std::vector<FuncBody> func_bodies_;
+  std::vector<u8> lazy_code_;
+  Offset lazy_code_offset_ = 0;  // Of lazy_code_ in the module.
+  FunctionBodyContext body_context_;
+
+  // Set while a worker compiles a function for CompileFuncsInParallel.
+  FuncFragment* fragment_ = nullptr;
+
   static const Index kMemoryIndex0 = 0;
   string_view filename_;
 };
@@ -370,13 +473,32 @@ void FixupMap::Resolve(Istream& istream, Index index) {
 BinaryReaderInterp::BinaryReaderInterp(ModuleDesc* module,
                                        string_view filename,
                                        Errors* errors,
-                                       const Features& features)
+                                       const Features& features,
+                                       const CompileOptions& compile_options)
     : errors_(errors),
-      module_(*module),
-      istream_(module->istream),
+      module_(module),
+      istream_(&module->istream),
       validator_(errors, ValidateOptions(features)),
+      compile_options_(compile_options),
       filename_(filename) {}
 
+BinaryReaderInterp::BinaryReaderInterp(const BinaryReaderInterp& parent,
+                                       Errors* errors)
+    : errors_(errors),
+      module_(parent.module_),
+      istream_(nullptr),
+      validator_(parent.validator_, errors),
+      func_(nullptr),
+      compile_options_(parent.compile_options_),
+      func_types_(parent.func_types_),
+      table_types_(parent.table_types_),
+      memory_types_(parent.memory_types_),
+      global_types_(parent.global_types_),
+      tag_types_(parent.tag_types_),
+      func_bodies_(parent.func_bodies_),
+      body_context_(parent.body_context_),
+      filename_(parent.filename_) {}
+
 Label* BinaryReaderInterp::GetLabel(Index depth) {
   assert(depth < label_stack_.size());
   return &label_stack_[label_stack_.size() - depth - 1];
@@ -402,11 +524,12 @@ void WABT_PRINTF_FORMAT(2, 3) BinaryReaderInterp::PrintError(const char* format,
   errors_->emplace_back(ErrorLevel::Error, Location(kInvalidOffset), buffer);
 }
 
+// Drop and keep counts are in value stack slots, see GetSlotCount.
 Result BinaryReaderInterp::GetDropCount(Index keep_count,
                                         size_t type_stack_limit,
                                         Index* out_drop_count) {
   assert(validator_.type_stack_size() >= type_stack_limit);
-  Index type_stack_count = validator_.type_stack_size() - type_stack_limit;
+  Index type_stack_count = GetTypeStackSlotCount(type_stack_limit);
   // The keep_count may be larger than the type_stack_count if the typechecker
   // is currently unreachable. In that case, it doesn't matter what value we
   // drop, but 0 is a reasonable choice.
@@ -420,7 +543,7 @@ Result BinaryReaderInterp::GetBrDropKeepCount(Index depth,
                                               Index* out_keep_count) {
   SharedValidator::Label* label;
   CHECK_RESULT(validator_.GetLabel(depth, &label));
-  Index keep_count = label->br_types().size();
+  Index keep_count = GetSlotCount(label->br_types());
   CHECK_RESULT(
       GetDropCount(keep_count, label->type_stack_limit, out_drop_count));
   *out_keep_count = keep_count;
@@ -431,7 +554,7 @@ Result BinaryReaderInterp::GetReturnDropKeepCount(Index* out_drop_count,
                                                   Index* out_keep_count) {
   CHECK_RESULT(GetBrDropKeepCount(label_stack_.size() - 1, out_drop_count,
                                   out_keep_count));
-  *out_drop_count += validator_.GetLocalCount();
+  *out_drop_count += GetLocalSlotCount();
   return Result::Ok;
 }
 
@@ -439,9 +562,9 @@ Result BinaryReaderInterp::GetReturnCallDropKeepCount(const FuncType& func_type,
                                                       Index keep_extra,
                                                       Index* out_drop_count,
                                                       Index* out_keep_count) {
-  Index keep_count = static_cast<Index>(func_type.params.size()) + keep_extra;
+  Index keep_count = GetSlotCount(func_type.params) + keep_extra;
   CHECK_RESULT(GetDropCount(keep_count, 0, out_drop_count));
-  *out_drop_count += validator_.GetLocalCount();
+  *out_drop_count += GetLocalSlotCount();
   *out_keep_count = keep_count;
   return Result::Ok;
 }
@@ -450,31 +573,175 @@ void BinaryReaderInterp::EmitBr(Index depth,
                                 Index drop_count,
                                 Index keep_count,
                                 Index catch_drop_count) {
-  istream_.EmitDropKeep(drop_count, keep_count);
-  istream_.EmitCatchDrop(catch_drop_count);
+  istream_->EmitDropKeep(drop_count, keep_count);
+  istream_->EmitCatchDrop(catch_drop_count);
   Istream::Offset offset = GetLabel(depth)->offset;
-  istream_.Emit(Opcode::Br);
+  istream_->Emit(Opcode::Br);
   if (offset == Istream::kInvalidOffset) {
     // depth_fixups_ stores the depth counting up from zero, where zero is the
     // top-level function scope.
-    depth_fixups_.Append(label_stack_.size() - 1 - depth, istream_.end());
+    depth_fixups_.Append(label_stack_.size() - 1 - depth, istream_->end());
   }
-  istream_.Emit(offset);
+  EmitOffset(offset);
 }
 
 void BinaryReaderInterp::FixupTopLabel() {
-  depth_fixups_.Resolve(istream_, label_stack_.size() - 1);
+  depth_fixups_.Resolve(*istream_, label_stack_.size() - 1);
 }
 
 u32 BinaryReaderInterp::GetFuncOffset(Index func_index) {
   assert(func_index >= num_func_imports());
-  FuncDesc& func = module_.funcs[func_index - num_func_imports()];
+  Index defined_index = func_index - num_func_imports();
+  if (fragment_) {
+    // Functions are only placed when the fragments are linked.
+    fragment_->func_fixups.Append(defined_index, istream_->end());
+    return Istream::kInvalidOffset;
+  }
+  FuncDesc& func = module_->funcs[defined_index];
   if (func.code_offset == Istream::kInvalidOffset) {
-    func_fixups_.Append(func_index, istream_.end());
+    // Resolved by BeginFunctionBody, which uses the defined function index.
+    func_fixups_.Append(defined_index, istream_->end());
   }
   return func.code_offset;
 }
 
+// Offset immediates (branch targets) must go through these, so that they can
+// be relocated when a fragment is linked.
+void BinaryReaderInterp::EmitOffset(Istream::Offset offset) {
+  if (fragment_) {
+    fragment_->relocs.push_back(istream_->end());
+  }
+  istream_->Emit(offset);
+}
+
+Istream::Offset BinaryReaderInterp::EmitOffsetFixup() {
+  if (fragment_) {
+    fragment_->relocs.push_back(istream_->end());
+  }
+  return istream_->EmitFixupU32();
+}
+
+void BinaryReaderInterp::Rewind(Istream::Offset offset) {
+  if (fragment_) {
+    auto& relocs = fragment_->relocs;
+    while (!relocs.empty() && relocs.back() >= offset) {
+      relocs.pop_back();
+    }
+  }
+  istream_->Rewind(offset);
+}
+
+// Records the operand stack slots that hold references while the call that was
+// just emitted is in progress. Must be called after the validator has handled
+// the call; the call's results aren't on the stack until it returns.
+void BinaryReaderInterp::AddStackMap(Index result_count) {
+  const TypeVector& types = validator_.type_stack();
+  StackMapDesc stack_map{istream_->end(), {}};
+  Index slot = GetLocalSlotCount() - param_slot_count_;
+  for (size_t i = 0; i + result_count < types.size(); ++i) {
+    if (types[i].IsRef()) {
+      stack_map.slots.push_back(slot);
+    }
+    slot += GetSlotCount(types[i]);
+  }
+  if (!stack_map.slots.empty()) {
+    func_->stack_maps.push_back(std::move(stack_map));
+  }
+}
+
+void BinaryReaderInterp::EmitConsumeFuel() {
+  if (!compile_options_.fuel_metering) {
+    return;
+  }
+  ResolveConsumeFuel();
+  // The cost isn't known yet, so always use the long form. Nothing may be
+  // fused across it, since it starts a new block.
+  fusion_window_.clear();
+  istream_->EmitWide(Opcode::InterpConsumeFuel, 0);
+  fuel_fixup_ = istream_->end() - sizeof(u32);
+  fuel_cost_ = 0;
+}
+
+// Sets the cost of the current basic block. Besides when the next block
+// starts, this is called after an unconditional branch, since the code up to
+// the next block can't run.
+void BinaryReaderInterp::ResolveConsumeFuel() {
+  if (fuel_fixup_ != Istream::kInvalidOffset) {
+    istream_->ResolveFixupU32(fuel_fixup_, std::max(fuel_cost_, 1u));
+    fuel_fixup_ = Istream::kInvalidOffset;
+  }
+}
+
+// Only these opcodes can extend a fusion candidate sequence; any other
+// instruction (in particular anything that creates a branch target) resets
+// the fusion window in OnOpcode.
+bool BinaryReaderInterp::IsFusionOpcode(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::LocalGet:
+    case Opcode::LocalSet:
+    case Opcode::I32Const:
+    case Opcode::I32Add:
+    case Opcode::I32Sub:
+    case Opcode::I32Eqz:
+    case Opcode::I32LtS:
+    case Opcode::I32LtU:
+    case Opcode::I32Load:
+    case Opcode::BrIf:
+    case Opcode::If:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+void BinaryReaderInterp::AddToFusionWindow(Istream::Offset offset) {
+  if (!compile_options_.fuse_instructions) {
+    return;
+  }
+  // No superinstruction replaces more than two preceding instructions.
+  const size_t kMaxFusionWindowSize = 2;
+  if (fusion_window_.size() == kMaxFusionWindowSize) {
+    fusion_window_.erase(fusion_window_.begin());
+  }
+  fusion_window_.push_back(offset);
+}
+
+bool BinaryReaderInterp::PeekFusionWindow(Index depth,
+                                          Instr* out_instr,
+                                          Istream::Offset* out_offset) {
+  if (depth >= fusion_window_.size()) {
+    return false;
+  }
+  Istream::Offset offset = fusion_window_[fusion_window_.size() - depth - 1];
+  *out_offset = offset;
+  *out_instr = istream_->Read(&offset);
+  return true;
+}
+
+// Emit a branch that is taken when the condition on top of the stack is zero,
+// folding a preceding i32 comparison into it where possible. Returns the
+// offset of the branch target, which must be resolved by the caller.
+Istream::Offset BinaryReaderInterp::EmitBrUnless() {
+  Opcode opcode = Opcode::InterpBrUnless;
+  Instr prev;
+  Istream::Offset prev_offset;
+  if (PeekFusionWindow(0, &prev, &prev_offset)) {
+    switch (prev.op) {
+      case Opcode::I32Eqz: opcode = Opcode::BrIf; break;
+      case Opcode::I32LtS: opcode = Opcode::InterpI32LtSBrUnless; break;
+      case Opcode::I32LtU: opcode = Opcode::InterpI32LtUBrUnless; break;
+      default:             break;
+    }
+    if (opcode != Opcode::InterpBrUnless) {
+      Rewind(prev_offset);
+    }
+  }
+  fusion_window_.clear();
+  istream_->Emit(opcode);
+  return EmitOffsetFixup();
+}
+
 bool BinaryReaderInterp::OnError(const Error& error) {
   errors_->push_back(error);
   return true;
@@ -486,7 +753,7 @@ Result BinaryReaderInterp::EndModule() {
 }
 
 Result BinaryReaderInterp::OnTypeCount(Index count) {
-  module_.func_types.reserve(count);
+  module_->func_types.reserve(count);
   return Result::Ok;
 }
 
@@ -497,7 +764,7 @@ Result BinaryReaderInterp::OnFuncType(Index index,
                                       Type* result_types) {
   CHECK_RESULT(validator_.OnFuncType(GetLocation(), param_count, param_types,
                                      result_count, result_types, index));
-  module_.func_types.push_back(FuncType(ToInterp(param_count, param_types),
+  module_->func_types.push_back(FuncType(ToInterp(param_count, param_types),
                                         ToInterp(result_count, result_types)));
   return Result::Ok;
 }
@@ -508,8 +775,8 @@ Result BinaryReaderInterp::OnImportFunc(Index import_index,
                                         Index func_index,
                                         Index sig_index) {
   CHECK_RESULT(validator_.OnFunction(GetLocation(), Var(sig_index)));
-  FuncType& func_type = module_.func_types[sig_index];
-  module_.imports.push_back(ImportDesc{ImportType(
+  FuncType& func_type = module_->func_types[sig_index];
+  module_->imports.push_back(ImportDesc{ImportType(
       module_name.to_string(), field_name.to_string(), func_type.Clone())});
   func_types_.push_back(func_type);
   return Result::Ok;
@@ -523,7 +790,7 @@ Result BinaryReaderInterp::OnImportTable(Index import_index,
                                          const Limits* elem_limits) {
   CHECK_RESULT(validator_.OnTable(GetLocation(), elem_type, *elem_limits));
   TableType table_type{elem_type, *elem_limits};
-  module_.imports.push_back(ImportDesc{ImportType(
+  module_->imports.push_back(ImportDesc{ImportType(
       module_name.to_string(), field_name.to_string(), table_type.Clone())});
   table_types_.push_back(table_type);
   return Result::Ok;
@@ -536,9 +803,10 @@ Result BinaryReaderInterp::OnImportMemory(Index import_index,
                                           const Limits* page_limits) {
   CHECK_RESULT(validator_.OnMemory(GetLocation(), *page_limits));
   MemoryType memory_type{*page_limits};
-  module_.imports.push_back(ImportDesc{ImportType(
+  module_->imports.push_back(ImportDesc{ImportType(
       module_name.to_string(), field_name.to_string(), memory_type.Clone())});
   memory_types_.push_back(memory_type);
+  body_context_.memories.push_back(*page_limits);
   return Result::Ok;
 }
 
@@ -550,7 +818,7 @@ Result BinaryReaderInterp::OnImportGlobal(Index import_index,
                                           bool mutable_) {
   CHECK_RESULT(validator_.OnGlobalImport(GetLocation(), type, mutable_));
   GlobalType global_type{type, ToMutability(mutable_)};
-  module_.imports.push_back(ImportDesc{ImportType(
+  module_->imports.push_back(ImportDesc{ImportType(
       module_name.to_string(), field_name.to_string(), global_type.Clone())});
   global_types_.push_back(global_type);
   return Result::Ok;
@@ -562,29 +830,30 @@ Result BinaryReaderInterp::OnImportTag(Index import_index,
                                        Index tag_index,
                                        Index sig_index) {
   CHECK_RESULT(validator_.OnTag(GetLocation(), Var(sig_index)));
-  FuncType& func_type = module_.func_types[sig_index];
+  FuncType& func_type = module_->func_types[sig_index];
   TagType tag_type{TagAttr::Exception, func_type.params};
-  module_.imports.push_back(ImportDesc{ImportType(
+  module_->imports.push_back(ImportDesc{ImportType(
       module_name.to_string(), field_name.to_string(), tag_type.Clone())});
   tag_types_.push_back(tag_type);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnFunctionCount(Index count) {
-  module_.funcs.reserve(count);
+  module_->funcs.reserve(count);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnFunction(Index index, Index sig_index) {
   CHECK_RESULT(validator_.OnFunction(GetLocation(), Var(sig_index)));
-  FuncType& func_type = module_.func_types[sig_index];
-  module_.funcs.push_back(FuncDesc{func_type, {}, Istream::kInvalidOffset, {}});
+  FuncType& func_type = module_->func_types[sig_index];
+  module_->funcs.push_back(
+      FuncDesc{func_type, {}, Istream::kInvalidOffset, {}, {}, {}});
   func_types_.push_back(func_type);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTableCount(Index count) {
-  module_.tables.reserve(count);
+  module_->tables.reserve(count);
   return Result::Ok;
 }
 
@@ -593,33 +862,34 @@ Result BinaryReaderInterp::OnTable(Index index,
                                    const Limits* elem_limits) {
   CHECK_RESULT(validator_.OnTable(GetLocation(), elem_type, *elem_limits));
   TableType table_type{elem_type, *elem_limits};
-  module_.tables.push_back(TableDesc{table_type});
+  module_->tables.push_back(TableDesc{table_type});
   table_types_.push_back(table_type);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnMemoryCount(Index count) {
-  module_.memories.reserve(count);
+  module_->memories.reserve(count);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnMemory(Index index, const Limits* limits) {
   CHECK_RESULT(validator_.OnMemory(GetLocation(), *limits));
   MemoryType memory_type{*limits};
-  module_.memories.push_back(MemoryDesc{memory_type});
+  module_->memories.push_back(MemoryDesc{memory_type});
   memory_types_.push_back(memory_type);
+  body_context_.memories.push_back(*limits);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnGlobalCount(Index count) {
-  module_.globals.reserve(count);
+  module_->globals.reserve(count);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::BeginGlobal(Index index, Type type, bool mutable_) {
   CHECK_RESULT(validator_.OnGlobal(GetLocation(), type, mutable_));
   GlobalType global_type{type, ToMutability(mutable_)};
-  module_.globals.push_back(GlobalDesc{global_type, InitExpr{}});
+  module_->globals.push_back(GlobalDesc{global_type, InitExpr{}});
   global_types_.push_back(global_type);
   init_expr_.kind = InitExprKind::None;
   return Result::Ok;
@@ -647,21 +917,21 @@ Result BinaryReaderInterp::BeginInitExpr(Type type) {
 
 Result BinaryReaderInterp::EndGlobalInitExpr(Index index) {
   CHECK_RESULT(EndInitExpr());
-  GlobalDesc& global = module_.globals.back();
+  GlobalDesc& global = module_->globals.back();
   global.init = init_expr_;
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTagCount(Index count) {
-  module_.tags.reserve(count);
+  module_->tags.reserve(count);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTagType(Index index, Index sig_index) {
   CHECK_RESULT(validator_.OnTag(GetLocation(), Var(sig_index)));
-  FuncType& func_type = module_.func_types[sig_index];
+  FuncType& func_type = module_->func_types[sig_index];
   TagType tag_type{TagAttr::Exception, func_type.params};
-  module_.tags.push_back(TagDesc{tag_type});
+  module_->tags.push_back(TagDesc{tag_type});
   tag_types_.push_back(tag_type);
   return Result::Ok;
 }
@@ -680,19 +950,19 @@ Result BinaryReaderInterp::OnExport(Index index,
     case ExternalKind::Global: type = global_types_[item_index].Clone(); break;
     case ExternalKind::Tag:    type = tag_types_[item_index].Clone(); break;
   }
-  module_.exports.push_back(
+  module_->exports.push_back(
       ExportDesc{ExportType(name.to_string(), std::move(type)), item_index});
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnStartFunction(Index func_index) {
   CHECK_RESULT(validator_.OnStart(GetLocation(), Var(func_index)));
-  module_.starts.push_back(StartDesc{func_index});
+  module_->starts.push_back(StartDesc{func_index});
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnElemSegmentCount(Index count) {
-  module_.elems.reserve(count);
+  module_->elems.reserve(count);
   return Result::Ok;
 }
 
@@ -706,7 +976,7 @@ Result BinaryReaderInterp::BeginElemSegment(Index index,
   desc.type = ValueType::Void;  // Initialized later in OnElemSegmentElemType.
   desc.mode = mode;
   desc.table_index = table_index;
-  module_.elems.push_back(desc);
+  module_->elems.push_back(desc);
   init_expr_.kind = InitExprKind::None;
   return Result::Ok;
 }
@@ -717,21 +987,21 @@ Result BinaryReaderInterp::BeginElemSegmentInitExpr(Index index) {
 
 Result BinaryReaderInterp::EndElemSegmentInitExpr(Index index) {
   CHECK_RESULT(EndInitExpr());
-  ElemDesc& elem = module_.elems.back();
+  ElemDesc& elem = module_->elems.back();
   elem.offset = init_expr_;
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnElemSegmentElemType(Index index, Type elem_type) {
   validator_.OnElemSegmentElemType(elem_type);
-  ElemDesc& elem = module_.elems.back();
+  ElemDesc& elem = module_->elems.back();
   elem.type = elem_type;
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnElemSegmentElemExprCount(Index index,
                                                       Index count) {
-  ElemDesc& elem = module_.elems.back();
+  ElemDesc& elem = module_->elems.back();
   elem.elements.reserve(count);
   return Result::Ok;
 }
@@ -739,7 +1009,7 @@ Result BinaryReaderInterp::OnElemSegmentElemExprCount(Index index,
 Result BinaryReaderInterp::OnElemSegmentElemExpr_RefNull(Index segment_index,
                                                          Type type) {
   CHECK_RESULT(validator_.OnElemSegmentElemExpr_RefNull(GetLocation(), type));
-  ElemDesc& elem = module_.elems.back();
+  ElemDesc& elem = module_->elems.back();
   elem.elements.push_back(ElemExpr{ElemKind::RefNull, 0});
   return Result::Ok;
 }
@@ -748,14 +1018,15 @@ Result BinaryReaderInterp::OnElemSegmentElemExpr_RefFunc(Index segment_index,
                                                          Index func_index) {
   CHECK_RESULT(
       validator_.OnElemSegmentElemExpr_RefFunc(GetLocation(), Var(func_index)));
-  ElemDesc& elem = module_.elems.back();
+  ElemDesc& elem = module_->elems.back();
   elem.elements.push_back(ElemExpr{ElemKind::RefFunc, func_index});
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnDataCount(Index count) {
   validator_.OnDataCount(count);
-  module_.datas.reserve(count);
+  body_context_.data_count = count;
+  module_->datas.reserve(count);
   return Result::Ok;
 }
 
@@ -766,7 +1037,7 @@ Result BinaryReaderInterp::BeginDataSegmentInitExpr(Index index) {
 
 Result BinaryReaderInterp::EndDataSegmentInitExpr(Index index) {
   CHECK_RESULT(EndInitExpr());
-  DataDesc& data = module_.datas.back();
+  DataDesc& data = module_->datas.back();
   data.offset = init_expr_;
   return Result::Ok;
 }
@@ -781,7 +1052,7 @@ Result BinaryReaderInterp::BeginDataSegment(Index index,
   DataDesc desc;
   desc.mode = mode;
   desc.memory_index = memory_index;
-  module_.datas.push_back(desc);
+  module_->datas.push_back(desc);
   init_expr_.kind = InitExprKind::None;
   return Result::Ok;
 }
@@ -789,7 +1060,7 @@ Result BinaryReaderInterp::BeginDataSegment(Index index,
 Result BinaryReaderInterp::OnDataSegmentData(Index index,
                                              const void* src_data,
                                              Address size) {
-  DataDesc& dst_data = module_.datas.back();
+  DataDesc& dst_data = module_->datas.back();
   if (size > 0) {
     dst_data.data.resize(size);
     memcpy(dst_data.data.data(), src_data, size);
@@ -797,6 +1068,17 @@ Result BinaryReaderInterp::OnDataSegmentData(Index index,
   return Result::Ok;
 }
 
+Result BinaryReaderInterp::OnFunctionName(Index function_index,
+                                          string_view function_name) {
+  // Imported functions keep the name they have in their own module.
+  if (function_index >= num_func_imports() &&
+      function_index < func_types_.size()) {
+    module_->funcs[function_index - num_func_imports()].name =
+        function_name.to_string();
+  }
+  return Result::Ok;
+}
+
 void BinaryReaderInterp::PushLabel(LabelKind kind,
                                    Istream::Offset offset,
                                    Istream::Offset fixup_offset,
@@ -808,15 +1090,191 @@ void BinaryReaderInterp::PopLabel() {
   label_stack_.pop_back();
 }
 
+Result BinaryReaderInterp::BeginCodeSection(Offset size) {
+  if (compile_options_.lazy) {
+    lazy_code_offset_ = state->offset;
+    lazy_code_.assign(state->data + state->offset,
+                      state->data + state->offset + size);
+  }
+  return Result::Ok;
+}
+
+Result BinaryReaderInterp::OnSkippedFunctionBody(Index index,
+                                                 Offset offset,
+                                                 Offset size) {
+  assert(index - num_func_imports() == func_bodies_.size());
+  func_bodies_.push_back(FuncBody{offset, size});
+  return Result::Ok;
+}
+
+Result BinaryReaderInterp::CompileFunc(ModuleDesc* module,
+                                       Index func_index,
+                                       const ReadBinaryOptions& options,
+                                       std::string* out_message) {
+  module_ = module;
+  istream_ = &module->istream;
+  errors_->clear();
+
+  // Start over, in case an earlier attempt failed part way through.
+  FuncDesc& func = module->funcs[func_index];
+  func.locals.clear();
+  func.handlers.clear();
+  func.stack_maps.clear();
+  Istream::Offset istream_end = istream_->end();
+
+  const FuncBody& body = func_bodies_[func_index];
+  Index module_func_index = num_func_imports() + func_index;
+  if (Failed(ReadBinaryFunctionBody(
+          lazy_code_.data(), lazy_code_.size(), module_func_index,
+          body.offset - lazy_code_offset_, body.size, body_context_, this,
+          options))) {
+    // Drop whatever was emitted, so a retry doesn't grow the istream.
+    istream_->Rewind(istream_end);
+    func.code_offset = Istream::kInvalidOffset;
+    *out_message = StringPrintf(
+        "invalid function %" PRIindex ": %s", module_func_index,
+        errors_->empty() ? "unknown error" : errors_->front().message.c_str());
+    return Result::Error;
+  }
+  return Result::Ok;
+}
+
+Result BinaryReaderInterp::CompileFragment(const void* data,
+                                           size_t size,
+                                           Index func_index,
+                                           const ReadBinaryOptions& options,
+                                           FuncFragment* fragment) {
+  fragment_ = fragment;
+  istream_ = &fragment->istream;
+  fragment->func = module_->funcs[func_index];
+  const FuncBody& body = func_bodies_[func_index];
+  fragment->result = ReadBinaryFunctionBody(
+      data, size, num_func_imports() + func_index, body.offset, body.size,
+      body_context_, this, options);
+  fragment->errors = std::move(*errors_);
+  errors_->clear();
+  fragment_ = nullptr;
+  istream_ = nullptr;
+  return fragment->result;
+}
+
+void BinaryReaderInterp::LinkFragment(Index func_index,
+                                      FuncFragment* fragment) {
+  FuncDesc& func = module_->funcs[func_index];
+  Istream::Offset base = istream_->end();
+  auto relocate = [=](u32* offset) {
+    if (*offset != Istream::kInvalidOffset) {
+      *offset += base;
+    }
+  };
+
+  func_fixups_.Resolve(*istream_, func_index);
+  istream_->Append(fragment->istream, fragment->relocs);
+  func.code_offset = base;
+  func.locals = std::move(fragment->func.locals);
+  func.handlers = std::move(fragment->func.handlers);
+  for (HandlerDesc& handler : func.handlers) {
+    relocate(&handler.try_start_offset);
+    relocate(&handler.try_end_offset);
+    for (CatchDesc& catch_ : handler.catches) {
+      relocate(&catch_.offset);
+    }
+    if (handler.kind == HandlerKind::Catch) {
+      relocate(&handler.catch_all_offset);
+    }
+  }
+  func.stack_maps = std::move(fragment->func.stack_maps);
+  for (StackMapDesc& stack_map : func.stack_maps) {
+    relocate(&stack_map.offset);
+  }
+
+  // Return calls to functions that are already placed can be resolved now,
+  // the rest are resolved when their callee is linked, as in BeginFunctionBody.
+  for (auto&& pair : fragment->func_fixups.map) {
+    for (Istream::Offset fixup : pair.second) {
+      if (pair.first <= func_index) {
+        istream_->ResolveFixupU32(base + fixup,
+                                  module_->funcs[pair.first].code_offset);
+      } else {
+        func_fixups_.Append(pair.first, base + fixup);
+      }
+    }
+  }
+}
+
+Result BinaryReaderInterp::CompileFuncsInParallel(
+    const void* data,
+    size_t size,
+    const ReadBinaryOptions& options) {
+  Index num_funcs = func_bodies_.size();
+  std::vector<FuncFragment> fragments(num_funcs);
+  std::atomic<Index> next_func{0};
+  std::atomic<bool> failed{false};
+
+  // Each worker takes the next function that hasn't been claimed, so large
+  // functions don't hold up the others. After an error there is no point in
+  // compiling more of them, since only the first error is reported.
+  auto worker = [&]() {
+    Errors errors;
+    BinaryReaderInterp reader(*this, &errors);
+    while (!failed) {
+      Index func_index = next_func++;
+      if (func_index >= num_funcs) {
+        break;
+      }
+      if (Failed(reader.CompileFragment(data, size, func_index, options,
+                                        &fragments[func_index]))) {
+        failed = true;
+      }
+    }
+  };
+
+  Index num_threads = std::min<Index>(compile_options_.num_threads, num_funcs);
+  std::vector<std::thread> threads;
+  for (Index i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  // Link the fragments in order, so that the result is the same as when the
+  // functions are read one after another. The first function that failed
+  // is the one that would have been reported then, too.
+  for (Index i = 0; i < num_funcs; ++i) {
+    FuncFragment& fragment = fragments[i];
+    if (Failed(fragment.result)) {
+      errors_->insert(errors_->end(), fragment.errors.begin(),
+                      fragment.errors.end());
+      return Result::Error;
+    }
+    LinkFragment(i, &fragment);
+    fragment = FuncFragment();
+  }
+  return Result::Ok;
+}
+
 Result BinaryReaderInterp::BeginFunctionBody(Index index, Offset size) {
   Index defined_index = index - num_func_imports();
-  func_ = &module_.funcs[defined_index];
-  func_->code_offset = istream_.end();
+  func_ = fragment_ ? &fragment_->func : &module_->funcs[defined_index];
+  func_->code_offset = istream_->end();
 
   depth_fixups_.Clear();
   label_stack_.clear();
+  fusion_window_.clear();
+  // A failed lazy compile can leave this pointing past the end of the istream.
+  fuel_fixup_ = Istream::kInvalidOffset;
 
-  func_fixups_.Resolve(istream_, defined_index);
+  local_slots_.clear();
+  for (Type param : func_->type.params) {
+    AddLocalSlots(1, param);
+  }
+  param_slot_count_ = GetLocalSlotCount();
+
+  if (!fragment_) {
+    func_fixups_.Resolve(*istream_, defined_index);
+  }
 
   CHECK_RESULT(validator_.BeginFunctionBody(GetLocation(), index));
 
@@ -827,12 +1285,13 @@ Result BinaryReaderInterp::BeginFunctionBody(Index index, Offset size) {
   PushLabel(LabelKind::Try, Istream::kInvalidOffset, Istream::kInvalidOffset,
             func_->handlers.size());
   func_->handlers.push_back(HandlerDesc{HandlerKind::Catch,
-                                        istream_.end(),
+                                        istream_->end(),
                                         Istream::kInvalidOffset,
                                         {},
                                         {Istream::kInvalidOffset},
                                         static_cast<u32>(func_->locals.size()),
                                         0});
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
@@ -841,9 +1300,10 @@ Result BinaryReaderInterp::EndFunctionBody(Index index) {
   Index drop_count, keep_count;
   CHECK_RESULT(GetReturnDropKeepCount(&drop_count, &keep_count));
   CHECK_RESULT(validator_.EndFunctionBody(GetLocation()));
-  istream_.EmitDropKeep(drop_count, keep_count);
-  istream_.Emit(Opcode::Return);
+  istream_->EmitDropKeep(drop_count, keep_count);
+  istream_->Emit(Opcode::Return);
   PopLabel();
+  ResolveConsumeFuel();
   func_ = nullptr;
   return Result::Ok;
 }
@@ -861,15 +1321,17 @@ Result BinaryReaderInterp::OnLocalDecl(Index decl_index,
 
   local_count_ += count;
   func_->locals.push_back(LocalDesc{type, count, local_count_});
+  AddLocalSlots(count, type);
 
   if (decl_index == local_decl_count_ - 1) {
-    istream_.Emit(Opcode::InterpAlloca, local_count_);
+    istream_->Emit(Opcode::InterpAlloca,
+                  GetLocalSlotCount() - param_slot_count_);
   }
   return Result::Ok;
 }
 
 Index BinaryReaderInterp::num_func_imports() const {
-  return func_types_.size() - module_.funcs.size();
+  return func_types_.size() - module_->funcs.size();
 }
 
 Result BinaryReaderInterp::OnOpcode(Opcode opcode) {
@@ -877,24 +1339,28 @@ Result BinaryReaderInterp::OnOpcode(Opcode opcode) {
     PrintError("Unexpected instruction after end of function");
     return Result::Error;
   }
+  if (!IsFusionOpcode(opcode)) {
+    fusion_window_.clear();
+  }
+  fuel_cost_++;
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnUnaryExpr(Opcode opcode) {
   CHECK_RESULT(validator_.OnUnary(GetLocation(), opcode));
-  istream_.Emit(opcode);
+  istream_->Emit(opcode);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTernaryExpr(Opcode opcode) {
   CHECK_RESULT(validator_.OnTernary(GetLocation(), opcode));
-  istream_.Emit(opcode);
+  istream_->Emit(opcode);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnSimdLaneOpExpr(Opcode opcode, uint64_t value) {
   CHECK_RESULT(validator_.OnSimdLaneOp(GetLocation(), opcode, value));
-  istream_.Emit(opcode, static_cast<u8>(value));
+  istream_->Emit(opcode, static_cast<u8>(value));
   return Result::Ok;
 }
 
@@ -909,7 +1375,7 @@ Result BinaryReaderInterp::OnSimdLoadLaneExpr(Opcode opcode,
                                               uint64_t value) {
   CHECK_RESULT(validator_.OnSimdLoadLane(GetLocation(), opcode,
                                          GetAlignment(alignment_log2), value));
-  istream_.Emit(opcode, memidx, offset, static_cast<u8>(value));
+  istream_->Emit(opcode, memidx, offset, static_cast<u8>(value));
   return Result::Ok;
 }
 
@@ -920,13 +1386,13 @@ Result BinaryReaderInterp::OnSimdStoreLaneExpr(Opcode opcode,
                                                uint64_t value) {
   CHECK_RESULT(validator_.OnSimdStoreLane(GetLocation(), opcode,
                                           GetAlignment(alignment_log2), value));
-  istream_.Emit(opcode, memidx, offset, static_cast<u8>(value));
+  istream_->Emit(opcode, memidx, offset, static_cast<u8>(value));
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnSimdShuffleOpExpr(Opcode opcode, v128 value) {
   CHECK_RESULT(validator_.OnSimdShuffleOp(GetLocation(), opcode, value));
-  istream_.Emit(opcode, value);
+  istream_->Emit(opcode, value);
   return Result::Ok;
 }
 
@@ -935,7 +1401,7 @@ Result BinaryReaderInterp::OnLoadSplatExpr(Opcode opcode,
                                            Address offset) {
   CHECK_RESULT(
       validator_.OnLoadSplat(GetLocation(), opcode, GetAlignment(align_log2)));
-  istream_.Emit(opcode, kMemoryIndex0, offset);
+  istream_->Emit(opcode, kMemoryIndex0, offset);
   return Result::Ok;
 }
 
@@ -944,7 +1410,7 @@ Result BinaryReaderInterp::OnLoadZeroExpr(Opcode opcode,
                                           Address offset) {
   CHECK_RESULT(
       validator_.OnLoadZero(GetLocation(), opcode, GetAlignment(align_log2)));
-  istream_.Emit(opcode, kMemoryIndex0, offset);
+  istream_->Emit(opcode, kMemoryIndex0, offset);
   return Result::Ok;
 }
 
@@ -953,7 +1419,7 @@ Result BinaryReaderInterp::OnAtomicLoadExpr(Opcode opcode,
                                             Address offset) {
   CHECK_RESULT(
       validator_.OnAtomicLoad(GetLocation(), opcode, GetAlignment(align_log2)));
-  istream_.Emit(opcode, kMemoryIndex0, offset);
+  istream_->Emit(opcode, kMemoryIndex0, offset);
   return Result::Ok;
 }
 
@@ -962,7 +1428,7 @@ Result BinaryReaderInterp::OnAtomicStoreExpr(Opcode opcode,
                                              Address offset) {
   CHECK_RESULT(validator_.OnAtomicStore(GetLocation(), opcode,
                                         GetAlignment(align_log2)));
-  istream_.Emit(opcode, kMemoryIndex0, offset);
+  istream_->Emit(opcode, kMemoryIndex0, offset);
   return Result::Ok;
 }
 
@@ -971,7 +1437,7 @@ Result BinaryReaderInterp::OnAtomicRmwExpr(Opcode opcode,
                                            Address offset) {
   CHECK_RESULT(
       validator_.OnAtomicRmw(GetLocation(), opcode, GetAlignment(align_log2)));
-  istream_.Emit(opcode, kMemoryIndex0, offset);
+  istream_->Emit(opcode, kMemoryIndex0, offset);
   return Result::Ok;
 }
 
@@ -980,13 +1446,28 @@ Result BinaryReaderInterp::OnAtomicRmwCmpxchgExpr(Opcode opcode,
                                                   Address offset) {
   CHECK_RESULT(validator_.OnAtomicRmwCmpxchg(GetLocation(), opcode,
                                              GetAlignment(align_log2)));
-  istream_.Emit(opcode, kMemoryIndex0, offset);
+  istream_->Emit(opcode, kMemoryIndex0, offset);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnBinaryExpr(Opcode opcode) {
   CHECK_RESULT(validator_.OnBinary(GetLocation(), opcode));
-  istream_.Emit(opcode);
+  Instr prev;
+  Istream::Offset prev_offset;
+  if ((opcode == Opcode::I32Add || opcode == Opcode::I32Sub) &&
+      PeekFusionWindow(0, &prev, &prev_offset) &&
+      prev.op == Opcode::I32Const) {
+    // i32.const c; i32.add => i32_add_imm c
+    // i32.const c; i32.sub => i32_add_imm -c
+    u32 imm = opcode == Opcode::I32Add ? prev.imm_u32 : 0 - prev.imm_u32;
+    Rewind(prev_offset);
+    fusion_window_.pop_back();
+    AddToFusionWindow(istream_->end());
+    istream_->Emit(Opcode::InterpI32AddImm, imm);
+    return Result::Ok;
+  }
+  fusion_window_.clear();
+  istream_->Emit(opcode);
   return Result::Ok;
 }
 
@@ -998,15 +1479,17 @@ Result BinaryReaderInterp::OnBlockExpr(Type sig_type) {
 
 Result BinaryReaderInterp::OnLoopExpr(Type sig_type) {
   CHECK_RESULT(validator_.OnLoop(GetLocation(), sig_type));
-  PushLabel(LabelKind::Block, istream_.end());
+  PushLabel(LabelKind::Block, istream_->end());
+  // Branches back to the loop consume fuel too.
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnIfExpr(Type sig_type) {
   CHECK_RESULT(validator_.OnIf(GetLocation(), sig_type));
-  istream_.Emit(Opcode::InterpBrUnless);
-  auto fixup = istream_.EmitFixupU32();
+  auto fixup = EmitBrUnless();
   PushLabel(LabelKind::Block, Istream::kInvalidOffset, fixup);
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
@@ -1014,9 +1497,10 @@ Result BinaryReaderInterp::OnElseExpr() {
   CHECK_RESULT(validator_.OnElse(GetLocation()));
   Label* label = TopLabel();
   Istream::Offset fixup_cond_offset = label->fixup_offset;
-  istream_.Emit(Opcode::Br);
-  label->fixup_offset = istream_.EmitFixupU32();
-  istream_.ResolveFixupU32(fixup_cond_offset);
+  istream_->Emit(Opcode::Br);
+  label->fixup_offset = EmitOffsetFixup();
+  istream_->ResolveFixupU32(fixup_cond_offset);
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
@@ -1029,19 +1513,21 @@ Result BinaryReaderInterp::OnEndExpr() {
   LabelType label_type = label->label_type;
   CHECK_RESULT(validator_.OnEnd(GetLocation()));
   if (label_type == LabelType::If || label_type == LabelType::Else) {
-    istream_.ResolveFixupU32(TopLabel()->fixup_offset);
+    istream_->ResolveFixupU32(TopLabel()->fixup_offset);
   } else if (label_type == LabelType::Try) {
     // Catch-less try blocks need to fill in the handler description
     // so that it can trigger an exception rethrow when it's reached.
     Label* local_label = TopLabel();
     HandlerDesc& desc = func_->handlers[local_label->handler_desc_index];
-    desc.try_end_offset = istream_.end();
+    desc.try_end_offset = istream_->end();
     assert(desc.catches.size() == 0);
   } else if (label_type == LabelType::Catch) {
-    istream_.EmitCatchDrop(1);
+    istream_->EmitCatchDrop(1);
   }
   FixupTopLabel();
   PopLabel();
+  // Branches to the end of the block consume fuel for the code after it.
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
@@ -1051,6 +1537,7 @@ Result BinaryReaderInterp::OnBrExpr(Index depth) {
   CHECK_RESULT(validator_.GetCatchCount(depth, &catch_drop_count));
   CHECK_RESULT(validator_.OnBr(GetLocation(), Var(depth)));
   EmitBr(depth, drop_count, keep_count, catch_drop_count);
+  ResolveConsumeFuel();
   return Result::Ok;
 }
 
@@ -1060,10 +1547,10 @@ Result BinaryReaderInterp::OnBrIfExpr(Index depth) {
   CHECK_RESULT(GetBrDropKeepCount(depth, &drop_count, &keep_count));
   CHECK_RESULT(validator_.GetCatchCount(depth, &catch_drop_count));
   // Flip the br_if so if <cond> is true it can drop values from the stack.
-  istream_.Emit(Opcode::InterpBrUnless);
-  auto fixup = istream_.EmitFixupU32();
+  auto fixup = EmitBrUnless();
   EmitBr(depth, drop_count, keep_count, catch_drop_count);
-  istream_.ResolveFixupU32(fixup);
+  istream_->ResolveFixupU32(fixup);
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
@@ -1072,17 +1559,18 @@ Result BinaryReaderInterp::OnBrTableExpr(Index num_targets,
                                          Index default_target_depth) {
   CHECK_RESULT(validator_.BeginBrTable(GetLocation()));
   Index drop_count, keep_count, catch_drop_count;
-  istream_.Emit(Opcode::BrTable, num_targets);
+  istream_->Emit(Opcode::BrTable, num_targets);
 
   for (Index i = 0; i < num_targets; ++i) {
     Index depth = target_depths[i];
     CHECK_RESULT(validator_.OnBrTableTarget(GetLocation(), Var(depth)));
     CHECK_RESULT(GetBrDropKeepCount(depth, &drop_count, &keep_count));
     CHECK_RESULT(validator_.GetCatchCount(depth, &catch_drop_count));
-    // Emit DropKeep directly (instead of using EmitDropKeep) so the
-    // instruction has a fixed size. Same for CatchDrop as well.
-    istream_.Emit(Opcode::InterpDropKeep, drop_count, keep_count);
-    istream_.Emit(Opcode::InterpCatchDrop, catch_drop_count);
+    // Emit DropKeep directly (instead of using EmitDropKeep) and never in
+    // short form, so the instruction has a fixed size. Same for CatchDrop as
+    // well.
+    istream_->EmitWide(Opcode::InterpDropKeep, drop_count, keep_count);
+    istream_->EmitWide(Opcode::InterpCatchDrop, catch_drop_count);
     EmitBr(depth, 0, 0, 0);
   }
   CHECK_RESULT(
@@ -1092,9 +1580,10 @@ Result BinaryReaderInterp::OnBrTableExpr(Index num_targets,
   CHECK_RESULT(
       validator_.GetCatchCount(default_target_depth, &catch_drop_count));
   // The default case doesn't need a fixed size, since it is never jumped over.
-  istream_.EmitDropKeep(drop_count, keep_count);
-  istream_.Emit(Opcode::InterpCatchDrop, catch_drop_count);
+  istream_->EmitDropKeep(drop_count, keep_count);
+  istream_->Emit(Opcode::InterpCatchDrop, catch_drop_count);
   EmitBr(default_target_depth, 0, 0, 0);
+  ResolveConsumeFuel();
 
   CHECK_RESULT(validator_.EndBrTable(GetLocation()));
   return Result::Ok;
@@ -1104,10 +1593,11 @@ Result BinaryReaderInterp::OnCallExpr(Index func_index) {
   CHECK_RESULT(validator_.OnCall(GetLocation(), Var(func_index)));
 
   if (func_index >= num_func_imports()) {
-    istream_.Emit(Opcode::Call, func_index);
+    istream_->Emit(Opcode::Call, func_index);
   } else {
-    istream_.Emit(Opcode::InterpCallImport, func_index);
+    istream_->Emit(Opcode::InterpCallImport, func_index);
   }
+  AddStackMap(func_types_[func_index].results.size());
 
   return Result::Ok;
 }
@@ -1116,7 +1606,8 @@ Result BinaryReaderInterp::OnCallIndirectExpr(Index sig_index,
                                               Index table_index) {
   CHECK_RESULT(validator_.OnCallIndirect(GetLocation(), Var(sig_index),
                                          Var(table_index)));
-  istream_.Emit(Opcode::CallIndirect, table_index, sig_index);
+  istream_->Emit(Opcode::CallIndirect, table_index, sig_index);
+  AddStackMap(module_->func_types[sig_index].results.size());
   return Result::Ok;
 }
 
@@ -1131,26 +1622,31 @@ Result BinaryReaderInterp::OnReturnCallExpr(Index func_index) {
   // The validator must be run after we get the drop/keep counts, since it
   // will change the type stack.
   CHECK_RESULT(validator_.OnReturnCall(GetLocation(), Var(func_index)));
-  istream_.EmitDropKeep(drop_count, keep_count);
-  istream_.EmitCatchDrop(catch_drop_count);
-
-  if (func_index >= num_func_imports()) {
-    istream_.Emit(Opcode::InterpAdjustFrameForReturnCall, func_index);
-    istream_.Emit(Opcode::Br);
+  istream_->EmitDropKeep(drop_count, keep_count);
+  istream_->EmitCatchDrop(catch_drop_count);
+
+  if (func_index >= num_func_imports() && compile_options_.lazy) {
+    // The callee may not be compiled yet, so its code offset is looked up
+    // when the call runs.
+    istream_->Emit(Opcode::ReturnCall, func_index);
+  } else if (func_index >= num_func_imports()) {
+    istream_->Emit(Opcode::InterpAdjustFrameForReturnCall, func_index);
+    istream_->Emit(Opcode::Br);
     // We emit this separately to ensure that the fixup generated by
     // GetFuncOffset comes after the Br opcode.
-    istream_.Emit(GetFuncOffset(func_index));
+    istream_->Emit(GetFuncOffset(func_index));
   } else {
-    istream_.Emit(Opcode::InterpCallImport, func_index);
-    istream_.Emit(Opcode::Return);
+    istream_->Emit(Opcode::InterpCallImport, func_index);
+    istream_->Emit(Opcode::Return);
   }
+  ResolveConsumeFuel();
 
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnReturnCallIndirectExpr(Index sig_index,
                                                     Index table_index) {
-  FuncType& func_type = module_.func_types[sig_index];
+  FuncType& func_type = module_->func_types[sig_index];
 
   Index drop_count, keep_count, catch_drop_count;
   // +1 to include the index of the function.
@@ -1162,27 +1658,40 @@ Result BinaryReaderInterp::OnReturnCallIndirectExpr(Index sig_index,
   // changes the type stack.
   CHECK_RESULT(validator_.OnReturnCallIndirect(GetLocation(), Var(sig_index),
                                                Var(table_index)));
-  istream_.EmitDropKeep(drop_count, keep_count);
-  istream_.EmitCatchDrop(catch_drop_count);
-  istream_.Emit(Opcode::ReturnCallIndirect, table_index, sig_index);
+  istream_->EmitDropKeep(drop_count, keep_count);
+  istream_->EmitCatchDrop(catch_drop_count);
+  istream_->Emit(Opcode::ReturnCallIndirect, table_index, sig_index);
+  ResolveConsumeFuel();
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnCompareExpr(Opcode opcode) {
   CHECK_RESULT(validator_.OnCompare(GetLocation(), opcode));
-  istream_.Emit(opcode);
+  if (IsFusionOpcode(opcode)) {
+    AddToFusionWindow(istream_->end());
+  }
+  istream_->Emit(opcode);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnConvertExpr(Opcode opcode) {
   CHECK_RESULT(validator_.OnConvert(GetLocation(), opcode));
-  istream_.Emit(opcode);
+  if (IsFusionOpcode(opcode)) {
+    AddToFusionWindow(istream_->end());
+  }
+  istream_->Emit(opcode);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnDropExpr() {
+  size_t v128_count = validator_.type_stack_v128_count();
   CHECK_RESULT(validator_.OnDrop(GetLocation()));
-  istream_.Emit(Opcode::Drop);
+  if (validator_.type_stack_v128_count() < v128_count) {
+    // A v128 takes two slots.
+    istream_->EmitDropKeep(2, 0);
+  } else {
+    istream_->Emit(Opcode::Drop);
+  }
   return Result::Ok;
 }
 
@@ -1193,7 +1702,8 @@ Result BinaryReaderInterp::OnI32ConstExpr(uint32_t value) {
     init_expr_.i32_ = value;
     return Result::Ok;
   }
-  istream_.Emit(Opcode::I32Const, value);
+  AddToFusionWindow(istream_->end());
+  istream_->Emit(Opcode::I32Const, value);
   return Result::Ok;
 }
 
@@ -1204,7 +1714,7 @@ Result BinaryReaderInterp::OnI64ConstExpr(uint64_t value) {
     init_expr_.i64_ = value;
     return Result::Ok;
   }
-  istream_.Emit(Opcode::I64Const, value);
+  istream_->Emit(Opcode::I64Const, value);
   return Result::Ok;
 }
 
@@ -1215,7 +1725,7 @@ Result BinaryReaderInterp::OnF32ConstExpr(uint32_t value_bits) {
     init_expr_.f32_ = Bitcast<f32>(value_bits);
     return Result::Ok;
   }
-  istream_.Emit(Opcode::F32Const, value_bits);
+  istream_->Emit(Opcode::F32Const, value_bits);
   return Result::Ok;
 }
 
@@ -1226,7 +1736,7 @@ Result BinaryReaderInterp::OnF64ConstExpr(uint64_t value_bits) {
     init_expr_.f64_ = Bitcast<f64>(value_bits);
     return Result::Ok;
   }
-  istream_.Emit(Opcode::F64Const, value_bits);
+  istream_->Emit(Opcode::F64Const, value_bits);
   return Result::Ok;
 }
 
@@ -1237,7 +1747,7 @@ Result BinaryReaderInterp::OnV128ConstExpr(v128 value_bits) {
     init_expr_.v128_ = Bitcast<v128>(value_bits);
     return Result::Ok;
   }
-  istream_.Emit(Opcode::V128Const, value_bits);
+  istream_->Emit(Opcode::V128Const, value_bits);
   return Result::Ok;
 }
 
@@ -1248,42 +1758,137 @@ Result BinaryReaderInterp::OnGlobalGetExpr(Index global_index) {
     init_expr_.index_ = global_index;
     return Result::Ok;
   }
-  istream_.Emit(Opcode::GlobalGet, global_index);
+  istream_->Emit(Opcode::GlobalGet, global_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnGlobalSetExpr(Index global_index) {
   CHECK_RESULT(validator_.OnGlobalSet(GetLocation(), Var(global_index)));
-  istream_.Emit(Opcode::GlobalSet, global_index);
+  istream_->Emit(Opcode::GlobalSet, global_index);
   return Result::Ok;
 }
 
-Index BinaryReaderInterp::TranslateLocalIndex(Index local_index) {
-  return validator_.type_stack_size() + validator_.GetLocalCount() -
-         local_index;
+// Returns the number of value stack slots used by the type stack entries at
+// or above `type_stack_limit`.
+Index BinaryReaderInterp::GetTypeStackSlotCount(size_t type_stack_limit) {
+  size_t size = validator_.type_stack_size();
+  if (type_stack_limit >= size) {
+    return 0;
+  }
+  return size - type_stack_limit +
+         validator_.type_stack_v128_count(type_stack_limit);
+}
+
+void BinaryReaderInterp::AddLocalSlots(Index count, Type type) {
+  LocalSlots prev = local_slots_.empty() ? LocalSlots{0, 0, 0}
+                                         : local_slots_.back();
+  Index slot_count = GetSlotCount(type);
+  local_slots_.push_back(LocalSlots{prev.end + count,
+                                    prev.slot_end + count * slot_count,
+                                    slot_count});
+}
+
+Index BinaryReaderInterp::GetLocalSlotCount() const {
+  return local_slots_.empty() ? 0 : local_slots_.back().slot_end;
+}
+
+// Returns the depth of the local's lowest slot, counting up from 1 at the top
+// of the value stack. A v128 local takes two slots; its high slot is at one
+// less than the returned depth.
+Index BinaryReaderInterp::TranslateLocalIndex(Index local_index,
+                                              Index* out_slot_count) {
+  auto iter = std::lower_bound(
+      local_slots_.begin(), local_slots_.end(), local_index + 1,
+      [](const LocalSlots& lhs, Index rhs) { return lhs.end < rhs; });
+  if (iter == local_slots_.end()) {
+    // Invalid local index; the validator will report the error.
+    if (out_slot_count) {
+      *out_slot_count = 1;
+    }
+    return 0;
+  }
+  Index local_slot =
+      iter->slot_end - (iter->end - local_index) * iter->slot_count;
+  if (out_slot_count) {
+    *out_slot_count = iter->slot_count;
+  }
+  return GetTypeStackSlotCount() + GetLocalSlotCount() - local_slot;
 }
 
 Result BinaryReaderInterp::OnLocalGetExpr(Index local_index) {
   // Get the translated index before calling validator_.OnLocalGet because it
   // will update the type stack size. We need the index to be relative to the
   // old stack size.
-  Index translated_local_index = TranslateLocalIndex(local_index);
+  Index slot_count;
+  Index translated_local_index = TranslateLocalIndex(local_index, &slot_count);
   CHECK_RESULT(validator_.OnLocalGet(GetLocation(), Var(local_index)));
-  istream_.Emit(Opcode::LocalGet, translated_local_index);
+  if (slot_count == 2) {
+    // Push the two slots of a v128 one at a time. Once the low slot is pushed,
+    // the high slot is at the same depth.
+    istream_->Emit(Opcode::LocalGet, translated_local_index);
+    istream_->Emit(Opcode::LocalGet, translated_local_index);
+    fusion_window_.clear();
+    return Result::Ok;
+  }
+  Instr prev;
+  Istream::Offset prev_offset;
+  if (PeekFusionWindow(0, &prev, &prev_offset) &&
+      prev.op == Opcode::LocalGet) {
+    // local.get a; local.get b => local_get_local_get a b
+    Rewind(prev_offset);
+    istream_->Emit(Opcode::InterpLocalGetLocalGet, prev.imm_u32,
+                  translated_local_index);
+    fusion_window_.clear();
+    return Result::Ok;
+  }
+  AddToFusionWindow(istream_->end());
+  istream_->Emit(Opcode::LocalGet, translated_local_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnLocalSetExpr(Index local_index) {
   // See comment in OnLocalGetExpr above.
-  Index translated_local_index = TranslateLocalIndex(local_index);
+  Index slot_count;
+  Index translated_local_index = TranslateLocalIndex(local_index, &slot_count);
   CHECK_RESULT(validator_.OnLocalSet(GetLocation(), Var(local_index)));
-  istream_.Emit(Opcode::LocalSet, translated_local_index);
+  Instr add, get;
+  Istream::Offset add_offset, get_offset;
+  if (slot_count == 2) {
+    // Set the high slot of a v128, then the low slot. Each local.set pops a
+    // slot, so both are one shallower than the local's low slot was.
+    istream_->Emit(Opcode::LocalSet, translated_local_index - 1);
+    istream_->Emit(Opcode::LocalSet, translated_local_index - 1);
+  } else if (PeekFusionWindow(0, &add, &add_offset) &&
+      add.op == Opcode::InterpI32AddImm &&
+      PeekFusionWindow(1, &get, &get_offset) && get.op == Opcode::LocalGet) {
+    // local.get a; i32_add_imm c; local.set b => i32_local_add_imm a b c
+    //
+    // The fused instruction never pushes the sum, so the local.set index is
+    // relative to a stack that is one value shorter.
+    Rewind(get_offset);
+    istream_->Emit(Opcode::InterpI32LocalAddImm, get.imm_u32,
+                  translated_local_index - 1, add.imm_u32);
+  } else {
+    istream_->Emit(Opcode::LocalSet, translated_local_index);
+  }
+  fusion_window_.clear();
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnLocalTeeExpr(Index local_index) {
+  Index slot_count;
+  Index translated_local_index = TranslateLocalIndex(local_index, &slot_count);
   CHECK_RESULT(validator_.OnLocalTee(GetLocation(), Var(local_index)));
-  istream_.Emit(Opcode::LocalTee, TranslateLocalIndex(local_index));
+  if (slot_count == 2) {
+    // Same as local.set followed by local.get; see OnLocalSetExpr and
+    // OnLocalGetExpr.
+    istream_->Emit(Opcode::LocalSet, translated_local_index - 1);
+    istream_->Emit(Opcode::LocalSet, translated_local_index - 1);
+    istream_->Emit(Opcode::LocalGet, translated_local_index - 2);
+    istream_->Emit(Opcode::LocalGet, translated_local_index - 2);
+  } else {
+    istream_->Emit(Opcode::LocalTee, translated_local_index);
+  }
   return Result::Ok;
 }
 
@@ -1293,7 +1898,18 @@ Result BinaryReaderInterp::OnLoadExpr(Opcode opcode,
                                       Address offset) {
   CHECK_RESULT(validator_.OnLoad(GetLocation(), opcode, Var(memidx),
                                  GetAlignment(align_log2)));
-  istream_.Emit(opcode, memidx, offset);
+  Instr prev;
+  Istream::Offset prev_offset;
+  if (opcode == Opcode::I32Load && PeekFusionWindow(0, &prev, &prev_offset) &&
+      prev.op == Opcode::LocalGet) {
+    // local.get a; i32.load offset => local_get_i32_load a offset
+    Rewind(prev_offset);
+    istream_->Emit(Opcode::InterpLocalGetI32Load, memidx, offset,
+                  prev.imm_u32);
+  } else {
+    istream_->Emit(opcode, memidx, offset);
+  }
+  fusion_window_.clear();
   return Result::Ok;
 }
 
@@ -1303,37 +1919,37 @@ Result BinaryReaderInterp::OnStoreExpr(Opcode opcode,
                                        Address offset) {
   CHECK_RESULT(validator_.OnStore(GetLocation(), opcode, Var(memidx),
                                   GetAlignment(align_log2)));
-  istream_.Emit(opcode, memidx, offset);
+  istream_->Emit(opcode, memidx, offset);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnMemoryGrowExpr(Index memidx) {
   CHECK_RESULT(validator_.OnMemoryGrow(GetLocation(), Var(memidx)));
-  istream_.Emit(Opcode::MemoryGrow, memidx);
+  istream_->Emit(Opcode::MemoryGrow, memidx);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnMemorySizeExpr(Index memidx) {
   CHECK_RESULT(validator_.OnMemorySize(GetLocation(), Var(memidx)));
-  istream_.Emit(Opcode::MemorySize, memidx);
+  istream_->Emit(Opcode::MemorySize, memidx);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTableGrowExpr(Index table_index) {
   CHECK_RESULT(validator_.OnTableGrow(GetLocation(), Var(table_index)));
-  istream_.Emit(Opcode::TableGrow, table_index);
+  istream_->Emit(Opcode::TableGrow, table_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTableSizeExpr(Index table_index) {
   CHECK_RESULT(validator_.OnTableSize(GetLocation(), Var(table_index)));
-  istream_.Emit(Opcode::TableSize, table_index);
+  istream_->Emit(Opcode::TableSize, table_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTableFillExpr(Index table_index) {
   CHECK_RESULT(validator_.OnTableFill(GetLocation(), Var(table_index)));
-  istream_.Emit(Opcode::TableFill, table_index);
+  istream_->Emit(Opcode::TableFill, table_index);
   return Result::Ok;
 }
 
@@ -1344,7 +1960,7 @@ Result BinaryReaderInterp::OnRefFuncExpr(Index func_index) {
     init_expr_.index_ = func_index;
     return Result::Ok;
   }
-  istream_.Emit(Opcode::RefFunc, func_index);
+  istream_->Emit(Opcode::RefFunc, func_index);
   return Result::Ok;
 }
 
@@ -1355,13 +1971,13 @@ Result BinaryReaderInterp::OnRefNullExpr(Type type) {
     init_expr_.type_ = type;
     return Result::Ok;
   }
-  istream_.Emit(Opcode::RefNull);
+  istream_->Emit(Opcode::RefNull);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnRefIsNullExpr() {
   CHECK_RESULT(validator_.OnRefIsNull(GetLocation()));
-  istream_.Emit(Opcode::RefIsNull);
+  istream_->Emit(Opcode::RefIsNull);
   return Result::Ok;
 }
 
@@ -1376,22 +1992,38 @@ Result BinaryReaderInterp::OnReturnExpr() {
   CHECK_RESULT(
       validator_.GetCatchCount(label_stack_.size() - 1, &catch_drop_count));
   CHECK_RESULT(validator_.OnReturn(GetLocation()));
-  istream_.EmitDropKeep(drop_count, keep_count);
-  istream_.EmitCatchDrop(catch_drop_count);
-  istream_.Emit(Opcode::Return);
+  istream_->EmitDropKeep(drop_count, keep_count);
+  istream_->EmitCatchDrop(catch_drop_count);
+  istream_->Emit(Opcode::Return);
+  ResolveConsumeFuel();
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnSelectExpr(Index result_count,
                                         Type* result_types) {
   CHECK_RESULT(validator_.OnSelect(GetLocation(), result_count, result_types));
-  istream_.Emit(Opcode::Select);
+  size_t size = validator_.type_stack_size();
+  if (size > 0 && validator_.type_stack_v128_count(size - 1) != 0) {
+    // Select only moves single slots, so branch on the condition instead and
+    // drop whichever v128 is not selected.
+    istream_->Emit(Opcode::InterpBrUnless);
+    auto false_fixup = EmitOffsetFixup();
+    istream_->EmitDropKeep(2, 0);
+    istream_->Emit(Opcode::Br);
+    auto end_fixup = EmitOffsetFixup();
+    istream_->ResolveFixupU32(false_fixup);
+    istream_->EmitDropKeep(2, 2);
+    istream_->ResolveFixupU32(end_fixup);
+  } else {
+    istream_->Emit(Opcode::Select);
+  }
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnUnreachableExpr() {
   CHECK_RESULT(validator_.OnUnreachable(GetLocation()));
-  istream_.Emit(Opcode::Unreachable);
+  istream_->Emit(Opcode::Unreachable);
+  ResolveConsumeFuel();
   return Result::Ok;
 }
 
@@ -1400,13 +2032,13 @@ Result BinaryReaderInterp::OnAtomicWaitExpr(Opcode opcode,
                                             Address offset) {
   CHECK_RESULT(
       validator_.OnAtomicWait(GetLocation(), opcode, GetAlignment(align_log2)));
-  istream_.Emit(opcode, kMemoryIndex0, offset);
+  istream_->Emit(opcode, kMemoryIndex0, offset);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnAtomicFenceExpr(uint32_t consistency_model) {
   CHECK_RESULT(validator_.OnAtomicFence(GetLocation(), consistency_model));
-  istream_.Emit(Opcode::AtomicFence, consistency_model);
+  istream_->Emit(Opcode::AtomicFence, consistency_model);
   return Result::Ok;
 }
 
@@ -1415,58 +2047,58 @@ Result BinaryReaderInterp::OnAtomicNotifyExpr(Opcode opcode,
                                               Address offset) {
   CHECK_RESULT(validator_.OnAtomicNotify(GetLocation(), opcode,
                                          GetAlignment(align_log2)));
-  istream_.Emit(opcode, kMemoryIndex0, offset);
+  istream_->Emit(opcode, kMemoryIndex0, offset);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnMemoryCopyExpr(Index srcmemidx, Index destmemidx) {
   CHECK_RESULT(
       validator_.OnMemoryCopy(GetLocation(), Var(srcmemidx), Var(destmemidx)));
-  istream_.Emit(Opcode::MemoryCopy, srcmemidx, destmemidx);
+  istream_->Emit(Opcode::MemoryCopy, srcmemidx, destmemidx);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnDataDropExpr(Index segment_index) {
   CHECK_RESULT(validator_.OnDataDrop(GetLocation(), Var(segment_index)));
-  istream_.Emit(Opcode::DataDrop, segment_index);
+  istream_->Emit(Opcode::DataDrop, segment_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnMemoryFillExpr(Index memidx) {
   CHECK_RESULT(validator_.OnMemoryFill(GetLocation(), Var(memidx)));
-  istream_.Emit(Opcode::MemoryFill, memidx);
+  istream_->Emit(Opcode::MemoryFill, memidx);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnMemoryInitExpr(Index segment_index, Index memidx) {
   CHECK_RESULT(
       validator_.OnMemoryInit(GetLocation(), Var(segment_index), Var(memidx)));
-  istream_.Emit(Opcode::MemoryInit, memidx, segment_index);
+  istream_->Emit(Opcode::MemoryInit, memidx, segment_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTableGetExpr(Index table_index) {
   CHECK_RESULT(validator_.OnTableGet(GetLocation(), Var(table_index)));
-  istream_.Emit(Opcode::TableGet, table_index);
+  istream_->Emit(Opcode::TableGet, table_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTableSetExpr(Index table_index) {
   CHECK_RESULT(validator_.OnTableSet(GetLocation(), Var(table_index)));
-  istream_.Emit(Opcode::TableSet, table_index);
+  istream_->Emit(Opcode::TableSet, table_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnTableCopyExpr(Index dst_index, Index src_index) {
   CHECK_RESULT(
       validator_.OnTableCopy(GetLocation(), Var(dst_index), Var(src_index)));
-  istream_.Emit(Opcode::TableCopy, dst_index, src_index);
+  istream_->Emit(Opcode::TableCopy, dst_index, src_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnElemDropExpr(Index segment_index) {
   CHECK_RESULT(validator_.OnElemDrop(GetLocation(), Var(segment_index)));
-  istream_.Emit(Opcode::ElemDrop, segment_index);
+  istream_->Emit(Opcode::ElemDrop, segment_index);
   return Result::Ok;
 }
 
@@ -1474,13 +2106,14 @@ Result BinaryReaderInterp::OnTableInitExpr(Index segment_index,
                                            Index table_index) {
   CHECK_RESULT(validator_.OnTableInit(GetLocation(), Var(segment_index),
                                       Var(table_index)));
-  istream_.Emit(Opcode::TableInit, table_index, segment_index);
+  istream_->Emit(Opcode::TableInit, table_index, segment_index);
   return Result::Ok;
 }
 
 Result BinaryReaderInterp::OnThrowExpr(Index tag_index) {
   CHECK_RESULT(validator_.OnThrow(GetLocation(), Var(tag_index)));
-  istream_.Emit(Opcode::Throw, tag_index);
+  istream_->Emit(Opcode::Throw, tag_index);
+  ResolveConsumeFuel();
   return Result::Ok;
 }
 
@@ -1490,7 +2123,8 @@ Result BinaryReaderInterp::OnRethrowExpr(Index depth) {
   CHECK_RESULT(validator_.GetCatchCount(depth, &catch_depth));
   // The rethrow opcode takes an index into the exception stack rather than
   // the number of catch nestings, so we subtract one here.
-  istream_.Emit(Opcode::Rethrow, catch_depth - 1);
+  istream_->Emit(Opcode::Rethrow, catch_depth - 1);
+  ResolveConsumeFuel();
   return Result::Ok;
 }
 
@@ -1498,13 +2132,15 @@ Result BinaryReaderInterp::OnTryExpr(Type sig_type) {
   u32 exn_stack_height;
   CHECK_RESULT(
       validator_.GetCatchCount(label_stack_.size() - 1, &exn_stack_height));
-  u32 value_stack_height = validator_.type_stack_size();
+  // The height is relative to the frame, which starts above the parameters.
+  u32 value_stack_height =
+      GetLocalSlotCount() - param_slot_count_ + GetTypeStackSlotCount();
   CHECK_RESULT(validator_.OnTry(GetLocation(), sig_type));
   // Push a label that tracks mapping of exn -> catch
   PushLabel(LabelKind::Try, Istream::kInvalidOffset, Istream::kInvalidOffset,
             func_->handlers.size());
   func_->handlers.push_back(HandlerDesc{HandlerKind::Catch,
-                                        istream_.end(),
+                                        istream_->end(),
                                         Istream::kInvalidOffset,
                                         {},
                                         {Istream::kInvalidOffset},
@@ -1520,25 +2156,26 @@ Result BinaryReaderInterp::OnCatchExpr(Index tag_index) {
   desc.kind = HandlerKind::Catch;
   // Drop the previous block's exception if it was a catch.
   if (label->kind == LabelKind::Block) {
-    istream_.EmitCatchDrop(1);
+    istream_->EmitCatchDrop(1);
   }
   // Jump to the end of the block at the end of the previous try or catch.
   Istream::Offset offset = label->offset;
-  istream_.Emit(Opcode::Br);
+  istream_->Emit(Opcode::Br);
   assert(offset == Istream::kInvalidOffset);
-  depth_fixups_.Append(label_stack_.size() - 1, istream_.end());
-  istream_.Emit(offset);
+  depth_fixups_.Append(label_stack_.size() - 1, istream_->end());
+  EmitOffset(offset);
   // The offset is only set after the first catch block, as the offset range
   // should only cover the try block itself.
   if (desc.try_end_offset == Istream::kInvalidOffset) {
-    desc.try_end_offset = istream_.end();
+    desc.try_end_offset = istream_->end();
   }
   // The label kind is switched to Block from Try in order to distinguish
   // catch blocks from try blocks. This is used to ensure that a try-delegate
   // inside this catch will not delegate to the catch, and instead find outer
   // try blocks to use as a delegate target.
   label->kind = LabelKind::Block;
-  desc.catches.push_back(CatchDesc{tag_index, istream_.end()});
+  desc.catches.push_back(CatchDesc{tag_index, istream_->end()});
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
@@ -1548,18 +2185,19 @@ Result BinaryReaderInterp::OnCatchAllExpr() {
   HandlerDesc& desc = func_->handlers[label->handler_desc_index];
   desc.kind = HandlerKind::Catch;
   if (label->kind == LabelKind::Block) {
-    istream_.EmitCatchDrop(1);
+    istream_->EmitCatchDrop(1);
   }
   Istream::Offset offset = label->offset;
-  istream_.Emit(Opcode::Br);
+  istream_->Emit(Opcode::Br);
   assert(offset == Istream::kInvalidOffset);
-  depth_fixups_.Append(label_stack_.size() - 1, istream_.end());
-  istream_.Emit(offset);
+  depth_fixups_.Append(label_stack_.size() - 1, istream_->end());
+  EmitOffset(offset);
   if (desc.try_end_offset == Istream::kInvalidOffset) {
-    desc.try_end_offset = istream_.end();
+    desc.try_end_offset = istream_->end();
   }
   label->kind = LabelKind::Block;
-  desc.catch_all_offset = istream_.end();
+  desc.catch_all_offset = istream_->end();
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
@@ -1570,19 +2208,58 @@ Result BinaryReaderInterp::OnDelegateExpr(Index depth) {
   HandlerDesc& desc = func_->handlers[label->handler_desc_index];
   desc.kind = HandlerKind::Delegate;
   Istream::Offset offset = label->offset;
-  istream_.Emit(Opcode::Br);
+  istream_->Emit(Opcode::Br);
   assert(offset == Istream::kInvalidOffset);
-  depth_fixups_.Append(label_stack_.size() - 1, istream_.end());
-  istream_.Emit(offset);
-  desc.try_end_offset = istream_.end();
+  depth_fixups_.Append(label_stack_.size() - 1, istream_->end());
+  EmitOffset(offset);
+  desc.try_end_offset = istream_->end();
   Label* target_label = GetNearestTryLabel(depth + 1);
   assert(target_label);
   desc.delegate_handler_index = target_label->handler_desc_index;
   FixupTopLabel();
   PopLabel();
+  EmitConsumeFuel();
   return Result::Ok;
 }
 
+// Keeps the reader of a module read with CompileOptions::lazy alive, so that
+// it can compile the module's functions later. The reader's filename and
+// errors must outlive the call to ReadBinaryInterp, so they are owned here.
+class LazyCompilerInterp : public LazyCompiler {
+ public:
+  LazyCompilerInterp(ModuleDesc* module,
+                     string_view filename,
+                     const Features& features,
+                     const CompileOptions& compile_options)
+      : filename_(filename.to_string()),
+        reader_(module, filename_, &errors_, features, compile_options) {
+    options_.features = features;
+  }
+
+  Result ReadModule(const void* data,
+                    size_t size,
+                    const ReadBinaryOptions& options,
+                    Errors* errors) {
+    ReadBinaryOptions lazy_options = options;
+    lazy_options.skip_function_bodies = true;
+    Result result = ReadBinary(data, size, &reader_, lazy_options);
+    errors->insert(errors->end(), errors_.begin(), errors_.end());
+    return result;
+  }
+
+  Result CompileFunc(ModuleDesc* module,
+                     Index func_index,
+                     std::string* out_message) override {
+    return reader_.CompileFunc(module, func_index, options_, out_message);
+  }
+
+ private:
+  std::string filename_;
+  Errors errors_;
+  ReadBinaryOptions options_;
+  BinaryReaderInterp reader_;
+};
+
 }  // namespace
 
 Result ReadBinaryInterp(string_view filename,
@@ -1591,7 +2268,33 @@ Result ReadBinaryInterp(string_view filename,
                         const ReadBinaryOptions& options,
                         Errors* errors,
                         ModuleDesc* out_module) {
-  BinaryReaderInterp reader(out_module, filename, errors, options.features);
+  return ReadBinaryInterp(filename, data, size, options, CompileOptions(),
+                          errors, out_module);
+}
+
+Result ReadBinaryInterp(string_view filename,
+                        const void* data,
+                        size_t size,
+                        const ReadBinaryOptions& options,
+                        const CompileOptions& compile_options,
+                        Errors* errors,
+                        ModuleDesc* out_module) {
+  if (compile_options.lazy) {
+    auto compiler = std::make_shared<LazyCompilerInterp>(
+        out_module, filename, options.features, compile_options);
+    CHECK_RESULT(compiler->ReadModule(data, size, options, errors));
+    out_module->lazy_compiler = std::move(compiler);
+    return Result::Ok;
+  }
+
+  BinaryReaderInterp reader(out_module, filename, errors, options.features,
+                            compile_options);
+  if (compile_options.num_threads > 1) {
+    ReadBinaryOptions parallel_options = options;
+    parallel_options.skip_function_bodies = true;
+    CHECK_RESULT(ReadBinary(data, size, &reader, parallel_options));
+    return reader.CompileFuncsInParallel(data, size, options);
+  }
   return ReadBinary(data, size, &reader, options);
 }
 
@@ -27,10 +27,44 @@ struct ReadBinaryOptions;
 
 namespace interp {
 
+// Options controlling how function bodies are translated to the istream.
+struct CompileOptions {
+  // Replace common instruction sequences (e.g. `local.get; local.get`,
+  // `i32.const; i32.add`, `i32.lt_s; br_if`) with fused superinstructions.
+  bool fuse_instructions = true;
+
+  // Only find the function bodies when the module is read, and validate and
+  // translate each one the first time it is called (see LazyCompiler). A
+  // module with an invalid function body can then be instantiated, and
+  // calling that function traps.
+  bool lazy = false;
+
+  // Validate and translate function bodies on this many threads. The
+  // resulting module is the same as with a single thread; in particular its
+  // istream is byte-for-byte identical. Ignored when `lazy` is set.
+  u32 num_threads = 1;
+
+  // Emit a consume_fuel instruction at the start of each basic block: the
+  // start of the function, loops, both arms of an if, the code after a
+  // br_if, an end or a catch. It takes the number of instructions in its block
+  // from the Thread's fuel, so a Thread runs out of fuel (see
+  // Thread::Options::fuel) in bounded time, and only the code that runs is
+  // charged.
+  bool fuel_metering = false;
+};
+
+Result ReadBinaryInterp(string_view filename,
+                        const void* data,
+                        size_t size,
+                        const ReadBinaryOptions& options,
+                        Errors*,
+                        ModuleDesc* out_module);
+
 Result ReadBinaryInterp(string_view filename,
                         const void* data,
                         size_t size,
                         const ReadBinaryOptions& options,
+                        const CompileOptions& compile_options,
                         Errors*,
                         ModuleDesc* out_module);
 
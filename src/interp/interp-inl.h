@@ -15,6 +15,7 @@
  */
 
 #include <cassert>
+#include <cstring>
 #include <limits>
 #include <string>
 
@@ -139,45 +140,52 @@ inline Frame::Frame(Ref func,
       mod(mod) {}
 
 //// FreeList ////
+template <typename T>
+FreeList<T>::~FreeList() {
+  for (uintptr_t word : list_) {
+    if (!(word & Traits::kFreeBit)) {
+      Traits::Destroy(word);
+    }
+  }
+}
+
 template <typename T>
 bool FreeList<T>::IsUsed(Index index) const {
-  return index < list_.size() && !is_free_[index];
+  return index < list_.size() && !(list_[index] & Traits::kFreeBit);
 }
 
 template <typename T>
 template <typename... Args>
 auto FreeList<T>::New(Args&&... args) -> Index {
-  if (!free_.empty()) {
-    Index index = free_.back();
-    assert(is_free_[index]);
-    free_.pop_back();
-    is_free_[index] = false;
-    list_[index] = T(std::forward<Args>(args)...);
+  uintptr_t word = Traits::Pack(T(std::forward<Args>(args)...));
+  assert(!(word & Traits::kFreeBit));
+  if (free_head_ != kNoFree) {
+    Index index = free_head_;
+    assert(!IsUsed(index));
+    free_head_ = Traits::UnpackFree(list_[index]);
+    --free_count_;
+    list_[index] = word;
     return index;
   }
-  assert(list_.size() == is_free_.size());
-  is_free_.push_back(false);
-  list_.emplace_back(std::forward<Args>(args)...);
+  list_.push_back(word);
   return list_.size() - 1;
 }
 
 template <typename T>
 void FreeList<T>::Delete(Index index) {
-  list_[index] = T();
-  is_free_[index] = true;
-  free_.push_back(index);
-}
-
-template <typename T>
-const T& FreeList<T>::Get(Index index) const {
   assert(IsUsed(index));
-  return list_[index];
+  uintptr_t word = list_[index];
+  list_[index] = Traits::PackFree(free_head_);
+  free_head_ = index;
+  ++free_count_;
+  // Destroy last, since an object's finalizer may call New.
+  Traits::Destroy(word);
 }
 
 template <typename T>
-T& FreeList<T>::Get(Index index) {
+auto FreeList<T>::Get(Index index) const -> Value {
   assert(IsUsed(index));
-  return list_[index];
+  return Traits::Unpack(list_[index]);
 }
 
 template <typename T>
@@ -187,7 +195,7 @@ auto FreeList<T>::size() const -> Index {
 
 template <typename T>
 auto FreeList<T>::count() const -> Index {
-  return list_.size() - free_.size();
+  return list_.size() - free_count_;
 }
 
 //// RefPtr ////
@@ -210,7 +218,7 @@ RefPtr<T>::RefPtr(Store& store, Ref ref) {
   }
 #endif
   root_index_ = store.NewRoot(ref);
-  obj_ = static_cast<T*>(store.objects_.Get(ref.index).get());
+  obj_ = static_cast<T*>(store.objects_.Get(ref.index));
   store_ = &store;
 }
 
@@ -222,9 +230,14 @@ RefPtr<T>::RefPtr(const RefPtr& other)
 
 template <typename T>
 RefPtr<T>& RefPtr<T>::operator=(const RefPtr& other) {
-  obj_ = other.obj_;
-  store_ = other.store_;
-  root_index_ = store_ ? store_->CopyRoot(other.root_index_) : 0;
+  // Copy the other root before releasing this one, in case they are the same.
+  T* obj = other.obj_;
+  Store* store = other.store_;
+  auto root_index = store ? store->CopyRoot(other.root_index_) : 0;
+  reset();
+  obj_ = obj;
+  store_ = store;
+  root_index_ = root_index;
   return *this;
 }
 
@@ -238,6 +251,10 @@ RefPtr<T>::RefPtr(RefPtr&& other)
 
 template <typename T>
 RefPtr<T>& RefPtr<T>::operator=(RefPtr&& other) {
+  if (this == &other) {
+    return *this;
+  }
+  reset();
   obj_ = other.obj_;
   store_ = other.store_;
   root_index_ = other.root_index_;
@@ -262,9 +279,14 @@ RefPtr<T>::RefPtr(const RefPtr<U>& other)
 template <typename T>
 template <typename U>
 RefPtr<T>& RefPtr<T>::operator=(const RefPtr<U>& other) {
-  obj_ = other.obj_;
-  store_ = other.store_;
-  root_index_ = store_ ? store_->CopyRoot(other.root_index_) : 0;
+  // Copy the other root before releasing this one, in case they are the same.
+  T* obj = other.obj_;
+  Store* store = other.store_;
+  auto root_index = store ? store->CopyRoot(other.root_index_) : 0;
+  reset();
+  obj_ = obj;
+  store_ = store;
+  root_index_ = root_index;
   return *this;
 }
 
@@ -280,6 +302,10 @@ RefPtr<T>::RefPtr(RefPtr&& other)
 template <typename T>
 template <typename U>
 RefPtr<T>& RefPtr<T>::operator=(RefPtr&& other) {
+  if (this == &other) {
+    return *this;
+  }
+  reset();
   obj_ = other.obj_;
   store_ = other.store_;
   root_index_ = other.root_index_;
@@ -377,6 +403,18 @@ inline bool TypesMatch(ValueType expected, ValueType actual) {
   return expected == actual;
 }
 
+inline Index GetSlotCount(ValueType type) {
+  return type == ValueType::V128 ? 2 : 1;
+}
+
+inline Index GetSlotCount(const ValueTypes& types) {
+  Index count = 0;
+  for (auto type : types) {
+    count += GetSlotCount(type);
+  }
+  return count;
+}
+
 //// Value ////
 inline Value WABT_VECTORCALL Value::Make(s32 val) { Value res; res.i32_ = val; res.SetType(ValueType::I32); return res; }
 inline Value WABT_VECTORCALL Value::Make(u32 val) { Value res; res.i32_ = val; res.SetType(ValueType::I32); return res; }
@@ -434,7 +472,7 @@ inline bool Store::IsValid(Ref ref) const {
 
 template <typename T>
 bool Store::Is(Ref ref) const {
-  return objects_.IsUsed(ref.index) && isa<T>(objects_.Get(ref.index).get());
+  return objects_.IsUsed(ref.index) && isa<T>(objects_.Get(ref.index));
 }
 
 template <typename T>
@@ -451,14 +489,31 @@ RefPtr<T> Store::UnsafeGet(Ref ref) {
   return RefPtr<T>(*this, ref);
 }
 
+template <typename T>
+T* Store::UnsafeGetRaw(Ref ref) {
+  return cast<T>(objects_.Get(ref.index));
+}
+
 template <typename T, typename... Args>
 RefPtr<T> Store::Alloc(Args&&... args) {
   Ref ref{objects_.New(new T(std::forward<Args>(args)...))};
+  if (ref.index >= marks_.size()) {
+    marks_.resize(ref.index + 1);
+    is_remembered_.resize(ref.index + 1);
+  }
+  young_.push_back(ref);
   RefPtr<T> ptr{*this, ref};
   ptr->self_ = ref;
   return ptr;
 }
 
+inline void Store::RecordWrite(Object* obj) {
+  Ref ref = obj->self();
+  if (marks_[ref.index] && !is_remembered_[ref.index]) {
+    Remember(ref);
+  }
+}
+
 inline Store::ObjectList::Index Store::object_count() const {
   return objects_.count();
 }
@@ -467,6 +522,10 @@ inline const Features& Store::features() const {
   return features_;
 }
 
+inline const Store::Options& Store::options() const {
+  return options_;
+}
+
 //// Object ////
 // static
 inline bool Object::classof(const Object* obj) {
@@ -588,6 +647,10 @@ inline const FuncType& Func::type() const {
   return type_;
 }
 
+inline Index Func::type_id() const {
+  return type_id_;
+}
+
 //// DefinedFunc ////
 // static
 inline bool DefinedFunc::classof(const Object* obj) {
@@ -597,7 +660,7 @@ inline bool DefinedFunc::classof(const Object* obj) {
 // static
 inline DefinedFunc::Ptr DefinedFunc::New(Store& store,
                                          Ref instance,
-                                         FuncDesc desc) {
+                                         const FuncDesc* desc) {
   return store.Alloc<DefinedFunc>(store, instance, desc);
 }
 
@@ -606,7 +669,7 @@ inline Ref DefinedFunc::instance() const {
 }
 
 inline const FuncDesc& DefinedFunc::desc() const {
-  return desc_;
+  return *desc_;
 }
 
 //// HostFunc ////
@@ -616,8 +679,55 @@ inline bool HostFunc::classof(const Object* obj) {
 }
 
 // static
-inline HostFunc::Ptr HostFunc::New(Store& store, FuncType type, Callback cb) {
-  return store.Alloc<HostFunc>(store, type, cb);
+inline HostFunc::Ptr HostFunc::New(Store& store,
+                                   FuncType type,
+                                   ArgsCallback cb) {
+  return store.Alloc<HostFunc>(store, type, std::move(cb));
+}
+
+//// HostCallArgs ////
+inline HostCallArgs::HostCallArgs(std::vector<StackSlot>& values,
+                                  const HostFunc& func,
+                                  u32 params,
+                                  u32 results)
+    : values_(values), func_(func), params_(params), results_(results) {}
+
+inline Index HostCallArgs::param_count() const {
+  return func_.param_slots_.size();
+}
+
+inline Index HostCallArgs::result_count() const {
+  return func_.result_slots_.size();
+}
+
+// Values are stored from the start of their first slot, so every type that
+// a parameter or result can have is read and written with a plain copy.
+template <typename T>
+T WABT_VECTORCALL HostCallArgs::Read(u32 slot) const {
+  static_assert(sizeof(T) >= sizeof(u32), "T must be a value type");
+  T value;
+  memcpy(&value, &values_[slot], sizeof(value));
+  return value;
+}
+
+template <typename T>
+T WABT_VECTORCALL HostCallArgs::param(Index index) const {
+  assert(index < param_count());
+  return Read<T>(params_ + func_.param_slots_[index]);
+}
+
+template <typename T>
+T WABT_VECTORCALL HostCallArgs::result(Index index) const {
+  assert(index < result_count());
+  return Read<T>(results_ + func_.result_slots_[index]);
+}
+
+template <typename T>
+void WABT_VECTORCALL HostCallArgs::set_result(Index index, T value) {
+  static_assert(sizeof(T) >= sizeof(u32), "T must be a value type");
+  assert(index < result_count());
+  memcpy(&values_[results_ + func_.result_slots_[index]], &value,
+         sizeof(value));
 }
 
 //// Table ////
@@ -658,10 +768,21 @@ inline Memory::Ptr Memory::New(interp::Store& store, MemoryType type) {
   return store.Alloc<Memory>(store, type);
 }
 
+// static
+inline Memory::Ptr Memory::New(interp::Store& store, SharedMemory shared) {
+  return store.Alloc<Memory>(store, std::move(shared));
+}
+
+inline bool IsInMemoryBounds(u64 byte_size, u64 offset, u64 addend, u64 size) {
+  return offset <= byte_size && addend <= byte_size && size <= byte_size &&
+         offset + addend + size <= byte_size;
+}
+
 inline bool Memory::IsValidAccess(u64 offset, u64 addend, u64 size) const {
   // FIXME: make this faster.
-  return offset <= data_.size() && addend <= data_.size() &&
-         size <= data_.size() && offset + addend + size <= data_.size();
+  return IsInMemoryBounds(byte_size_, offset, addend, size) ||
+         (shared_ && IsInMemoryBounds(shared_->byte_size.load(), offset,
+                                      addend, size));
 }
 
 inline bool Memory::IsValidAtomicAccess(u64 offset,
@@ -676,7 +797,7 @@ Result Memory::Load(u64 offset, u64 addend, T* out) const {
   if (!IsValidAccess(offset, addend, sizeof(T))) {
     return Result::Error;
   }
-  wabt::MemcpyEndianAware(out, data_.data(), sizeof(T), data_.size(), 0,
+  wabt::MemcpyEndianAware(out, data_, sizeof(T), byte_size_, 0,
                           offset + addend, sizeof(T));
   return Result::Ok;
 }
@@ -685,7 +806,7 @@ template <typename T>
 T WABT_VECTORCALL Memory::UnsafeLoad(u64 offset, u64 addend) const {
   assert(IsValidAccess(offset, addend, sizeof(T)));
   T val;
-  wabt::MemcpyEndianAware(&val, data_.data(), sizeof(T), data_.size(), 0,
+  wabt::MemcpyEndianAware(&val, data_, sizeof(T), byte_size_, 0,
                           offset + addend, sizeof(T));
   return val;
 }
@@ -695,18 +816,31 @@ Result WABT_VECTORCALL Memory::Store(u64 offset, u64 addend, T val) {
   if (!IsValidAccess(offset, addend, sizeof(T))) {
     return Result::Error;
   }
-  wabt::MemcpyEndianAware(data_.data(), &val, data_.size(), sizeof(T),
+  wabt::MemcpyEndianAware(data_, &val, byte_size_, sizeof(T),
                           offset + addend, 0, sizeof(T));
   return Result::Ok;
 }
 
+template <typename T>
+std::atomic<T>* Memory::AtomicAddress(u64 offset, u64 addend) const {
+  static_assert(sizeof(std::atomic<T>) == sizeof(T),
+                "atomic must have the same layout as the value");
+#if WABT_BIG_ENDIAN
+  // The memory is stored back to front, so the bytes of the value are in
+  // native order.
+  u8* address = data_ + byte_size_ - offset - addend - sizeof(T);
+#else
+  u8* address = data_ + offset + addend;
+#endif
+  return reinterpret_cast<std::atomic<T>*>(address);
+}
+
 template <typename T>
 Result Memory::AtomicLoad(u64 offset, u64 addend, T* out) const {
   if (!IsValidAtomicAccess(offset, addend, sizeof(T))) {
     return Result::Error;
   }
-  wabt::MemcpyEndianAware(out, data_.data(), sizeof(T), data_.size(), 0,
-                          offset + addend, sizeof(T));
+  *out = AtomicAddress<T>(offset, addend)->load();
   return Result::Ok;
 }
 
@@ -715,16 +849,19 @@ Result Memory::AtomicStore(u64 offset, u64 addend, T val) {
   if (!IsValidAtomicAccess(offset, addend, sizeof(T))) {
     return Result::Error;
   }
-  wabt::MemcpyEndianAware(data_.data(), &val, data_.size(), sizeof(T),
-                          offset + addend, 0, sizeof(T));
+  AtomicAddress<T>(offset, addend)->store(val);
   return Result::Ok;
 }
 
 template <typename T, typename F>
 Result Memory::AtomicRmw(u64 offset, u64 addend, T rhs, F&& func, T* out) {
-  T lhs;
-  CHECK_RESULT(AtomicLoad(offset, addend, &lhs));
-  CHECK_RESULT(AtomicStore(offset, addend, func(lhs, rhs)));
+  if (!IsValidAtomicAccess(offset, addend, sizeof(T))) {
+    return Result::Error;
+  }
+  std::atomic<T>* address = AtomicAddress<T>(offset, addend);
+  T lhs = address->load();
+  while (!address->compare_exchange_weak(lhs, func(lhs, rhs))) {
+  }
   *out = lhs;
   return Result::Ok;
 }
@@ -735,25 +872,39 @@ Result Memory::AtomicRmwCmpxchg(u64 offset,
                                 T expect,
                                 T replace,
                                 T* out) {
-  T read;
-  CHECK_RESULT(AtomicLoad(offset, addend, &read));
-  if (read == expect) {
-    CHECK_RESULT(AtomicStore(offset, addend, replace));
+  if (!IsValidAtomicAccess(offset, addend, sizeof(T))) {
+    return Result::Error;
   }
-  *out = read;
+  // On failure, `expect` is set to the value that was read.
+  AtomicAddress<T>(offset, addend)->compare_exchange_strong(expect, replace);
+  *out = expect;
   return Result::Ok;
 }
 
+template <typename T>
+T WABT_VECTORCALL Memory::GuardedLoad(u64 offset, u64 addend) const {
+  assert(has_guard_pages());
+  T val;
+  memcpy(&val, data_ + offset + addend, sizeof(T));
+  return val;
+}
+
+template <typename T>
+void WABT_VECTORCALL Memory::GuardedStore(u64 offset, u64 addend, T val) {
+  assert(has_guard_pages());
+  memcpy(data_ + offset + addend, &val, sizeof(T));
+}
+
 inline u8* Memory::UnsafeData() {
-  return data_.data();
+  return data_;
 }
 
 inline u64 Memory::ByteSize() const {
-  return data_.size();
+  return shared_ ? shared_->byte_size.load() : byte_size_;
 }
 
 inline u64 Memory::PageSize() const {
-  return pages_;
+  return shared_ ? shared_->byte_size.load() / WABT_PAGE_SIZE : pages_;
 }
 
 inline const ExternType& Memory::extern_type() {
@@ -764,6 +915,14 @@ inline const MemoryType& Memory::type() const {
   return type_;
 }
 
+inline bool Memory::has_guard_pages() const {
+  return reserved_size_ != 0 && (!pool_ || pool_->guarded());
+}
+
+inline const SharedMemory& Memory::shared() const {
+  return shared_;
+}
+
 //// Global ////
 // static
 inline bool Global::classof(const Object* obj) {
@@ -796,6 +955,8 @@ T WABT_VECTORCALL Global::UnsafeGet() const {
 
 template <typename T>
 Result WABT_VECTORCALL Global::Set(T val) {
+  static_assert(!std::is_same<T, Ref>::value,
+                "use Set(Store&, Ref) so the write is recorded");
   if (type_.mut == Mutability::Var && HasType<T>(type_.type)) {
     value_.Set(val);
     return Result::Ok;
@@ -868,10 +1029,19 @@ inline bool Module::classof(const Object* obj) {
 
 // static
 inline Module::Ptr Module::New(Store& store, ModuleDesc desc) {
+  return New(store, std::make_shared<ModuleDesc>(std::move(desc)));
+}
+
+// static
+inline Module::Ptr Module::New(Store& store, SharedModuleDesc desc) {
   return store.Alloc<Module>(store, std::move(desc));
 }
 
 inline const ModuleDesc& Module::desc() const {
+  return *desc_;
+}
+
+inline const SharedModuleDesc& Module::shared_desc() const {
   return desc_;
 }
 
@@ -937,6 +1107,36 @@ inline std::vector<DataSegment>& Instance::datas() {
   return datas_;
 }
 
+inline Func* Instance::func_ptr(Index index) const {
+  return func_ptrs_[index];
+}
+
+inline Index Instance::func_type_id(Index index) const {
+  return func_type_ids_[index];
+}
+
+inline Table* Instance::table_ptr(Index index) const {
+  return table_ptrs_[index];
+}
+
+inline Memory* Instance::memory_ptr(Index index) const {
+  return memory_ptrs_[index];
+}
+
+inline Global* Instance::global_ptr(Index index) const {
+  return global_ptrs_[index];
+}
+
+//// InstanceSnapshot ////
+// static
+inline bool InstanceSnapshot::classof(const Object* obj) {
+  return obj->kind() == skind;
+}
+
+inline Ref InstanceSnapshot::module() const {
+  return module_;
+}
+
 //// Thread ////
 // static
 inline bool Thread::classof(const Object* obj) {
@@ -952,5 +1152,13 @@ inline Store& Thread::store() {
   return store_;
 }
 
+inline u64 Thread::fuel() const {
+  return fuel_;
+}
+
+inline void Thread::set_fuel(u64 fuel) {
+  fuel_ = fuel;
+}
+
 }  // namespace interp
 }  // namespace wabt
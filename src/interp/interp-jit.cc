@@ -0,0 +1,1159 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp/interp-jit.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+#if WABT_INTERP_JIT
+#include <sys/mman.h>
+#endif
+
+namespace wabt {
+namespace interp {
+
+#if WABT_INTERP_JIT
+
+namespace {
+
+using Offset = Istream::Offset;
+
+enum Reg : u8 {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Condition codes, as encoded in jcc, setcc and cmovcc.
+enum Cond : u8 {
+  kO, kNO, kB, kAE, kE, kNE, kBE, kA, kS, kNS, kP, kNP, kL, kGE, kLE, kG,
+};
+
+Cond Invert(Cond cond) {
+  return static_cast<Cond>(cond ^ 1);
+}
+
+// Register assignment. Everything else is scratch.
+const Reg kSp = RBX;       // JitContext::sp
+const Reg kLimit = R12;    // JitContext::limit
+const Reg kCtx = R13;      // JitContext*
+const Reg kMemData = R14;  // JitContext::memory_data
+const Reg kMemSize = R15;  // JitContext::memory_size
+
+// A memory operand, [base + index + disp].
+struct Mem {
+  Reg base;
+  Reg index;
+  bool has_index;
+  s32 disp;
+};
+
+Mem M(Reg base, s32 disp) {
+  return Mem{base, RAX, false, disp};
+}
+
+Mem M(Reg base, Reg index, s32 disp) {
+  return Mem{base, index, true, disp};
+}
+
+// The value stack slot `n` down from the top, as numbered by Thread::Pick.
+Mem Slot(u32 n) {
+  return M(kSp, -8 * static_cast<s32>(n));
+}
+
+Mem Ctx(size_t field) {
+  return M(kCtx, static_cast<s32>(field));
+}
+
+// A one or two byte opcode.
+struct Opc {
+  Opc(u8 byte) : size(1), bytes{byte, 0} {}
+  Opc(u8 byte0, u8 byte1) : size(2), bytes{byte0, byte1} {}
+
+  u8 size;
+  u8 bytes[2];
+};
+
+// Just enough of an x86-64 assembler for the templates below. Operands
+// follow Intel order: destination first.
+class Assembler {
+ public:
+  size_t size() const { return code_.size(); }
+  const std::vector<u8>& code() const { return code_; }
+
+  void Emit8(u8 value) { code_.push_back(value); }
+  void Emit32(u32 value) { EmitBytes(&value, sizeof(value)); }
+  void Emit64(u64 value) { EmitBytes(&value, sizeof(value)); }
+  void Patch32(size_t pos, u32 value) {
+    memcpy(&code_[pos], &value, sizeof(value));
+  }
+
+  // `prefix` is a mandatory prefix (0x66, 0xf2 or 0xf3), or 0 for none.
+  // `reg` is the ModRM reg field: a register, or an opcode extension.
+  void Op(u8 prefix, bool w, Opc opcode, int reg,
+          const Mem& m) {
+    if (prefix) {
+      Emit8(prefix);
+    }
+    Rex(w, reg, m.has_index ? m.index : 0, m.base);
+    EmitOpcode(opcode);
+    ModRM(reg, m);
+  }
+
+  void OpRR(u8 prefix, bool w, Opc opcode, int reg,
+            int rm) {
+    if (prefix) {
+      Emit8(prefix);
+    }
+    Rex(w, reg, 0, rm);
+    EmitOpcode(opcode);
+    Emit8(0xc0 | (reg & 7) << 3 | (rm & 7));
+  }
+
+  // mov dst, imm, with the shortest encoding that zero-extends imm.
+  void MovImm(Reg dst, u64 imm) {
+    bool wide = imm > 0xffffffffu;
+    Rex(wide, 0, 0, dst);
+    Emit8(0xb8 | (dst & 7));
+    if (wide) {
+      Emit64(imm);
+    } else {
+      Emit32(static_cast<u32>(imm));
+    }
+  }
+
+  void Push(Reg reg) {
+    Rex(false, 0, 0, reg);
+    Emit8(0x50 | (reg & 7));
+  }
+
+  void Pop(Reg reg) {
+    Rex(false, 0, 0, reg);
+    Emit8(0x58 | (reg & 7));
+  }
+
+  void Ret() { Emit8(0xc3); }
+
+  // Returns the position of the rel32 operand, to be patched.
+  size_t Jmp() {
+    Emit8(0xe9);
+    return Rel32();
+  }
+
+  size_t Jcc(Cond cond) {
+    Emit8(0x0f);
+    Emit8(0x80 | cond);
+    return Rel32();
+  }
+
+  // Short forward jumps over a few instructions; see Bind8.
+  size_t Jcc8(Cond cond) {
+    Emit8(0x70 | cond);
+    Emit8(0);
+    return size();
+  }
+
+  size_t Jmp8() {
+    Emit8(0xeb);
+    Emit8(0);
+    return size();
+  }
+
+  void Bind8(size_t pos) {
+    size_t distance = size() - pos;
+    assert(distance < 128);
+    code_[pos - 1] = static_cast<u8>(distance);
+  }
+
+  void BindRel32(size_t pos, size_t target) {
+    Patch32(pos, static_cast<u32>(target - (pos + 4)));
+  }
+
+ private:
+  void EmitBytes(const void* data, size_t size) {
+    auto* bytes = static_cast<const u8*>(data);
+    code_.insert(code_.end(), bytes, bytes + size);
+  }
+
+  void EmitOpcode(Opc opcode) {
+    for (u8 i = 0; i < opcode.size; ++i) {
+      Emit8(opcode.bytes[i]);
+    }
+  }
+
+  void Rex(bool w, int reg, int index, int base) {
+    u8 rex = 0x40 | (w << 3) | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 |
+             ((base >> 3) & 1);
+    if (rex != 0x40) {
+      Emit8(rex);
+    }
+  }
+
+  // Always uses a displacement, so that rbp and r13 work as a base.
+  void ModRM(int reg, const Mem& m) {
+    bool disp8 = m.disp >= -128 && m.disp < 128;
+    u8 mod = disp8 ? 0x40 : 0x80;
+    if (m.has_index) {
+      Emit8(mod | (reg & 7) << 3 | 4);
+      Emit8((m.index & 7) << 3 | (m.base & 7));
+    } else {
+      Emit8(mod | (reg & 7) << 3 | (m.base & 7));
+      if ((m.base & 7) == RSP) {
+        Emit8(0x24);
+      }
+    }
+    if (disp8) {
+      Emit8(static_cast<u8>(m.disp));
+    } else {
+      Emit32(static_cast<u32>(m.disp));
+    }
+  }
+
+  size_t Rel32() {
+    size_t pos = size();
+    Emit32(0);
+    return pos;
+  }
+
+  std::vector<u8> code_;
+};
+
+// Opcodes of the "op r, r/m" forms of the ALU instructions; the "op r/m, imm"
+// form uses opcode 0x81 with these shifted right by 3 as the extension.
+enum Alu : u8 {
+  kAdd = 0x03,
+  kOr = 0x0b,
+  kAnd = 0x23,
+  kSub = 0x2b,
+  kXor = 0x33,
+  kCmp = 0x3b,
+};
+
+// Extensions of opcode 0xd3, shift r/m by cl.
+enum Shift : u8 {
+  kRol = 0,
+  kRor = 1,
+  kShl = 4,
+  kShr = 5,
+  kSar = 7,
+};
+
+// The second byte of the scalar SSE arithmetic opcodes.
+enum Sse : u8 {
+  kSqrt = 0x51,
+  kAddSse = 0x58,
+  kMulSse = 0x59,
+  kSubSse = 0x5c,
+  kDivSse = 0x5e,
+};
+
+class JitCompiler {
+ public:
+  explicit JitCompiler(const Istream& istream) : istream_(istream) {}
+
+  // Returns the code, and adds the entry for each instruction to `entries`.
+  std::vector<u8> Compile(Offset code_offset,
+                          std::vector<std::pair<Offset, u32>>* entries);
+
+ private:
+  struct Decoded {
+    Offset offset;
+    Offset next;
+    Instr instr;
+  };
+
+  void FindReachable(Offset code_offset);
+  void EmitPrologue();
+  // Returns false if the instruction never falls through to the next one.
+  bool EmitInstr(const Decoded&);
+
+  // Exits before the instruction at `offset`.
+  void EmitExit(Offset offset);
+  void EmitExitIf(Cond, Offset offset);
+  void EmitJump(Offset target);
+  void EmitJumpIf(Cond, Offset target, Offset from);
+  void EmitJumpBack(Offset target);
+
+  // Exits unless there is room to push `count` slots.
+  void EmitCheckRoom(Offset, u32 count);
+  void EmitAdjustSp(s32 slots);
+
+  // Operations on the value stack. i32 and f32 results are zero-extended to
+  // a full slot, as Thread::Push does.
+  void EmitConst(u64 value);
+  void EmitBinop(bool w, Alu);
+  void EmitMul(bool w);
+  void EmitShift(bool w, Shift);
+  void EmitCompare(bool w, Cond);
+  void EmitEqz(bool w);
+  void EmitClz(bool w);
+  void EmitCtz(bool w);
+  void EmitDivRem(Offset, bool w, bool is_signed, bool is_rem);
+  void EmitFloatBinop(bool is_f64, Sse);
+  void EmitFloatSqrt(bool is_f64);
+  void EmitFloatCompare(bool is_f64, Opcode::Enum);
+  void EmitCanonNaN(bool is_f64);
+  void EmitStoreFloat(bool is_f64, Mem);
+
+  // Leaves the effective address minus `offset` in rax, or exits if the
+  // access is out of bounds. Returns false if `offset` is too large to
+  // translate.
+  bool EmitBoundsCheck(Offset, Mem addr, u32 offset, u32 size);
+  bool EmitLoad(Offset, const Instr&, u32 local);
+  bool EmitStore(Offset, const Instr&);
+
+  const Istream& istream_;
+  Assembler a_;
+  std::vector<Decoded> instrs_;
+  std::unordered_map<Offset, u32> labels_;
+  // rel32 operands to patch with the code for an istream offset, or with an
+  // exit stub.
+  std::vector<std::pair<size_t, Offset>> label_fixups_;
+  std::vector<std::pair<size_t, Offset>> exit_fixups_;
+  size_t common_exit_ = 0;
+};
+
+void JitCompiler::FindReachable(Offset code_offset) {
+  std::map<Offset, Decoded> found;
+  std::vector<Offset> worklist = {code_offset};
+  while (!worklist.empty()) {
+    Offset offset = worklist.back();
+    worklist.pop_back();
+    if (found.count(offset)) {
+      continue;
+    }
+    Decoded decoded;
+    decoded.offset = offset;
+    decoded.next = offset;
+    decoded.instr = istream_.Read(&decoded.next);
+    found[offset] = decoded;
+
+    const Instr& instr = decoded.instr;
+    switch (instr.op) {
+      case Opcode::Br:
+        worklist.push_back(instr.imm_u32);
+        break;
+
+      case Opcode::BrIf:
+      case Opcode::InterpBrUnless:
+      case Opcode::InterpI32LtSBrUnless:
+      case Opcode::InterpI32LtUBrUnless:
+        worklist.push_back(instr.imm_u32);
+        worklist.push_back(decoded.next);
+        break;
+
+      case Opcode::BrTable:
+        for (u32 i = 0; i <= instr.imm_u32; ++i) {
+          worklist.push_back(decoded.next + i * Istream::kBrTableEntrySize);
+        }
+        break;
+
+      // The Br after InterpAdjustFrameForReturnCall goes to another
+      // function.
+      case Opcode::Unreachable:
+      case Opcode::Return:
+      case Opcode::ReturnCall:
+      case Opcode::ReturnCallIndirect:
+      case Opcode::InterpAdjustFrameForReturnCall:
+      case Opcode::Throw:
+      case Opcode::Rethrow:
+        break;
+
+      default:
+        worklist.push_back(decoded.next);
+        break;
+    }
+  }
+
+  for (auto&& pair : found) {
+    instrs_.push_back(pair.second);
+  }
+}
+
+std::vector<u8> JitCompiler::Compile(
+    Offset code_offset,
+    std::vector<std::pair<Offset, u32>>* entries) {
+  FindReachable(code_offset);
+  EmitPrologue();
+
+  for (size_t i = 0; i < instrs_.size(); ++i) {
+    const Decoded& decoded = instrs_[i];
+    labels_[decoded.offset] = a_.size();
+    if (EmitInstr(decoded) &&
+        (i + 1 == instrs_.size() || instrs_[i + 1].offset != decoded.next)) {
+      EmitJump(decoded.next);
+    }
+  }
+
+  // Exit stubs, shared by all exits to the same instruction.
+  std::map<Offset, size_t> stubs;
+  for (auto&& fixup : exit_fixups_) {
+    auto iter = stubs.find(fixup.second);
+    if (iter == stubs.end()) {
+      iter = stubs.emplace(fixup.second, a_.size()).first;
+      // mov eax, offset; jmp common_exit
+      a_.MovImm(RAX, fixup.second);
+      a_.BindRel32(a_.Jmp(), common_exit_);
+    }
+    a_.BindRel32(fixup.first, iter->second);
+  }
+  for (auto&& fixup : label_fixups_) {
+    a_.BindRel32(fixup.first, labels_.at(fixup.second));
+  }
+
+  for (auto&& decoded : instrs_) {
+    entries->emplace_back(decoded.offset, labels_[decoded.offset]);
+  }
+  return a_.code();
+}
+
+void JitCompiler::EmitPrologue() {
+  // u64 Run(JitContext* ctx, const void* entry)
+  for (Reg reg : {RBX, R12, R13, R14, R15}) {
+    a_.Push(reg);
+  }
+  a_.OpRR(0, true, {0x89}, RDI, kCtx);  // mov r13, rdi
+  a_.Op(0, true, {0x8b}, kSp, Ctx(offsetof(JitContext, sp)));
+  a_.Op(0, true, {0x8b}, kLimit, Ctx(offsetof(JitContext, limit)));
+  a_.Op(0, true, {0x8b}, kMemData, Ctx(offsetof(JitContext, memory_data)));
+  a_.Op(0, true, {0x8b}, kMemSize, Ctx(offsetof(JitContext, memory_size)));
+  a_.OpRR(0, false, {0xff}, 4, RSI);  // jmp rsi
+
+  // The exit stubs jump here with the exit in rax.
+  common_exit_ = a_.size();
+  a_.Op(0, true, {0x89}, kSp, Ctx(offsetof(JitContext, sp)));
+  for (Reg reg : {R15, R14, R13, R12, RBX}) {
+    a_.Pop(reg);
+  }
+  a_.Ret();
+}
+
+void JitCompiler::EmitExit(Offset offset) {
+  exit_fixups_.emplace_back(a_.Jmp(), offset);
+}
+
+void JitCompiler::EmitExitIf(Cond cond, Offset offset) {
+  exit_fixups_.emplace_back(a_.Jcc(cond), offset);
+}
+
+void JitCompiler::EmitJump(Offset target) {
+  label_fixups_.emplace_back(a_.Jmp(), target);
+}
+
+void JitCompiler::EmitJumpIf(Cond cond, Offset target, Offset from) {
+  if (target > from) {
+    label_fixups_.emplace_back(a_.Jcc(cond), target);
+    return;
+  }
+  size_t skip = a_.Jcc8(Invert(cond));
+  EmitJumpBack(target);
+  a_.Bind8(skip);
+}
+
+// Backward branches are loops, so they count down the budget, and exit to the
+// branch target when it runs out. The Thread then gets a chance to check
+// for interrupts.
+void JitCompiler::EmitJumpBack(Offset target) {
+  a_.Op(0, false, {0xff}, 1, Ctx(offsetof(JitContext, budget)));  // dec
+  EmitExitIf(kE, target);
+  EmitJump(target);
+}
+
+void JitCompiler::EmitCheckRoom(Offset offset, u32 count) {
+  a_.Op(0, true, {0x8d}, RAX, M(kSp, 8 * count));  // lea rax, [sp + 8*count]
+  a_.OpRR(0, true, {kCmp}, RAX, kLimit);
+  EmitExitIf(kA, offset);
+}
+
+void JitCompiler::EmitAdjustSp(s32 slots) {
+  a_.Op(0, true, {0x8d}, kSp, M(kSp, 8 * slots));  // lea sp, [sp + 8*slots]
+}
+
+void JitCompiler::EmitConst(u64 value) {
+  a_.MovImm(RAX, value);
+  a_.Op(0, true, {0x89}, RAX, Slot(0));
+  EmitAdjustSp(1);
+}
+
+void JitCompiler::EmitBinop(bool w, Alu alu) {
+  a_.Op(0, w, {0x8b}, RAX, Slot(2));
+  a_.Op(0, w, {alu}, RAX, Slot(1));
+  a_.Op(0, true, {0x89}, RAX, Slot(2));
+  EmitAdjustSp(-1);
+}
+
+void JitCompiler::EmitMul(bool w) {
+  a_.Op(0, w, {0x8b}, RAX, Slot(2));
+  a_.Op(0, w, {0x0f, 0xaf}, RAX, Slot(1));
+  a_.Op(0, true, {0x89}, RAX, Slot(2));
+  EmitAdjustSp(-1);
+}
+
+void JitCompiler::EmitShift(bool w, Shift shift) {
+  // x86 masks the count the same way wasm does.
+  a_.Op(0, w, {0x8b}, RAX, Slot(2));
+  a_.Op(0, false, {0x8b}, RCX, Slot(1));
+  a_.OpRR(0, w, {0xd3}, shift, RAX);
+  a_.Op(0, true, {0x89}, RAX, Slot(2));
+  EmitAdjustSp(-1);
+}
+
+void JitCompiler::EmitCompare(bool w, Cond cond) {
+  a_.Op(0, w, {0x8b}, RCX, Slot(2));
+  a_.OpRR(0, false, {kXor}, RAX, RAX);
+  a_.Op(0, w, {kCmp}, RCX, Slot(1));
+  a_.OpRR(0, false, {0x0f, static_cast<u8>(0x90 | cond)}, 0, RAX);  // setcc al
+  a_.Op(0, true, {0x89}, RAX, Slot(2));
+  EmitAdjustSp(-1);
+}
+
+void JitCompiler::EmitEqz(bool w) {
+  a_.Op(0, w, {0x8b}, RCX, Slot(1));
+  a_.OpRR(0, false, {kXor}, RAX, RAX);
+  a_.OpRR(0, w, {0x85}, RCX, RCX);                         // test rcx, rcx
+  a_.OpRR(0, false, {0x0f, 0x90 | kE}, 0, RAX);            // sete al
+  a_.Op(0, true, {0x89}, RAX, Slot(1));
+}
+
+void JitCompiler::EmitClz(bool w) {
+  // bsr leaves its destination alone when the source is zero, so start
+  // from -1 to get a result of bits - 1 - (-1).
+  a_.MovImm(RCX, ~u64{0});
+  a_.Op(0, w, {0x0f, 0xbd}, RAX, Slot(1));                 // bsr rax, [x]
+  a_.OpRR(0, w, {0x0f, 0x40 | kE}, RAX, RCX);              // cmovz rax, rcx
+  a_.OpRR(0, w, {0xf7}, 3, RAX);                           // neg rax
+  a_.OpRR(0, w, {0x81}, kAdd >> 3, RAX);                   // add rax, bits-1
+  a_.Emit32(w ? 63 : 31);
+  a_.Op(0, true, {0x89}, RAX, Slot(1));
+}
+
+void JitCompiler::EmitCtz(bool w) {
+  a_.MovImm(RCX, w ? 64 : 32);
+  a_.Op(0, w, {0x0f, 0xbc}, RAX, Slot(1));                 // bsf rax, [x]
+  a_.OpRR(0, w, {0x0f, 0x40 | kE}, RAX, RCX);              // cmovz rax, rcx
+  a_.Op(0, true, {0x89}, RAX, Slot(1));
+}
+
+void JitCompiler::EmitDivRem(Offset offset,
+                             bool w,
+                             bool is_signed,
+                             bool is_rem) {
+  a_.Op(0, w, {0x8b}, RCX, Slot(1));
+  a_.OpRR(0, w, {0x85}, RCX, RCX);
+  EmitExitIf(kE, offset);  // Division by zero.
+  a_.Op(0, w, {0x8b}, RAX, Slot(2));
+  size_t done = 0;
+  if (is_signed) {
+    // INT_MIN / -1 overflows, and INT_MIN % -1 is 0; idiv faults on both.
+    a_.OpRR(0, w, {0x83}, kCmp >> 3, RCX);
+    a_.Emit8(0xff);
+    size_t not_minus_one = a_.Jcc8(kNE);
+    if (is_rem) {
+      a_.OpRR(0, false, {kXor}, RDX, RDX);
+      done = a_.Jmp8();
+    } else {
+      a_.MovImm(RDX, w ? u64{1} << 63 : u64{1} << 31);
+      a_.OpRR(0, w, {kCmp}, RAX, RDX);
+      EmitExitIf(kE, offset);  // Integer overflow.
+    }
+    a_.Bind8(not_minus_one);
+    if (w) {
+      a_.Emit8(0x48);  // cqo
+    }
+    a_.Emit8(0x99);  // cdq
+    a_.OpRR(0, w, {0xf7}, 7, RCX);  // idiv rcx
+  } else {
+    a_.OpRR(0, false, {kXor}, RDX, RDX);
+    a_.OpRR(0, w, {0xf7}, 6, RCX);  // div rcx
+  }
+  if (done) {
+    a_.Bind8(done);
+  }
+  a_.Op(0, true, {0x89}, is_rem ? RDX : RAX, Slot(2));
+  EmitAdjustSp(-1);
+}
+
+void JitCompiler::EmitCanonNaN(bool is_f64) {
+  // ucomis[sd] xmm0, xmm0 is unordered only for a NaN.
+  a_.OpRR(is_f64 ? 0x66 : 0, false, {0x0f, 0x2e}, 0, 0);
+  size_t not_nan = a_.Jcc8(kNP);
+  a_.MovImm(RAX, is_f64 ? 0x7ff8000000000000ull : 0x7fc00000u);
+  a_.OpRR(0x66, is_f64, {0x0f, 0x6e}, 0, RAX);  // movd/movq xmm0, rax
+  a_.Bind8(not_nan);
+}
+
+void JitCompiler::EmitStoreFloat(bool is_f64, Mem m) {
+  a_.OpRR(0x66, is_f64, {0x0f, 0x7e}, 0, RAX);  // movd/movq rax, xmm0
+  a_.Op(0, true, {0x89}, RAX, m);
+}
+
+void JitCompiler::EmitFloatBinop(bool is_f64, Sse op) {
+  u8 prefix = is_f64 ? 0xf2 : 0xf3;
+  a_.Op(prefix, false, {0x0f, 0x10}, 0, Slot(2));  // movs[sd] xmm0, [lhs]
+  a_.Op(prefix, false, {0x0f, op}, 0, Slot(1));
+  EmitCanonNaN(is_f64);
+  EmitStoreFloat(is_f64, Slot(2));
+  EmitAdjustSp(-1);
+}
+
+void JitCompiler::EmitFloatSqrt(bool is_f64) {
+  a_.Op(is_f64 ? 0xf2 : 0xf3, false, {0x0f, kSqrt}, 0, Slot(1));
+  EmitCanonNaN(is_f64);
+  EmitStoreFloat(is_f64, Slot(1));
+}
+
+void JitCompiler::EmitFloatCompare(bool is_f64, Opcode::Enum op) {
+  // ucomis[sd] is unordered (ZF, PF and CF set) if either operand is a NaN,
+  // which makes a and ae false. lt and le swap the operands to use those.
+  bool swap = false;
+  Cond cond = kE;
+  switch (op) {
+    case Opcode::F32Eq: case Opcode::F64Eq: cond = kE; break;
+    case Opcode::F32Ne: case Opcode::F64Ne: cond = kNE; break;
+    case Opcode::F32Gt: case Opcode::F64Gt: cond = kA; break;
+    case Opcode::F32Ge: case Opcode::F64Ge: cond = kAE; break;
+    case Opcode::F32Lt: case Opcode::F64Lt: cond = kA; swap = true; break;
+    case Opcode::F32Le: case Opcode::F64Le: cond = kAE; swap = true; break;
+    default: WABT_UNREACHABLE;
+  }
+  u8 prefix = is_f64 ? 0xf2 : 0xf3;
+  a_.Op(prefix, false, {0x0f, 0x10}, 0, Slot(swap ? 1 : 2));
+  a_.OpRR(0, false, {kXor}, RAX, RAX);
+  a_.OpRR(0, false, {kXor}, RCX, RCX);
+  a_.Op(is_f64 ? 0x66 : 0, false, {0x0f, 0x2e}, 0, Slot(swap ? 2 : 1));
+  a_.OpRR(0, false, {0x0f, static_cast<u8>(0x90 | cond)}, 0, RAX);
+  if (cond == kE) {
+    a_.OpRR(0, false, {0x0f, 0x90 | kNP}, 0, RCX);  // and not unordered
+    a_.OpRR(0, false, {kAnd}, RAX, RCX);
+  } else if (cond == kNE) {
+    a_.OpRR(0, false, {0x0f, 0x90 | kP}, 0, RCX);  // or unordered
+    a_.OpRR(0, false, {kOr}, RAX, RCX);
+  }
+  a_.Op(0, true, {0x89}, RAX, Slot(2));
+  EmitAdjustSp(-1);
+}
+
+bool JitCompiler::EmitBoundsCheck(Offset offset,
+                                  Mem addr,
+                                  u32 mem_offset,
+                                  u32 size) {
+  if (mem_offset > 0x7fffffffu - size) {
+    return false;
+  }
+  a_.Op(0, false, {0x8b}, RAX, addr);  // mov eax, [addr]; zero-extends
+  a_.Op(0, true, {0x8d}, RCX, M(RAX, static_cast<s32>(mem_offset + size)));
+  a_.OpRR(0, true, {kCmp}, RCX, kMemSize);
+  EmitExitIf(kA, offset);
+  return true;
+}
+
+bool JitCompiler::EmitLoad(Offset offset, const Instr& instr, u32 local) {
+  // Only memory 0 is passed in the JitContext.
+  if (instr.imm_u32x2.fst != 0) {
+    return false;
+  }
+  using O = Opcode;
+  u32 mem_offset = instr.imm_u32x2.snd;
+  Opcode::Enum op = instr.op;
+  if (op == O::InterpLocalGetI32Load) {
+    mem_offset = instr.imm_u32x3.snd;
+    op = O::I32Load;
+  }
+
+  bool w = false;
+  Opc opcode = 0x8b;
+  u32 size = 4;
+  switch (op) {
+    case O::I32Load:    case O::F32Load:    break;
+    case O::I64Load:    case O::F64Load:    w = true; size = 8; break;
+    case O::I32Load8S:  opcode = Opc(0x0f, 0xbe); size = 1; break;
+    case O::I32Load8U:  opcode = Opc(0x0f, 0xb6); size = 1; break;
+    case O::I32Load16S: opcode = Opc(0x0f, 0xbf); size = 2; break;
+    case O::I32Load16U: opcode = Opc(0x0f, 0xb7); size = 2; break;
+    case O::I64Load8S:  opcode = Opc(0x0f, 0xbe); w = true; size = 1; break;
+    case O::I64Load8U:  opcode = Opc(0x0f, 0xb6); size = 1; break;
+    case O::I64Load16S: opcode = Opc(0x0f, 0xbf); w = true; size = 2; break;
+    case O::I64Load16U: opcode = Opc(0x0f, 0xb7); size = 2; break;
+    case O::I64Load32S: opcode = 0x63; w = true; break;
+    case O::I64Load32U: break;
+    default: WABT_UNREACHABLE;
+  }
+
+  // local_get_i32_load pushes the local, and loads from it.
+  Mem addr = Slot(local ? local : 1);
+  Mem result = local ? Slot(0) : Slot(1);
+  if (local) {
+    EmitCheckRoom(offset, 1);
+  }
+  if (!EmitBoundsCheck(offset, addr, mem_offset, size)) {
+    return false;
+  }
+  a_.Op(0, w, opcode, RAX, M(kMemData, RAX, static_cast<s32>(mem_offset)));
+  a_.Op(0, true, {0x89}, RAX, result);
+  if (local) {
+    EmitAdjustSp(1);
+  }
+  return true;
+}
+
+bool JitCompiler::EmitStore(Offset offset, const Instr& instr) {
+  if (instr.imm_u32x2.fst != 0) {
+    return false;
+  }
+  using O = Opcode;
+  u32 mem_offset = instr.imm_u32x2.snd;
+  u8 prefix = 0;
+  bool w = false;
+  u8 opcode = 0x89;
+  u32 size = 4;
+  switch (instr.op) {
+    case O::I32Store:   case O::F32Store:   break;
+    case O::I64Store:   case O::F64Store:   w = true; size = 8; break;
+    case O::I32Store8:  case O::I64Store8:  opcode = 0x88; size = 1; break;
+    case O::I32Store16: case O::I64Store16: prefix = 0x66; size = 2; break;
+    case O::I64Store32: break;
+    default: WABT_UNREACHABLE;
+  }
+
+  if (!EmitBoundsCheck(offset, Slot(2), mem_offset, size)) {
+    return false;
+  }
+  a_.Op(0, w, {0x8b}, RCX, Slot(1));
+  a_.Op(prefix, w, {opcode}, RCX,
+        M(kMemData, RAX, static_cast<s32>(mem_offset)));
+  EmitAdjustSp(-2);
+  return true;
+}
+
+bool JitCompiler::EmitInstr(const Decoded& decoded) {
+  using O = Opcode;
+  const Instr& instr = decoded.instr;
+  const Offset offset = decoded.offset;
+
+  switch (instr.op) {
+    case O::Nop:
+      break;
+
+    case O::Br:
+      if (instr.imm_u32 > offset) {
+        EmitJump(instr.imm_u32);
+      } else {
+        EmitJumpBack(instr.imm_u32);
+      }
+      return false;
+
+    case O::BrIf:
+    case O::InterpBrUnless:
+      a_.Op(0, false, {0x8b}, RAX, Slot(1));
+      EmitAdjustSp(-1);
+      a_.OpRR(0, false, {0x85}, RAX, RAX);
+      EmitJumpIf(instr.op == O::BrIf ? kNE : kE, instr.imm_u32, offset);
+      break;
+
+    case O::InterpI32LtSBrUnless:
+    case O::InterpI32LtUBrUnless:
+      a_.Op(0, false, {0x8b}, RAX, Slot(2));
+      a_.Op(0, false, {kCmp}, RAX, Slot(1));
+      EmitAdjustSp(-2);  // lea leaves the flags alone.
+      EmitJumpIf(instr.op == O::InterpI32LtSBrUnless ? kGE : kAE,
+                 instr.imm_u32, offset);
+      break;
+
+    case O::Drop:
+      EmitAdjustSp(-1);
+      break;
+
+    case O::Select:
+      a_.Op(0, false, {0x8b}, RAX, Slot(1));
+      a_.Op(0, true, {0x8b}, RCX, Slot(3));
+      a_.OpRR(0, false, {0x85}, RAX, RAX);
+      a_.Op(0, true, {0x0f, 0x40 | kE}, RCX, Slot(2));  // cmovz rcx, [false]
+      a_.Op(0, true, {0x89}, RCX, Slot(3));
+      EmitAdjustSp(-2);
+      break;
+
+    case O::LocalGet:
+      EmitCheckRoom(offset, 1);
+      a_.Op(0, true, {0x8b}, RAX, Slot(instr.imm_u32));
+      a_.Op(0, true, {0x89}, RAX, Slot(0));
+      EmitAdjustSp(1);
+      break;
+
+    case O::LocalSet:
+    case O::LocalTee:
+      a_.Op(0, true, {0x8b}, RAX, Slot(1));
+      a_.Op(0, true, {0x89}, RAX, Slot(instr.imm_u32));
+      if (instr.op == O::LocalSet) {
+        EmitAdjustSp(-1);
+      }
+      break;
+
+    case O::InterpLocalGetLocalGet:
+      EmitCheckRoom(offset, 2);
+      a_.Op(0, true, {0x8b}, RAX, Slot(instr.imm_u32x2.fst));
+      a_.Op(0, true, {0x89}, RAX, Slot(0));
+      // The second index is relative to the stack after the first push.
+      a_.Op(0, true, {0x8b}, RAX, Slot(instr.imm_u32x2.snd - 1));
+      a_.Op(0, true, {0x89}, RAX, M(kSp, 8));
+      EmitAdjustSp(2);
+      break;
+
+    case O::InterpAlloca: {
+      // Locals are zeroed, which makes reference locals null.
+      u32 count = instr.imm_u32;
+      EmitCheckRoom(offset, count);
+      a_.OpRR(0, false, {kXor}, RAX, RAX);
+      if (count <= 8) {
+        for (u32 i = 0; i < count; ++i) {
+          a_.Op(0, true, {0x89}, RAX, M(kSp, 8 * i));
+        }
+      } else {
+        a_.OpRR(0, true, {0x89}, kSp, RDI);  // mov rdi, sp
+        a_.MovImm(RCX, count);
+        a_.Emit8(0xf3);  // rep stosq
+        a_.Emit8(0x48);
+        a_.Emit8(0xab);
+      }
+      EmitAdjustSp(count);
+      break;
+    }
+
+    case O::InterpDropKeep: {
+      u32 drop = instr.imm_u32x2.fst;
+      u32 keep = instr.imm_u32x2.snd;
+      for (u32 i = keep; i > 0; --i) {
+        a_.Op(0, true, {0x8b}, RAX, Slot(i));
+        a_.Op(0, true, {0x89}, RAX, Slot(i + drop));
+      }
+      EmitAdjustSp(-static_cast<s32>(drop));
+      break;
+    }
+
+    case O::InterpCatchDrop:
+      if (instr.imm_u32 != 0) {
+        EmitExit(offset);
+        return false;
+      }
+      break;
+
+    case O::InterpConsumeFuel:
+      if (instr.imm_u32 > 0x7fffffffu) {
+        EmitExit(offset);
+        return false;
+      }
+      a_.Op(0, true, {0x8b}, RAX, Ctx(offsetof(JitContext, fuel)));
+      a_.OpRR(0, true, {0x81}, kSub >> 3, RAX);
+      a_.Emit32(instr.imm_u32);
+      EmitExitIf(kB, offset);  // Out of fuel.
+      a_.Op(0, true, {0x89}, RAX, Ctx(offsetof(JitContext, fuel)));
+      break;
+
+    case O::I32Const:
+    case O::F32Const:
+      EmitCheckRoom(offset, 1);
+      EmitConst(instr.imm_u32);
+      break;
+
+    case O::I64Const:
+    case O::F64Const:
+      EmitCheckRoom(offset, 1);
+      EmitConst(instr.imm_u64);
+      break;
+
+    case O::InterpI32AddImm:
+      a_.Op(0, false, {0x8b}, RAX, Slot(1));
+      a_.OpRR(0, false, {0x81}, kAdd >> 3, RAX);
+      a_.Emit32(instr.imm_u32);
+      a_.Op(0, true, {0x89}, RAX, Slot(1));
+      break;
+
+    case O::InterpI32LocalAddImm:
+      // Only writes the low half of the slot, like WriteSlots<u32>.
+      a_.Op(0, false, {0x8b}, RAX, Slot(instr.imm_u32x3.fst));
+      a_.OpRR(0, false, {0x81}, kAdd >> 3, RAX);
+      a_.Emit32(instr.imm_u32x3.thd);
+      a_.Op(0, false, {0x89}, RAX, Slot(instr.imm_u32x3.snd));
+      break;
+
+    case O::I32Load:    case O::I64Load:    case O::F32Load:
+    case O::F64Load:    case O::I32Load8S:  case O::I32Load8U:
+    case O::I32Load16S: case O::I32Load16U: case O::I64Load8S:
+    case O::I64Load8U:  case O::I64Load16S: case O::I64Load16U:
+    case O::I64Load32S: case O::I64Load32U:
+      if (!EmitLoad(offset, instr, 0)) {
+        EmitExit(offset);
+        return false;
+      }
+      break;
+
+    case O::InterpLocalGetI32Load:
+      if (instr.imm_u32x3.thd == 0 ||
+          !EmitLoad(offset, instr, instr.imm_u32x3.thd)) {
+        EmitExit(offset);
+        return false;
+      }
+      break;
+
+    case O::I32Store:   case O::I64Store:   case O::F32Store:
+    case O::F64Store:   case O::I32Store8:  case O::I32Store16:
+    case O::I64Store8:  case O::I64Store16: case O::I64Store32:
+      if (!EmitStore(offset, instr)) {
+        EmitExit(offset);
+        return false;
+      }
+      break;
+
+    case O::I32Eqz: EmitEqz(false); break;
+    case O::I32Eq:  EmitCompare(false, kE); break;
+    case O::I32Ne:  EmitCompare(false, kNE); break;
+    case O::I32LtS: EmitCompare(false, kL); break;
+    case O::I32LtU: EmitCompare(false, kB); break;
+    case O::I32GtS: EmitCompare(false, kG); break;
+    case O::I32GtU: EmitCompare(false, kA); break;
+    case O::I32LeS: EmitCompare(false, kLE); break;
+    case O::I32LeU: EmitCompare(false, kBE); break;
+    case O::I32GeS: EmitCompare(false, kGE); break;
+    case O::I32GeU: EmitCompare(false, kAE); break;
+
+    case O::I64Eqz: EmitEqz(true); break;
+    case O::I64Eq:  EmitCompare(true, kE); break;
+    case O::I64Ne:  EmitCompare(true, kNE); break;
+    case O::I64LtS: EmitCompare(true, kL); break;
+    case O::I64LtU: EmitCompare(true, kB); break;
+    case O::I64GtS: EmitCompare(true, kG); break;
+    case O::I64GtU: EmitCompare(true, kA); break;
+    case O::I64LeS: EmitCompare(true, kLE); break;
+    case O::I64LeU: EmitCompare(true, kBE); break;
+    case O::I64GeS: EmitCompare(true, kGE); break;
+    case O::I64GeU: EmitCompare(true, kAE); break;
+
+    case O::F32Eq: case O::F32Ne: case O::F32Lt:
+    case O::F32Gt: case O::F32Le: case O::F32Ge:
+      EmitFloatCompare(false, instr.op);
+      break;
+
+    case O::F64Eq: case O::F64Ne: case O::F64Lt:
+    case O::F64Gt: case O::F64Le: case O::F64Ge:
+      EmitFloatCompare(true, instr.op);
+      break;
+
+    case O::I32Clz:  EmitClz(false); break;
+    case O::I32Ctz:  EmitCtz(false); break;
+    case O::I32Add:  EmitBinop(false, kAdd); break;
+    case O::I32Sub:  EmitBinop(false, kSub); break;
+    case O::I32Mul:  EmitMul(false); break;
+    case O::I32DivS: EmitDivRem(offset, false, true, false); break;
+    case O::I32DivU: EmitDivRem(offset, false, false, false); break;
+    case O::I32RemS: EmitDivRem(offset, false, true, true); break;
+    case O::I32RemU: EmitDivRem(offset, false, false, true); break;
+    case O::I32And:  EmitBinop(false, kAnd); break;
+    case O::I32Or:   EmitBinop(false, kOr); break;
+    case O::I32Xor:  EmitBinop(false, kXor); break;
+    case O::I32Shl:  EmitShift(false, kShl); break;
+    case O::I32ShrS: EmitShift(false, kSar); break;
+    case O::I32ShrU: EmitShift(false, kShr); break;
+    case O::I32Rotl: EmitShift(false, kRol); break;
+    case O::I32Rotr: EmitShift(false, kRor); break;
+
+    case O::I64Clz:  EmitClz(true); break;
+    case O::I64Ctz:  EmitCtz(true); break;
+    case O::I64Add:  EmitBinop(true, kAdd); break;
+    case O::I64Sub:  EmitBinop(true, kSub); break;
+    case O::I64Mul:  EmitMul(true); break;
+    case O::I64DivS: EmitDivRem(offset, true, true, false); break;
+    case O::I64DivU: EmitDivRem(offset, true, false, false); break;
+    case O::I64RemS: EmitDivRem(offset, true, true, true); break;
+    case O::I64RemU: EmitDivRem(offset, true, false, true); break;
+    case O::I64And:  EmitBinop(true, kAnd); break;
+    case O::I64Or:   EmitBinop(true, kOr); break;
+    case O::I64Xor:  EmitBinop(true, kXor); break;
+    case O::I64Shl:  EmitShift(true, kShl); break;
+    case O::I64ShrS: EmitShift(true, kSar); break;
+    case O::I64ShrU: EmitShift(true, kShr); break;
+    case O::I64Rotl: EmitShift(true, kRol); break;
+    case O::I64Rotr: EmitShift(true, kRor); break;
+
+    case O::F32Add:  EmitFloatBinop(false, kAddSse); break;
+    case O::F32Sub:  EmitFloatBinop(false, kSubSse); break;
+    case O::F32Mul:  EmitFloatBinop(false, kMulSse); break;
+    case O::F32Div:  EmitFloatBinop(false, kDivSse); break;
+    case O::F32Sqrt: EmitFloatSqrt(false); break;
+    case O::F64Add:  EmitFloatBinop(true, kAddSse); break;
+    case O::F64Sub:  EmitFloatBinop(true, kSubSse); break;
+    case O::F64Mul:  EmitFloatBinop(true, kMulSse); break;
+    case O::F64Div:  EmitFloatBinop(true, kDivSse); break;
+    case O::F64Sqrt: EmitFloatSqrt(true); break;
+
+    // Sign bit operations are done on the bits, so they keep NaN payloads.
+    case O::F32Neg:
+      a_.Op(0, false, {0x81}, kXor >> 3, Slot(1));
+      a_.Emit32(0x80000000u);
+      break;
+
+    case O::F32Abs:
+      a_.Op(0, false, {0x81}, kAnd >> 3, Slot(1));
+      a_.Emit32(0x7fffffffu);
+      break;
+
+    case O::F64Neg:
+    case O::F64Abs:
+      a_.MovImm(RAX, instr.op == O::F64Neg ? 0x8000000000000000ull
+                                           : 0x7fffffffffffffffull);
+      // xor/and [x], rax
+      a_.Op(0, true, {instr.op == O::F64Neg ? u8{0x31} : u8{0x21}}, RAX,
+            Slot(1));
+      break;
+
+    case O::F32Copysign:
+    case O::F64Copysign: {
+      bool w = instr.op == O::F64Copysign;
+      a_.MovImm(RDX, w ? 0x7fffffffffffffffull : 0x7fffffffu);
+      a_.Op(0, w, {0x8b}, RAX, Slot(2));
+      a_.OpRR(0, w, {kAnd}, RAX, RDX);
+      a_.OpRR(0, w, {0xf7}, 2, RDX);  // not rdx
+      a_.Op(0, w, {0x8b}, RCX, Slot(1));
+      a_.OpRR(0, w, {kAnd}, RCX, RDX);
+      a_.OpRR(0, w, {kOr}, RAX, RCX);
+      a_.Op(0, true, {0x89}, RAX, Slot(2));
+      EmitAdjustSp(-1);
+      break;
+    }
+
+    case O::F32ConvertI32S:
+    case O::F32ConvertI64S:
+    case O::F64ConvertI32S:
+    case O::F64ConvertI64S: {
+      bool is_f64 =
+          instr.op == O::F64ConvertI32S || instr.op == O::F64ConvertI64S;
+      bool w = instr.op == O::F32ConvertI64S || instr.op == O::F64ConvertI64S;
+      a_.OpRR(0, false, {0x0f, 0x57}, 0, 0);  // xorps xmm0, xmm0
+      a_.Op(is_f64 ? 0xf2 : 0xf3, w, {0x0f, 0x2a}, 0, Slot(1));  // cvtsi2s[sd]
+      EmitStoreFloat(is_f64, Slot(1));
+      break;
+    }
+
+    case O::I32WrapI64:
+    case O::I64ExtendI32U:
+      a_.Op(0, false, {0x8b}, RAX, Slot(1));
+      a_.Op(0, true, {0x89}, RAX, Slot(1));
+      break;
+
+    case O::I32Extend8S:
+    case O::I32Extend16S:
+    case O::I64Extend8S:
+    case O::I64Extend16S:
+    case O::I64Extend32S:
+    case O::I64ExtendI32S: {
+      bool w = instr.op != O::I32Extend8S && instr.op != O::I32Extend16S;
+      Opc opcode = 0x63;  // movsxd
+      if (instr.op == O::I32Extend8S || instr.op == O::I64Extend8S) {
+        opcode = Opc(0x0f, 0xbe);
+      } else if (instr.op == O::I32Extend16S || instr.op == O::I64Extend16S) {
+        opcode = Opc(0x0f, 0xbf);
+      }
+      a_.Op(0, w, opcode, RAX, Slot(1));
+      a_.Op(0, true, {0x89}, RAX, Slot(1));
+      break;
+    }
+
+    // The bits in the slot are the same.
+    case O::I32ReinterpretF32:
+    case O::F32ReinterpretI32:
+    case O::I64ReinterpretF64:
+    case O::F64ReinterpretI64:
+      break;
+
+    default:
+      // Everything else runs in the interpreter. An exit doesn't fall
+      // through, but the next instruction still gets translated, so the
+      // Thread can come back to it after a call.
+      EmitExit(offset);
+      return false;
+  }
+  return true;
+}
+
+}  // end anonymous namespace
+
+// static
+std::unique_ptr<JitCode> JitCode::Compile(const Istream& istream,
+                                          Istream::Offset code_offset) {
+  std::unique_ptr<JitCode> code(new JitCode());
+  std::vector<u8> bytes =
+      JitCompiler(istream).Compile(code_offset, &code->entries_);
+
+  void* memory = mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  code->code_ = static_cast<u8*>(memory);
+  code->size_ = bytes.size();
+  memcpy(code->code_, bytes.data(), bytes.size());
+  if (mprotect(memory, bytes.size(), PROT_READ | PROT_EXEC) != 0) {
+    return nullptr;
+  }
+  return code;
+}
+
+JitCode::~JitCode() {
+  if (code_) {
+    munmap(code_, size_);
+  }
+}
+
+const void* JitCode::GetEntry(Istream::Offset offset) const {
+  auto iter = std::lower_bound(
+      entries_.begin(), entries_.end(), offset,
+      [](const std::pair<Istream::Offset, u32>& lhs, Istream::Offset rhs) {
+        return lhs.first < rhs;
+      });
+  if (iter == entries_.end() || iter->first != offset) {
+    return nullptr;
+  }
+  return code_ + iter->second;
+}
+
+Istream::Offset JitCode::Run(JitContext* context, const void* entry) const {
+  using Func = Istream::Offset (*)(JitContext*, const void*);
+  return reinterpret_cast<Func>(code_)(context, entry);
+}
+
+#else
+
+// static
+std::unique_ptr<JitCode> JitCode::Compile(const Istream&, Istream::Offset) {
+  return nullptr;
+}
+
+JitCode::~JitCode() {}
+
+const void* JitCode::GetEntry(Istream::Offset) const {
+  return nullptr;
+}
+
+Istream::Offset JitCode::Run(JitContext*, const void*) const {
+  WABT_UNREACHABLE;
+}
+
+#endif  // WABT_INTERP_JIT
+
+}  // namespace interp
+}  // namespace wabt
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_JIT_H_
+#define WABT_INTERP_JIT_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/interp/istream.h"
+
+// The generated code uses the System V calling convention, and needs mmap to
+// allocate executable memory.
+#if WITH_INTERP_JIT && defined(__x86_64__) && !defined(_WIN32)
+#define WABT_INTERP_JIT 1
+#else
+#define WABT_INTERP_JIT 0
+#endif
+
+namespace wabt {
+namespace interp {
+
+// The state that a Thread passes to the code it runs, and gets back when the
+// code exits.
+struct JitContext {
+  u64* sp;     // One past the top of the value stack.
+  u64* limit;  // End of the value stack slots that the code may use.
+  u8* memory_data;  // Memory 0 of the running instance, if any.
+  u64 memory_size;  // 0 if there is no memory 0, or it is 64-bit.
+  u64 fuel;
+  u32 budget;  // Loop iterations left; the code exits when it reaches 0.
+};
+
+// x86-64 machine code for one function, translated from its istream.
+//
+// The code works directly on the Thread's value stack, with the same layout
+// as the interpreter, so it can be entered at the start of any instruction it
+// translated, and exit at any other. It never traps: an instruction that it
+// doesn't translate, or that would trap or needs more stack than the Thread
+// made room for, makes it exit before the instruction with the Thread's
+// state as the interpreter would have left it. The Thread then runs the
+// instruction itself, so the trap message and backtrace are the same either
+// way.
+class JitCode {
+ public:
+  // Returns null if the JIT isn't supported on this host, or executable
+  // memory can't be allocated.
+  static std::unique_ptr<JitCode> Compile(const Istream&,
+                                          Istream::Offset code_offset);
+
+  JitCode(const JitCode&) = delete;
+  JitCode& operator=(const JitCode&) = delete;
+  ~JitCode();
+
+  // Returns the address of the code for the instruction at `offset`, or null
+  // if there is none.
+  const void* GetEntry(Istream::Offset offset) const;
+  // Returns the offset of the instruction that the code exited before. Calls,
+  // returns and throws always exit.
+  Istream::Offset Run(JitContext*, const void* entry) const;
+
+ private:
+  JitCode() = default;
+
+  u8* code_ = nullptr;
+  size_t size_ = 0;
+  // Sorted by istream offset; the second element is the code offset.
+  std::vector<std::pair<Istream::Offset, u32>> entries_;
+};
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif  // WABT_INTERP_JIT_H_
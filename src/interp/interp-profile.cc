@@ -0,0 +1,174 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp/interp-profile.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "src/stream.h"
+
+namespace wabt {
+namespace interp {
+
+Profiler::Profiler(u32 sample_interval)
+    : sample_interval_(std::max(sample_interval, 1u)) {}
+
+void Profiler::Sample(const std::vector<Frame>& frames) {
+  if (frames.empty()) {
+    return;
+  }
+
+  ++sample_count_;
+  stack_.clear();
+  for (const Frame& frame : frames) {
+    FuncId id = GetFuncId(frame);
+    stack_.push_back(id);
+    FuncProfile& func = funcs_[id];
+    if (func.last_sample != sample_count_) {
+      func.last_sample = sample_count_;
+      func.inclusive += sample_interval_;
+    }
+  }
+  funcs_[stack_.back()].self += sample_interval_;
+  stacks_[stack_] += sample_interval_;
+}
+
+auto Profiler::GetFuncId(const Frame& frame) -> FuncId {
+  if (!frame.mod) {
+    if (host_func_id_ == kInvalidIndex) {
+      host_func_id_ = NewFunc("<host>");
+    }
+    return host_func_id_;
+  }
+
+  if (frame.mod != last_module_) {
+    last_module_ = frame.mod;
+    last_module_profile_ = &modules_[frame.mod];
+  }
+  auto& funcs_by_offset = last_module_profile_->funcs_by_offset;
+  auto iter = funcs_by_offset.find(frame.offset);
+  if (iter != funcs_by_offset.end()) {
+    return iter->second;
+  }
+
+  // The frame is in the function that starts closest before its offset.
+  // Function bodies are laid out in order in the istream, unless they were
+  // compiled lazily, in the order they were first called.
+  const ModuleDesc& desc = frame.mod->desc();
+  Index func_index;
+  if (!desc.lazy_compiler) {
+    auto func_iter =
+        std::upper_bound(desc.funcs.begin(), desc.funcs.end(), frame.offset,
+                         [](u32 offset, const FuncDesc& func) {
+                           return offset < func.code_offset;
+                         });
+    assert(func_iter != desc.funcs.begin());
+    func_index = (func_iter - desc.funcs.begin()) - 1;
+  } else {
+    func_index = kInvalidIndex;
+    for (Index i = 0; i < desc.funcs.size(); ++i) {
+      // Functions that haven't been compiled have an invalid (maximum) offset.
+      u32 code_offset = desc.funcs[i].code_offset;
+      if (code_offset <= frame.offset &&
+          (func_index == kInvalidIndex ||
+           code_offset > desc.funcs[func_index].code_offset)) {
+        func_index = i;
+      }
+    }
+    assert(func_index != kInvalidIndex);
+  }
+
+  auto& funcs_by_index = last_module_profile_->funcs_by_index;
+  auto index_iter = funcs_by_index.find(func_index);
+  FuncId id;
+  if (index_iter != funcs_by_index.end()) {
+    id = index_iter->second;
+  } else {
+    id = NewFunc(GetFuncName(desc, func_index));
+    funcs_by_index.emplace(func_index, id);
+  }
+  funcs_by_offset.emplace(frame.offset, id);
+  return id;
+}
+
+auto Profiler::NewFunc(std::string name) -> FuncId {
+  funcs_.emplace_back();
+  funcs_.back().name = std::move(name);
+  return funcs_.size() - 1;
+}
+
+std::string Profiler::GetFuncName(const ModuleDesc& desc, Index func_index) {
+  if (!desc.funcs[func_index].name.empty()) {
+    return desc.funcs[func_index].name;
+  }
+
+  Index num_func_imports = std::count_if(
+      desc.imports.begin(), desc.imports.end(), [](const ImportDesc& import) {
+        return import.type.type->kind == ExternKind::Func;
+      });
+  return StringPrintf("func[%" PRIindex "]", num_func_imports + func_index);
+}
+
+void Profiler::WriteFoldedStacks(Stream* stream) const {
+  std::vector<std::string> lines;
+  for (auto&& pair : stacks_) {
+    std::string line;
+    for (FuncId id : pair.first) {
+      if (!line.empty()) {
+        line += ';';
+      }
+      line += funcs_[id].name;
+    }
+    line += StringPrintf(" %" PRIu64 "\n", pair.second);
+    lines.push_back(std::move(line));
+  }
+  std::sort(lines.begin(), lines.end());
+  for (auto&& line : lines) {
+    stream->WriteData(line.data(), line.size());
+  }
+}
+
+void Profiler::WriteTopFunctions(Stream* stream, size_t count) const {
+  std::vector<const FuncProfile*> funcs;
+  u64 total = 0;
+  for (auto&& func : funcs_) {
+    funcs.push_back(&func);
+    total += func.self;
+  }
+  std::sort(funcs.begin(), funcs.end(),
+            [](const FuncProfile* lhs, const FuncProfile* rhs) {
+              if (lhs->self != rhs->self) {
+                return lhs->self > rhs->self;
+              }
+              return lhs->name < rhs->name;
+            });
+  if (funcs.size() > count) {
+    funcs.resize(count);
+  }
+
+  auto percent = [=](u64 value) { return total ? 100.0 * value / total : 0.0; };
+  stream->Writef("%12s %7s %12s %7s  %s\n", "self", "self%", "inclusive",
+                 "incl%", "function");
+  for (const FuncProfile* func : funcs) {
+    stream->Writef("%12" PRIu64 " %6.2f%% %12" PRIu64 " %6.2f%%  %s\n",
+                   func->self, percent(func->self), func->inclusive,
+                   percent(func->inclusive), func->name.c_str());
+  }
+}
+
+}  // namespace interp
+}  // namespace wabt
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_PROFILE_H_
+#define WABT_INTERP_PROFILE_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "src/hash-util.h"
+#include "src/interp/interp.h"
+
+namespace wabt {
+
+class Stream;
+
+namespace interp {
+
+// A sampling profiler for the interpreter. A Thread created with
+// Thread::Options::profiler calls Sample every sample_interval() instructions,
+// and the instructions up to the next sample are attributed to the sampled
+// call stack. With an interval of 1 the counts are exact.
+//
+// Functions are identified by the address of their Module, so a profiler
+// should only be used while the modules it has seen are alive.
+class Profiler {
+ public:
+  static const u32 kDefaultSampleInterval = 10000;
+
+  explicit Profiler(u32 sample_interval = kDefaultSampleInterval);
+
+  u32 sample_interval() const { return sample_interval_; }
+  u64 sample_count() const { return sample_count_; }
+
+  void Sample(const std::vector<Frame>&);
+
+  // One line per distinct call stack, outermost function first, e.g.
+  // "main;f;g 1200". This is the input format of flamegraph.pl.
+  void WriteFoldedStacks(Stream*) const;
+
+  // The `count` functions with the highest self count.
+  void WriteTopFunctions(Stream*, size_t count) const;
+
+ private:
+  using FuncId = Index;
+
+  struct FuncProfile {
+    std::string name;
+    u64 self = 0;
+    u64 inclusive = 0;
+    u64 last_sample = 0;  // Counts recursive calls once per sample.
+  };
+
+  struct ModuleProfile {
+    // Frames only ever have a few distinct offsets (the current instruction
+    // and return addresses), so these are cached to avoid searching the
+    // function list for every frame.
+    std::unordered_map<u32, FuncId> funcs_by_offset;
+    std::unordered_map<Index, FuncId> funcs_by_index;  // Defined functions.
+  };
+
+  struct StackHash {
+    size_t operator()(const std::vector<FuncId>& stack) const {
+      return HashRange(stack.begin(), stack.end());
+    }
+  };
+
+  FuncId GetFuncId(const Frame&);
+  FuncId NewFunc(std::string name);
+  static std::string GetFuncName(const ModuleDesc&, Index func_index);
+
+  u32 sample_interval_;
+  u64 sample_count_ = 0;
+  std::vector<FuncProfile> funcs_;
+  std::unordered_map<const Module*, ModuleProfile> modules_;
+  std::unordered_map<std::vector<FuncId>, u64, StackHash> stacks_;
+  FuncId host_func_id_ = kInvalidIndex;
+
+  // The most recently used module; almost every frame is in the same one.
+  const Module* last_module_ = nullptr;
+  ModuleProfile* last_module_profile_ = nullptr;
+
+  std::vector<FuncId> stack_;  // Scratch space for Sample.
+};
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif  // WABT_INTERP_PROFILE_H_
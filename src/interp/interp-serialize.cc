@@ -0,0 +1,727 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp/interp-serialize.h"
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "src/cast.h"
+#include "src/make-unique.h"
+
+namespace wabt {
+namespace interp {
+
+namespace {
+
+// Layout:
+//
+//   magic     8 bytes
+//   version   u32
+//   opcodes   u64  (GetOpcodeTableHash())
+//   flags     u32
+//   module    ...
+//   checksum  u64  (HashBytes of everything before it)
+//
+// Bump kVersion whenever the layout of the module, or of the istream encoding
+// (other than opcode numbering, which the opcode table hash covers) changes.
+const char kMagic[8] = {'\0', 'w', 'a', 'b', 't', 'i', 's', '\0'};
+const u32 kVersion = 2;
+const u32 kBigEndianFlag = 1;
+
+#if WABT_BIG_ENDIAN
+const u32 kFlags = kBigEndianFlag;
+#else
+const u32 kFlags = 0;
+#endif
+
+// The istream stores opcodes by their enum value, so data written by a build
+// with a different opcode table must not be read, even if the number of
+// opcodes happens to match. Hash every opcode's name and encoding, in enum
+// order.
+u64 GetOpcodeTableHash() {
+  static const u64 s_hash = [] {
+    std::string table;
+    for (u32 i = 0; i < static_cast<u32>(Opcode::Invalid); ++i) {
+      Opcode opcode(static_cast<Opcode::Enum>(i));
+      table += opcode.GetName();
+      table += '\0';
+      u64 code = u64{opcode.GetPrefix()} << 32 | opcode.GetCode();
+      table.append(reinterpret_cast<const char*>(&code), sizeof(code));
+    }
+    return HashBytes(table.data(), table.size());
+  }();
+  return s_hash;
+}
+
+class ModuleDescWriter {
+ public:
+  explicit ModuleDescWriter(std::vector<u8>* out) : out_(*out) {}
+
+  void WriteModule(const ModuleDesc&);
+
+ private:
+  template <typename T>
+  void Write(T value) {
+    static_assert(std::is_trivially_copyable<T>::value, "not a plain value");
+    size_t offset = out_.size();
+    out_.resize(offset + sizeof(T));
+    memcpy(out_.data() + offset, &value, sizeof(T));
+  }
+
+  void WriteData(const void* data, size_t size);
+  void WriteCount(size_t);
+  void WriteString(const std::string&);
+  void WriteType(Type);
+  void WriteTypes(const ValueTypes&);
+  void WriteLimits(const Limits&);
+  void WriteFuncType(const FuncType&);
+  void WriteTableType(const TableType&);
+  void WriteMemoryType(const MemoryType&);
+  void WriteGlobalType(const GlobalType&);
+  void WriteTagType(const TagType&);
+  void WriteExternType(const ExternType&);
+  void WriteInitExpr(const InitExpr&);
+  void WriteFunc(const FuncDesc&);
+  void WriteElem(const ElemDesc&);
+  void WriteData(const DataDesc&);
+
+  std::vector<u8>& out_;
+};
+
+class ModuleDescReader {
+ public:
+  ModuleDescReader(const u8* data, size_t size) : data_(data), size_(size) {}
+
+  Result ReadModule(ModuleDesc*);
+
+ private:
+  template <typename T>
+  Result Read(T* out_value) {
+    static_assert(std::is_trivially_copyable<T>::value, "not a plain value");
+    if (sizeof(T) > size_ - offset_) {
+      return Result::Error;
+    }
+    memcpy(out_value, data_ + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return Result::Ok;
+  }
+
+  // Enums are read as u32 and range-checked, so a corrupt file can't produce
+  // an invalid enumerator.
+  template <typename T>
+  Result ReadEnum(T* out_value, T last) {
+    u32 value;
+    CHECK_RESULT(Read(&value));
+    if (value > static_cast<u32>(last)) {
+      return Result::Error;
+    }
+    *out_value = static_cast<T>(value);
+    return Result::Ok;
+  }
+
+  Result ReadBool(bool*);
+  // Reads an element count, and checks that at least that many elements of
+  // min_size bytes are left, so a corrupt count can't cause a huge allocation.
+  Result ReadCount(size_t* out_count, size_t min_size);
+  Result ReadBytes(size_t size, const u8** out_data);
+  Result ReadString(std::string*);
+  Result ReadType(Type*);
+  Result ReadTypes(ValueTypes*);
+  Result ReadLimits(Limits*);
+  Result ReadFuncType(FuncType*);
+  Result ReadTableType(TableType*);
+  Result ReadMemoryType(MemoryType*);
+  Result ReadGlobalType(GlobalType*);
+  Result ReadTagType(TagType*);
+  Result ReadExternType(std::unique_ptr<ExternType>*);
+  Result ReadInitExpr(InitExpr*);
+  Result ReadFunc(FuncDesc*);
+  Result ReadElem(ElemDesc*);
+  Result ReadData(DataDesc*);
+
+  const u8* data_;
+  size_t size_;
+  size_t offset_ = 0;
+};
+
+//// ModuleDescWriter ////
+
+void ModuleDescWriter::WriteData(const void* data, size_t size) {
+  const u8* bytes = static_cast<const u8*>(data);
+  out_.insert(out_.end(), bytes, bytes + size);
+}
+
+void ModuleDescWriter::WriteCount(size_t count) {
+  Write(static_cast<u32>(count));
+}
+
+void ModuleDescWriter::WriteString(const std::string& s) {
+  WriteCount(s.size());
+  WriteData(s.data(), s.size());
+}
+
+void ModuleDescWriter::WriteType(Type type) {
+  Write(static_cast<s32>(type));
+  Write(type.IsReferenceWithIndex() ? type.GetReferenceIndex()
+                                    : kInvalidIndex);
+}
+
+void ModuleDescWriter::WriteTypes(const ValueTypes& types) {
+  WriteCount(types.size());
+  for (Type type : types) {
+    WriteType(type);
+  }
+}
+
+void ModuleDescWriter::WriteLimits(const Limits& limits) {
+  Write(limits.initial);
+  Write(limits.max);
+  Write<u8>(limits.has_max);
+  Write<u8>(limits.is_shared);
+  Write<u8>(limits.is_64);
+}
+
+void ModuleDescWriter::WriteFuncType(const FuncType& type) {
+  WriteTypes(type.params);
+  WriteTypes(type.results);
+}
+
+void ModuleDescWriter::WriteTableType(const TableType& type) {
+  WriteType(type.element);
+  WriteLimits(type.limits);
+}
+
+void ModuleDescWriter::WriteMemoryType(const MemoryType& type) {
+  WriteLimits(type.limits);
+}
+
+void ModuleDescWriter::WriteGlobalType(const GlobalType& type) {
+  WriteType(type.type);
+  Write(static_cast<u32>(type.mut));
+}
+
+void ModuleDescWriter::WriteTagType(const TagType& type) {
+  Write(static_cast<u32>(type.attr));
+  WriteTypes(type.signature);
+}
+
+void ModuleDescWriter::WriteExternType(const ExternType& type) {
+  Write(static_cast<u32>(type.kind));
+  switch (type.kind) {
+    case ExternKind::Func:   WriteFuncType(*cast<FuncType>(&type)); break;
+    case ExternKind::Table:  WriteTableType(*cast<TableType>(&type)); break;
+    case ExternKind::Memory: WriteMemoryType(*cast<MemoryType>(&type)); break;
+    case ExternKind::Global: WriteGlobalType(*cast<GlobalType>(&type)); break;
+    case ExternKind::Tag:    WriteTagType(*cast<TagType>(&type)); break;
+  }
+}
+
+void ModuleDescWriter::WriteInitExpr(const InitExpr& init) {
+  Write(static_cast<u32>(init.kind));
+  switch (init.kind) {
+    case InitExprKind::None:      break;
+    case InitExprKind::I32:       Write(init.i32_); break;
+    case InitExprKind::I64:       Write(init.i64_); break;
+    case InitExprKind::F32:       Write(init.f32_); break;
+    case InitExprKind::F64:       Write(init.f64_); break;
+    case InitExprKind::V128:      Write(init.v128_); break;
+    case InitExprKind::GlobalGet: Write(init.index_); break;
+    case InitExprKind::RefNull:   WriteType(init.type_); break;
+    case InitExprKind::RefFunc:   Write(init.index_); break;
+  }
+}
+
+void ModuleDescWriter::WriteFunc(const FuncDesc& func) {
+  assert(func.code_offset != Istream::kInvalidOffset);
+  WriteFuncType(func.type);
+  WriteCount(func.locals.size());
+  for (auto&& local : func.locals) {
+    WriteType(local.type);
+    Write(local.count);
+    Write(local.end);
+  }
+  Write(func.code_offset);
+  WriteCount(func.handlers.size());
+  for (auto&& handler : func.handlers) {
+    Write(static_cast<u32>(handler.kind));
+    Write(handler.try_start_offset);
+    Write(handler.try_end_offset);
+    WriteCount(handler.catches.size());
+    for (auto&& catch_ : handler.catches) {
+      Write(catch_.tag_index);
+      Write(catch_.offset);
+    }
+    // catch_all_offset and delegate_handler_index share storage.
+    Write(handler.catch_all_offset);
+    Write(handler.values);
+    Write(handler.exceptions);
+  }
+  WriteCount(func.stack_maps.size());
+  for (auto&& stack_map : func.stack_maps) {
+    Write(stack_map.offset);
+    WriteCount(stack_map.slots.size());
+    WriteData(stack_map.slots.data(), stack_map.slots.size() * sizeof(u32));
+  }
+  WriteString(func.name);
+}
+
+void ModuleDescWriter::WriteElem(const ElemDesc& elem) {
+  WriteCount(elem.elements.size());
+  for (auto&& expr : elem.elements) {
+    Write(static_cast<u32>(expr.kind));
+    Write(expr.index);
+  }
+  WriteType(elem.type);
+  Write(static_cast<u32>(elem.mode));
+  Write(elem.table_index);
+  WriteInitExpr(elem.offset);
+}
+
+void ModuleDescWriter::WriteData(const DataDesc& data) {
+  WriteCount(data.data.size());
+  WriteData(data.data.data(), data.data.size());
+  Write(static_cast<u32>(data.mode));
+  Write(data.memory_index);
+  WriteInitExpr(data.offset);
+}
+
+void ModuleDescWriter::WriteModule(const ModuleDesc& desc) {
+  WriteData(kMagic, sizeof(kMagic));
+  Write(kVersion);
+  Write(GetOpcodeTableHash());
+  Write(kFlags);
+
+  WriteCount(desc.func_types.size());
+  for (auto&& type : desc.func_types) {
+    WriteFuncType(type);
+  }
+  WriteCount(desc.imports.size());
+  for (auto&& import : desc.imports) {
+    WriteString(import.type.module);
+    WriteString(import.type.name);
+    WriteExternType(*import.type.type);
+  }
+  WriteCount(desc.funcs.size());
+  for (auto&& func : desc.funcs) {
+    WriteFunc(func);
+  }
+  WriteCount(desc.tables.size());
+  for (auto&& table : desc.tables) {
+    WriteTableType(table.type);
+  }
+  WriteCount(desc.memories.size());
+  for (auto&& memory : desc.memories) {
+    WriteMemoryType(memory.type);
+  }
+  WriteCount(desc.globals.size());
+  for (auto&& global : desc.globals) {
+    WriteGlobalType(global.type);
+    WriteInitExpr(global.init);
+  }
+  WriteCount(desc.tags.size());
+  for (auto&& tag : desc.tags) {
+    WriteTagType(tag.type);
+  }
+  WriteCount(desc.exports.size());
+  for (auto&& export_ : desc.exports) {
+    WriteString(export_.type.name);
+    WriteExternType(*export_.type.type);
+    Write(export_.index);
+  }
+  WriteCount(desc.starts.size());
+  for (auto&& start : desc.starts) {
+    Write(start.func_index);
+  }
+  WriteCount(desc.elems.size());
+  for (auto&& elem : desc.elems) {
+    WriteElem(elem);
+  }
+  WriteCount(desc.datas.size());
+  for (auto&& data : desc.datas) {
+    WriteData(data);
+  }
+  WriteCount(desc.istream.end());
+  WriteData(desc.istream.data(), desc.istream.end());
+
+  Write(HashBytes(out_.data(), out_.size()));
+}
+
+//// ModuleDescReader ////
+
+Result ModuleDescReader::ReadBool(bool* out_value) {
+  u8 value;
+  CHECK_RESULT(Read(&value));
+  if (value > 1) {
+    return Result::Error;
+  }
+  *out_value = value;
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadCount(size_t* out_count, size_t min_size) {
+  u32 count;
+  CHECK_RESULT(Read(&count));
+  if (count > (size_ - offset_) / min_size) {
+    return Result::Error;
+  }
+  *out_count = count;
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadBytes(size_t size, const u8** out_data) {
+  if (size > size_ - offset_) {
+    return Result::Error;
+  }
+  *out_data = data_ + offset_;
+  offset_ += size;
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadString(std::string* out_string) {
+  size_t size;
+  const u8* data;
+  CHECK_RESULT(ReadCount(&size, 1));
+  CHECK_RESULT(ReadBytes(size, &data));
+  out_string->assign(reinterpret_cast<const char*>(data), size);
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadType(Type* out_type) {
+  s32 code;
+  Index type_index;
+  CHECK_RESULT(Read(&code));
+  CHECK_RESULT(Read(&type_index));
+  if (code == Type::Reference) {
+    *out_type = Type(Type::Reference, type_index);
+  } else {
+    *out_type = Type(code);
+  }
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadTypes(ValueTypes* out_types) {
+  size_t count;
+  CHECK_RESULT(ReadCount(&count, 2 * sizeof(u32)));
+  out_types->resize(count);
+  for (auto&& type : *out_types) {
+    CHECK_RESULT(ReadType(&type));
+  }
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadLimits(Limits* out_limits) {
+  CHECK_RESULT(Read(&out_limits->initial));
+  CHECK_RESULT(Read(&out_limits->max));
+  CHECK_RESULT(ReadBool(&out_limits->has_max));
+  CHECK_RESULT(ReadBool(&out_limits->is_shared));
+  CHECK_RESULT(ReadBool(&out_limits->is_64));
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadFuncType(FuncType* out_type) {
+  CHECK_RESULT(ReadTypes(&out_type->params));
+  CHECK_RESULT(ReadTypes(&out_type->results));
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadTableType(TableType* out_type) {
+  CHECK_RESULT(ReadType(&out_type->element));
+  CHECK_RESULT(ReadLimits(&out_type->limits));
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadMemoryType(MemoryType* out_type) {
+  return ReadLimits(&out_type->limits);
+}
+
+Result ModuleDescReader::ReadGlobalType(GlobalType* out_type) {
+  CHECK_RESULT(ReadType(&out_type->type));
+  CHECK_RESULT(ReadEnum(&out_type->mut, Mutability::Var));
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadTagType(TagType* out_type) {
+  CHECK_RESULT(ReadEnum(&out_type->attr, TagAttr::Exception));
+  CHECK_RESULT(ReadTypes(&out_type->signature));
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadExternType(std::unique_ptr<ExternType>* out_type) {
+  ExternKind kind;
+  CHECK_RESULT(ReadEnum(&kind, ExternKind::Last));
+  switch (kind) {
+    case ExternKind::Func: {
+      auto type = MakeUnique<FuncType>(ValueTypes{}, ValueTypes{});
+      CHECK_RESULT(ReadFuncType(type.get()));
+      *out_type = std::move(type);
+      break;
+    }
+    case ExternKind::Table: {
+      auto type = MakeUnique<TableType>(ValueType::FuncRef, Limits{});
+      CHECK_RESULT(ReadTableType(type.get()));
+      *out_type = std::move(type);
+      break;
+    }
+    case ExternKind::Memory: {
+      auto type = MakeUnique<MemoryType>(Limits{});
+      CHECK_RESULT(ReadMemoryType(type.get()));
+      *out_type = std::move(type);
+      break;
+    }
+    case ExternKind::Global: {
+      auto type = MakeUnique<GlobalType>(ValueType::I32, Mutability::Const);
+      CHECK_RESULT(ReadGlobalType(type.get()));
+      *out_type = std::move(type);
+      break;
+    }
+    case ExternKind::Tag: {
+      auto type = MakeUnique<TagType>(TagAttr::Exception, ValueTypes{});
+      CHECK_RESULT(ReadTagType(type.get()));
+      *out_type = std::move(type);
+      break;
+    }
+  }
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadInitExpr(InitExpr* out_init) {
+  CHECK_RESULT(ReadEnum(&out_init->kind, InitExprKind::RefFunc));
+  switch (out_init->kind) {
+    case InitExprKind::None:      return Result::Ok;
+    case InitExprKind::I32:       return Read(&out_init->i32_);
+    case InitExprKind::I64:       return Read(&out_init->i64_);
+    case InitExprKind::F32:       return Read(&out_init->f32_);
+    case InitExprKind::F64:       return Read(&out_init->f64_);
+    case InitExprKind::V128:      return Read(&out_init->v128_);
+    case InitExprKind::GlobalGet: return Read(&out_init->index_);
+    case InitExprKind::RefNull:   return ReadType(&out_init->type_);
+    case InitExprKind::RefFunc:   return Read(&out_init->index_);
+  }
+  WABT_UNREACHABLE;
+}
+
+Result ModuleDescReader::ReadFunc(FuncDesc* out_func) {
+  size_t count;
+  CHECK_RESULT(ReadFuncType(&out_func->type));
+  CHECK_RESULT(ReadCount(&count, 4 * sizeof(u32)));
+  out_func->locals.resize(count);
+  for (auto&& local : out_func->locals) {
+    CHECK_RESULT(ReadType(&local.type));
+    CHECK_RESULT(Read(&local.count));
+    CHECK_RESULT(Read(&local.end));
+  }
+  CHECK_RESULT(Read(&out_func->code_offset));
+  CHECK_RESULT(ReadCount(&count, 7 * sizeof(u32)));
+  out_func->handlers.resize(count);
+  for (auto&& handler : out_func->handlers) {
+    CHECK_RESULT(ReadEnum(&handler.kind, HandlerKind::Delegate));
+    CHECK_RESULT(Read(&handler.try_start_offset));
+    CHECK_RESULT(Read(&handler.try_end_offset));
+    CHECK_RESULT(ReadCount(&count, 2 * sizeof(u32)));
+    handler.catches.resize(count);
+    for (auto&& catch_ : handler.catches) {
+      CHECK_RESULT(Read(&catch_.tag_index));
+      CHECK_RESULT(Read(&catch_.offset));
+    }
+    CHECK_RESULT(Read(&handler.catch_all_offset));
+    CHECK_RESULT(Read(&handler.values));
+    CHECK_RESULT(Read(&handler.exceptions));
+  }
+  CHECK_RESULT(ReadCount(&count, 2 * sizeof(u32)));
+  out_func->stack_maps.resize(count);
+  for (auto&& stack_map : out_func->stack_maps) {
+    const u8* slots;
+    CHECK_RESULT(Read(&stack_map.offset));
+    CHECK_RESULT(ReadCount(&count, sizeof(u32)));
+    CHECK_RESULT(ReadBytes(count * sizeof(u32), &slots));
+    stack_map.slots.resize(count);
+    memcpy(stack_map.slots.data(), slots, count * sizeof(u32));
+  }
+  CHECK_RESULT(ReadString(&out_func->name));
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadElem(ElemDesc* out_elem) {
+  size_t count;
+  CHECK_RESULT(ReadCount(&count, 2 * sizeof(u32)));
+  out_elem->elements.resize(count);
+  for (auto&& expr : out_elem->elements) {
+    CHECK_RESULT(ReadEnum(&expr.kind, ElemKind::RefFunc));
+    CHECK_RESULT(Read(&expr.index));
+  }
+  CHECK_RESULT(ReadType(&out_elem->type));
+  CHECK_RESULT(ReadEnum(&out_elem->mode, SegmentMode::Declared));
+  CHECK_RESULT(Read(&out_elem->table_index));
+  CHECK_RESULT(ReadInitExpr(&out_elem->offset));
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadData(DataDesc* out_data) {
+  size_t size;
+  const u8* data;
+  CHECK_RESULT(ReadCount(&size, 1));
+  CHECK_RESULT(ReadBytes(size, &data));
+  out_data->data.assign(data, data + size);
+  CHECK_RESULT(ReadEnum(&out_data->mode, SegmentMode::Declared));
+  CHECK_RESULT(Read(&out_data->memory_index));
+  CHECK_RESULT(ReadInitExpr(&out_data->offset));
+  return Result::Ok;
+}
+
+Result ModuleDescReader::ReadModule(ModuleDesc* out_desc) {
+  // Check the header and checksum first, so nothing is read from data written
+  // by another version, or from a truncated or corrupt file.
+  const u8* magic;
+  u32 version, flags;
+  u64 opcode_table_hash;
+  CHECK_RESULT(ReadBytes(sizeof(kMagic), &magic));
+  CHECK_RESULT(Read(&version));
+  CHECK_RESULT(Read(&opcode_table_hash));
+  CHECK_RESULT(Read(&flags));
+  if (memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kVersion ||
+      opcode_table_hash != GetOpcodeTableHash() || flags != kFlags ||
+      size_ - offset_ < sizeof(u64)) {
+    return Result::Error;
+  }
+  u64 checksum;
+  size_ -= sizeof(u64);
+  memcpy(&checksum, data_ + size_, sizeof(checksum));
+  if (checksum != HashBytes(data_, size_)) {
+    return Result::Error;
+  }
+
+  ModuleDesc& desc = *out_desc;
+  size_t count;
+  CHECK_RESULT(ReadCount(&count, 2 * sizeof(u32)));
+  desc.func_types.resize(count, FuncType{{}, {}});
+  for (auto&& type : desc.func_types) {
+    CHECK_RESULT(ReadFuncType(&type));
+  }
+  CHECK_RESULT(ReadCount(&count, 3 * sizeof(u32)));
+  for (size_t i = 0; i < count; ++i) {
+    std::string module, name;
+    std::unique_ptr<ExternType> type;
+    CHECK_RESULT(ReadString(&module));
+    CHECK_RESULT(ReadString(&name));
+    CHECK_RESULT(ReadExternType(&type));
+    desc.imports.push_back(
+        ImportDesc{ImportType(std::move(module), std::move(name),
+                              std::move(type))});
+  }
+  CHECK_RESULT(ReadCount(&count, 7 * sizeof(u32)));
+  desc.funcs.resize(count, FuncDesc{FuncType{{}, {}}, {}, 0, {}, {}, {}});
+  for (auto&& func : desc.funcs) {
+    CHECK_RESULT(ReadFunc(&func));
+  }
+  CHECK_RESULT(ReadCount(&count, 2 * sizeof(u32)));
+  desc.tables.resize(count, TableDesc{TableType{ValueType::FuncRef, {}}});
+  for (auto&& table : desc.tables) {
+    CHECK_RESULT(ReadTableType(&table.type));
+  }
+  CHECK_RESULT(ReadCount(&count, 2 * sizeof(u64)));
+  desc.memories.resize(count, MemoryDesc{MemoryType{Limits{}}});
+  for (auto&& memory : desc.memories) {
+    CHECK_RESULT(ReadMemoryType(&memory.type));
+  }
+  CHECK_RESULT(ReadCount(&count, 3 * sizeof(u32)));
+  desc.globals.resize(
+      count, GlobalDesc{GlobalType{ValueType::I32, Mutability::Const}, {}});
+  for (auto&& global : desc.globals) {
+    CHECK_RESULT(ReadGlobalType(&global.type));
+    CHECK_RESULT(ReadInitExpr(&global.init));
+  }
+  CHECK_RESULT(ReadCount(&count, 2 * sizeof(u32)));
+  desc.tags.resize(count, TagDesc{TagType{TagAttr::Exception, {}}});
+  for (auto&& tag : desc.tags) {
+    CHECK_RESULT(ReadTagType(&tag.type));
+  }
+  CHECK_RESULT(ReadCount(&count, 3 * sizeof(u32)));
+  for (size_t i = 0; i < count; ++i) {
+    std::string name;
+    std::unique_ptr<ExternType> type;
+    Index index;
+    CHECK_RESULT(ReadString(&name));
+    CHECK_RESULT(ReadExternType(&type));
+    CHECK_RESULT(Read(&index));
+    desc.exports.push_back(
+        ExportDesc{ExportType(std::move(name), std::move(type)), index});
+  }
+  CHECK_RESULT(ReadCount(&count, sizeof(u32)));
+  desc.starts.resize(count);
+  for (auto&& start : desc.starts) {
+    CHECK_RESULT(Read(&start.func_index));
+  }
+  CHECK_RESULT(ReadCount(&count, 6 * sizeof(u32)));
+  desc.elems.resize(count);
+  for (auto&& elem : desc.elems) {
+    CHECK_RESULT(ReadElem(&elem));
+  }
+  CHECK_RESULT(ReadCount(&count, 4 * sizeof(u32)));
+  desc.datas.resize(count);
+  for (auto&& data : desc.datas) {
+    CHECK_RESULT(ReadData(&data));
+  }
+  size_t istream_size;
+  const u8* istream_data;
+  CHECK_RESULT(ReadCount(&istream_size, 1));
+  CHECK_RESULT(ReadBytes(istream_size, &istream_data));
+  desc.istream = Istream(istream_data, istream_size);
+
+  if (offset_ != size_) {
+    return Result::Error;
+  }
+  return Result::Ok;
+}
+
+}  // end anonymous namespace
+
+void WriteModuleDesc(const ModuleDesc& desc, std::vector<u8>* out_data) {
+  out_data->clear();
+  ModuleDescWriter writer(out_data);
+  writer.WriteModule(desc);
+}
+
+Result ReadModuleDesc(const void* data, size_t size, ModuleDesc* out_desc) {
+  ModuleDescReader reader(static_cast<const u8*>(data), size);
+  ModuleDesc desc;
+  CHECK_RESULT(reader.ReadModule(&desc));
+  *out_desc = std::move(desc);
+  return Result::Ok;
+}
+
+u64 HashBytes(const void* data, size_t size, u64 seed) {
+  const u64 kOffsetBasis = 0xcbf29ce484222325ull;
+  const u64 kPrime = 0x100000001b3ull;
+  const u8* bytes = static_cast<const u8*>(data);
+  u64 hash = kOffsetBasis ^ seed;
+  for (; size >= sizeof(u64); size -= sizeof(u64), bytes += sizeof(u64)) {
+    u64 word;
+    memcpy(&word, bytes, sizeof(word));
+    hash = (hash ^ word) * kPrime;
+    // The multiply only carries upwards; fold the high bits back down so
+    // every input bit can affect every output bit.
+    hash ^= hash >> 32;
+  }
+  for (; size > 0; --size, ++bytes) {
+    hash = (hash ^ *bytes) * kPrime;
+  }
+  return hash;
+}
+
+}  // namespace interp
+}  // namespace wabt
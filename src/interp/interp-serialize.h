@@ -0,0 +1,51 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_SERIALIZE_H_
+#define WABT_INTERP_SERIALIZE_H_
+
+#include <vector>
+
+#include "src/common.h"
+#include "src/interp/interp.h"
+
+namespace wabt {
+namespace interp {
+
+// Serializes a compiled module, including its istream, so it can be loaded
+// again without parsing, validating or compiling the original binary.
+//
+// The format is specific to this build of wabt: it uses the host byte order,
+// and the istream opcode numbering. ReadModuleDesc rejects data written by a
+// different format version or opcode table.
+//
+// Every function must be compiled, so a module read with CompileOptions::lazy
+// can't be written until all of its functions have been called.
+void WriteModuleDesc(const ModuleDesc&, std::vector<u8>* out_data);
+
+// Loads a module written by WriteModuleDesc. The data is bounds-checked and
+// checksummed, but the module itself is trusted: it is not validated again.
+Result ReadModuleDesc(const void* data, size_t size, ModuleDesc* out_desc);
+
+// A fast non-cryptographic 64-bit hash (a variant of FNV-1a that consumes
+// 64-bit words). Used for the checksum of the serialized data; it is not
+// collision resistant, so use Sha256 to identify untrusted input.
+u64 HashBytes(const void* data, size_t size, u64 seed = 0);
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif  // WABT_INTERP_SERIALIZE_H_
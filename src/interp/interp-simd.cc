@@ -0,0 +1,1472 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp/interp-simd.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define WABT_SIMD_X86_64 1
+#include <immintrin.h>
+#if COMPILER_IS_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define WABT_SIMD_X86_64 0
+#endif
+
+// The NEON kernels assume little-endian lanes, like v128.
+#if defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN) && !COMPILER_IS_MSVC
+#define WABT_SIMD_AARCH64 1
+#include <arm_neon.h>
+#else
+#define WABT_SIMD_AARCH64 0
+#endif
+
+// MSVC lets any function use any instruction set, GCC and Clang need to be
+// told which functions may use the instructions beyond SSE2.
+#if COMPILER_IS_MSVC
+#define WABT_TARGET(isa)
+#else
+#define WABT_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace wabt {
+namespace interp {
+
+namespace {
+
+#if WABT_SIMD_X86_64
+
+struct CpuFeatures {
+  bool ssse3 = false;
+  bool sse41 = false;
+  bool sse42 = false;
+};
+
+CpuFeatures GetCpuFeatures() {
+  CpuFeatures features;
+#if COMPILER_IS_MSVC
+  int info[4];
+  __cpuid(info, 1);
+  unsigned ecx = info[2];
+#else
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return features;
+  }
+#endif
+  features.ssse3 = ecx & (1 << 9);
+  features.sse41 = ecx & (1 << 19);
+  features.sse42 = ecx & (1 << 20);
+  return features;
+}
+
+// Conversions between v128 and the intrinsic vector types.
+inline __m128i I(v128 x) { __m128i r; memcpy(&r, &x, sizeof(r)); return r; }
+inline __m128 F(v128 x) { return _mm_castsi128_ps(I(x)); }
+inline __m128d D(v128 x) { return _mm_castsi128_pd(I(x)); }
+inline v128 V(__m128i x) { v128 r; memcpy(&r, &x, sizeof(r)); return r; }
+inline v128 V(__m128 x) { return V(_mm_castps_si128(x)); }
+inline v128 V(__m128d x) { return V(_mm_castpd_si128(x)); }
+
+inline __m128i Zero() { return _mm_setzero_si128(); }
+inline __m128i Not(__m128i x) { return _mm_xor_si128(x, _mm_set1_epi32(-1)); }
+
+inline __m128i Select(__m128i mask, __m128i t, __m128i f) {
+  return _mm_or_si128(_mm_and_si128(mask, t), _mm_andnot_si128(mask, f));
+}
+
+// Replaces the lanes set in |nan| with the canonical NaN.
+inline __m128 CanonNaN(__m128 nan, __m128 x) {
+  return _mm_castsi128_ps(Select(_mm_castps_si128(nan),
+                                 _mm_set1_epi32(0x7fc00000),
+                                 _mm_castps_si128(x)));
+}
+
+inline __m128d CanonNaN(__m128d nan, __m128d x) {
+  return _mm_castsi128_pd(Select(_mm_castpd_si128(nan),
+                                 _mm_set1_epi64x(0x7ff8000000000000ull),
+                                 _mm_castpd_si128(x)));
+}
+
+// Replaces the NaN lanes with the canonical NaN, as CanonNaN does.
+inline __m128 CanonNaN(__m128 x) { return CanonNaN(_mm_cmpunord_ps(x, x), x); }
+inline __m128d CanonNaN(__m128d x) {
+  return CanonNaN(_mm_cmpunord_pd(x, x), x);
+}
+
+//// SSE2 ////
+
+// Lane traits, so the kernels that only differ in lane size can be written
+// once.
+struct I8 {
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi8(a, b); }
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi8(a, b); }
+  static __m128i Eq(__m128i a, __m128i b) { return _mm_cmpeq_epi8(a, b); }
+  static __m128i Gt(__m128i a, __m128i b) { return _mm_cmpgt_epi8(a, b); }
+  static __m128i SignBit() { return _mm_set1_epi8(-128); }
+};
+
+struct I16 {
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi16(a, b); }
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi16(a, b); }
+  static __m128i Eq(__m128i a, __m128i b) { return _mm_cmpeq_epi16(a, b); }
+  static __m128i Gt(__m128i a, __m128i b) { return _mm_cmpgt_epi16(a, b); }
+  static __m128i SignBit() { return _mm_set1_epi16(-32768); }
+};
+
+struct I32 {
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi32(a, b); }
+  static __m128i Eq(__m128i a, __m128i b) { return _mm_cmpeq_epi32(a, b); }
+  static __m128i Gt(__m128i a, __m128i b) { return _mm_cmpgt_epi32(a, b); }
+  static __m128i SignBit() { return _mm_set1_epi32(INT32_MIN); }
+};
+
+struct I64 {
+  static __m128i Add(__m128i a, __m128i b) { return _mm_add_epi64(a, b); }
+  static __m128i Sub(__m128i a, __m128i b) { return _mm_sub_epi64(a, b); }
+  static __m128i Eq(__m128i a, __m128i b) {
+    __m128i eq = _mm_cmpeq_epi32(a, b);
+    return _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+  }
+};
+
+template <typename L> v128 Add(v128 a, v128 b) { return V(L::Add(I(a), I(b))); }
+template <typename L> v128 Sub(v128 a, v128 b) { return V(L::Sub(I(a), I(b))); }
+template <typename L> v128 Neg(v128 a) { return V(L::Sub(Zero(), I(a))); }
+
+template <typename L> v128 Eq(v128 a, v128 b) { return V(L::Eq(I(a), I(b))); }
+template <typename L> v128 Ne(v128 a, v128 b) {
+  return V(Not(L::Eq(I(a), I(b))));
+}
+template <typename L> v128 GtS(v128 a, v128 b) { return V(L::Gt(I(a), I(b))); }
+template <typename L> v128 LtS(v128 a, v128 b) { return V(L::Gt(I(b), I(a))); }
+template <typename L> v128 LeS(v128 a, v128 b) {
+  return V(Not(L::Gt(I(a), I(b))));
+}
+template <typename L> v128 GeS(v128 a, v128 b) {
+  return V(Not(L::Gt(I(b), I(a))));
+}
+
+// Flipping the sign bits turns an unsigned comparison into a signed one.
+template <typename L> __m128i Bias(v128 x) {
+  return _mm_xor_si128(I(x), L::SignBit());
+}
+template <typename L> v128 GtU(v128 a, v128 b) {
+  return V(L::Gt(Bias<L>(a), Bias<L>(b)));
+}
+template <typename L> v128 LtU(v128 a, v128 b) {
+  return V(L::Gt(Bias<L>(b), Bias<L>(a)));
+}
+template <typename L> v128 LeU(v128 a, v128 b) {
+  return V(Not(L::Gt(Bias<L>(a), Bias<L>(b))));
+}
+template <typename L> v128 GeU(v128 a, v128 b) {
+  return V(Not(L::Gt(Bias<L>(b), Bias<L>(a))));
+}
+
+// Returns 1 if every lane is non-zero.
+template <typename L> u32 AllTrue(v128 a) {
+  return _mm_movemask_epi8(L::Eq(I(a), Zero())) == 0;
+}
+
+v128 V128Not(v128 a) { return V(Not(I(a))); }
+v128 V128And(v128 a, v128 b) { return V(_mm_and_si128(I(a), I(b))); }
+v128 V128Or(v128 a, v128 b) { return V(_mm_or_si128(I(a), I(b))); }
+v128 V128Xor(v128 a, v128 b) { return V(_mm_xor_si128(I(a), I(b))); }
+v128 V128Andnot(v128 a, v128 b) { return V(_mm_andnot_si128(I(b), I(a))); }
+v128 V128BitSelect(v128 a, v128 b, v128 c) {
+  return V(Select(I(c), I(a), I(b)));
+}
+
+u32 V128AnyTrue(v128 a) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(I(a), Zero())) != 0xffff;
+}
+
+u32 I8X16Bitmask(v128 a) { return _mm_movemask_epi8(I(a)); }
+u32 I16X8Bitmask(v128 a) {
+  return _mm_movemask_epi8(_mm_packs_epi16(I(a), Zero()));
+}
+u32 I32X4Bitmask(v128 a) { return _mm_movemask_ps(F(a)); }
+u32 I64X2Bitmask(v128 a) { return _mm_movemask_pd(D(a)); }
+
+v128 I8X16AddSatS(v128 a, v128 b) { return V(_mm_adds_epi8(I(a), I(b))); }
+v128 I8X16AddSatU(v128 a, v128 b) { return V(_mm_adds_epu8(I(a), I(b))); }
+v128 I8X16SubSatS(v128 a, v128 b) { return V(_mm_subs_epi8(I(a), I(b))); }
+v128 I8X16SubSatU(v128 a, v128 b) { return V(_mm_subs_epu8(I(a), I(b))); }
+v128 I8X16MinU(v128 a, v128 b) { return V(_mm_min_epu8(I(a), I(b))); }
+v128 I8X16MaxU(v128 a, v128 b) { return V(_mm_max_epu8(I(a), I(b))); }
+v128 I8X16AvgrU(v128 a, v128 b) { return V(_mm_avg_epu8(I(a), I(b))); }
+
+v128 I16X8AddSatS(v128 a, v128 b) { return V(_mm_adds_epi16(I(a), I(b))); }
+v128 I16X8AddSatU(v128 a, v128 b) { return V(_mm_adds_epu16(I(a), I(b))); }
+v128 I16X8SubSatS(v128 a, v128 b) { return V(_mm_subs_epi16(I(a), I(b))); }
+v128 I16X8SubSatU(v128 a, v128 b) { return V(_mm_subs_epu16(I(a), I(b))); }
+v128 I16X8Mul(v128 a, v128 b) { return V(_mm_mullo_epi16(I(a), I(b))); }
+v128 I16X8MinS(v128 a, v128 b) { return V(_mm_min_epi16(I(a), I(b))); }
+v128 I16X8MaxS(v128 a, v128 b) { return V(_mm_max_epi16(I(a), I(b))); }
+v128 I16X8AvgrU(v128 a, v128 b) { return V(_mm_avg_epu16(I(a), I(b))); }
+
+v128 I32X4DotI16X8S(v128 a, v128 b) { return V(_mm_madd_epi16(I(a), I(b))); }
+
+v128 I64X2Mul(v128 a, v128 b) {
+  __m128i x = I(a);
+  __m128i y = I(b);
+  __m128i lo = _mm_mul_epu32(x, y);
+  __m128i hi = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), y),
+                             _mm_mul_epu32(x, _mm_srli_epi64(y, 32)));
+  return V(_mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+}
+
+v128 I64X2Abs(v128 a) {
+  __m128i x = I(a);
+  __m128i sign =
+      _mm_shuffle_epi32(_mm_srai_epi32(x, 31), _MM_SHUFFLE(3, 3, 1, 1));
+  return V(_mm_sub_epi64(_mm_xor_si128(x, sign), sign));
+}
+
+// The shift count is taken modulo the lane width, as in IntShl and IntShr.
+inline __m128i Count(u32 n, u32 bits) {
+  return _mm_cvtsi32_si128(n & (bits - 1));
+}
+
+v128 I8X16Shl(v128 a, u32 n) {
+  n &= 7;
+  __m128i mask = _mm_set1_epi8(static_cast<char>(0xff << n));
+  return V(_mm_and_si128(_mm_sll_epi16(I(a), Count(n, 8)), mask));
+}
+
+v128 I8X16ShrU(v128 a, u32 n) {
+  n &= 7;
+  __m128i mask = _mm_set1_epi8(static_cast<char>(0xff >> n));
+  return V(_mm_and_si128(_mm_srl_epi16(I(a), Count(n, 8)), mask));
+}
+
+v128 I8X16ShrS(v128 a, u32 n) {
+  // Shift each byte as the top half of a 16-bit lane.
+  __m128i count = _mm_cvtsi32_si128((n & 7) + 8);
+  __m128i lo = _mm_sra_epi16(_mm_unpacklo_epi8(I(a), I(a)), count);
+  __m128i hi = _mm_sra_epi16(_mm_unpackhi_epi8(I(a), I(a)), count);
+  return V(_mm_packs_epi16(lo, hi));
+}
+
+v128 I16X8Shl(v128 a, u32 n) { return V(_mm_sll_epi16(I(a), Count(n, 16))); }
+v128 I16X8ShrS(v128 a, u32 n) { return V(_mm_sra_epi16(I(a), Count(n, 16))); }
+v128 I16X8ShrU(v128 a, u32 n) { return V(_mm_srl_epi16(I(a), Count(n, 16))); }
+v128 I32X4Shl(v128 a, u32 n) { return V(_mm_sll_epi32(I(a), Count(n, 32))); }
+v128 I32X4ShrS(v128 a, u32 n) { return V(_mm_sra_epi32(I(a), Count(n, 32))); }
+v128 I32X4ShrU(v128 a, u32 n) { return V(_mm_srl_epi32(I(a), Count(n, 32))); }
+v128 I64X2Shl(v128 a, u32 n) { return V(_mm_sll_epi64(I(a), Count(n, 64))); }
+v128 I64X2ShrU(v128 a, u32 n) { return V(_mm_srl_epi64(I(a), Count(n, 64))); }
+
+v128 I64X2ShrS(v128 a, u32 n) {
+  // There is no 64-bit arithmetic shift; sign-extend the logical shift.
+  __m128i count = Count(n, 64);
+  __m128i sign = _mm_srl_epi64(_mm_set1_epi64x(INT64_MIN), count);
+  __m128i x = _mm_srl_epi64(I(a), count);
+  return V(_mm_sub_epi64(_mm_xor_si128(x, sign), sign));
+}
+
+v128 I8X16NarrowI16X8S(v128 a, v128 b) {
+  return V(_mm_packs_epi16(I(a), I(b)));
+}
+v128 I8X16NarrowI16X8U(v128 a, v128 b) {
+  return V(_mm_packus_epi16(I(a), I(b)));
+}
+v128 I16X8NarrowI32X4S(v128 a, v128 b) {
+  return V(_mm_packs_epi32(I(a), I(b)));
+}
+
+inline __m128i Sign8(__m128i x) { return _mm_cmpgt_epi8(Zero(), x); }
+inline __m128i Sign16(__m128i x) { return _mm_srai_epi16(x, 15); }
+inline __m128i Sign32(__m128i x) { return _mm_srai_epi32(x, 31); }
+
+v128 I16X8ExtendLowI8X16S(v128 a) {
+  return V(_mm_unpacklo_epi8(I(a), Sign8(I(a))));
+}
+v128 I16X8ExtendHighI8X16S(v128 a) {
+  return V(_mm_unpackhi_epi8(I(a), Sign8(I(a))));
+}
+v128 I16X8ExtendLowI8X16U(v128 a) { return V(_mm_unpacklo_epi8(I(a), Zero())); }
+v128 I16X8ExtendHighI8X16U(v128 a) {
+  return V(_mm_unpackhi_epi8(I(a), Zero()));
+}
+v128 I32X4ExtendLowI16X8S(v128 a) {
+  return V(_mm_unpacklo_epi16(I(a), Sign16(I(a))));
+}
+v128 I32X4ExtendHighI16X8S(v128 a) {
+  return V(_mm_unpackhi_epi16(I(a), Sign16(I(a))));
+}
+v128 I32X4ExtendLowI16X8U(v128 a) {
+  return V(_mm_unpacklo_epi16(I(a), Zero()));
+}
+v128 I32X4ExtendHighI16X8U(v128 a) {
+  return V(_mm_unpackhi_epi16(I(a), Zero()));
+}
+v128 I64X2ExtendLowI32X4S(v128 a) {
+  return V(_mm_unpacklo_epi32(I(a), Sign32(I(a))));
+}
+v128 I64X2ExtendHighI32X4S(v128 a) {
+  return V(_mm_unpackhi_epi32(I(a), Sign32(I(a))));
+}
+v128 I64X2ExtendLowI32X4U(v128 a) {
+  return V(_mm_unpacklo_epi32(I(a), Zero()));
+}
+v128 I64X2ExtendHighI32X4U(v128 a) {
+  return V(_mm_unpackhi_epi32(I(a), Zero()));
+}
+
+v128 I16X8ExtmulLowI8X16S(v128 a, v128 b) {
+  return I16X8Mul(I16X8ExtendLowI8X16S(a), I16X8ExtendLowI8X16S(b));
+}
+v128 I16X8ExtmulHighI8X16S(v128 a, v128 b) {
+  return I16X8Mul(I16X8ExtendHighI8X16S(a), I16X8ExtendHighI8X16S(b));
+}
+v128 I16X8ExtmulLowI8X16U(v128 a, v128 b) {
+  return I16X8Mul(I16X8ExtendLowI8X16U(a), I16X8ExtendLowI8X16U(b));
+}
+v128 I16X8ExtmulHighI8X16U(v128 a, v128 b) {
+  return I16X8Mul(I16X8ExtendHighI8X16U(a), I16X8ExtendHighI8X16U(b));
+}
+
+// The 32-bit products of 16-bit lanes are the interleaved low and high halves
+// of the 16-bit multiplies.
+v128 I32X4ExtmulLowI16X8S(v128 a, v128 b) {
+  __m128i lo = _mm_mullo_epi16(I(a), I(b));
+  return V(_mm_unpacklo_epi16(lo, _mm_mulhi_epi16(I(a), I(b))));
+}
+v128 I32X4ExtmulHighI16X8S(v128 a, v128 b) {
+  __m128i lo = _mm_mullo_epi16(I(a), I(b));
+  return V(_mm_unpackhi_epi16(lo, _mm_mulhi_epi16(I(a), I(b))));
+}
+v128 I32X4ExtmulLowI16X8U(v128 a, v128 b) {
+  __m128i lo = _mm_mullo_epi16(I(a), I(b));
+  return V(_mm_unpacklo_epi16(lo, _mm_mulhi_epu16(I(a), I(b))));
+}
+v128 I32X4ExtmulHighI16X8U(v128 a, v128 b) {
+  __m128i lo = _mm_mullo_epi16(I(a), I(b));
+  return V(_mm_unpackhi_epi16(lo, _mm_mulhi_epu16(I(a), I(b))));
+}
+
+// pmuludq multiplies lanes 0 and 2, so spread the low or high half over them.
+#define WABT_LOW_LANES _MM_SHUFFLE(1, 1, 0, 0)
+#define WABT_HIGH_LANES _MM_SHUFFLE(3, 3, 2, 2)
+
+v128 I64X2ExtmulLowI32X4U(v128 a, v128 b) {
+  return V(_mm_mul_epu32(_mm_shuffle_epi32(I(a), WABT_LOW_LANES),
+                         _mm_shuffle_epi32(I(b), WABT_LOW_LANES)));
+}
+v128 I64X2ExtmulHighI32X4U(v128 a, v128 b) {
+  return V(_mm_mul_epu32(_mm_shuffle_epi32(I(a), WABT_HIGH_LANES),
+                         _mm_shuffle_epi32(I(b), WABT_HIGH_LANES)));
+}
+
+v128 I16X8ExtaddPairwiseI8X16S(v128 a) {
+  __m128i even = _mm_srai_epi16(_mm_slli_epi16(I(a), 8), 8);
+  return V(_mm_add_epi16(even, _mm_srai_epi16(I(a), 8)));
+}
+v128 I16X8ExtaddPairwiseI8X16U(v128 a) {
+  __m128i even = _mm_and_si128(I(a), _mm_set1_epi16(0xff));
+  return V(_mm_add_epi16(even, _mm_srli_epi16(I(a), 8)));
+}
+v128 I32X4ExtaddPairwiseI16X8S(v128 a) {
+  return V(_mm_madd_epi16(I(a), _mm_set1_epi16(1)));
+}
+v128 I32X4ExtaddPairwiseI16X8U(v128 a) {
+  __m128i even = _mm_and_si128(I(a), _mm_set1_epi32(0xffff));
+  return V(_mm_add_epi32(even, _mm_srli_epi32(I(a), 16)));
+}
+
+v128 F32X4Abs(v128 a) {
+  return V(_mm_and_si128(I(a), _mm_set1_epi32(INT32_MAX)));
+}
+v128 F32X4Neg(v128 a) {
+  return V(_mm_xor_si128(I(a), _mm_set1_epi32(INT32_MIN)));
+}
+v128 F32X4Sqrt(v128 a) { return V(CanonNaN(_mm_sqrt_ps(F(a)))); }
+v128 F32X4Add(v128 a, v128 b) { return V(CanonNaN(_mm_add_ps(F(a), F(b)))); }
+v128 F32X4Sub(v128 a, v128 b) { return V(CanonNaN(_mm_sub_ps(F(a), F(b)))); }
+v128 F32X4Mul(v128 a, v128 b) { return V(CanonNaN(_mm_mul_ps(F(a), F(b)))); }
+v128 F32X4Div(v128 a, v128 b) { return V(CanonNaN(_mm_div_ps(F(a), F(b)))); }
+// std::min(a, b) is b < a ? b : a, and minps(x, y) is x < y ? x : y.
+v128 F32X4PMin(v128 a, v128 b) { return V(_mm_min_ps(F(b), F(a))); }
+v128 F32X4PMax(v128 a, v128 b) { return V(_mm_max_ps(F(b), F(a))); }
+
+// minps and maxps return their second operand for NaNs and zeroes of either
+// sign. Doing it both ways round and merging the results gives -0 for min
+// and +0 for max, and then the lanes with a NaN operand get the canonical NaN.
+v128 F32X4Min(v128 a, v128 b) {
+  __m128 min = _mm_or_ps(_mm_min_ps(F(a), F(b)), _mm_min_ps(F(b), F(a)));
+  return V(CanonNaN(_mm_cmpunord_ps(F(a), F(b)), min));
+}
+v128 F32X4Max(v128 a, v128 b) {
+  __m128 max = _mm_and_ps(_mm_max_ps(F(a), F(b)), _mm_max_ps(F(b), F(a)));
+  return V(CanonNaN(_mm_cmpunord_ps(F(a), F(b)), max));
+}
+
+v128 F32X4Eq(v128 a, v128 b) { return V(_mm_cmpeq_ps(F(a), F(b))); }
+v128 F32X4Ne(v128 a, v128 b) { return V(_mm_cmpneq_ps(F(a), F(b))); }
+v128 F32X4Lt(v128 a, v128 b) { return V(_mm_cmplt_ps(F(a), F(b))); }
+v128 F32X4Gt(v128 a, v128 b) { return V(_mm_cmpgt_ps(F(a), F(b))); }
+v128 F32X4Le(v128 a, v128 b) { return V(_mm_cmple_ps(F(a), F(b))); }
+v128 F32X4Ge(v128 a, v128 b) { return V(_mm_cmpge_ps(F(a), F(b))); }
+
+v128 F64X2Abs(v128 a) {
+  return V(_mm_and_si128(I(a), _mm_set1_epi64x(INT64_MAX)));
+}
+v128 F64X2Neg(v128 a) {
+  return V(_mm_xor_si128(I(a), _mm_set1_epi64x(INT64_MIN)));
+}
+v128 F64X2Sqrt(v128 a) { return V(CanonNaN(_mm_sqrt_pd(D(a)))); }
+v128 F64X2Add(v128 a, v128 b) { return V(CanonNaN(_mm_add_pd(D(a), D(b)))); }
+v128 F64X2Sub(v128 a, v128 b) { return V(CanonNaN(_mm_sub_pd(D(a), D(b)))); }
+v128 F64X2Mul(v128 a, v128 b) { return V(CanonNaN(_mm_mul_pd(D(a), D(b)))); }
+v128 F64X2Div(v128 a, v128 b) { return V(CanonNaN(_mm_div_pd(D(a), D(b)))); }
+v128 F64X2PMin(v128 a, v128 b) { return V(_mm_min_pd(D(b), D(a))); }
+v128 F64X2PMax(v128 a, v128 b) { return V(_mm_max_pd(D(b), D(a))); }
+
+v128 F64X2Min(v128 a, v128 b) {
+  __m128d min = _mm_or_pd(_mm_min_pd(D(a), D(b)), _mm_min_pd(D(b), D(a)));
+  return V(CanonNaN(_mm_cmpunord_pd(D(a), D(b)), min));
+}
+v128 F64X2Max(v128 a, v128 b) {
+  __m128d max = _mm_and_pd(_mm_max_pd(D(a), D(b)), _mm_max_pd(D(b), D(a)));
+  return V(CanonNaN(_mm_cmpunord_pd(D(a), D(b)), max));
+}
+
+v128 F64X2Eq(v128 a, v128 b) { return V(_mm_cmpeq_pd(D(a), D(b))); }
+v128 F64X2Ne(v128 a, v128 b) { return V(_mm_cmpneq_pd(D(a), D(b))); }
+v128 F64X2Lt(v128 a, v128 b) { return V(_mm_cmplt_pd(D(a), D(b))); }
+v128 F64X2Gt(v128 a, v128 b) { return V(_mm_cmpgt_pd(D(a), D(b))); }
+v128 F64X2Le(v128 a, v128 b) { return V(_mm_cmple_pd(D(a), D(b))); }
+v128 F64X2Ge(v128 a, v128 b) { return V(_mm_cmpge_pd(D(a), D(b))); }
+
+v128 F32X4ConvertI32X4S(v128 a) { return V(_mm_cvtepi32_ps(I(a))); }
+
+v128 F32X4ConvertI32X4U(v128 a) {
+  // Both halves convert exactly, so the sum is rounded once.
+  __m128 lo = _mm_cvtepi32_ps(_mm_and_si128(I(a), _mm_set1_epi32(0xffff)));
+  __m128 hi = _mm_cvtepi32_ps(_mm_srli_epi32(I(a), 16));
+  return V(_mm_add_ps(_mm_mul_ps(hi, _mm_set1_ps(65536.f)), lo));
+}
+
+v128 F64X2ConvertLowI32X4S(v128 a) { return V(_mm_cvtepi32_pd(I(a))); }
+
+v128 F64X2ConvertLowI32X4U(v128 a) {
+  // 2^52 + x as a double has x in its low mantissa bits.
+  __m128i x = _mm_unpacklo_epi32(I(a), _mm_set1_epi32(0x43300000));
+  return V(_mm_sub_pd(_mm_castsi128_pd(x), _mm_set1_pd(4503599627370496.)));
+}
+
+v128 F32X4DemoteF64X2Zero(v128 a) { return V(CanonNaN(_mm_cvtpd_ps(D(a)))); }
+v128 F64X2PromoteLowF32X4(v128 a) { return V(_mm_cvtps_pd(F(a))); }
+
+// cvttps2dq gives INT32_MIN for NaNs and for values out of range.
+v128 I32X4TruncSatF32X4S(v128 a) {
+  __m128 x = _mm_and_ps(F(a), _mm_cmpeq_ps(F(a), F(a)));
+  __m128i too_big =
+      _mm_castps_si128(_mm_cmpge_ps(x, _mm_set1_ps(2147483648.f)));
+  return V(_mm_xor_si128(_mm_cvttps_epi32(x), too_big));
+}
+
+v128 I32X4TruncSatF32X4U(v128 a) {
+  // maxps returns the zero for NaNs.
+  __m128 x = _mm_max_ps(F(a), _mm_setzero_ps());
+  __m128 two31 = _mm_set1_ps(2147483648.f);
+  __m128i lo = _mm_cvttps_epi32(x);
+  __m128i hi = _mm_add_epi32(_mm_cvttps_epi32(_mm_sub_ps(x, two31)),
+                             _mm_set1_epi32(INT32_MIN));
+  __m128i is_hi = _mm_castps_si128(_mm_cmpge_ps(x, two31));
+  __m128i too_big =
+      _mm_castps_si128(_mm_cmpge_ps(x, _mm_set1_ps(4294967296.f)));
+  return V(_mm_or_si128(Select(is_hi, hi, lo), too_big));
+}
+
+v128 I32X4TruncSatF64X2SZero(v128 a) {
+  __m128d x = _mm_and_pd(D(a), _mm_cmpeq_pd(D(a), D(a)));
+  x = _mm_min_pd(x, _mm_set1_pd(2147483647.));
+  return V(_mm_cvttpd_epi32(x));
+}
+
+//// SSSE3 ////
+
+WABT_TARGET("ssse3") v128 I8X16Abs(v128 a) { return V(_mm_abs_epi8(I(a))); }
+WABT_TARGET("ssse3") v128 I16X8Abs(v128 a) { return V(_mm_abs_epi16(I(a))); }
+WABT_TARGET("ssse3") v128 I32X4Abs(v128 a) { return V(_mm_abs_epi32(I(a))); }
+
+WABT_TARGET("ssse3") v128 I8X16Popcnt(v128 a) {
+  __m128i table = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  __m128i nibble = _mm_set1_epi8(0x0f);
+  __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(I(a), nibble));
+  __m128i hi = _mm_shuffle_epi8(
+      table, _mm_and_si128(_mm_srli_epi16(I(a), 4), nibble));
+  return V(_mm_add_epi8(lo, hi));
+}
+
+// pshufb zeroes the lanes whose index has the top bit set, and otherwise uses
+// the low four bits. Adding 0x70 with saturation sets the top bit for every
+// index past 15 and keeps the low bits of the others.
+WABT_TARGET("ssse3") v128 I8X16Swizzle(v128 a, v128 b) {
+  __m128i index = _mm_adds_epu8(I(b), _mm_set1_epi8(0x70));
+  return V(_mm_shuffle_epi8(I(a), index));
+}
+
+WABT_TARGET("ssse3") v128 I8X16Shuffle(v128 a, v128 b, v128 sel) {
+  __m128i bias = _mm_set1_epi8(0x70);
+  __m128i lhs = _mm_adds_epu8(I(sel), bias);
+  __m128i rhs = _mm_adds_epu8(_mm_xor_si128(I(sel), _mm_set1_epi8(0x10)), bias);
+  return V(_mm_or_si128(_mm_shuffle_epi8(I(a), lhs),
+                        _mm_shuffle_epi8(I(b), rhs)));
+}
+
+// pmulhrsw gives 0x8000 for -1 * -1, which should saturate to 0x7fff.
+WABT_TARGET("ssse3") v128 I16X8Q15mulrSatS(v128 a, v128 b) {
+  __m128i x = _mm_mulhrs_epi16(I(a), I(b));
+  return V(_mm_xor_si128(x, _mm_cmpeq_epi16(x, _mm_set1_epi16(-32768))));
+}
+
+//// SSE4.1 ////
+
+#define WABT_SSE41_BINOP(Name, intrinsic)              \
+  WABT_TARGET("sse4.1") v128 Name(v128 a, v128 b) {    \
+    return V(intrinsic(I(a), I(b)));                   \
+  }
+
+WABT_SSE41_BINOP(I8X16MinS, _mm_min_epi8)
+WABT_SSE41_BINOP(I8X16MaxS, _mm_max_epi8)
+WABT_SSE41_BINOP(I16X8MinU, _mm_min_epu16)
+WABT_SSE41_BINOP(I16X8MaxU, _mm_max_epu16)
+WABT_SSE41_BINOP(I32X4MinS, _mm_min_epi32)
+WABT_SSE41_BINOP(I32X4MaxS, _mm_max_epi32)
+WABT_SSE41_BINOP(I32X4MinU, _mm_min_epu32)
+WABT_SSE41_BINOP(I32X4MaxU, _mm_max_epu32)
+WABT_SSE41_BINOP(I32X4Mul, _mm_mullo_epi32)
+WABT_SSE41_BINOP(I16X8NarrowI32X4U, _mm_packus_epi32)
+
+#undef WABT_SSE41_BINOP
+
+WABT_TARGET("sse4.1") v128 I64X2ExtmulLowI32X4S(v128 a, v128 b) {
+  return V(_mm_mul_epi32(_mm_shuffle_epi32(I(a), WABT_LOW_LANES),
+                         _mm_shuffle_epi32(I(b), WABT_LOW_LANES)));
+}
+WABT_TARGET("sse4.1") v128 I64X2ExtmulHighI32X4S(v128 a, v128 b) {
+  return V(_mm_mul_epi32(_mm_shuffle_epi32(I(a), WABT_HIGH_LANES),
+                         _mm_shuffle_epi32(I(b), WABT_HIGH_LANES)));
+}
+
+#undef WABT_LOW_LANES
+#undef WABT_HIGH_LANES
+
+const int kCeil = _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC;
+const int kFloor = _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC;
+const int kTrunc = _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC;
+const int kNearest = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+template <int mode>
+WABT_TARGET("sse4.1") v128 F32X4Round(v128 a) {
+  return V(CanonNaN(_mm_round_ps(F(a), mode)));
+}
+
+template <int mode>
+WABT_TARGET("sse4.1") v128 F64X2Round(v128 a) {
+  return V(CanonNaN(_mm_round_pd(D(a), mode)));
+}
+
+WABT_TARGET("sse4.1") v128 I32X4TruncSatF64X2UZero(v128 a) {
+  // maxpd returns the zero for NaNs. Adding 2^52 to the truncated value puts
+  // it in the low half of the double.
+  __m128d x = _mm_max_pd(D(a), _mm_setzero_pd());
+  x = _mm_min_pd(x, _mm_set1_pd(4294967295.));
+  x = _mm_add_pd(_mm_round_pd(x, kTrunc), _mm_set1_pd(4503599627370496.));
+  return V(_mm_shuffle_ps(_mm_castpd_ps(x), _mm_setzero_ps(),
+                          _MM_SHUFFLE(3, 3, 2, 0)));
+}
+
+//// SSE4.2 ////
+
+WABT_TARGET("sse4.2") v128 I64X2GtS(v128 a, v128 b) {
+  return V(_mm_cmpgt_epi64(I(a), I(b)));
+}
+WABT_TARGET("sse4.2") v128 I64X2LtS(v128 a, v128 b) {
+  return V(_mm_cmpgt_epi64(I(b), I(a)));
+}
+WABT_TARGET("sse4.2") v128 I64X2LeS(v128 a, v128 b) {
+  return V(Not(_mm_cmpgt_epi64(I(a), I(b))));
+}
+WABT_TARGET("sse4.2") v128 I64X2GeS(v128 a, v128 b) {
+  return V(Not(_mm_cmpgt_epi64(I(b), I(a))));
+}
+
+void InitX86_64Kernels(SimdKernels* k) {
+  using O = Opcode;
+  CpuFeatures features = GetCpuFeatures();
+
+  k->unop[O::V128Not] = V128Not;
+  k->binop[O::V128And] = V128And;
+  k->binop[O::V128Or] = V128Or;
+  k->binop[O::V128Xor] = V128Xor;
+  k->binop[O::V128Andnot] = V128Andnot;
+  k->ternop[O::V128BitSelect] = V128BitSelect;
+  k->test[O::V128AnyTrue] = V128AnyTrue;
+
+  k->unop[O::I8X16Neg] = Neg<I8>;
+  k->test[O::I8X16AllTrue] = AllTrue<I8>;
+  k->test[O::I8X16Bitmask] = I8X16Bitmask;
+  k->shift[O::I8X16Shl] = I8X16Shl;
+  k->shift[O::I8X16ShrS] = I8X16ShrS;
+  k->shift[O::I8X16ShrU] = I8X16ShrU;
+  k->binop[O::I8X16Add] = Add<I8>;
+  k->binop[O::I8X16AddSatS] = I8X16AddSatS;
+  k->binop[O::I8X16AddSatU] = I8X16AddSatU;
+  k->binop[O::I8X16Sub] = Sub<I8>;
+  k->binop[O::I8X16SubSatS] = I8X16SubSatS;
+  k->binop[O::I8X16SubSatU] = I8X16SubSatU;
+  k->binop[O::I8X16MinU] = I8X16MinU;
+  k->binop[O::I8X16MaxU] = I8X16MaxU;
+  k->binop[O::I8X16AvgrU] = I8X16AvgrU;
+  k->binop[O::I8X16Eq] = Eq<I8>;
+  k->binop[O::I8X16Ne] = Ne<I8>;
+  k->binop[O::I8X16LtS] = LtS<I8>;
+  k->binop[O::I8X16LtU] = LtU<I8>;
+  k->binop[O::I8X16GtS] = GtS<I8>;
+  k->binop[O::I8X16GtU] = GtU<I8>;
+  k->binop[O::I8X16LeS] = LeS<I8>;
+  k->binop[O::I8X16LeU] = LeU<I8>;
+  k->binop[O::I8X16GeS] = GeS<I8>;
+  k->binop[O::I8X16GeU] = GeU<I8>;
+  k->binop[O::I8X16NarrowI16X8S] = I8X16NarrowI16X8S;
+  k->binop[O::I8X16NarrowI16X8U] = I8X16NarrowI16X8U;
+
+  k->unop[O::I16X8Neg] = Neg<I16>;
+  k->test[O::I16X8AllTrue] = AllTrue<I16>;
+  k->test[O::I16X8Bitmask] = I16X8Bitmask;
+  k->shift[O::I16X8Shl] = I16X8Shl;
+  k->shift[O::I16X8ShrS] = I16X8ShrS;
+  k->shift[O::I16X8ShrU] = I16X8ShrU;
+  k->binop[O::I16X8Add] = Add<I16>;
+  k->binop[O::I16X8AddSatS] = I16X8AddSatS;
+  k->binop[O::I16X8AddSatU] = I16X8AddSatU;
+  k->binop[O::I16X8Sub] = Sub<I16>;
+  k->binop[O::I16X8SubSatS] = I16X8SubSatS;
+  k->binop[O::I16X8SubSatU] = I16X8SubSatU;
+  k->binop[O::I16X8Mul] = I16X8Mul;
+  k->binop[O::I16X8MinS] = I16X8MinS;
+  k->binop[O::I16X8MaxS] = I16X8MaxS;
+  k->binop[O::I16X8AvgrU] = I16X8AvgrU;
+  k->binop[O::I16X8Eq] = Eq<I16>;
+  k->binop[O::I16X8Ne] = Ne<I16>;
+  k->binop[O::I16X8LtS] = LtS<I16>;
+  k->binop[O::I16X8LtU] = LtU<I16>;
+  k->binop[O::I16X8GtS] = GtS<I16>;
+  k->binop[O::I16X8GtU] = GtU<I16>;
+  k->binop[O::I16X8LeS] = LeS<I16>;
+  k->binop[O::I16X8LeU] = LeU<I16>;
+  k->binop[O::I16X8GeS] = GeS<I16>;
+  k->binop[O::I16X8GeU] = GeU<I16>;
+  k->binop[O::I16X8NarrowI32X4S] = I16X8NarrowI32X4S;
+  k->unop[O::I16X8ExtendLowI8X16S] = I16X8ExtendLowI8X16S;
+  k->unop[O::I16X8ExtendHighI8X16S] = I16X8ExtendHighI8X16S;
+  k->unop[O::I16X8ExtendLowI8X16U] = I16X8ExtendLowI8X16U;
+  k->unop[O::I16X8ExtendHighI8X16U] = I16X8ExtendHighI8X16U;
+  k->binop[O::I16X8ExtmulLowI8X16S] = I16X8ExtmulLowI8X16S;
+  k->binop[O::I16X8ExtmulHighI8X16S] = I16X8ExtmulHighI8X16S;
+  k->binop[O::I16X8ExtmulLowI8X16U] = I16X8ExtmulLowI8X16U;
+  k->binop[O::I16X8ExtmulHighI8X16U] = I16X8ExtmulHighI8X16U;
+  k->unop[O::I16X8ExtaddPairwiseI8X16S] = I16X8ExtaddPairwiseI8X16S;
+  k->unop[O::I16X8ExtaddPairwiseI8X16U] = I16X8ExtaddPairwiseI8X16U;
+
+  k->unop[O::I32X4Neg] = Neg<I32>;
+  k->test[O::I32X4AllTrue] = AllTrue<I32>;
+  k->test[O::I32X4Bitmask] = I32X4Bitmask;
+  k->shift[O::I32X4Shl] = I32X4Shl;
+  k->shift[O::I32X4ShrS] = I32X4ShrS;
+  k->shift[O::I32X4ShrU] = I32X4ShrU;
+  k->binop[O::I32X4Add] = Add<I32>;
+  k->binop[O::I32X4Sub] = Sub<I32>;
+  k->binop[O::I32X4Eq] = Eq<I32>;
+  k->binop[O::I32X4Ne] = Ne<I32>;
+  k->binop[O::I32X4LtS] = LtS<I32>;
+  k->binop[O::I32X4LtU] = LtU<I32>;
+  k->binop[O::I32X4GtS] = GtS<I32>;
+  k->binop[O::I32X4GtU] = GtU<I32>;
+  k->binop[O::I32X4LeS] = LeS<I32>;
+  k->binop[O::I32X4LeU] = LeU<I32>;
+  k->binop[O::I32X4GeS] = GeS<I32>;
+  k->binop[O::I32X4GeU] = GeU<I32>;
+  k->binop[O::I32X4DotI16X8S] = I32X4DotI16X8S;
+  k->unop[O::I32X4ExtendLowI16X8S] = I32X4ExtendLowI16X8S;
+  k->unop[O::I32X4ExtendHighI16X8S] = I32X4ExtendHighI16X8S;
+  k->unop[O::I32X4ExtendLowI16X8U] = I32X4ExtendLowI16X8U;
+  k->unop[O::I32X4ExtendHighI16X8U] = I32X4ExtendHighI16X8U;
+  k->binop[O::I32X4ExtmulLowI16X8S] = I32X4ExtmulLowI16X8S;
+  k->binop[O::I32X4ExtmulHighI16X8S] = I32X4ExtmulHighI16X8S;
+  k->binop[O::I32X4ExtmulLowI16X8U] = I32X4ExtmulLowI16X8U;
+  k->binop[O::I32X4ExtmulHighI16X8U] = I32X4ExtmulHighI16X8U;
+  k->unop[O::I32X4ExtaddPairwiseI16X8S] = I32X4ExtaddPairwiseI16X8S;
+  k->unop[O::I32X4ExtaddPairwiseI16X8U] = I32X4ExtaddPairwiseI16X8U;
+  k->unop[O::I32X4TruncSatF32X4S] = I32X4TruncSatF32X4S;
+  k->unop[O::I32X4TruncSatF32X4U] = I32X4TruncSatF32X4U;
+  k->unop[O::I32X4TruncSatF64X2SZero] = I32X4TruncSatF64X2SZero;
+
+  k->unop[O::I64X2Neg] = Neg<I64>;
+  k->unop[O::I64X2Abs] = I64X2Abs;
+  k->test[O::I64X2AllTrue] = AllTrue<I64>;
+  k->test[O::I64X2Bitmask] = I64X2Bitmask;
+  k->shift[O::I64X2Shl] = I64X2Shl;
+  k->shift[O::I64X2ShrS] = I64X2ShrS;
+  k->shift[O::I64X2ShrU] = I64X2ShrU;
+  k->binop[O::I64X2Add] = Add<I64>;
+  k->binop[O::I64X2Sub] = Sub<I64>;
+  k->binop[O::I64X2Mul] = I64X2Mul;
+  k->binop[O::I64X2Eq] = Eq<I64>;
+  k->binop[O::I64X2Ne] = Ne<I64>;
+  k->unop[O::I64X2ExtendLowI32X4S] = I64X2ExtendLowI32X4S;
+  k->unop[O::I64X2ExtendHighI32X4S] = I64X2ExtendHighI32X4S;
+  k->unop[O::I64X2ExtendLowI32X4U] = I64X2ExtendLowI32X4U;
+  k->unop[O::I64X2ExtendHighI32X4U] = I64X2ExtendHighI32X4U;
+  k->binop[O::I64X2ExtmulLowI32X4U] = I64X2ExtmulLowI32X4U;
+  k->binop[O::I64X2ExtmulHighI32X4U] = I64X2ExtmulHighI32X4U;
+
+  k->unop[O::F32X4Abs] = F32X4Abs;
+  k->unop[O::F32X4Neg] = F32X4Neg;
+  k->unop[O::F32X4Sqrt] = F32X4Sqrt;
+  k->binop[O::F32X4Add] = F32X4Add;
+  k->binop[O::F32X4Sub] = F32X4Sub;
+  k->binop[O::F32X4Mul] = F32X4Mul;
+  k->binop[O::F32X4Div] = F32X4Div;
+  k->binop[O::F32X4Min] = F32X4Min;
+  k->binop[O::F32X4Max] = F32X4Max;
+  k->binop[O::F32X4PMin] = F32X4PMin;
+  k->binop[O::F32X4PMax] = F32X4PMax;
+  k->binop[O::F32X4Eq] = F32X4Eq;
+  k->binop[O::F32X4Ne] = F32X4Ne;
+  k->binop[O::F32X4Lt] = F32X4Lt;
+  k->binop[O::F32X4Gt] = F32X4Gt;
+  k->binop[O::F32X4Le] = F32X4Le;
+  k->binop[O::F32X4Ge] = F32X4Ge;
+  k->unop[O::F32X4ConvertI32X4S] = F32X4ConvertI32X4S;
+  k->unop[O::F32X4ConvertI32X4U] = F32X4ConvertI32X4U;
+  k->unop[O::F32X4DemoteF64X2Zero] = F32X4DemoteF64X2Zero;
+
+  k->unop[O::F64X2Abs] = F64X2Abs;
+  k->unop[O::F64X2Neg] = F64X2Neg;
+  k->unop[O::F64X2Sqrt] = F64X2Sqrt;
+  k->binop[O::F64X2Add] = F64X2Add;
+  k->binop[O::F64X2Sub] = F64X2Sub;
+  k->binop[O::F64X2Mul] = F64X2Mul;
+  k->binop[O::F64X2Div] = F64X2Div;
+  k->binop[O::F64X2Min] = F64X2Min;
+  k->binop[O::F64X2Max] = F64X2Max;
+  k->binop[O::F64X2PMin] = F64X2PMin;
+  k->binop[O::F64X2PMax] = F64X2PMax;
+  k->binop[O::F64X2Eq] = F64X2Eq;
+  k->binop[O::F64X2Ne] = F64X2Ne;
+  k->binop[O::F64X2Lt] = F64X2Lt;
+  k->binop[O::F64X2Gt] = F64X2Gt;
+  k->binop[O::F64X2Le] = F64X2Le;
+  k->binop[O::F64X2Ge] = F64X2Ge;
+  k->unop[O::F64X2ConvertLowI32X4S] = F64X2ConvertLowI32X4S;
+  k->unop[O::F64X2ConvertLowI32X4U] = F64X2ConvertLowI32X4U;
+  k->unop[O::F64X2PromoteLowF32X4] = F64X2PromoteLowF32X4;
+
+  if (features.ssse3) {
+    k->unop[O::I8X16Abs] = I8X16Abs;
+    k->unop[O::I16X8Abs] = I16X8Abs;
+    k->unop[O::I32X4Abs] = I32X4Abs;
+    k->unop[O::I8X16Popcnt] = I8X16Popcnt;
+    k->binop[O::I8X16Swizzle] = I8X16Swizzle;
+    k->ternop[O::I8X16Shuffle] = I8X16Shuffle;
+    k->binop[O::I16X8Q15mulrSatS] = I16X8Q15mulrSatS;
+  }
+
+  if (features.sse41) {
+    k->binop[O::I8X16MinS] = I8X16MinS;
+    k->binop[O::I8X16MaxS] = I8X16MaxS;
+    k->binop[O::I16X8MinU] = I16X8MinU;
+    k->binop[O::I16X8MaxU] = I16X8MaxU;
+    k->binop[O::I32X4MinS] = I32X4MinS;
+    k->binop[O::I32X4MaxS] = I32X4MaxS;
+    k->binop[O::I32X4MinU] = I32X4MinU;
+    k->binop[O::I32X4MaxU] = I32X4MaxU;
+    k->binop[O::I32X4Mul] = I32X4Mul;
+    k->binop[O::I16X8NarrowI32X4U] = I16X8NarrowI32X4U;
+    k->binop[O::I64X2ExtmulLowI32X4S] = I64X2ExtmulLowI32X4S;
+    k->binop[O::I64X2ExtmulHighI32X4S] = I64X2ExtmulHighI32X4S;
+    k->unop[O::F32X4Ceil] = F32X4Round<kCeil>;
+    k->unop[O::F32X4Floor] = F32X4Round<kFloor>;
+    k->unop[O::F32X4Trunc] = F32X4Round<kTrunc>;
+    k->unop[O::F32X4Nearest] = F32X4Round<kNearest>;
+    k->unop[O::F64X2Ceil] = F64X2Round<kCeil>;
+    k->unop[O::F64X2Floor] = F64X2Round<kFloor>;
+    k->unop[O::F64X2Trunc] = F64X2Round<kTrunc>;
+    k->unop[O::F64X2Nearest] = F64X2Round<kNearest>;
+    k->unop[O::I32X4TruncSatF64X2UZero] = I32X4TruncSatF64X2UZero;
+  }
+
+  if (features.sse42) {
+    k->binop[O::I64X2GtS] = I64X2GtS;
+    k->binop[O::I64X2LtS] = I64X2LtS;
+    k->binop[O::I64X2LeS] = I64X2LeS;
+    k->binop[O::I64X2GeS] = I64X2GeS;
+  }
+}
+
+#endif  // WABT_SIMD_X86_64
+
+#if WABT_SIMD_AARCH64
+
+// Conversions between v128 and the NEON vector types. AArch64 always has
+// NEON, so unlike on x86-64 there is nothing to check at run time.
+inline uint8x16_t U8(v128 x) { uint8x16_t r; memcpy(&r, &x, 16); return r; }
+inline int8x16_t S8(v128 x) { return vreinterpretq_s8_u8(U8(x)); }
+inline uint16x8_t U16(v128 x) { return vreinterpretq_u16_u8(U8(x)); }
+inline int16x8_t S16(v128 x) { return vreinterpretq_s16_u8(U8(x)); }
+inline uint32x4_t U32(v128 x) { return vreinterpretq_u32_u8(U8(x)); }
+inline int32x4_t S32(v128 x) { return vreinterpretq_s32_u8(U8(x)); }
+inline uint64x2_t U64(v128 x) { return vreinterpretq_u64_u8(U8(x)); }
+inline int64x2_t S64(v128 x) { return vreinterpretq_s64_u8(U8(x)); }
+inline float32x4_t F32(v128 x) { return vreinterpretq_f32_u8(U8(x)); }
+inline float64x2_t F64(v128 x) { return vreinterpretq_f64_u8(U8(x)); }
+
+inline v128 V(uint8x16_t x) { v128 r; memcpy(&r, &x, 16); return r; }
+inline v128 V(int8x16_t x) { return V(vreinterpretq_u8_s8(x)); }
+inline v128 V(uint16x8_t x) { return V(vreinterpretq_u8_u16(x)); }
+inline v128 V(int16x8_t x) { return V(vreinterpretq_u8_s16(x)); }
+inline v128 V(uint32x4_t x) { return V(vreinterpretq_u8_u32(x)); }
+inline v128 V(int32x4_t x) { return V(vreinterpretq_u8_s32(x)); }
+inline v128 V(uint64x2_t x) { return V(vreinterpretq_u8_u64(x)); }
+inline v128 V(int64x2_t x) { return V(vreinterpretq_u8_s64(x)); }
+inline v128 V(float32x4_t x) { return V(vreinterpretq_u8_f32(x)); }
+inline v128 V(float64x2_t x) { return V(vreinterpretq_u8_f64(x)); }
+
+// There is no vmvnq for 64-bit lanes.
+inline uint64x2_t Not(uint64x2_t x) {
+  return vreinterpretq_u64_u32(vmvnq_u32(vreinterpretq_u32_u64(x)));
+}
+
+// Replaces the NaN lanes with the canonical NaN. x != x only for NaNs.
+inline float32x4_t CanonNaN(float32x4_t x) {
+  return vbslq_f32(vmvnq_u32(vceqq_f32(x, x)),
+                   vreinterpretq_f32_u32(vdupq_n_u32(0x7fc00000)), x);
+}
+inline float64x2_t CanonNaN(float64x2_t x) {
+  return vbslq_f64(Not(vceqq_f64(x, x)),
+                   vreinterpretq_f64_u64(vdupq_n_u64(0x7ff8000000000000ull)),
+                   x);
+}
+
+// Most instructions map to a single intrinsic, with the operands and result
+// viewed as the given vector type.
+#define WABT_NEON_UNOP(Name, T, intrinsic) \
+  v128 Name(v128 a) { return V(intrinsic(T(a))); }
+#define WABT_NEON_BINOP(Name, T, intrinsic) \
+  v128 Name(v128 a, v128 b) { return V(intrinsic(T(a), T(b))); }
+#define WABT_NEON_FLOAT_UNOP(Name, T, intrinsic) \
+  v128 Name(v128 a) { return V(CanonNaN(intrinsic(T(a)))); }
+#define WABT_NEON_FLOAT_BINOP(Name, T, intrinsic) \
+  v128 Name(v128 a, v128 b) { return V(CanonNaN(intrinsic(T(a), T(b)))); }
+
+v128 V128Not(v128 a) { return V(vmvnq_u8(U8(a))); }
+WABT_NEON_BINOP(V128And, U8, vandq_u8)
+WABT_NEON_BINOP(V128Or, U8, vorrq_u8)
+WABT_NEON_BINOP(V128Xor, U8, veorq_u8)
+WABT_NEON_BINOP(V128Andnot, U8, vbicq_u8)
+v128 V128BitSelect(v128 a, v128 b, v128 c) {
+  return V(vbslq_u8(U8(c), U8(a), U8(b)));
+}
+u32 V128AnyTrue(v128 a) { return vmaxvq_u32(U32(a)) != 0; }
+
+// Returns 1 if every lane is non-zero.
+u32 I8X16AllTrue(v128 a) { return vminvq_u8(U8(a)) != 0; }
+u32 I16X8AllTrue(v128 a) { return vminvq_u16(U16(a)) != 0; }
+u32 I32X4AllTrue(v128 a) { return vminvq_u32(U32(a)) != 0; }
+u32 I64X2AllTrue(v128 a) {
+  return vminvq_u32(vreinterpretq_u32_u64(vtstq_u64(U64(a), U64(a)))) != 0;
+}
+
+// Each sign bit is moved down to bit 0, shifted up to its lane number and
+// the lanes are added up.
+u32 I8X16Bitmask(v128 a) {
+  const int8_t kShifts[16] = {0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7};
+  uint8x16_t bits = vshlq_u8(vshrq_n_u8(U8(a), 7), vld1q_s8(kShifts));
+  return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+}
+u32 I16X8Bitmask(v128 a) {
+  const int16_t kShifts[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  return vaddvq_u16(vshlq_u16(vshrq_n_u16(U16(a), 15), vld1q_s16(kShifts)));
+}
+u32 I32X4Bitmask(v128 a) {
+  const int32_t kShifts[4] = {0, 1, 2, 3};
+  return vaddvq_u32(vshlq_u32(vshrq_n_u32(U32(a), 31), vld1q_s32(kShifts)));
+}
+u32 I64X2Bitmask(v128 a) {
+  uint64x2_t bits = vshrq_n_u64(U64(a), 63);
+  return vgetq_lane_u64(bits, 0) | (vgetq_lane_u64(bits, 1) << 1);
+}
+
+// vshlq shifts each lane left by a signed count, or right if it is negative.
+// The count is taken modulo the lane width, as in IntShl and IntShr.
+v128 I8X16Shl(v128 a, u32 n) {
+  return V(vshlq_u8(U8(a), vdupq_n_s8(n & 7)));
+}
+v128 I8X16ShrS(v128 a, u32 n) {
+  return V(vshlq_s8(S8(a), vdupq_n_s8(-static_cast<int>(n & 7))));
+}
+v128 I8X16ShrU(v128 a, u32 n) {
+  return V(vshlq_u8(U8(a), vdupq_n_s8(-static_cast<int>(n & 7))));
+}
+v128 I16X8Shl(v128 a, u32 n) {
+  return V(vshlq_u16(U16(a), vdupq_n_s16(n & 15)));
+}
+v128 I16X8ShrS(v128 a, u32 n) {
+  return V(vshlq_s16(S16(a), vdupq_n_s16(-static_cast<int>(n & 15))));
+}
+v128 I16X8ShrU(v128 a, u32 n) {
+  return V(vshlq_u16(U16(a), vdupq_n_s16(-static_cast<int>(n & 15))));
+}
+v128 I32X4Shl(v128 a, u32 n) {
+  return V(vshlq_u32(U32(a), vdupq_n_s32(n & 31)));
+}
+v128 I32X4ShrS(v128 a, u32 n) {
+  return V(vshlq_s32(S32(a), vdupq_n_s32(-static_cast<int>(n & 31))));
+}
+v128 I32X4ShrU(v128 a, u32 n) {
+  return V(vshlq_u32(U32(a), vdupq_n_s32(-static_cast<int>(n & 31))));
+}
+v128 I64X2Shl(v128 a, u32 n) {
+  return V(vshlq_u64(U64(a), vdupq_n_s64(n & 63)));
+}
+v128 I64X2ShrS(v128 a, u32 n) {
+  return V(vshlq_s64(S64(a), vdupq_n_s64(-static_cast<int>(n & 63))));
+}
+v128 I64X2ShrU(v128 a, u32 n) {
+  return V(vshlq_u64(U64(a), vdupq_n_s64(-static_cast<int>(n & 63))));
+}
+
+WABT_NEON_UNOP(I8X16Neg, S8, vnegq_s8)
+WABT_NEON_UNOP(I8X16Abs, S8, vabsq_s8)
+WABT_NEON_UNOP(I8X16Popcnt, U8, vcntq_u8)
+WABT_NEON_BINOP(I8X16Add, U8, vaddq_u8)
+WABT_NEON_BINOP(I8X16AddSatS, S8, vqaddq_s8)
+WABT_NEON_BINOP(I8X16AddSatU, U8, vqaddq_u8)
+WABT_NEON_BINOP(I8X16Sub, U8, vsubq_u8)
+WABT_NEON_BINOP(I8X16SubSatS, S8, vqsubq_s8)
+WABT_NEON_BINOP(I8X16SubSatU, U8, vqsubq_u8)
+WABT_NEON_BINOP(I8X16MinS, S8, vminq_s8)
+WABT_NEON_BINOP(I8X16MinU, U8, vminq_u8)
+WABT_NEON_BINOP(I8X16MaxS, S8, vmaxq_s8)
+WABT_NEON_BINOP(I8X16MaxU, U8, vmaxq_u8)
+WABT_NEON_BINOP(I8X16AvgrU, U8, vrhaddq_u8)
+WABT_NEON_BINOP(I8X16Eq, U8, vceqq_u8)
+WABT_NEON_BINOP(I8X16LtS, S8, vcltq_s8)
+WABT_NEON_BINOP(I8X16LtU, U8, vcltq_u8)
+WABT_NEON_BINOP(I8X16GtS, S8, vcgtq_s8)
+WABT_NEON_BINOP(I8X16GtU, U8, vcgtq_u8)
+WABT_NEON_BINOP(I8X16LeS, S8, vcleq_s8)
+WABT_NEON_BINOP(I8X16LeU, U8, vcleq_u8)
+WABT_NEON_BINOP(I8X16GeS, S8, vcgeq_s8)
+WABT_NEON_BINOP(I8X16GeU, U8, vcgeq_u8)
+v128 I8X16Ne(v128 a, v128 b) { return V(vmvnq_u8(vceqq_u8(U8(a), U8(b)))); }
+v128 I8X16NarrowI16X8S(v128 a, v128 b) {
+  return V(vcombine_s8(vqmovn_s16(S16(a)), vqmovn_s16(S16(b))));
+}
+v128 I8X16NarrowI16X8U(v128 a, v128 b) {
+  return V(vcombine_u8(vqmovun_s16(S16(a)), vqmovun_s16(S16(b))));
+}
+
+// Table lookups give 0 for out of range indexes, as swizzle and shuffle do.
+WABT_NEON_BINOP(I8X16Swizzle, U8, vqtbl1q_u8)
+v128 I8X16Shuffle(v128 a, v128 b, v128 sel) {
+  uint8x16x2_t table = {{U8(a), U8(b)}};
+  return V(vqtbl2q_u8(table, U8(sel)));
+}
+
+WABT_NEON_UNOP(I16X8Neg, S16, vnegq_s16)
+WABT_NEON_UNOP(I16X8Abs, S16, vabsq_s16)
+WABT_NEON_BINOP(I16X8Add, U16, vaddq_u16)
+WABT_NEON_BINOP(I16X8AddSatS, S16, vqaddq_s16)
+WABT_NEON_BINOP(I16X8AddSatU, U16, vqaddq_u16)
+WABT_NEON_BINOP(I16X8Sub, U16, vsubq_u16)
+WABT_NEON_BINOP(I16X8SubSatS, S16, vqsubq_s16)
+WABT_NEON_BINOP(I16X8SubSatU, U16, vqsubq_u16)
+WABT_NEON_BINOP(I16X8Mul, U16, vmulq_u16)
+WABT_NEON_BINOP(I16X8MinS, S16, vminq_s16)
+WABT_NEON_BINOP(I16X8MinU, U16, vminq_u16)
+WABT_NEON_BINOP(I16X8MaxS, S16, vmaxq_s16)
+WABT_NEON_BINOP(I16X8MaxU, U16, vmaxq_u16)
+WABT_NEON_BINOP(I16X8AvgrU, U16, vrhaddq_u16)
+// sqrdmulh computes (2 * a * b + 0x8000) >> 16, which is the same value, and
+// saturates -1 * -1 too.
+WABT_NEON_BINOP(I16X8Q15mulrSatS, S16, vqrdmulhq_s16)
+WABT_NEON_BINOP(I16X8Eq, U16, vceqq_u16)
+WABT_NEON_BINOP(I16X8LtS, S16, vcltq_s16)
+WABT_NEON_BINOP(I16X8LtU, U16, vcltq_u16)
+WABT_NEON_BINOP(I16X8GtS, S16, vcgtq_s16)
+WABT_NEON_BINOP(I16X8GtU, U16, vcgtq_u16)
+WABT_NEON_BINOP(I16X8LeS, S16, vcleq_s16)
+WABT_NEON_BINOP(I16X8LeU, U16, vcleq_u16)
+WABT_NEON_BINOP(I16X8GeS, S16, vcgeq_s16)
+WABT_NEON_BINOP(I16X8GeU, U16, vcgeq_u16)
+v128 I16X8Ne(v128 a, v128 b) {
+  return V(vmvnq_u16(vceqq_u16(U16(a), U16(b))));
+}
+v128 I16X8NarrowI32X4S(v128 a, v128 b) {
+  return V(vcombine_s16(vqmovn_s32(S32(a)), vqmovn_s32(S32(b))));
+}
+v128 I16X8NarrowI32X4U(v128 a, v128 b) {
+  return V(vcombine_u16(vqmovun_s32(S32(a)), vqmovun_s32(S32(b))));
+}
+v128 I16X8ExtendLowI8X16S(v128 a) { return V(vmovl_s8(vget_low_s8(S8(a)))); }
+v128 I16X8ExtendHighI8X16S(v128 a) {
+  return V(vmovl_s8(vget_high_s8(S8(a))));
+}
+v128 I16X8ExtendLowI8X16U(v128 a) { return V(vmovl_u8(vget_low_u8(U8(a)))); }
+v128 I16X8ExtendHighI8X16U(v128 a) {
+  return V(vmovl_u8(vget_high_u8(U8(a))));
+}
+v128 I16X8ExtmulLowI8X16S(v128 a, v128 b) {
+  return V(vmull_s8(vget_low_s8(S8(a)), vget_low_s8(S8(b))));
+}
+v128 I16X8ExtmulHighI8X16S(v128 a, v128 b) {
+  return V(vmull_s8(vget_high_s8(S8(a)), vget_high_s8(S8(b))));
+}
+v128 I16X8ExtmulLowI8X16U(v128 a, v128 b) {
+  return V(vmull_u8(vget_low_u8(U8(a)), vget_low_u8(U8(b))));
+}
+v128 I16X8ExtmulHighI8X16U(v128 a, v128 b) {
+  return V(vmull_u8(vget_high_u8(U8(a)), vget_high_u8(U8(b))));
+}
+WABT_NEON_UNOP(I16X8ExtaddPairwiseI8X16S, S8, vpaddlq_s8)
+WABT_NEON_UNOP(I16X8ExtaddPairwiseI8X16U, U8, vpaddlq_u8)
+
+WABT_NEON_UNOP(I32X4Neg, S32, vnegq_s32)
+WABT_NEON_UNOP(I32X4Abs, S32, vabsq_s32)
+WABT_NEON_BINOP(I32X4Add, U32, vaddq_u32)
+WABT_NEON_BINOP(I32X4Sub, U32, vsubq_u32)
+WABT_NEON_BINOP(I32X4Mul, U32, vmulq_u32)
+WABT_NEON_BINOP(I32X4MinS, S32, vminq_s32)
+WABT_NEON_BINOP(I32X4MinU, U32, vminq_u32)
+WABT_NEON_BINOP(I32X4MaxS, S32, vmaxq_s32)
+WABT_NEON_BINOP(I32X4MaxU, U32, vmaxq_u32)
+WABT_NEON_BINOP(I32X4Eq, U32, vceqq_u32)
+WABT_NEON_BINOP(I32X4LtS, S32, vcltq_s32)
+WABT_NEON_BINOP(I32X4LtU, U32, vcltq_u32)
+WABT_NEON_BINOP(I32X4GtS, S32, vcgtq_s32)
+WABT_NEON_BINOP(I32X4GtU, U32, vcgtq_u32)
+WABT_NEON_BINOP(I32X4LeS, S32, vcleq_s32)
+WABT_NEON_BINOP(I32X4LeU, U32, vcleq_u32)
+WABT_NEON_BINOP(I32X4GeS, S32, vcgeq_s32)
+WABT_NEON_BINOP(I32X4GeU, U32, vcgeq_u32)
+v128 I32X4Ne(v128 a, v128 b) {
+  return V(vmvnq_u32(vceqq_u32(U32(a), U32(b))));
+}
+// Adding neighbouring pairs of the 32-bit products gives the dot product.
+v128 I32X4DotI16X8S(v128 a, v128 b) {
+  int32x4_t lo = vmull_s16(vget_low_s16(S16(a)), vget_low_s16(S16(b)));
+  int32x4_t hi = vmull_s16(vget_high_s16(S16(a)), vget_high_s16(S16(b)));
+  return V(vpaddq_s32(lo, hi));
+}
+v128 I32X4ExtendLowI16X8S(v128 a) {
+  return V(vmovl_s16(vget_low_s16(S16(a))));
+}
+v128 I32X4ExtendHighI16X8S(v128 a) {
+  return V(vmovl_s16(vget_high_s16(S16(a))));
+}
+v128 I32X4ExtendLowI16X8U(v128 a) {
+  return V(vmovl_u16(vget_low_u16(U16(a))));
+}
+v128 I32X4ExtendHighI16X8U(v128 a) {
+  return V(vmovl_u16(vget_high_u16(U16(a))));
+}
+v128 I32X4ExtmulLowI16X8S(v128 a, v128 b) {
+  return V(vmull_s16(vget_low_s16(S16(a)), vget_low_s16(S16(b))));
+}
+v128 I32X4ExtmulHighI16X8S(v128 a, v128 b) {
+  return V(vmull_s16(vget_high_s16(S16(a)), vget_high_s16(S16(b))));
+}
+v128 I32X4ExtmulLowI16X8U(v128 a, v128 b) {
+  return V(vmull_u16(vget_low_u16(U16(a)), vget_low_u16(U16(b))));
+}
+v128 I32X4ExtmulHighI16X8U(v128 a, v128 b) {
+  return V(vmull_u16(vget_high_u16(U16(a)), vget_high_u16(U16(b))));
+}
+WABT_NEON_UNOP(I32X4ExtaddPairwiseI16X8S, S16, vpaddlq_s16)
+WABT_NEON_UNOP(I32X4ExtaddPairwiseI16X8U, U16, vpaddlq_u16)
+// The float to integer conversions saturate, and give 0 for NaNs.
+WABT_NEON_UNOP(I32X4TruncSatF32X4S, F32, vcvtq_s32_f32)
+WABT_NEON_UNOP(I32X4TruncSatF32X4U, F32, vcvtq_u32_f32)
+v128 I32X4TruncSatF64X2SZero(v128 a) {
+  return V(vcombine_s32(vqmovn_s64(vcvtq_s64_f64(F64(a))), vdup_n_s32(0)));
+}
+v128 I32X4TruncSatF64X2UZero(v128 a) {
+  return V(vcombine_u32(vqmovn_u64(vcvtq_u64_f64(F64(a))), vdup_n_u32(0)));
+}
+
+// There is no 64-bit lane multiply, so i64x2.mul runs one lane at a time.
+WABT_NEON_UNOP(I64X2Neg, S64, vnegq_s64)
+WABT_NEON_UNOP(I64X2Abs, S64, vabsq_s64)
+WABT_NEON_BINOP(I64X2Add, U64, vaddq_u64)
+WABT_NEON_BINOP(I64X2Sub, U64, vsubq_u64)
+WABT_NEON_BINOP(I64X2Eq, U64, vceqq_u64)
+WABT_NEON_BINOP(I64X2LtS, S64, vcltq_s64)
+WABT_NEON_BINOP(I64X2GtS, S64, vcgtq_s64)
+WABT_NEON_BINOP(I64X2LeS, S64, vcleq_s64)
+WABT_NEON_BINOP(I64X2GeS, S64, vcgeq_s64)
+v128 I64X2Ne(v128 a, v128 b) { return V(Not(vceqq_u64(U64(a), U64(b)))); }
+v128 I64X2ExtendLowI32X4S(v128 a) {
+  return V(vmovl_s32(vget_low_s32(S32(a))));
+}
+v128 I64X2ExtendHighI32X4S(v128 a) {
+  return V(vmovl_s32(vget_high_s32(S32(a))));
+}
+v128 I64X2ExtendLowI32X4U(v128 a) {
+  return V(vmovl_u32(vget_low_u32(U32(a))));
+}
+v128 I64X2ExtendHighI32X4U(v128 a) {
+  return V(vmovl_u32(vget_high_u32(U32(a))));
+}
+v128 I64X2ExtmulLowI32X4S(v128 a, v128 b) {
+  return V(vmull_s32(vget_low_s32(S32(a)), vget_low_s32(S32(b))));
+}
+v128 I64X2ExtmulHighI32X4S(v128 a, v128 b) {
+  return V(vmull_s32(vget_high_s32(S32(a)), vget_high_s32(S32(b))));
+}
+v128 I64X2ExtmulLowI32X4U(v128 a, v128 b) {
+  return V(vmull_u32(vget_low_u32(U32(a)), vget_low_u32(U32(b))));
+}
+v128 I64X2ExtmulHighI32X4U(v128 a, v128 b) {
+  return V(vmull_u32(vget_high_u32(U32(a)), vget_high_u32(U32(b))));
+}
+
+// abs and neg only change the sign bit, so they are done on the bits to keep
+// NaN payloads as they are.
+v128 F32X4Abs(v128 a) {
+  return V(vbicq_u32(U32(a), vdupq_n_u32(0x80000000)));
+}
+v128 F32X4Neg(v128 a) {
+  return V(veorq_u32(U32(a), vdupq_n_u32(0x80000000)));
+}
+WABT_NEON_FLOAT_UNOP(F32X4Sqrt, F32, vsqrtq_f32)
+WABT_NEON_FLOAT_UNOP(F32X4Ceil, F32, vrndpq_f32)
+WABT_NEON_FLOAT_UNOP(F32X4Floor, F32, vrndmq_f32)
+WABT_NEON_FLOAT_UNOP(F32X4Trunc, F32, vrndq_f32)
+WABT_NEON_FLOAT_UNOP(F32X4Nearest, F32, vrndnq_f32)
+WABT_NEON_FLOAT_BINOP(F32X4Add, F32, vaddq_f32)
+WABT_NEON_FLOAT_BINOP(F32X4Sub, F32, vsubq_f32)
+WABT_NEON_FLOAT_BINOP(F32X4Mul, F32, vmulq_f32)
+WABT_NEON_FLOAT_BINOP(F32X4Div, F32, vdivq_f32)
+// fmin and fmax order -0 before +0 and return a NaN if either operand is one,
+// as wasm does.
+WABT_NEON_FLOAT_BINOP(F32X4Min, F32, vminq_f32)
+WABT_NEON_FLOAT_BINOP(F32X4Max, F32, vmaxq_f32)
+// pmin is b < a ? b : a, and pmax is a < b ? b : a.
+v128 F32X4PMin(v128 a, v128 b) {
+  return V(vbslq_f32(vcltq_f32(F32(b), F32(a)), F32(b), F32(a)));
+}
+v128 F32X4PMax(v128 a, v128 b) {
+  return V(vbslq_f32(vcltq_f32(F32(a), F32(b)), F32(b), F32(a)));
+}
+WABT_NEON_BINOP(F32X4Eq, F32, vceqq_f32)
+WABT_NEON_BINOP(F32X4Lt, F32, vcltq_f32)
+WABT_NEON_BINOP(F32X4Gt, F32, vcgtq_f32)
+WABT_NEON_BINOP(F32X4Le, F32, vcleq_f32)
+WABT_NEON_BINOP(F32X4Ge, F32, vcgeq_f32)
+v128 F32X4Ne(v128 a, v128 b) {
+  return V(vmvnq_u32(vceqq_f32(F32(a), F32(b))));
+}
+WABT_NEON_UNOP(F32X4ConvertI32X4S, S32, vcvtq_f32_s32)
+WABT_NEON_UNOP(F32X4ConvertI32X4U, U32, vcvtq_f32_u32)
+v128 F32X4DemoteF64X2Zero(v128 a) {
+  return V(CanonNaN(vcombine_f32(vcvt_f32_f64(F64(a)), vdup_n_f32(0))));
+}
+
+v128 F64X2Abs(v128 a) {
+  return V(vbicq_u64(U64(a), vdupq_n_u64(0x8000000000000000ull)));
+}
+v128 F64X2Neg(v128 a) {
+  return V(veorq_u64(U64(a), vdupq_n_u64(0x8000000000000000ull)));
+}
+WABT_NEON_FLOAT_UNOP(F64X2Sqrt, F64, vsqrtq_f64)
+WABT_NEON_FLOAT_UNOP(F64X2Ceil, F64, vrndpq_f64)
+WABT_NEON_FLOAT_UNOP(F64X2Floor, F64, vrndmq_f64)
+WABT_NEON_FLOAT_UNOP(F64X2Trunc, F64, vrndq_f64)
+WABT_NEON_FLOAT_UNOP(F64X2Nearest, F64, vrndnq_f64)
+WABT_NEON_FLOAT_BINOP(F64X2Add, F64, vaddq_f64)
+WABT_NEON_FLOAT_BINOP(F64X2Sub, F64, vsubq_f64)
+WABT_NEON_FLOAT_BINOP(F64X2Mul, F64, vmulq_f64)
+WABT_NEON_FLOAT_BINOP(F64X2Div, F64, vdivq_f64)
+WABT_NEON_FLOAT_BINOP(F64X2Min, F64, vminq_f64)
+WABT_NEON_FLOAT_BINOP(F64X2Max, F64, vmaxq_f64)
+v128 F64X2PMin(v128 a, v128 b) {
+  return V(vbslq_f64(vcltq_f64(F64(b), F64(a)), F64(b), F64(a)));
+}
+v128 F64X2PMax(v128 a, v128 b) {
+  return V(vbslq_f64(vcltq_f64(F64(a), F64(b)), F64(b), F64(a)));
+}
+WABT_NEON_BINOP(F64X2Eq, F64, vceqq_f64)
+WABT_NEON_BINOP(F64X2Lt, F64, vcltq_f64)
+WABT_NEON_BINOP(F64X2Gt, F64, vcgtq_f64)
+WABT_NEON_BINOP(F64X2Le, F64, vcleq_f64)
+WABT_NEON_BINOP(F64X2Ge, F64, vcgeq_f64)
+v128 F64X2Ne(v128 a, v128 b) { return V(Not(vceqq_f64(F64(a), F64(b)))); }
+v128 F64X2ConvertLowI32X4S(v128 a) {
+  return V(vcvtq_f64_s64(vmovl_s32(vget_low_s32(S32(a)))));
+}
+v128 F64X2ConvertLowI32X4U(v128 a) {
+  return V(vcvtq_f64_u64(vmovl_u32(vget_low_u32(U32(a)))));
+}
+v128 F64X2PromoteLowF32X4(v128 a) {
+  return V(vcvt_f64_f32(vget_low_f32(F32(a))));
+}
+
+#undef WABT_NEON_UNOP
+#undef WABT_NEON_BINOP
+#undef WABT_NEON_FLOAT_UNOP
+#undef WABT_NEON_FLOAT_BINOP
+
+void InitAArch64Kernels(SimdKernels* k) {
+  using O = Opcode;
+
+  k->unop[O::V128Not] = V128Not;
+  k->binop[O::V128And] = V128And;
+  k->binop[O::V128Or] = V128Or;
+  k->binop[O::V128Xor] = V128Xor;
+  k->binop[O::V128Andnot] = V128Andnot;
+  k->ternop[O::V128BitSelect] = V128BitSelect;
+  k->test[O::V128AnyTrue] = V128AnyTrue;
+
+  k->unop[O::I8X16Neg] = I8X16Neg;
+  k->unop[O::I8X16Abs] = I8X16Abs;
+  k->unop[O::I8X16Popcnt] = I8X16Popcnt;
+  k->test[O::I8X16AllTrue] = I8X16AllTrue;
+  k->test[O::I8X16Bitmask] = I8X16Bitmask;
+  k->shift[O::I8X16Shl] = I8X16Shl;
+  k->shift[O::I8X16ShrS] = I8X16ShrS;
+  k->shift[O::I8X16ShrU] = I8X16ShrU;
+  k->binop[O::I8X16Add] = I8X16Add;
+  k->binop[O::I8X16AddSatS] = I8X16AddSatS;
+  k->binop[O::I8X16AddSatU] = I8X16AddSatU;
+  k->binop[O::I8X16Sub] = I8X16Sub;
+  k->binop[O::I8X16SubSatS] = I8X16SubSatS;
+  k->binop[O::I8X16SubSatU] = I8X16SubSatU;
+  k->binop[O::I8X16MinS] = I8X16MinS;
+  k->binop[O::I8X16MinU] = I8X16MinU;
+  k->binop[O::I8X16MaxS] = I8X16MaxS;
+  k->binop[O::I8X16MaxU] = I8X16MaxU;
+  k->binop[O::I8X16AvgrU] = I8X16AvgrU;
+  k->binop[O::I8X16Eq] = I8X16Eq;
+  k->binop[O::I8X16Ne] = I8X16Ne;
+  k->binop[O::I8X16LtS] = I8X16LtS;
+  k->binop[O::I8X16LtU] = I8X16LtU;
+  k->binop[O::I8X16GtS] = I8X16GtS;
+  k->binop[O::I8X16GtU] = I8X16GtU;
+  k->binop[O::I8X16LeS] = I8X16LeS;
+  k->binop[O::I8X16LeU] = I8X16LeU;
+  k->binop[O::I8X16GeS] = I8X16GeS;
+  k->binop[O::I8X16GeU] = I8X16GeU;
+  k->binop[O::I8X16NarrowI16X8S] = I8X16NarrowI16X8S;
+  k->binop[O::I8X16NarrowI16X8U] = I8X16NarrowI16X8U;
+  k->binop[O::I8X16Swizzle] = I8X16Swizzle;
+  k->ternop[O::I8X16Shuffle] = I8X16Shuffle;
+
+  k->unop[O::I16X8Neg] = I16X8Neg;
+  k->unop[O::I16X8Abs] = I16X8Abs;
+  k->test[O::I16X8AllTrue] = I16X8AllTrue;
+  k->test[O::I16X8Bitmask] = I16X8Bitmask;
+  k->shift[O::I16X8Shl] = I16X8Shl;
+  k->shift[O::I16X8ShrS] = I16X8ShrS;
+  k->shift[O::I16X8ShrU] = I16X8ShrU;
+  k->binop[O::I16X8Add] = I16X8Add;
+  k->binop[O::I16X8AddSatS] = I16X8AddSatS;
+  k->binop[O::I16X8AddSatU] = I16X8AddSatU;
+  k->binop[O::I16X8Sub] = I16X8Sub;
+  k->binop[O::I16X8SubSatS] = I16X8SubSatS;
+  k->binop[O::I16X8SubSatU] = I16X8SubSatU;
+  k->binop[O::I16X8Mul] = I16X8Mul;
+  k->binop[O::I16X8MinS] = I16X8MinS;
+  k->binop[O::I16X8MinU] = I16X8MinU;
+  k->binop[O::I16X8MaxS] = I16X8MaxS;
+  k->binop[O::I16X8MaxU] = I16X8MaxU;
+  k->binop[O::I16X8AvgrU] = I16X8AvgrU;
+  k->binop[O::I16X8Q15mulrSatS] = I16X8Q15mulrSatS;
+  k->binop[O::I16X8Eq] = I16X8Eq;
+  k->binop[O::I16X8Ne] = I16X8Ne;
+  k->binop[O::I16X8LtS] = I16X8LtS;
+  k->binop[O::I16X8LtU] = I16X8LtU;
+  k->binop[O::I16X8GtS] = I16X8GtS;
+  k->binop[O::I16X8GtU] = I16X8GtU;
+  k->binop[O::I16X8LeS] = I16X8LeS;
+  k->binop[O::I16X8LeU] = I16X8LeU;
+  k->binop[O::I16X8GeS] = I16X8GeS;
+  k->binop[O::I16X8GeU] = I16X8GeU;
+  k->binop[O::I16X8NarrowI32X4S] = I16X8NarrowI32X4S;
+  k->binop[O::I16X8NarrowI32X4U] = I16X8NarrowI32X4U;
+  k->unop[O::I16X8ExtendLowI8X16S] = I16X8ExtendLowI8X16S;
+  k->unop[O::I16X8ExtendHighI8X16S] = I16X8ExtendHighI8X16S;
+  k->unop[O::I16X8ExtendLowI8X16U] = I16X8ExtendLowI8X16U;
+  k->unop[O::I16X8ExtendHighI8X16U] = I16X8ExtendHighI8X16U;
+  k->binop[O::I16X8ExtmulLowI8X16S] = I16X8ExtmulLowI8X16S;
+  k->binop[O::I16X8ExtmulHighI8X16S] = I16X8ExtmulHighI8X16S;
+  k->binop[O::I16X8ExtmulLowI8X16U] = I16X8ExtmulLowI8X16U;
+  k->binop[O::I16X8ExtmulHighI8X16U] = I16X8ExtmulHighI8X16U;
+  k->unop[O::I16X8ExtaddPairwiseI8X16S] = I16X8ExtaddPairwiseI8X16S;
+  k->unop[O::I16X8ExtaddPairwiseI8X16U] = I16X8ExtaddPairwiseI8X16U;
+
+  k->unop[O::I32X4Neg] = I32X4Neg;
+  k->unop[O::I32X4Abs] = I32X4Abs;
+  k->test[O::I32X4AllTrue] = I32X4AllTrue;
+  k->test[O::I32X4Bitmask] = I32X4Bitmask;
+  k->shift[O::I32X4Shl] = I32X4Shl;
+  k->shift[O::I32X4ShrS] = I32X4ShrS;
+  k->shift[O::I32X4ShrU] = I32X4ShrU;
+  k->binop[O::I32X4Add] = I32X4Add;
+  k->binop[O::I32X4Sub] = I32X4Sub;
+  k->binop[O::I32X4Mul] = I32X4Mul;
+  k->binop[O::I32X4MinS] = I32X4MinS;
+  k->binop[O::I32X4MinU] = I32X4MinU;
+  k->binop[O::I32X4MaxS] = I32X4MaxS;
+  k->binop[O::I32X4MaxU] = I32X4MaxU;
+  k->binop[O::I32X4Eq] = I32X4Eq;
+  k->binop[O::I32X4Ne] = I32X4Ne;
+  k->binop[O::I32X4LtS] = I32X4LtS;
+  k->binop[O::I32X4LtU] = I32X4LtU;
+  k->binop[O::I32X4GtS] = I32X4GtS;
+  k->binop[O::I32X4GtU] = I32X4GtU;
+  k->binop[O::I32X4LeS] = I32X4LeS;
+  k->binop[O::I32X4LeU] = I32X4LeU;
+  k->binop[O::I32X4GeS] = I32X4GeS;
+  k->binop[O::I32X4GeU] = I32X4GeU;
+  k->binop[O::I32X4DotI16X8S] = I32X4DotI16X8S;
+  k->unop[O::I32X4ExtendLowI16X8S] = I32X4ExtendLowI16X8S;
+  k->unop[O::I32X4ExtendHighI16X8S] = I32X4ExtendHighI16X8S;
+  k->unop[O::I32X4ExtendLowI16X8U] = I32X4ExtendLowI16X8U;
+  k->unop[O::I32X4ExtendHighI16X8U] = I32X4ExtendHighI16X8U;
+  k->binop[O::I32X4ExtmulLowI16X8S] = I32X4ExtmulLowI16X8S;
+  k->binop[O::I32X4ExtmulHighI16X8S] = I32X4ExtmulHighI16X8S;
+  k->binop[O::I32X4ExtmulLowI16X8U] = I32X4ExtmulLowI16X8U;
+  k->binop[O::I32X4ExtmulHighI16X8U] = I32X4ExtmulHighI16X8U;
+  k->unop[O::I32X4ExtaddPairwiseI16X8S] = I32X4ExtaddPairwiseI16X8S;
+  k->unop[O::I32X4ExtaddPairwiseI16X8U] = I32X4ExtaddPairwiseI16X8U;
+  k->unop[O::I32X4TruncSatF32X4S] = I32X4TruncSatF32X4S;
+  k->unop[O::I32X4TruncSatF32X4U] = I32X4TruncSatF32X4U;
+  k->unop[O::I32X4TruncSatF64X2SZero] = I32X4TruncSatF64X2SZero;
+  k->unop[O::I32X4TruncSatF64X2UZero] = I32X4TruncSatF64X2UZero;
+
+  k->unop[O::I64X2Neg] = I64X2Neg;
+  k->unop[O::I64X2Abs] = I64X2Abs;
+  k->test[O::I64X2AllTrue] = I64X2AllTrue;
+  k->test[O::I64X2Bitmask] = I64X2Bitmask;
+  k->shift[O::I64X2Shl] = I64X2Shl;
+  k->shift[O::I64X2ShrS] = I64X2ShrS;
+  k->shift[O::I64X2ShrU] = I64X2ShrU;
+  k->binop[O::I64X2Add] = I64X2Add;
+  k->binop[O::I64X2Sub] = I64X2Sub;
+  k->binop[O::I64X2Eq] = I64X2Eq;
+  k->binop[O::I64X2Ne] = I64X2Ne;
+  k->binop[O::I64X2LtS] = I64X2LtS;
+  k->binop[O::I64X2GtS] = I64X2GtS;
+  k->binop[O::I64X2LeS] = I64X2LeS;
+  k->binop[O::I64X2GeS] = I64X2GeS;
+  k->unop[O::I64X2ExtendLowI32X4S] = I64X2ExtendLowI32X4S;
+  k->unop[O::I64X2ExtendHighI32X4S] = I64X2ExtendHighI32X4S;
+  k->unop[O::I64X2ExtendLowI32X4U] = I64X2ExtendLowI32X4U;
+  k->unop[O::I64X2ExtendHighI32X4U] = I64X2ExtendHighI32X4U;
+  k->binop[O::I64X2ExtmulLowI32X4S] = I64X2ExtmulLowI32X4S;
+  k->binop[O::I64X2ExtmulHighI32X4S] = I64X2ExtmulHighI32X4S;
+  k->binop[O::I64X2ExtmulLowI32X4U] = I64X2ExtmulLowI32X4U;
+  k->binop[O::I64X2ExtmulHighI32X4U] = I64X2ExtmulHighI32X4U;
+
+  k->unop[O::F32X4Abs] = F32X4Abs;
+  k->unop[O::F32X4Neg] = F32X4Neg;
+  k->unop[O::F32X4Sqrt] = F32X4Sqrt;
+  k->unop[O::F32X4Ceil] = F32X4Ceil;
+  k->unop[O::F32X4Floor] = F32X4Floor;
+  k->unop[O::F32X4Trunc] = F32X4Trunc;
+  k->unop[O::F32X4Nearest] = F32X4Nearest;
+  k->binop[O::F32X4Add] = F32X4Add;
+  k->binop[O::F32X4Sub] = F32X4Sub;
+  k->binop[O::F32X4Mul] = F32X4Mul;
+  k->binop[O::F32X4Div] = F32X4Div;
+  k->binop[O::F32X4Min] = F32X4Min;
+  k->binop[O::F32X4Max] = F32X4Max;
+  k->binop[O::F32X4PMin] = F32X4PMin;
+  k->binop[O::F32X4PMax] = F32X4PMax;
+  k->binop[O::F32X4Eq] = F32X4Eq;
+  k->binop[O::F32X4Ne] = F32X4Ne;
+  k->binop[O::F32X4Lt] = F32X4Lt;
+  k->binop[O::F32X4Gt] = F32X4Gt;
+  k->binop[O::F32X4Le] = F32X4Le;
+  k->binop[O::F32X4Ge] = F32X4Ge;
+  k->unop[O::F32X4ConvertI32X4S] = F32X4ConvertI32X4S;
+  k->unop[O::F32X4ConvertI32X4U] = F32X4ConvertI32X4U;
+  k->unop[O::F32X4DemoteF64X2Zero] = F32X4DemoteF64X2Zero;
+
+  k->unop[O::F64X2Abs] = F64X2Abs;
+  k->unop[O::F64X2Neg] = F64X2Neg;
+  k->unop[O::F64X2Sqrt] = F64X2Sqrt;
+  k->unop[O::F64X2Ceil] = F64X2Ceil;
+  k->unop[O::F64X2Floor] = F64X2Floor;
+  k->unop[O::F64X2Trunc] = F64X2Trunc;
+  k->unop[O::F64X2Nearest] = F64X2Nearest;
+  k->binop[O::F64X2Add] = F64X2Add;
+  k->binop[O::F64X2Sub] = F64X2Sub;
+  k->binop[O::F64X2Mul] = F64X2Mul;
+  k->binop[O::F64X2Div] = F64X2Div;
+  k->binop[O::F64X2Min] = F64X2Min;
+  k->binop[O::F64X2Max] = F64X2Max;
+  k->binop[O::F64X2PMin] = F64X2PMin;
+  k->binop[O::F64X2PMax] = F64X2PMax;
+  k->binop[O::F64X2Eq] = F64X2Eq;
+  k->binop[O::F64X2Ne] = F64X2Ne;
+  k->binop[O::F64X2Lt] = F64X2Lt;
+  k->binop[O::F64X2Gt] = F64X2Gt;
+  k->binop[O::F64X2Le] = F64X2Le;
+  k->binop[O::F64X2Ge] = F64X2Ge;
+  k->unop[O::F64X2ConvertLowI32X4S] = F64X2ConvertLowI32X4S;
+  k->unop[O::F64X2ConvertLowI32X4U] = F64X2ConvertLowI32X4U;
+  k->unop[O::F64X2PromoteLowF32X4] = F64X2PromoteLowF32X4;
+}
+
+#endif  // WABT_SIMD_AARCH64
+
+SimdKernels* MakeNativeSimdKernels() {
+  auto* kernels = new SimdKernels();
+#if WABT_SIMD_X86_64
+  InitX86_64Kernels(kernels);
+#elif WABT_SIMD_AARCH64
+  InitAArch64Kernels(kernels);
+#endif
+  return kernels;
+}
+
+}  // end anonymous namespace
+
+const SimdKernels& GetNativeSimdKernels() {
+  static const SimdKernels* kernels = MakeNativeSimdKernels();
+  return *kernels;
+}
+
+const SimdKernels& GetPortableSimdKernels() {
+  static const SimdKernels* kernels = new SimdKernels();
+  return *kernels;
+}
+
+}  // namespace interp
+}  // namespace wabt
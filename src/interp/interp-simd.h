@@ -0,0 +1,59 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_SIMD_H_
+#define WABT_INTERP_SIMD_H_
+
+#include "src/interp/istream.h"
+
+namespace wabt {
+namespace interp {
+
+// Implementations of v128 instructions that use the host's vector
+// instructions, indexed by opcode. Each kernel produces the same bits as the
+// lane-at-a-time code in Thread, including NaN canonicalization, so which
+// table a thread uses is not observable. Thread falls back to running the
+// instruction one lane at a time when the entry for its opcode is null.
+struct SimdKernels {
+  using Unop = v128 (*)(v128);
+  using Binop = v128 (*)(v128, v128);
+  // bitselect, and i8x16.shuffle with its lane immediate as the third operand.
+  using Ternop = v128 (*)(v128, v128, v128);
+  using Shift = v128 (*)(v128, u32);
+  // any_true, all_true and bitmask.
+  using Test = u32 (*)(v128);
+
+  Unop unop[Opcode::Invalid] = {};
+  Binop binop[Opcode::Invalid] = {};
+  Ternop ternop[Opcode::Invalid] = {};
+  Shift shift[Opcode::Invalid] = {};
+  Test test[Opcode::Invalid] = {};
+};
+
+// Returns the kernels for the CPU this is running on, chosen the first time
+// it is called. On x86-64 the SSE2 kernels are always available, and the
+// SSSE3, SSE4.1 and SSE4.2 ones are added when cpuid reports them. On
+// little-endian AArch64 the NEON kernels are used. Other hosts get an empty
+// table.
+const SimdKernels& GetNativeSimdKernels();
+
+// A table with no kernels, so every instruction runs one lane at a time.
+const SimdKernels& GetPortableSimdKernels();
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif  // WABT_INTERP_SIMD_H_
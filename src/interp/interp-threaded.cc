@@ -0,0 +1,173 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp/interp-threaded.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+namespace wabt {
+namespace interp {
+
+namespace {
+
+using Offset = Istream::Offset;
+
+ThreadedOp GetThreadedOp(Opcode op) {
+  switch (op) {
+#define WABT_THREADED_OP(name) \
+  case Opcode::name:           \
+    return ThreadedOp::name;
+    WABT_FOREACH_THREADED_OPCODE(WABT_THREADED_OP)
+#undef WABT_THREADED_OP
+
+    default:
+      return ThreadedOp::Generic;
+  }
+}
+
+// Returns the offset of the instruction that `instr` branches to, or
+// kInvalidOffset if it isn't a branch.
+Offset GetBranchTarget(const Instr& instr) {
+  switch (instr.op) {
+    case Opcode::Br:
+    case Opcode::BrIf:
+    case Opcode::InterpBrUnless:
+    case Opcode::InterpI32LtSBrUnless:
+    case Opcode::InterpI32LtUBrUnless:
+      return instr.imm_u32;
+
+    default:
+      return Istream::kInvalidOffset;
+  }
+}
+
+}  // end anonymous namespace
+
+// static
+std::unique_ptr<ThreadedCode> ThreadedCode::Decode(
+    const Istream& istream,
+    Offset code_offset,
+    const void* const* handlers) {
+  std::map<Offset, ThreadedInstr> found;
+  std::vector<Offset> worklist = {code_offset};
+  while (!worklist.empty()) {
+    Offset offset = worklist.back();
+    worklist.pop_back();
+    if (found.count(offset)) {
+      continue;
+    }
+    ThreadedInstr decoded;
+    decoded.offset = offset;
+    decoded.next = offset;
+    decoded.instr = istream.Read(&decoded.next);
+    decoded.target = nullptr;
+    found[offset] = decoded;
+
+    const Instr& instr = decoded.instr;
+    switch (instr.op) {
+      case Opcode::Br:
+        worklist.push_back(instr.imm_u32);
+        break;
+
+      case Opcode::BrIf:
+      case Opcode::InterpBrUnless:
+      case Opcode::InterpI32LtSBrUnless:
+      case Opcode::InterpI32LtUBrUnless:
+        worklist.push_back(instr.imm_u32);
+        worklist.push_back(decoded.next);
+        break;
+
+      case Opcode::BrTable:
+        for (u32 i = 0; i <= instr.imm_u32; ++i) {
+          worklist.push_back(decoded.next + i * Istream::kBrTableEntrySize);
+        }
+        break;
+
+      // The Br after InterpAdjustFrameForReturnCall goes to another
+      // function.
+      case Opcode::Unreachable:
+      case Opcode::Return:
+      case Opcode::ReturnCall:
+      case Opcode::ReturnCallIndirect:
+      case Opcode::InterpAdjustFrameForReturnCall:
+      case Opcode::Throw:
+      case Opcode::Rethrow:
+        break;
+
+      default:
+        worklist.push_back(decoded.next);
+        break;
+    }
+  }
+
+  std::unique_ptr<ThreadedCode> code(new ThreadedCode);
+  auto& instrs = code->instrs_;
+  instrs.reserve(found.size() + 1);
+  for (auto&& pair : found) {
+    instrs.push_back(pair.second);
+  }
+
+  // Link the branches, now that the instructions won't move.
+  for (size_t i = 0; i < instrs.size(); ++i) {
+    ThreadedInstr& decoded = instrs[i];
+    ThreadedOp op = GetThreadedOp(decoded.instr.op);
+    Offset target = GetBranchTarget(decoded.instr);
+    if (target != Istream::kInvalidOffset) {
+      decoded.target = code->Find(target);
+      assert(decoded.target);
+    } else if (decoded.instr.op == Opcode::BrTable) {
+      // The handler indexes the entries, so it needs each to be three
+      // consecutive instructions. Otherwise the generic handler runs it.
+      u32 count = decoded.instr.imm_u32 + 1;
+      size_t end = i + 1 + 3 * count;
+      bool consecutive = end <= instrs.size();
+      for (u32 k = 0; consecutive && k < count; ++k) {
+        consecutive = instrs[i + 1 + 3 * k].offset ==
+                      decoded.next + k * Istream::kBrTableEntrySize;
+      }
+      if (consecutive) {
+        decoded.target = &instrs[i + 1];
+      } else {
+        op = ThreadedOp::Generic;
+      }
+    }
+    decoded.handler = handlers[static_cast<int>(op)];
+  }
+
+  ThreadedInstr end;
+  end.handler = handlers[static_cast<int>(ThreadedOp::Generic)];
+  end.instr.op = Opcode::Invalid;
+  end.offset = Istream::kInvalidOffset;
+  end.next = Istream::kInvalidOffset;
+  end.target = nullptr;
+  instrs.push_back(end);
+  return code;
+}
+
+const ThreadedInstr* ThreadedCode::Find(Offset offset) const {
+  auto iter = std::lower_bound(
+      instrs_.begin(), instrs_.end(), offset,
+      [](const ThreadedInstr& lhs, Offset rhs) { return lhs.offset < rhs; });
+  if (iter == instrs_.end() || iter->offset != offset) {
+    return nullptr;
+  }
+  return &*iter;
+}
+
+}  // namespace interp
+}  // namespace wabt
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_THREADED_H_
+#define WABT_INTERP_THREADED_H_
+
+#include <memory>
+#include <vector>
+
+#include "src/interp/istream.h"
+
+// Handler addresses are taken with the labels-as-values extension.
+#if defined(__GNUC__)
+#define WABT_INTERP_THREADED 1
+#else
+#define WABT_INTERP_THREADED 0
+#endif
+
+// The instructions that Thread::ThreadedInstructions has a handler of its own
+// for. All others share a generic handler, which runs them with
+// Thread::StepInternal.
+#define WABT_FOREACH_THREADED_OPCODE(V) \
+  V(Br)                                 \
+  V(BrIf)                               \
+  V(BrTable)                            \
+  V(InterpBrUnless)                     \
+  V(InterpI32LtSBrUnless)               \
+  V(InterpI32LtUBrUnless)               \
+  V(InterpConsumeFuel)                  \
+  V(InterpAlloca)                       \
+  V(InterpDropKeep)                     \
+  V(Drop)                               \
+  V(Select)                             \
+  V(LocalGet)                           \
+  V(LocalSet)                           \
+  V(LocalTee)                           \
+  V(GlobalGet)                          \
+  V(GlobalSet)                          \
+  V(InterpLocalGetLocalGet)             \
+  V(InterpI32AddImm)                    \
+  V(InterpI32LocalAddImm)               \
+  V(InterpLocalGetI32Load)              \
+  V(I32Load)                            \
+  V(I64Load)                            \
+  V(F32Load)                            \
+  V(F64Load)                            \
+  V(I32Load8S)                          \
+  V(I32Load8U)                          \
+  V(I32Load16S)                         \
+  V(I32Load16U)                         \
+  V(I64Load8S)                          \
+  V(I64Load8U)                          \
+  V(I64Load16S)                         \
+  V(I64Load16U)                         \
+  V(I64Load32S)                         \
+  V(I64Load32U)                         \
+  V(I32Store)                           \
+  V(I64Store)                           \
+  V(F32Store)                           \
+  V(F64Store)                           \
+  V(I32Store8)                          \
+  V(I32Store16)                         \
+  V(I64Store8)                          \
+  V(I64Store16)                         \
+  V(I64Store32)                         \
+  V(I32Const)                           \
+  V(I64Const)                           \
+  V(F32Const)                           \
+  V(F64Const)                           \
+  V(I32Eqz)                             \
+  V(I32Eq)                              \
+  V(I32Ne)                              \
+  V(I32LtS)                             \
+  V(I32LtU)                             \
+  V(I32GtS)                             \
+  V(I32GtU)                             \
+  V(I32LeS)                             \
+  V(I32LeU)                             \
+  V(I32GeS)                             \
+  V(I32GeU)                             \
+  V(I64Eqz)                             \
+  V(I64Eq)                              \
+  V(I64Ne)                              \
+  V(I64LtS)                             \
+  V(I64LtU)                             \
+  V(I64GtS)                             \
+  V(I64GtU)                             \
+  V(I64LeS)                             \
+  V(I64LeU)                             \
+  V(I64GeS)                             \
+  V(I64GeU)                             \
+  V(F32Eq)                              \
+  V(F32Ne)                              \
+  V(F32Lt)                              \
+  V(F32Gt)                              \
+  V(F32Le)                              \
+  V(F32Ge)                              \
+  V(F64Eq)                              \
+  V(F64Ne)                              \
+  V(F64Lt)                              \
+  V(F64Gt)                              \
+  V(F64Le)                              \
+  V(F64Ge)                              \
+  V(I32Add)                             \
+  V(I32Sub)                             \
+  V(I32Mul)                             \
+  V(I32And)                             \
+  V(I32Or)                              \
+  V(I32Xor)                             \
+  V(I32Shl)                             \
+  V(I32ShrS)                            \
+  V(I32ShrU)                            \
+  V(I64Add)                             \
+  V(I64Sub)                             \
+  V(I64Mul)                             \
+  V(I64And)                             \
+  V(I64Or)                              \
+  V(I64Xor)                             \
+  V(I64Shl)                             \
+  V(I64ShrS)                            \
+  V(I64ShrU)                            \
+  V(F32Add)                             \
+  V(F32Sub)                             \
+  V(F32Mul)                             \
+  V(F32Div)                             \
+  V(F64Add)                             \
+  V(F64Sub)                             \
+  V(F64Mul)                             \
+  V(F64Div)                             \
+  V(I32WrapI64)                         \
+  V(I64ExtendI32S)                      \
+  V(I64ExtendI32U)
+
+namespace wabt {
+namespace interp {
+
+// Indexes Thread::ThreadedInstructions' handler table.
+enum class ThreadedOp {
+  Generic,
+#define WABT_THREADED_OP(name) name,
+  WABT_FOREACH_THREADED_OPCODE(WABT_THREADED_OP)
+#undef WABT_THREADED_OP
+  Count,
+};
+
+// One decoded instruction of a ThreadedCode.
+struct ThreadedInstr {
+  const void* handler;
+  Instr instr;
+  Istream::Offset offset;  // Of the instruction in the istream.
+  Istream::Offset next;    // Of the instruction after it in the istream.
+  // The instruction that a branch goes to, or for a br_table, the first
+  // instruction of its first entry. Null for everything else.
+  const ThreadedInstr* target;
+};
+
+// The instructions of one function, decoded from its istream once so they
+// can be run without decoding them again, each with the address of the code
+// that runs it.
+//
+// Only the instructions that are reachable from the start of the function by
+// falling through or branching are decoded. The Thread runs the rest (the
+// catch handlers) with StepInternal.
+class ThreadedCode {
+ public:
+  // `handlers` is indexed by ThreadedOp.
+  static std::unique_ptr<ThreadedCode> Decode(const Istream&,
+                                              Istream::Offset code_offset,
+                                              const void* const* handlers);
+
+  ThreadedCode(const ThreadedCode&) = delete;
+  ThreadedCode& operator=(const ThreadedCode&) = delete;
+
+  // Returns the instruction at `offset`, or null if it wasn't decoded.
+  const ThreadedInstr* Find(Istream::Offset offset) const;
+
+ private:
+  ThreadedCode() = default;
+
+  // Sorted by istream offset, and followed by one at kInvalidOffset, so that
+  // every instruction has another after it.
+  std::vector<ThreadedInstr> instrs_;
+};
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif  // WABT_INTERP_THREADED_H_
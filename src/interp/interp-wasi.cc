@@ -36,6 +36,8 @@
 #include "uvwasi.h"
 
 #include <cinttypes>
+#include <cstring>
+#include <mutex>
 #include <unordered_map>
 
 using namespace wabt;
@@ -163,50 +165,50 @@ class WasiInstance {
   WasiInstance(Instance::Ptr instance,
                uvwasi_s* uvwasi,
                Memory* memory,
-               Stream* trace_stream)
+               Stream* trace_stream,
+               const WasiOptions& options)
       : trace_stream(trace_stream),
         instance(instance),
         uvwasi(uvwasi),
-        memory(memory) {}
+        memory(memory),
+        options(options) {}
 
-  Result random_get(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result random_get(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_errno_t __wasi_random_get(uint8_t * buf, __wasi_size_t buf_len) */
     assert(false);
     return Result::Ok;
   }
 
-  Result proc_exit(const Values& params, Values& results, Trap::Ptr* trap) {
-    const Value arg0 = params[0];
-    uvwasi_proc_exit(uvwasi, arg0.Get<u32>());
+  Result proc_exit(HostCallArgs& args, Trap::Ptr* trap) {
+    flushOutput();
+    uvwasi_proc_exit(uvwasi, args.param<u32>(0));
     return Result::Ok;
   }
 
-  Result poll_oneoff(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result poll_oneoff(HostCallArgs& args, Trap::Ptr* trap) {
     assert(false);
     return Result::Ok;
   }
 
-  Result clock_time_get(const Values& params,
-                        Values& results,
-                        Trap::Ptr* trap) {
+  Result clock_time_get(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_errno_t __wasi_clock_time_get(__wasi_clockid_t id,
      *                                      __wasi_timestamp_t precision,
      *                                      __wasi_timestamp_t *time)
      */
     __wasi_timestamp_t t;
-    results[0].Set<u32>(uvwasi_clock_time_get(uvwasi, params[0].Get<u32>(),
-                                              params[1].Get<u64>(), &t));
-    uint32_t time_ptr = params[2].Get<u32>();
+    args.set_result<u32>(0, uvwasi_clock_time_get(uvwasi, args.param<u32>(0),
+                                                  args.param<u64>(1), &t));
+    uint32_t time_ptr = args.param<u32>(2);
     CHECK_RESULT(writeValue<__wasi_timestamp_t>(t, time_ptr, trap));
     return Result::Ok;
   }
 
-  Result path_rename(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result path_rename(HostCallArgs& args, Trap::Ptr* trap) {
     assert(false);
     return Result::Ok;
   }
 
-  Result path_open(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result path_open(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_errno_t __wasi_path_open(__wasi_fd_t fd,
                                        __wasi_lookupflags_t dirflags,
                                        const char *path,
@@ -216,65 +218,64 @@ class WasiInstance {
                                        __wasi_rights_t fs_rights_inherting,
                                        __wasi_fdflags_t fdflags,
                                        __wasi_fd_t *opened_fd) */
-    uvwasi_fd_t dirfd = params[0].Get<u32>();
-    __wasi_lookupflags_t dirflags = params[1].Get<u32>();
-    uint32_t path_ptr = params[2].Get<u32>();
-    __wasi_size_t path_len = params[3].Get<u32>();
-    __wasi_oflags_t oflags = params[4].Get<u32>();
-    __wasi_rights_t fs_rights_base = params[5].Get<u32>();
-    __wasi_rights_t fs_rights_inherting = params[6].Get<u32>();
-    __wasi_fdflags_t fs_flags = params[7].Get<u32>();
-    uint32_t out_ptr = params[8].Get<u32>();
+    uvwasi_fd_t dirfd = args.param<u32>(0);
+    __wasi_lookupflags_t dirflags = args.param<u32>(1);
+    uint32_t path_ptr = args.param<u32>(2);
+    __wasi_size_t path_len = args.param<u32>(3);
+    __wasi_oflags_t oflags = args.param<u32>(4);
+    __wasi_rights_t fs_rights_base = args.param<u32>(5);
+    __wasi_rights_t fs_rights_inherting = args.param<u32>(6);
+    __wasi_fdflags_t fs_flags = args.param<u32>(7);
+    uint32_t out_ptr = args.param<u32>(8);
     char* path;
     CHECK_RESULT(getMemPtr<char>(path_ptr, path_len, &path, trap));
     if (trace_stream) {
       trace_stream->Writef("path_open : %s\n", path);
     }
     uvwasi_fd_t outfd;
-    results[0].Set<u32>(uvwasi_path_open(
-        uvwasi, dirfd, dirflags, path, path_len, oflags, fs_rights_base,
-        fs_rights_inherting, fs_flags, &outfd));
+    args.set_result<u32>(
+        0, uvwasi_path_open(uvwasi, dirfd, dirflags, path, path_len, oflags,
+                            fs_rights_base, fs_rights_inherting, fs_flags,
+                            &outfd));
     if (trace_stream) {
-      trace_stream->Writef("path_open -> %d\n", results[0].Get<u32>());
+      trace_stream->Writef("path_open -> %d\n", args.result<u32>(0));
     }
     CHECK_RESULT(writeValue<__wasi_fd_t>(outfd, out_ptr, trap));
     return Result::Ok;
   }
 
-  Result path_filestat_get(const Values& params,
-                           Values& results,
-                           Trap::Ptr* trap) {
+  Result path_filestat_get(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_errno_t __wasi_path_filestat_get(__wasi_fd_t fd,
      *                                         __wasi_lookupflags_t flags,
      *                                         const char *path,
      *                                         size_t path_len,
      *                                         __wasi_filestat_t *buf
      */
-    uvwasi_fd_t fd = params[0].Get<u32>();
-    __wasi_lookupflags_t flags = params[1].Get<u32>();
-    uint32_t path_ptr = params[2].Get<u32>();
-    uvwasi_size_t path_len = params[3].Get<u32>();
-    uint32_t filestat_ptr = params[4].Get<u32>();
+    uvwasi_fd_t fd = args.param<u32>(0);
+    __wasi_lookupflags_t flags = args.param<u32>(1);
+    uint32_t path_ptr = args.param<u32>(2);
+    uvwasi_size_t path_len = args.param<u32>(3);
+    uint32_t filestat_ptr = args.param<u32>(4);
     char* path;
     CHECK_RESULT(getMemPtr<char>(path_ptr, path_len, &path, trap));
     if (trace_stream) {
       trace_stream->Writef("path_filestat_get : %d %s\n", fd, path);
     }
     uvwasi_filestat_t buf;
-    results[0].Set<u32>(
-        uvwasi_path_filestat_get(uvwasi, fd, flags, path, path_len, &buf));
+    args.set_result<u32>(0, uvwasi_path_filestat_get(uvwasi, fd, flags, path,
+                                                     path_len, &buf));
     __wasi_filestat_t* filestat;
     CHECK_RESULT(getMemPtr<__wasi_filestat_t>(
         filestat_ptr, sizeof(__wasi_filestat_t), &filestat, trap));
     uvwasi_serdes_write_filestat_t(filestat, 0, &buf);
     if (trace_stream) {
       trace_stream->Writef("path_filestat_get -> size=%" PRIu64 " %d\n",
-                           buf.st_size, results[0].Get<u32>());
+                           buf.st_size, args.result<u32>(0));
     }
     return Result::Ok;
   }
 
-  Result path_symlink(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result path_symlink(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_errno_t __wasi_path_symlink(const char *old_path,
      *                                    size_t old_path_len,
      *                                    __wasi_fd_t fd,
@@ -282,11 +283,11 @@ class WasiInstance {
      *                                    size_t new_path_len);
      */
 
-    uint32_t old_path_ptr = params[0].Get<u32>();
-    __wasi_size_t old_path_len = params[1].Get<u32>();
-    uvwasi_fd_t fd = params[2].Get<u32>();
-    uint32_t new_path_ptr = params[3].Get<u32>();
-    __wasi_size_t new_path_len = params[4].Get<u32>();
+    uint32_t old_path_ptr = args.param<u32>(0);
+    __wasi_size_t old_path_len = args.param<u32>(1);
+    uvwasi_fd_t fd = args.param<u32>(2);
+    uint32_t new_path_ptr = args.param<u32>(3);
+    __wasi_size_t new_path_len = args.param<u32>(4);
     char* old_path;
     char* new_path;
     CHECK_RESULT(getMemPtr<char>(old_path_ptr, old_path_len, &old_path, trap));
@@ -294,129 +295,117 @@ class WasiInstance {
     if (trace_stream) {
       trace_stream->Writef("path_symlink %d %s : %s\n", fd, old_path, new_path);
     }
-    results[0].Set<u32>(uvwasi_path_symlink(uvwasi, old_path, old_path_len, fd,
-                                            new_path, new_path_len));
+    args.set_result<u32>(0, uvwasi_path_symlink(uvwasi, old_path, old_path_len,
+                                                fd, new_path, new_path_len));
     if (trace_stream) {
-      trace_stream->Writef("path_symlink -> %d\n", results[0].Get<u32>());
+      trace_stream->Writef("path_symlink -> %d\n", args.result<u32>(0));
     }
     return Result::Ok;
   }
 
-  Result path_readlink(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result path_readlink(HostCallArgs& args, Trap::Ptr* trap) {
     assert(false);
     return Result::Ok;
   }
 
-  Result path_create_directory(const Values& params,
-                               Values& results,
-                               Trap::Ptr* trap) {
+  Result path_create_directory(HostCallArgs& args, Trap::Ptr* trap) {
     assert(false);
     return Result::Ok;
   }
 
-  Result path_remove_directory(const Values& params,
-                               Values& results,
-                               Trap::Ptr* trap) {
+  Result path_remove_directory(HostCallArgs& args, Trap::Ptr* trap) {
     assert(false);
     return Result::Ok;
   }
 
-  Result path_unlink_file(const Values& params,
-                          Values& results,
-                          Trap::Ptr* trap) {
+  Result path_unlink_file(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_errno_t __wasi_path_unlink_file(__wasi_fd_t fd,
      *                                        const char *path,
      *                                        size_t path_len)
      */
-    uvwasi_fd_t fd = params[0].Get<u32>();
-    uint32_t path_ptr = params[1].Get<u32>();
-    __wasi_size_t path_len = params[2].Get<u32>();
+    uvwasi_fd_t fd = args.param<u32>(0);
+    uint32_t path_ptr = args.param<u32>(1);
+    __wasi_size_t path_len = args.param<u32>(2);
     char* path;
     CHECK_RESULT(getMemPtr<char>(path_ptr, path_len, &path, trap));
     if (trace_stream) {
       trace_stream->Writef("path_unlink_file %d %s\n", fd, path);
     }
-    results[0].Set<u32>(uvwasi_path_unlink_file(uvwasi, fd, path, path_len));
+    args.set_result<u32>(0,
+                         uvwasi_path_unlink_file(uvwasi, fd, path, path_len));
     return Result::Ok;
   }
 
-  Result fd_prestat_get(const Values& params,
-                        Values& results,
-                        Trap::Ptr* trap) {
+  Result fd_prestat_get(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_errno_t __wasi_fd_prestat_get(__wasi_fd_t fd,
      *                                      __wasi_prestat_t *buf))
      */
-    uvwasi_fd_t fd = params[0].Get<u32>();
-    uint32_t prestat_ptr = params[1].Get<u32>();
+    uvwasi_fd_t fd = args.param<u32>(0);
+    uint32_t prestat_ptr = args.param<u32>(1);
     if (trace_stream) {
       trace_stream->Writef("fd_prestat_get %d\n", fd);
     }
     uvwasi_prestat_t buf;
-    results[0].Set<u32>(uvwasi_fd_prestat_get(uvwasi, fd, &buf));
+    args.set_result<u32>(0, uvwasi_fd_prestat_get(uvwasi, fd, &buf));
     __wasi_prestat_t* prestat;
     CHECK_RESULT(getMemPtr<__wasi_prestat_t>(prestat_ptr, 1, &prestat, trap));
     uvwasi_serdes_write_prestat_t(prestat, 0, &buf);
     if (trace_stream) {
-      trace_stream->Writef("fd_prestat_get -> %d\n", results[0].Get<u32>());
+      trace_stream->Writef("fd_prestat_get -> %d\n", args.result<u32>(0));
     }
     return Result::Ok;
   }
 
-  Result fd_prestat_dir_name(const Values& params,
-                             Values& results,
-                             Trap::Ptr* trap) {
-    uvwasi_fd_t fd = params[0].Get<u32>();
-    uint32_t path_ptr = params[1].Get<u32>();
-    uvwasi_size_t path_len = params[2].Get<u32>();
+  Result fd_prestat_dir_name(HostCallArgs& args, Trap::Ptr* trap) {
+    uvwasi_fd_t fd = args.param<u32>(0);
+    uint32_t path_ptr = args.param<u32>(1);
+    uvwasi_size_t path_len = args.param<u32>(2);
     if (trace_stream) {
       trace_stream->Writef("fd_prestat_dir_name %d %d %d\n", fd, path_ptr,
                            path_len);
     }
     char* path;
     CHECK_RESULT(getMemPtr<char>(path_ptr, path_len, &path, trap));
-    results[0].Set<u32>(uvwasi_fd_prestat_dir_name(uvwasi, fd, path, path_len));
+    args.set_result<u32>(
+        0, uvwasi_fd_prestat_dir_name(uvwasi, fd, path, path_len));
     if (trace_stream) {
       trace_stream->Writef("fd_prestat_dir_name %d -> %d %s %d\n", fd,
-                           results[0].Get<u32>(), path, path_len);
+                           args.result<u32>(0), path, path_len);
     }
     return Result::Ok;
   }
 
-  Result fd_filestat_get(const Values& params,
-                         Values& results,
-                         Trap::Ptr* trap) {
+  Result fd_filestat_get(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_fd_filestat_get(__wasi_fd_t f, __wasi_filestat_t *buf) */
-    uvwasi_fd_t fd = params[0].Get<u32>();
-    uint32_t filestat_ptr = params[1].Get<u32>();
+    uvwasi_fd_t fd = args.param<u32>(0);
+    uint32_t filestat_ptr = args.param<u32>(1);
     uvwasi_filestat_t buf;
-    results[0].Set<u32>(uvwasi_fd_filestat_get(uvwasi, fd, &buf));
+    args.set_result<u32>(0, uvwasi_fd_filestat_get(uvwasi, fd, &buf));
     __wasi_filestat_t* filestat;
     CHECK_RESULT(getMemPtr<__wasi_filestat_t>(
         filestat_ptr, sizeof(__wasi_filestat_t), &filestat, trap));
     uvwasi_serdes_write_filestat_t(filestat, 0, &buf);
     if (trace_stream) {
       trace_stream->Writef("fd_filestat_get -> size=%" PRIu64 " %d\n",
-                           buf.st_size, results[0].Get<u32>());
+                           buf.st_size, args.result<u32>(0));
     }
     return Result::Ok;
   }
 
-  Result fd_fdstat_set_flags(const Values& params,
-                             Values& results,
-                             Trap::Ptr* trap) {
+  Result fd_fdstat_set_flags(HostCallArgs& args, Trap::Ptr* trap) {
     assert(false);
     return Result::Ok;
   }
 
-  Result fd_fdstat_get(const Values& params, Values& results, Trap::Ptr* trap) {
-    int32_t fd = params[0].Get<u32>();
-    uint32_t stat_ptr = params[1].Get<u32>();
+  Result fd_fdstat_get(HostCallArgs& args, Trap::Ptr* trap) {
+    int32_t fd = args.param<u32>(0);
+    uint32_t stat_ptr = args.param<u32>(1);
     if (trace_stream) {
       trace_stream->Writef("fd_fdstat_get %d\n", fd);
     }
     CHECK_RESULT(getMemPtr<__wasi_fdstat_t>(stat_ptr, 1, nullptr, trap));
     uvwasi_fdstat_t host_statbuf;
-    results[0].Set<u32>(uvwasi_fd_fdstat_get(uvwasi, fd, &host_statbuf));
+    args.set_result<u32>(0, uvwasi_fd_fdstat_get(uvwasi, fd, &host_statbuf));
 
     // Write the host statbuf into the target wasm memory
     __wasi_fdstat_t* statbuf;
@@ -425,96 +414,154 @@ class WasiInstance {
     return Result::Ok;
   }
 
-  Result fd_read(const Values& params, Values& results, Trap::Ptr* trap) {
-    int32_t fd = params[0].Get<u32>();
-    int32_t iovptr = params[1].Get<u32>();
-    int32_t iovcnt = params[2].Get<u32>();
-    int32_t out_ptr = params[2].Get<u32>();
+  Result fd_read(HostCallArgs& args, Trap::Ptr* trap) {
+    /* __wasi_errno_t __wasi_fd_read(__wasi_fd_t fd,
+     *                               const __wasi_iovec_t *iovs,
+     *                               size_t iovs_len,
+     *                               __wasi_size_t *nread)
+     */
+    uvwasi_fd_t fd = args.param<u32>(0);
+    uint32_t iovcnt = args.param<u32>(2);
     if (trace_stream) {
       trace_stream->Writef("fd_read %d [%d]\n", fd, iovcnt);
     }
-    __wasi_iovec_t* wasm_iovs;
-    CHECK_RESULT(getMemPtr<__wasi_iovec_t>(iovptr, iovcnt, &wasm_iovs, trap));
-    std::vector<uvwasi_iovec_t> iovs(iovcnt);
-    for (int i = 0; i < iovcnt; i++) {
-      iovs[i].buf_len = wasm_iovs[i].buf_len;
-
-      CHECK_RESULT(getMemPtr<uint8_t>(wasm_iovs[i].buf, wasm_iovs[i].buf_len,
-                                      reinterpret_cast<uint8_t**>(&iovs[i].buf),
-                                      trap));
-    }
-    __wasi_ptr_t* out_addr;
-    CHECK_RESULT(getMemPtr<__wasi_ptr_t>(out_ptr, 1, &out_addr, trap));
-    results[0].Set<u32>(
-        uvwasi_fd_read(uvwasi, fd, iovs.data(), iovs.size(), out_addr));
+    CHECK_RESULT(getIovecs(args.param<u32>(1), iovcnt, &iovs, trap));
+    __wasi_size_t* out_addr;
+    CHECK_RESULT(
+        getMemPtr<__wasi_size_t>(args.param<u32>(3), 1, &out_addr, trap));
+    // The guest may be waiting for input after a prompt.
+    flushOutput();
+    args.set_result<u32>(
+        0, uvwasi_fd_read(uvwasi, fd, iovs.data(), iovs.size(), out_addr));
     if (trace_stream) {
-      trace_stream->Writef("fd_read -> %d\n", results[0].Get<u32>());
+      trace_stream->Writef("fd_read -> %d\n", args.result<u32>(0));
     }
     return Result::Ok;
   }
 
-  Result fd_pread(const Values& params, Values& results, Trap::Ptr* trap) {
-    assert(false);
+  Result fd_pread(HostCallArgs& args, Trap::Ptr* trap) {
+    /* __wasi_errno_t __wasi_fd_pread(__wasi_fd_t fd,
+     *                                const __wasi_iovec_t *iovs,
+     *                                size_t iovs_len,
+     *                                __wasi_filesize_t offset,
+     *                                __wasi_size_t *nread)
+     */
+    uvwasi_fd_t fd = args.param<u32>(0);
+    CHECK_RESULT(getIovecs(args.param<u32>(1), args.param<u32>(2), &iovs,
+                           trap));
+    __wasi_filesize_t offset = args.param<u64>(3);
+    __wasi_size_t* out_addr;
+    CHECK_RESULT(
+        getMemPtr<__wasi_size_t>(args.param<u32>(4), 1, &out_addr, trap));
+    flushOutput();
+    args.set_result<u32>(0, uvwasi_fd_pread(uvwasi, fd, iovs.data(),
+                                            iovs.size(), offset, out_addr));
+    if (trace_stream) {
+      trace_stream->Writef("fd_pread %d %" PRIu64 " -> %d\n", fd, offset,
+                           args.result<u32>(0));
+    }
     return Result::Ok;
   }
 
-  Result fd_readdir(const Values& params, Values& results, Trap::Ptr* trap) {
-    assert(false);
+  Result fd_readdir(HostCallArgs& args, Trap::Ptr* trap) {
+    /* __wasi_errno_t __wasi_fd_readdir(__wasi_fd_t fd,
+     *                                  uint8_t *buf,
+     *                                  __wasi_size_t buf_len,
+     *                                  __wasi_dircookie_t cookie,
+     *                                  __wasi_size_t *bufused)
+     */
+    uvwasi_fd_t fd = args.param<u32>(0);
+    __wasi_size_t buf_len = args.param<u32>(2);
+    uint64_t cookie = args.param<u64>(3);
+    uint8_t* buf;
+    CHECK_RESULT(getMemPtr<uint8_t>(args.param<u32>(1), buf_len, &buf, trap));
+    __wasi_size_t* out_addr;
+    CHECK_RESULT(
+        getMemPtr<__wasi_size_t>(args.param<u32>(4), 1, &out_addr, trap));
+    // uvwasi writes the entries in the WASI layout, so they go straight into
+    // the guest's buffer.
+    args.set_result<u32>(
+        0, uvwasi_fd_readdir(uvwasi, fd, buf, buf_len, cookie, out_addr));
+    if (trace_stream) {
+      trace_stream->Writef("fd_readdir %d %" PRIu64 " -> %d\n", fd, cookie,
+                           args.result<u32>(0));
+    }
     return Result::Ok;
   }
 
-  Result fd_write(const Values& params, Values& results, Trap::Ptr* trap) {
-    int32_t fd = params[0].Get<u32>();
-    int32_t iovptr = params[1].Get<u32>();
-    int32_t iovcnt = params[2].Get<u32>();
-    __wasi_iovec_t* wasm_iovs;
-    CHECK_RESULT(getMemPtr<__wasi_iovec_t>(iovptr, iovcnt, &wasm_iovs, trap));
-    std::vector<uvwasi_ciovec_t> iovs(iovcnt);
-    for (int i = 0; i < iovcnt; i++) {
-      iovs[i].buf_len = wasm_iovs[i].buf_len;
-      CHECK_RESULT(getMemPtr<const uint8_t>(
-          wasm_iovs[i].buf, wasm_iovs[i].buf_len,
-          reinterpret_cast<const uint8_t**>(&iovs[i].buf), trap));
-    }
-    __wasi_ptr_t* out_addr;
+  Result fd_write(HostCallArgs& args, Trap::Ptr* trap) {
+    /* __wasi_errno_t __wasi_fd_write(__wasi_fd_t fd,
+     *                                const __wasi_ciovec_t *iovs,
+     *                                size_t iovs_len,
+     *                                __wasi_size_t *nwritten)
+     */
+    uvwasi_fd_t fd = args.param<u32>(0);
+    CHECK_RESULT(getIovecs(args.param<u32>(1), args.param<u32>(2), &ciovs,
+                           trap));
+    __wasi_size_t* out_addr;
     CHECK_RESULT(
-        getMemPtr<__wasi_ptr_t>(params[3].Get<u32>(), 1, &out_addr, trap));
-    results[0].Set<u32>(
-        uvwasi_fd_write(uvwasi, fd, iovs.data(), iovs.size(), out_addr));
+        getMemPtr<__wasi_size_t>(args.param<u32>(3), 1, &out_addr, trap));
+    if (options.output_buffer_size != 0 && (fd == 1 || fd == 2)) {
+      args.set_result<u32>(0, bufferOutput(fd, out_addr));
+      return Result::Ok;
+    }
+    flushOutput();
+    args.set_result<u32>(
+        0, uvwasi_fd_write(uvwasi, fd, ciovs.data(), ciovs.size(), out_addr));
     return Result::Ok;
   }
 
-  Result fd_pwrite(const Values& params, Values& results, Trap::Ptr* trap) {
-    assert(false);
+  Result fd_pwrite(HostCallArgs& args, Trap::Ptr* trap) {
+    /* __wasi_errno_t __wasi_fd_pwrite(__wasi_fd_t fd,
+     *                                 const __wasi_ciovec_t *iovs,
+     *                                 size_t iovs_len,
+     *                                 __wasi_filesize_t offset,
+     *                                 __wasi_size_t *nwritten)
+     */
+    uvwasi_fd_t fd = args.param<u32>(0);
+    CHECK_RESULT(getIovecs(args.param<u32>(1), args.param<u32>(2), &ciovs,
+                           trap));
+    __wasi_filesize_t offset = args.param<u64>(3);
+    __wasi_size_t* out_addr;
+    CHECK_RESULT(
+        getMemPtr<__wasi_size_t>(args.param<u32>(4), 1, &out_addr, trap));
+    flushOutput();
+    args.set_result<u32>(0, uvwasi_fd_pwrite(uvwasi, fd, ciovs.data(),
+                                             ciovs.size(), offset, out_addr));
+    if (trace_stream) {
+      trace_stream->Writef("fd_pwrite %d %" PRIu64 " -> %d\n", fd, offset,
+                           args.result<u32>(0));
+    }
     return Result::Ok;
   }
 
-  Result fd_close(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result fd_close(HostCallArgs& args, Trap::Ptr* trap) {
     assert(false);
     return Result::Ok;
   }
 
-  Result fd_seek(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result fd_seek(HostCallArgs& args, Trap::Ptr* trap) {
     /* __wasi_errno_t __wasi_fd_seek(__wasi_fd_t fd,
      *                               __wasi_filedelta_t offset,
      *                               __wasi_whence_t whence,
      *                               __wasi_filesize_t *newoffset)
      */
-    int32_t fd = params[0].Get<u32>();
-    __wasi_filedelta_t offset = params[1].Get<u32>();
-    __wasi_whence_t whence = params[2].Get<u32>();
-    uint32_t newoffset_ptr = params[3].Get<u32>();
+    int32_t fd = args.param<u32>(0);
+    __wasi_filedelta_t offset = args.param<u32>(1);
+    __wasi_whence_t whence = args.param<u32>(2);
+    uint32_t newoffset_ptr = args.param<u32>(3);
     uvwasi_filesize_t newoffset;
-    results[0].Set<u32>(uvwasi_fd_seek(uvwasi, fd, offset, whence, &newoffset));
+    args.set_result<u32>(
+        0, uvwasi_fd_seek(uvwasi, fd, offset, whence, &newoffset));
     CHECK_RESULT(writeValue<__wasi_filesize_t>(newoffset, newoffset_ptr, trap));
     return Result::Ok;
   }
 
-  Result environ_get(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result environ_get(HostCallArgs& args, Trap::Ptr* trap) {
     uvwasi_size_t environc;
     uvwasi_size_t environ_buf_size;
     uvwasi_environ_sizes_get(uvwasi, &environc, &environ_buf_size);
-    uint32_t wasm_buf = params[1].Get<u32>();
+    uint32_t wasm_buf = args.param<u32>(1);
     char* buf;
     CHECK_RESULT(getMemPtr<char>(wasm_buf, environ_buf_size, &buf, trap));
     std::vector<char*> host_env(environc);
@@ -523,36 +570,34 @@ class WasiInstance {
     // Copy host_env pointer array wasm_env)
     for (uvwasi_size_t i = 0; i < environc; i++) {
       uint32_t rel_address = host_env[i] - buf;
-      uint32_t dest = params[0].Get<u32>() + (i * sizeof(uint32_t));
+      uint32_t dest = args.param<u32>(0) + (i * sizeof(uint32_t));
       CHECK_RESULT(writeValue<uint32_t>(wasm_buf + rel_address, dest, trap));
     }
 
-    results[0].Set<u32>(__WASI_ERRNO_SUCCESS);
+    args.set_result<u32>(0, __WASI_ERRNO_SUCCESS);
     return Result::Ok;
   }
 
-  Result environ_sizes_get(const Values& params,
-                           Values& results,
-                           Trap::Ptr* trap) {
+  Result environ_sizes_get(HostCallArgs& args, Trap::Ptr* trap) {
     uvwasi_size_t environc;
     uvwasi_size_t environ_buf_size;
     uvwasi_environ_sizes_get(uvwasi, &environc, &environ_buf_size);
-    CHECK_RESULT(writeValue<uint32_t>(environc, params[0].Get<u32>(), trap));
+    CHECK_RESULT(writeValue<uint32_t>(environc, args.param<u32>(0), trap));
     CHECK_RESULT(
-        writeValue<uint32_t>(environ_buf_size, params[1].Get<u32>(), trap));
+        writeValue<uint32_t>(environ_buf_size, args.param<u32>(1), trap));
     if (trace_stream) {
       trace_stream->Writef("environ_sizes_get -> %d %d\n", environc,
                            environ_buf_size);
     }
-    results[0].Set<u32>(__WASI_ERRNO_SUCCESS);
+    args.set_result<u32>(0, __WASI_ERRNO_SUCCESS);
     return Result::Ok;
   }
 
-  Result args_get(const Values& params, Values& results, Trap::Ptr* trap) {
+  Result args_get(HostCallArgs& args, Trap::Ptr* trap) {
     uvwasi_size_t argc;
     uvwasi_size_t arg_buf_size;
     uvwasi_args_sizes_get(uvwasi, &argc, &arg_buf_size);
-    uint32_t wasm_buf = params[1].Get<u32>();
+    uint32_t wasm_buf = args.param<u32>(1);
     char* buf;
     CHECK_RESULT(getMemPtr<char>(wasm_buf, arg_buf_size, &buf, trap));
     std::vector<char*> host_args(argc);
@@ -561,35 +606,103 @@ class WasiInstance {
     // Copy host_args pointer array wasm_args)
     for (uvwasi_size_t i = 0; i < argc; i++) {
       uint32_t rel_address = host_args[i] - buf;
-      uint32_t dest = params[0].Get<u32>() + (i * sizeof(uint32_t));
+      uint32_t dest = args.param<u32>(0) + (i * sizeof(uint32_t));
       CHECK_RESULT(writeValue<uint32_t>(wasm_buf + rel_address, dest, trap));
     }
-    results[0].Set<u32>(__WASI_ERRNO_SUCCESS);
+    args.set_result<u32>(0, __WASI_ERRNO_SUCCESS);
     return Result::Ok;
   }
 
-  Result args_sizes_get(const Values& params,
-                        Values& results,
-                        Trap::Ptr* trap) {
+  Result args_sizes_get(HostCallArgs& args, Trap::Ptr* trap) {
     uvwasi_size_t argc;
     uvwasi_size_t arg_buf_size;
     uvwasi_args_sizes_get(uvwasi, &argc, &arg_buf_size);
-    CHECK_RESULT(writeValue<uint32_t>(argc, params[0].Get<u32>(), trap));
+    CHECK_RESULT(writeValue<uint32_t>(argc, args.param<u32>(0), trap));
     CHECK_RESULT(
-        writeValue<uint32_t>(arg_buf_size, params[1].Get<u32>(), trap));
+        writeValue<uint32_t>(arg_buf_size, args.param<u32>(1), trap));
     if (trace_stream) {
       trace_stream->Writef("args_sizes_get -> %d %d\n", argc, arg_buf_size);
     }
-    results[0].Set<u32>(__WASI_ERRNO_SUCCESS);
+    args.set_result<u32>(0, __WASI_ERRNO_SUCCESS);
     return Result::Ok;
   }
 
+  // Writes out the output collected by fd_write; see
+  // WasiOptions::output_buffer_size.
+  void flushOutput() {
+    size_t offset = 0;
+    while (offset < output.size()) {
+      uvwasi_ciovec_t iov;
+      iov.buf = output.data() + offset;
+      iov.buf_len = output.size() - offset;
+      uvwasi_size_t nwritten;
+      if (uvwasi_fd_write(uvwasi, output_fd, &iov, 1, &nwritten) !=
+              UVWASI_ESUCCESS ||
+          nwritten == 0) {
+        break;
+      }
+      offset += nwritten;
+    }
+    output.clear();
+  }
+
   // The trace stream accosiated with the instance.
   Stream* trace_stream;
 
   Instance::Ptr instance;
 
  private:
+  // Adds the data in `ciovs` to the output buffer. The buffer only holds
+  // output for one fd, so that the output of stdout and stderr stays in
+  // order. A write that doesn't fit in the buffer goes straight from the
+  // guest's memory.
+  uvwasi_errno_t bufferOutput(uvwasi_fd_t fd, __wasi_size_t* out_nwritten) {
+    size_t size = 0;
+    for (const uvwasi_ciovec_t& iov : ciovs) {
+      size += iov.buf_len;
+    }
+    if (fd != output_fd || output.size() + size > options.output_buffer_size) {
+      flushOutput();
+      output_fd = fd;
+    }
+    if (size >= options.output_buffer_size) {
+      return uvwasi_fd_write(uvwasi, fd, ciovs.data(), ciovs.size(),
+                             out_nwritten);
+    }
+    bool newline = false;
+    for (const uvwasi_ciovec_t& iov : ciovs) {
+      auto* buf = static_cast<const uint8_t*>(iov.buf);
+      output.insert(output.end(), buf, buf + iov.buf_len);
+      newline = newline || memchr(buf, '\n', iov.buf_len);
+    }
+    *out_nwritten = size;
+    if (newline && options.line_buffered) {
+      flushOutput();
+    }
+    return UVWASI_ESUCCESS;
+  }
+
+  // Translates the guest's iovecs at `iovptr` to host pointers in `out_iovs`.
+  // The vectors are members, so a call doesn't allocate once they are large
+  // enough.
+  template <typename T>
+  Result getIovecs(uint32_t iovptr,
+                   uint32_t iovcnt,
+                   std::vector<T>* out_iovs,
+                   Trap::Ptr* trap) {
+    __wasi_iovec_t* wasm_iovs;
+    CHECK_RESULT(getMemPtr<__wasi_iovec_t>(iovptr, iovcnt, &wasm_iovs, trap));
+    out_iovs->resize(iovcnt);
+    for (uint32_t i = 0; i < iovcnt; i++) {
+      uint8_t* buf;
+      CHECK_RESULT(getMemPtr<uint8_t>(wasm_iovs[i].buf, wasm_iovs[i].buf_len,
+                                      &buf, trap));
+      (*out_iovs)[i].buf = buf;
+      (*out_iovs)[i].buf_len = wasm_iovs[i].buf_len;
+    }
+    return Result::Ok;
+  }
+
   // Write a value into wasm-memory and the given memory offset.
   template <typename T>
   Result writeValue(T value, uint32_t target_address, Trap::Ptr* trap) {
@@ -624,23 +737,44 @@ class WasiInstance {
   // The memory accociated with the instance.  Looked up once on startup
   // and cached here.
   Memory* memory;
+  WasiOptions options;
+
+  // Scratch space for getIovecs.
+  std::vector<uvwasi_iovec_t> iovs;
+  std::vector<uvwasi_ciovec_t> ciovs;
+
+  std::vector<uint8_t> output;
+  uvwasi_fd_t output_fd = 1;
 };
 
+// Guest threads register their instances concurrently.
+std::mutex wasiInstancesMutex;
 std::unordered_map<Instance*, WasiInstance*> wasiInstances;
 
+// The instance that WasiRunFunc is running on this OS thread. WASI calls
+// nearly always come from it, so they can usually skip the lock.
+thread_local WasiInstance* currentWasiInstance;
+
+WasiInstance* GetWasiInstance(Instance* instance) {
+  if (currentWasiInstance && currentWasiInstance->instance.get() == instance) {
+    return currentWasiInstance;
+  }
+  std::lock_guard<std::mutex> lock(wasiInstancesMutex);
+  return wasiInstances[instance];
+}
+
 // TODO(sbc): Auto-generate this.
 
-#define WASI_CALLBACK(NAME)                                                 \
-  static Result NAME(Thread& thread, const Values& params, Values& results, \
-                     Trap::Ptr* trap) {                                     \
-    Instance* instance = thread.GetCallerInstance();                        \
-    assert(instance);                                                       \
-    WasiInstance* wasi_instance = wasiInstances[instance];                  \
-    if (wasi_instance->trace_stream) {                                      \
-      wasi_instance->trace_stream->Writef(                                  \
-          ">>> running wasi function \"%s\":\n", #NAME);                    \
-    }                                                                       \
-    return wasi_instance->NAME(params, results, trap);                      \
+#define WASI_CALLBACK(NAME)                                                   \
+  static Result NAME(Thread& thread, HostCallArgs& args, Trap::Ptr* trap) {   \
+    Instance* instance = thread.GetCallerInstance();                          \
+    assert(instance);                                                         \
+    WasiInstance* wasi_instance = GetWasiInstance(instance);                  \
+    if (wasi_instance->trace_stream) {                                        \
+      wasi_instance->trace_stream->Writef(                                    \
+          ">>> running wasi function \"%s\":\n", #NAME);                      \
+    }                                                                         \
+    return wasi_instance->NAME(args, trap);                                   \
   }
 
 #define WASI_FUNC(NAME) WASI_CALLBACK(NAME)
@@ -657,7 +791,14 @@ Result WasiBindImports(const Module::Ptr& module,
                        Stream* stream,
                        Stream* trace_stream) {
   Store* store = module.store();
-  for (auto&& import : module->desc().imports) {
+  auto&& module_imports = module->desc().imports;
+  imports.resize(module_imports.size(), Ref::Null);
+  for (Index i = 0; i < module_imports.size(); ++i) {
+    auto&& import = module_imports[i];
+    if (imports[i] != Ref::Null) {
+      continue;  // Already bound by the caller.
+    }
+
     if (import.type.type->kind != ExternKind::Func) {
       stream->Writef("wasi error: invalid import type: %s\n",
                      import.type.name.c_str());
@@ -688,38 +829,55 @@ Result WasiBindImports(const Module::Ptr& module,
     stream->Writef("unknown wasi API import: `%s`\n", import.type.name.c_str());
     return Result::Error;
   found:
-    imports.push_back(host_func.ref());
+    imports[i] = host_func.ref();
   }
 
   return Result::Ok;
 }
 
-Result WasiRunStart(const Instance::Ptr& instance,
-                    uvwasi_s* uvwasi,
-                    Stream* err_stream,
-                    Stream* trace_stream) {
+// Returns the memory that the WASI functions use: the one exported as
+// "memory", or else an imported memory, as wasi-threads programs import a
+// shared memory.
+static Memory::Ptr FindWasiMemory(const Instance::Ptr& instance,
+                                  Stream* err_stream) {
   Store* store = instance.store();
   auto module = store->UnsafeGet<Module>(instance->module());
   auto&& module_desc = module->desc();
-
-  Func::Ptr start;
-  Memory::Ptr memory;
   for (auto&& export_ : module_desc.exports) {
     if (export_.type.name == "memory") {
       if (export_.type.type->kind != ExternalKind::Memory) {
         err_stream->Writef("wasi error: memory export has incorrect type\n");
-        return Result::Error;
+        return {};
       }
-      memory = store->UnsafeGet<Memory>(instance->memories()[export_.index]);
+      return store->UnsafeGet<Memory>(instance->memories()[export_.index]);
+    }
+  }
+  for (auto&& import : module_desc.imports) {
+    if (import.type.type->kind == ExternalKind::Memory) {
+      return store->UnsafeGet<Memory>(instance->memories()[0]);
     }
+  }
+  err_stream->Writef("wasi error: memory export not found\n");
+  return {};
+}
+
+Result WasiRunStart(const Instance::Ptr& instance,
+                    uvwasi_s* uvwasi,
+                    Stream* err_stream,
+                    const Thread::Options& thread_options,
+                    const WasiOptions& wasi_options) {
+  Store* store = instance.store();
+  auto module = store->UnsafeGet<Module>(instance->module());
+  auto&& module_desc = module->desc();
+
+  Func::Ptr start;
+  for (auto&& export_ : module_desc.exports) {
     if (export_.type.name == "_start") {
       if (export_.type.type->kind != ExternalKind::Func) {
         err_stream->Writef("wasi error: _start export is not a function\n");
         return Result::Error;
       }
       start = store->UnsafeGet<Func>(instance->funcs()[export_.index]);
-    }
-    if (start && memory) {
       break;
     }
   }
@@ -729,31 +887,55 @@ Result WasiRunStart(const Instance::Ptr& instance,
     return Result::Error;
   }
 
-  if (!memory) {
-    err_stream->Writef("wasi error: memory export not found\n");
-    return Result::Error;
-  }
-
   if (start->type().params.size() || start->type().results.size()) {
     err_stream->Writef("wasi error: invalid _start signature\n");
     return Result::Error;
   }
 
-  // Register memory
-  WasiInstance wasi(instance, uvwasi, memory.get(), trace_stream);
-  wasiInstances[instance.get()] = &wasi;
-
   // Call start ([] -> [])
   Values params;
   Values results;
+  return WasiRunFunc(instance, start, params, results, uvwasi, err_stream,
+                     thread_options, wasi_options);
+}
+
+Result WasiRunFunc(const Instance::Ptr& instance,
+                   const Func::Ptr& func,
+                   const Values& params,
+                   Values& results,
+                   uvwasi_s* uvwasi,
+                   Stream* err_stream,
+                   const Thread::Options& thread_options,
+                   const WasiOptions& wasi_options) {
+  Memory::Ptr memory = FindWasiMemory(instance, err_stream);
+  if (!memory) {
+    return Result::Error;
+  }
+
+  // Register memory
+  WasiInstance wasi(instance, uvwasi, memory.get(),
+                    thread_options.trace_stream, wasi_options);
+  {
+    std::lock_guard<std::mutex> lock(wasiInstancesMutex);
+    wasiInstances[instance.get()] = &wasi;
+  }
+  WasiInstance* prev_wasi = currentWasiInstance;
+  currentWasiInstance = &wasi;
+
   Trap::Ptr trap;
-  Result res = start->Call(*store, params, results, &trap, trace_stream);
+  Thread::Ptr thread = Thread::New(*instance.store(), thread_options);
+  Result res = func->Call(*thread, params, results, &trap);
+  wasi.flushOutput();
+  currentWasiInstance = prev_wasi;
   if (trap) {
     WriteTrap(err_stream, "error", trap);
   }
 
   // Unregister memory
-  wasiInstances.erase(instance.get());
+  {
+    std::lock_guard<std::mutex> lock(wasiInstancesMutex);
+    wasiInstances.erase(instance.get());
+  }
   return res;
 }
 
@@ -28,6 +28,19 @@ struct uvwasi_s;
 namespace wabt {
 namespace interp {
 
+struct WasiOptions {
+  // Collect fd_write calls to stdout and stderr in a buffer of this many
+  // bytes, and write it out in one call when it fills up, before the guest
+  // reads or writes anything else, and when it exits. 0 writes each call
+  // through.
+  u32 output_buffer_size = 0;
+  // Also write out buffered output at the end of each line.
+  bool line_buffered = false;
+};
+
+// Binds the WASI functions that `module` imports. Entries of `imports` that
+// are already bound, such as the shared memory of a wasi-threads program, are
+// left as they are.
 Result WasiBindImports(const Module::Ptr& module,
                        RefVec& imports,
                        Stream* err_stream,
@@ -36,7 +49,20 @@ Result WasiBindImports(const Module::Ptr& module,
 Result WasiRunStart(const Instance::Ptr& instance,
                     uvwasi_s* uvwasi,
                     Stream* stream,
-                    Stream* trace_stream);
+                    const Thread::Options& thread_options,
+                    const WasiOptions& wasi_options);
+
+// Calls `func` on a new Thread, with the WASI functions imported by
+// `instance` using `uvwasi`. Each thread of a wasi-threads program runs its
+// entry point this way, in its own Store.
+Result WasiRunFunc(const Instance::Ptr& instance,
+                   const Func::Ptr& func,
+                   const Values& params,
+                   Values& results,
+                   uvwasi_s* uvwasi,
+                   Stream* err_stream,
+                   const Thread::Options& thread_options,
+                   const WasiOptions& wasi_options);
 
 }  // namespace interp
 }  // namespace wabt
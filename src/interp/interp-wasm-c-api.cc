@@ -20,7 +20,9 @@
 #include "src/cast.h"
 #include "src/error-formatter.h"
 #include "src/interp/binary-reader-interp.h"
+#include "src/interp/interp-serialize.h"
 #include "src/interp/interp-util.h"
+#include "src/interp/interp-wasm-c-api.h"
 #include "src/interp/interp.h"
 
 using namespace wabt;
@@ -70,9 +72,13 @@ static void FromWabtValues(Store& store,
                            const Values& wabt_values);
 
 // Structs
-struct wasm_config_t {};
+struct wasm_config_t {
+  Store::Options store_options;
+};
 
-struct wasm_engine_t {};
+struct wasm_engine_t {
+  Store::Options store_options;
+};
 
 struct wasm_valtype_t {
   ValueType I;
@@ -243,7 +249,8 @@ struct wasm_exporttype_t {
 };
 
 struct wasm_store_t {
-  wasm_store_t(const Features& features) : I(features) {}
+  wasm_store_t(const Features& features, const Store::Options& options)
+      : I(features, options) {}
   Store I;
 };
 
@@ -271,30 +278,14 @@ struct wasm_foreign_t : wasm_ref_t {
 };
 
 struct wasm_module_t : wasm_ref_t {
-  wasm_module_t(RefPtr<Module> ptr, const wasm_byte_vec_t* in)
-      : wasm_ref_t(ptr) {
-    wasm_byte_vec_copy(&binary, in);
-  }
-
-  wasm_module_t(const wasm_module_t& other) : wasm_ref_t(other.I) {
-    wasm_byte_vec_copy(&binary, &other.binary);
-  }
-
-  wasm_module_t& operator=(const wasm_module_t& other) {
-    wasm_module_t copy(other);
-    std::swap(I, copy.I);
-    std::swap(binary, copy.binary);
-    return *this;
-  }
-
-  ~wasm_module_t() { wasm_byte_vec_delete(&binary); }
-  // TODO: This is used for wasm_module_serialize/wasm_module_deserialize.
-  // Currently the standard wasm binary bytes are cached here, but it would be
-  // better to have a serialization of ModuleDesc instead.
-  wasm_byte_vec_t binary;
+  wasm_module_t(RefPtr<Module> ptr) : wasm_ref_t(ptr) {}
 };
 
-struct wasm_shared_module_t : wasm_module_t {};
+// Shares the compiled module, not the Module object, which belongs to a single
+// store.
+struct wasm_shared_module_t {
+  SharedModuleDesc I;
+};
 
 struct wasm_extern_t : wasm_ref_t {
   wasm_extern_t(RefPtr<Extern> ptr) : wasm_ref_t(ptr) {}
@@ -320,6 +311,10 @@ struct wasm_instance_t : wasm_ref_t {
   wasm_instance_t(RefPtr<Instance> ptr) : wasm_ref_t(ptr) {}
 };
 
+struct wasm_instance_snapshot_t {
+  InstanceSnapshot::Ptr I;
+};
+
 // Type conversion utilities
 static ValueType ToWabtValueType(wasm_valkind_t kind) {
   switch (kind) {
@@ -608,22 +603,40 @@ own wasm_config_t* wasm_config_new() {
   return new wasm_config_t();
 }
 
+void wasm_config_set_memory_pool_size(wasm_config_t* config, uint32_t size) {
+  assert(config);
+  config->store_options.memory_pool_size = size;
+}
+
+void wasm_config_set_memory_pool_max_pages(wasm_config_t* config,
+                                           uint32_t pages) {
+  assert(config);
+  config->store_options.memory_pool_max_pages = pages;
+}
+
+void wasm_config_set_guard_pages(wasm_config_t* config, bool enabled) {
+  assert(config);
+  config->store_options.guard_pages = enabled;
+}
+
 // wasm_engine
 
 own wasm_engine_t* wasm_engine_new() {
   return new wasm_engine_t();
 }
 
-own wasm_engine_t* wasm_engine_new_with_config(own wasm_config_t*) {
-  assert(false);
-  return nullptr;
+own wasm_engine_t* wasm_engine_new_with_config(own wasm_config_t* config) {
+  assert(config);
+  auto* engine = new wasm_engine_t{config->store_options};
+  wasm_config_delete(config);
+  return engine;
 }
 
 // wasm_store
 
 own wasm_store_t* wasm_store_new(wasm_engine_t* engine) {
   assert(engine);
-  return new wasm_store_t(s_features);
+  return new wasm_store_t(s_features, engine->store_options);
 }
 
 // wasm_module
@@ -638,7 +651,7 @@ own wasm_module_t* wasm_module_new(wasm_store_t* store,
     return nullptr;
   }
 
-  return new wasm_module_t{Module::New(store->I, module_desc), binary};
+  return new wasm_module_t{Module::New(store->I, std::move(module_desc))};
 }
 
 bool wasm_module_validate(wasm_store_t* store, const wasm_byte_vec_t* binary) {
@@ -676,12 +689,19 @@ void wasm_module_exports(const wasm_module_t* module,
 
 void wasm_module_serialize(const wasm_module_t* module,
                            own wasm_byte_vec_t* out) {
-  wasm_byte_vec_copy(out, &module->binary);
+  std::vector<u8> data;
+  WriteModuleDesc(module->As<Module>()->desc(), &data);
+  wasm_byte_vec_new(out, data.size(),
+                    reinterpret_cast<const wasm_byte_t*>(data.data()));
 }
 
 own wasm_module_t* wasm_module_deserialize(wasm_store_t* store,
                                            const wasm_byte_vec_t* bytes) {
-  return wasm_module_new(store, bytes);
+  ModuleDesc module_desc;
+  if (Failed(ReadModuleDesc(bytes->data, bytes->size, &module_desc))) {
+    return nullptr;
+  }
+  return new wasm_module_t{Module::New(store->I, std::move(module_desc))};
 }
 
 // wasm_importtype
@@ -760,6 +780,37 @@ void wasm_instance_exports(const wasm_instance_t* instance,
   }
 }
 
+// wasm_instance_snapshot
+
+own wasm_instance_snapshot_t* wasm_instance_snapshot_new(
+    wasm_store_t* store,
+    const wasm_instance_t* instance,
+    own wasm_trap_t** trap_out) {
+  TRACE("%p %p", store, instance);
+  assert(store);
+  assert(instance);
+
+  Trap::Ptr trap;
+  auto snapshot = InstanceSnapshot::New(store->I, instance->I->self(), &trap);
+  if (!snapshot) {
+    if (trap_out) {
+      *trap_out = new wasm_trap_t{trap};
+    }
+    return nullptr;
+  }
+
+  return new wasm_instance_snapshot_t{snapshot};
+}
+
+own wasm_instance_t* wasm_instance_new_from_snapshot(
+    wasm_store_t* store,
+    const wasm_instance_snapshot_t* snapshot) {
+  TRACE("%p %p", store, snapshot);
+  assert(store);
+  assert(snapshot);
+  return new wasm_instance_t{snapshot->I->Instantiate(store->I)};
+}
+
 // wasm_functype
 
 own wasm_functype_t* wasm_functype_new(own wasm_valtype_vec_t* params,
@@ -858,14 +909,33 @@ own wasm_trap_t* wasm_func_call(const wasm_func_t* f,
   // TRACE("%d", f->index);
 
   auto&& func_type = f->As<Func>()->type();
-  Values wabt_args = ToWabtValues(args, func_type.params.size());
-  Values wabt_results;
+  size_t param_count = func_type.params.size();
+  size_t result_count = func_type.results.size();
+
+  // Most functions only have a few parameters and results, so convert them on
+  // the stack instead of allocating.
+  const size_t kMaxInlineValues = 16;
+  Value inline_values[kMaxInlineValues];
+  Values heap_values;
+  Value* wabt_args = inline_values;
+  if (param_count + result_count > kMaxInlineValues) {
+    heap_values.resize(param_count + result_count);
+    wabt_args = heap_values.data();
+  }
+  Value* wabt_results = wabt_args + param_count;
+
+  for (size_t i = 0; i < param_count; ++i) {
+    wabt_args[i] = ToWabtValue(args[i]).value;
+  }
+  Store& store = *f->I.store();
   Trap::Ptr trap;
-  if (Failed(
-          f->As<Func>()->Call(*f->I.store(), wabt_args, wabt_results, &trap))) {
+  if (Failed(f->As<Func>()->Call(store, wabt_args, wabt_results, &trap))) {
     return new wasm_trap_t{trap};
   }
-  FromWabtValues(*f->I.store(), results, func_type.results, wabt_results);
+  for (size_t i = 0; i < result_count; ++i) {
+    results[i] =
+        FromWabtValue(store, TypedValue{func_type.results[i], wabt_results[i]});
+  }
   return nullptr;
 }
 
@@ -944,7 +1014,8 @@ void wasm_global_set(wasm_global_t* global, const wasm_val_t* val) {
   if (wasm_valkind_is_ref(val->kind)) {
     global->As<Global>()->Set(*global->I.store(), val->of.ref->I->self());
   } else {
-    global->As<Global>()->UnsafeSet(ToWabtValue(*val).value);
+    global->As<Global>()->UnsafeSet(*global->I.store(),
+                                    ToWabtValue(*val).value);
   }
 }
 
@@ -1081,6 +1152,7 @@ WASM_IMPL_OWN(frame);
 WASM_IMPL_OWN(config);
 WASM_IMPL_OWN(engine);
 WASM_IMPL_OWN(store);
+WASM_IMPL_OWN(instance_snapshot);
 
 #define WASM_IMPL_VEC_BASE(name, ptr_or_none)                            \
   void wasm_##name##_vec_new_empty(own wasm_##name##_vec_t* out) {       \
@@ -1251,20 +1323,17 @@ WASM_IMPL_REF(memory);
 WASM_IMPL_REF(table);
 WASM_IMPL_REF(trap);
 
-#define WASM_IMPL_SHARABLE_REF(name)                                           \
-  WASM_IMPL_REF(name)                                                          \
-  WASM_IMPL_OWN(shared_##name)                                                 \
-  own wasm_shared_##name##_t* wasm_##name##_share(const wasm_##name##_t* t) {  \
-    return static_cast<wasm_shared_##name##_t*>(                               \
-        const_cast<wasm_##name##_t*>(t));                                      \
-  }                                                                            \
-  own wasm_##name##_t* wasm_##name##_obtain(wasm_store_t*,                     \
-                                            const wasm_shared_##name##_t* t) { \
-    return static_cast<wasm_##name##_t*>(                                      \
-        const_cast<wasm_shared_##name##_t*>(t));                               \
-  }
+WASM_IMPL_REF(module);
+WASM_IMPL_OWN(shared_module);
 
-WASM_IMPL_SHARABLE_REF(module)
+own wasm_shared_module_t* wasm_module_share(const wasm_module_t* module) {
+  return new wasm_shared_module_t{module->As<Module>()->shared_desc()};
+}
+
+own wasm_module_t* wasm_module_obtain(wasm_store_t* store,
+                                      const wasm_shared_module_t* shared) {
+  return new wasm_module_t{Module::New(store->I, shared->I)};
+}
 
 #define WASM_IMPL_EXTERN(name)                                                 \
   const wasm_##name##type_t* wasm_externtype_as_##name##type_const(            \
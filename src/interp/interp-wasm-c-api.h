@@ -0,0 +1,61 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_WASM_C_API_H_
+#define WABT_INTERP_WASM_C_API_H_
+
+// Extensions to the wasm C API that are specific to libwasm.
+
+#include <wasm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A snapshot of the state of an instance (its memories, tables and globals).
+// New instances created from it start in that state, without running the
+// module's segment initializers or start function again. See
+// wabt::interp::InstanceSnapshot.
+typedef struct wasm_instance_snapshot_t wasm_instance_snapshot_t;
+
+WASM_API_EXTERN void wasm_instance_snapshot_delete(wasm_instance_snapshot_t*);
+
+// Returns null, and a trap in `trap` if it is not null, if the instance
+// imports a memory, a table or a mutable global.
+WASM_API_EXTERN wasm_instance_snapshot_t* wasm_instance_snapshot_new(
+    wasm_store_t*,
+    const wasm_instance_t*,
+    wasm_trap_t** trap);
+
+WASM_API_EXTERN wasm_instance_t* wasm_instance_new_from_snapshot(
+    wasm_store_t*,
+    const wasm_instance_snapshot_t*);
+
+// Options for the stores of an engine created with
+// wasm_engine_new_with_config. See wabt::interp::Store::Options.
+WASM_API_EXTERN void wasm_config_set_guard_pages(wasm_config_t*, bool);
+// The number of memory address ranges that each store keeps reserved for
+// reuse, and the number of pages in each; 0 (the default) disables the pool.
+WASM_API_EXTERN void wasm_config_set_memory_pool_size(wasm_config_t*,
+                                                      uint32_t size);
+WASM_API_EXTERN void wasm_config_set_memory_pool_max_pages(wasm_config_t*,
+                                                           uint32_t pages);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // WABT_INTERP_WASM_C_API_H_
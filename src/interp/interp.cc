@@ -18,11 +18,23 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cinttypes>
+#include <cstring>
+#include <type_traits>
 
+#include "src/hash-util.h"
 #include "src/interp/interp-math.h"
+#include "src/interp/interp-profile.h"
 #include "src/make-unique.h"
 
+#if WABT_INTERP_GUARD_PAGES
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 namespace wabt {
 namespace interp {
 
@@ -41,8 +53,9 @@ const char* GetName(ExternKind kind) {
 
 const char* GetName(ObjectKind kind) {
   static const char* kNames[] = {
-      "Null",   "Foreign", "Trap", "DefinedFunc", "HostFunc", "Table",
-      "Memory", "Global",  "Tag",  "Module",      "Instance", "Thread",
+      "Null",     "Foreign",          "Trap",   "DefinedFunc", "HostFunc",
+      "Table",    "Memory",           "Global", "Tag",         "Module",
+      "Instance", "InstanceSnapshot", "Thread",
   };
   return kNames[int(kind)];
 }
@@ -199,10 +212,20 @@ ValueType FuncDesc::GetLocalType(Index index) const {
 }
 
 //// Store ////
-Store::Store(const Features& features) : features_(features) {
+Store::Store(const Features& features) : Store(features, Options()) {}
+
+Store::Store(const Features& features, const Options& options)
+    : features_(features), options_(options) {
+  if (options_.guard_pages && !Thread::InstallGuardPageHandler()) {
+    options_.guard_pages = false;
+  }
+  memory_pool_ = MemoryPool::New(options_);
   Ref ref{objects_.New(new Object(ObjectKind::Null))};
   assert(ref == Ref::Null);
   roots_.New(ref);
+  // The null object is always old.
+  marks_.push_back(true);
+  is_remembered_.push_back(false);
 }
 
 bool Store::HasValueType(Ref ref, ValueType type) const {
@@ -217,7 +240,7 @@ bool Store::HasValueType(Ref ref, ValueType type) const {
     return true;
   }
 
-  Object* obj = objects_.Get(ref.index).get();
+  Object* obj = objects_.Get(ref.index);
   switch (type) {
     case ValueType::FuncRef:
       return obj->kind() == ObjectKind::DefinedFunc ||
@@ -232,12 +255,7 @@ Store::RootList::Index Store::NewRoot(Ref ref) {
 }
 
 Store::RootList::Index Store::CopyRoot(RootList::Index index) {
-  // roots_.Get() returns a reference to an element in an internal vector, and
-  // roots_.New() might forward its arguments to emplace_back on the same
-  // vector. This seems to "work" in most environments, but fails on Visual
-  // Studio 2015 Win64. Copying it to a value fixes the issue.
-  auto obj_index = roots_.Get(index);
-  return roots_.New(obj_index);
+  return roots_.New(roots_.Get(index));
 }
 
 void Store::DeleteRoot(RootList::Index index) {
@@ -246,41 +264,76 @@ void Store::DeleteRoot(RootList::Index index) {
 
 void Store::Collect() {
   size_t object_count = objects_.size();
-  marks_.resize(object_count);
-  std::fill(marks_.begin(), marks_.end(), false);
+  marks_.assign(object_count, false);
 
-  // First mark all roots.
   for (RootList::Index i = 0; i < roots_.size(); ++i) {
     if (roots_.IsUsed(i)) {
       Mark(roots_.Get(i));
     }
   }
+  // Idle threads aren't marked, so this frees them and their stacks.
+  idle_threads_.clear();
+  ProcessMarkStack();
+
+  // Delete all unmarked objects. The survivors are all old now, so the only
+  // objects left to remember are the threads.
+  young_.clear();
+  remembered_.clear();
+  is_remembered_.assign(object_count, false);
+  for (size_t i = 0; i < object_count; ++i) {
+    if (!objects_.IsUsed(i)) {
+      continue;
+    }
+    if (!marks_[i]) {
+      objects_.Delete(i);
+    } else if (isa<Thread>(objects_.Get(i))) {
+      Remember(Ref{i});
+    }
+  }
+}
 
-  // TODO: better GC algo.
-  // Loop through all newly marked objects and mark their referents.
-  std::vector<bool> all_marked(object_count, false);
-  bool new_marked;
-  do {
-    new_marked = false;
-    for (size_t i = 0; i < object_count; ++i) {
-      if (!all_marked[i] && marks_[i]) {
-        all_marked[i] = true;
-        objects_.Get(i)->Mark(*this);
-        new_marked = true;
-      }
+void Store::CollectYoung() {
+  // Old objects are already marked, so marking stops at them.
+  for (RootList::Index i = 0; i < roots_.size(); ++i) {
+    if (roots_.IsUsed(i)) {
+      Mark(roots_.Get(i));
     }
-  } while (new_marked);
+  }
+  Mark(idle_threads_);
+  for (Ref ref : remembered_) {
+    objects_.Get(ref.index)->Mark(*this);
+  }
+  ProcessMarkStack();
 
-  // Delete all unmarked objects.
-  for (size_t i = 0; i < object_count; ++i) {
-    if (objects_.IsUsed(i) && !all_marked[i]) {
-      objects_.Delete(i);
+  // Remembered objects only point to old objects now, except for threads.
+  RefVec threads;
+  for (Ref ref : remembered_) {
+    if (isa<Thread>(objects_.Get(ref.index))) {
+      threads.push_back(ref);
+    } else {
+      is_remembered_[ref.index] = false;
+    }
+  }
+  remembered_ = std::move(threads);
+
+  // Delete the unmarked young objects; the marked ones become old. Swap the
+  // list out first, since a finalizer may allocate.
+  RefVec young;
+  young.swap(young_);
+  for (Ref ref : young) {
+    if (!marks_[ref.index]) {
+      objects_.Delete(ref.index);
+    } else if (isa<Thread>(objects_.Get(ref.index))) {
+      Remember(ref);
     }
   }
 }
 
 void Store::Mark(Ref ref) {
-  marks_[ref.index] = true;
+  if (!marks_[ref.index]) {
+    marks_[ref.index] = true;
+    mark_stack_.push_back(ref.index);
+  }
 }
 
 void Store::Mark(const RefVec& refs) {
@@ -289,6 +342,58 @@ void Store::Mark(const RefVec& refs) {
   }
 }
 
+void Store::ProcessMarkStack() {
+  while (!mark_stack_.empty()) {
+    ObjectList::Index index = mark_stack_.back();
+    mark_stack_.pop_back();
+    objects_.Get(index)->Mark(*this);
+  }
+}
+
+void Store::Remember(Ref ref) {
+  is_remembered_[ref.index] = true;
+  remembered_.push_back(ref);
+}
+
+Thread::Ptr Store::AcquireThread() {
+  if (idle_threads_.empty()) {
+    return Thread::New(*this, Thread::Options());
+  }
+  Ref ref = idle_threads_.back();
+  idle_threads_.pop_back();
+  return Thread::Ptr(*this, ref);
+}
+
+void Store::ReleaseThread(Thread::Ptr thread) {
+  // Calls are only nested this deep when host functions call back into wasm;
+  // a thread beyond that is left for the collector.
+  const size_t kMaxIdleThreads = 8;
+  if (idle_threads_.size() < kMaxIdleThreads) {
+    thread->Reset();
+    idle_threads_.push_back(thread.ref());
+  }
+}
+
+Index Store::InternFuncType(const FuncType& type) {
+  // Match compares the type codes only, so reference type indexes are not
+  // part of the key.
+  FuncTypeKey key;
+  key.reserve(1 + type.params.size() + type.results.size());
+  key.push_back(type.params.size());
+  for (ValueType param : type.params) {
+    key.push_back(ValueType::Enum(param));
+  }
+  for (ValueType result : type.results) {
+    key.push_back(ValueType::Enum(result));
+  }
+  return func_type_ids_.emplace(std::move(key), func_type_ids_.size())
+      .first->second;
+}
+
+size_t Store::FuncTypeKeyHash::operator()(const FuncTypeKey& key) const {
+  return HashRange(key.begin(), key.end());
+}
+
 //// Object ////
 Object::~Object() {
   if (finalizer_) {
@@ -359,29 +464,56 @@ Result Extern::MatchImpl(Store& store,
 }
 
 //// Func ////
-Func::Func(ObjectKind kind, FuncType type) : Extern(kind), type_(type) {}
+Func::Func(ObjectKind kind, FuncType type, Index type_id)
+    : Extern(kind), type_(type), type_id_(type_id) {}
 
 Result Func::Call(Store& store,
                   const Values& params,
                   Values& results,
                   Trap::Ptr* out_trap,
                   Stream* trace_stream) {
-  Thread::Options options;
-  options.trace_stream = trace_stream;
-  Thread::Ptr thread = Thread::New(store, options);
-  return DoCall(*thread, params, results, out_trap);
+  assert(params.size() == type_.params.size());
+  results.resize(type_.results.size());
+  if (trace_stream) {
+    Thread::Options options;
+    options.trace_stream = trace_stream;
+    Thread::Ptr thread = Thread::New(store, options);
+    return DoCall(*thread, params.data(), results.data(), out_trap);
+  }
+  return Call(store, params.data(), results.data(), out_trap);
 }
 
 Result Func::Call(Thread& thread,
                   const Values& params,
                   Values& results,
                   Trap::Ptr* out_trap) {
+  assert(params.size() == type_.params.size());
+  results.resize(type_.results.size());
+  return DoCall(thread, params.data(), results.data(), out_trap);
+}
+
+Result Func::Call(Store& store,
+                  const Value* params,
+                  Value* results,
+                  Trap::Ptr* out_trap) {
+  Thread::Ptr thread = store.AcquireThread();
+  Result result = DoCall(*thread, params, results, out_trap);
+  store.ReleaseThread(std::move(thread));
+  return result;
+}
+
+Result Func::Call(Thread& thread,
+                  const Value* params,
+                  Value* results,
+                  Trap::Ptr* out_trap) {
   return DoCall(thread, params, results, out_trap);
 }
 
 //// DefinedFunc ////
-DefinedFunc::DefinedFunc(Store& store, Ref instance, FuncDesc desc)
-    : Func(skind, desc.type), instance_(instance), desc_(desc) {}
+DefinedFunc::DefinedFunc(Store& store, Ref instance, const FuncDesc* desc)
+    : Func(skind, desc->type, store.InternFuncType(desc->type)),
+      instance_(instance),
+      desc_(desc) {}
 
 void DefinedFunc::Mark(Store& store) {
   store.Mark(instance_);
@@ -394,10 +526,9 @@ Result DefinedFunc::Match(Store& store,
 }
 
 Result DefinedFunc::DoCall(Thread& thread,
-                           const Values& params,
-                           Values& results,
+                           const Value* params,
+                           Value* results,
                            Trap::Ptr* out_trap) {
-  assert(params.size() == type_.params.size());
   thread.PushValues(type_.params, params);
   RunResult result = thread.PushCall(*this, out_trap);
   if (result == RunResult::Trap) {
@@ -411,14 +542,53 @@ Result DefinedFunc::DoCall(Thread& thread,
     // to report an uncaught exception.
     *out_trap = Trap::New(thread.store(), "uncaught exception");
     return Result::Error;
+  } else if (result == RunResult::OutOfFuel) {
+    *out_trap = Trap::New(thread.store(), "out of fuel", thread.frames_);
+    return Result::Error;
+  } else if (result == RunResult::Interrupted) {
+    *out_trap = Trap::New(thread.store(), "interrupted", thread.frames_);
+    return Result::Error;
   }
-  thread.PopValues(type_.results, &results);
+  thread.PopValues(type_.results, results);
   return Result::Ok;
 }
 
 //// HostFunc ////
-HostFunc::HostFunc(Store&, FuncType type, Callback callback)
-    : Func(skind, type), callback_(callback) {}
+// Appends the slot offset of each value to `out_slots`, and returns the total
+// slot count.
+static u32 GetSlotOffsets(const ValueTypes& types, std::vector<u32>* out_slots) {
+  u32 count = 0;
+  for (ValueType type : types) {
+    out_slots->push_back(count);
+    count += GetSlotCount(type);
+  }
+  return count;
+}
+
+HostFunc::HostFunc(Store& store, FuncType type, ArgsCallback callback)
+    : Func(skind, type, store.InternFuncType(type)),
+      callback_(std::move(callback)) {
+  param_slot_count_ = GetSlotOffsets(type_.params, &param_slots_);
+  result_slot_count_ = GetSlotOffsets(type_.results, &result_slots_);
+}
+
+// static
+HostFunc::Ptr HostFunc::New(Store& store, FuncType type, Callback callback) {
+  ArgsCallback args_callback = [callback](Thread& thread, HostCallArgs& args,
+                                          Trap::Ptr* out_trap) {
+    Values params(args.param_count());
+    for (Index i = 0; i < params.size(); ++i) {
+      params[i] = args.param_value(i);
+    }
+    Values results(args.result_count());
+    CHECK_RESULT(callback(thread, params, results, out_trap));
+    for (Index i = 0; i < results.size(); ++i) {
+      args.set_result_value(i, results[i]);
+    }
+    return Result::Ok;
+  };
+  return New(store, type, std::move(args_callback));
+}
 
 void HostFunc::Mark(Store&) {}
 
@@ -429,10 +599,44 @@ Result HostFunc::Match(Store& store,
 }
 
 Result HostFunc::DoCall(Thread& thread,
-                        const Values& params,
-                        Values& results,
+                        const Value* params,
+                        Value* results,
                         Trap::Ptr* out_trap) {
-  return callback_(thread, params, results, out_trap);
+  thread.PushValues(type_.params, params);
+  if (thread.CallHost(*this, out_trap) == RunResult::Trap) {
+    return Result::Error;
+  }
+  thread.PopValues(type_.results, results);
+  return Result::Ok;
+}
+
+//// HostCallArgs ////
+Value HostCallArgs::param_value(Index index) const {
+  assert(index < param_count());
+  u32 slot = params_ + func_.param_slots_[index];
+  switch (func_.type().params[index]) {
+    case ValueType::I32:       return Value::Make(Read<u32>(slot));
+    case ValueType::I64:       return Value::Make(Read<u64>(slot));
+    case ValueType::F32:       return Value::Make(Read<f32>(slot));
+    case ValueType::F64:       return Value::Make(Read<f64>(slot));
+    case ValueType::V128:      return Value::Make(Read<v128>(slot));
+    case ValueType::FuncRef:
+    case ValueType::ExternRef: return Value::Make(Read<Ref>(slot));
+    default:                   WABT_UNREACHABLE;
+  }
+}
+
+void HostCallArgs::set_result_value(Index index, Value value) {
+  switch (func_.type().results[index]) {
+    case ValueType::I32:       set_result(index, value.Get<u32>()); break;
+    case ValueType::I64:       set_result(index, value.Get<u64>()); break;
+    case ValueType::F32:       set_result(index, value.Get<f32>()); break;
+    case ValueType::F64:       set_result(index, value.Get<f64>()); break;
+    case ValueType::V128:      set_result(index, value.Get<v128>()); break;
+    case ValueType::FuncRef:
+    case ValueType::ExternRef: set_result(index, value.Get<Ref>()); break;
+    default:                   WABT_UNREACHABLE;
+  }
 }
 
 //// Table ////
@@ -471,6 +675,7 @@ Ref Table::UnsafeGet(u32 offset) const {
 Result Table::Set(Store& store, u32 offset, Ref ref) {
   if (IsValidRange(offset, 1) && store.HasValueType(ref, type_.element)) {
     elements_[offset] = ref;
+    store.RecordWrite(this);
     return Result::Ok;
   }
   return Result::Error;
@@ -495,6 +700,7 @@ Result Table::Fill(Store& store, u32 offset, Ref ref, u32 size) {
   if (IsValidRange(offset, size) && store.HasValueType(ref, type_.element)) {
     std::fill(elements_.begin() + offset, elements_.begin() + offset + size,
               ref);
+    store.RecordWrite(this);
     return Result::Ok;
   }
   return Result::Error;
@@ -510,6 +716,7 @@ Result Table::Init(Store& store,
     std::copy(src.elements().begin() + src_offset,
               src.elements().begin() + src_offset + size,
               elements_.begin() + dst_offset);
+    store.RecordWrite(this);
     return Result::Ok;
   }
   return Result::Error;
@@ -534,15 +741,204 @@ Result Table::Copy(Store& store,
     } else {
       std::move(src_begin, src_end, dst_begin);
     }
+    store.RecordWrite(&dst);
     return Result::Ok;
   }
   return Result::Error;
 }
 
+//// MemoryPool ////
+#if WABT_INTERP_GUARD_PAGES
+// Large enough for any 32-bit address plus a 32-bit offset, with room for the
+// widest access at the end.
+static const u64 kGuardedRangeSize = (u64{1} << 33) + WABT_PAGE_SIZE;
+#endif
+
+std::unique_ptr<MemoryPool> MemoryPool::New(const Store::Options& options) {
+#if WABT_INTERP_GUARD_PAGES
+  u32 slot_count = options.memory_pool_size;
+  u64 slot_size = options.guard_pages
+                      ? kGuardedRangeSize
+                      : u64{options.memory_pool_max_pages} * WABT_PAGE_SIZE;
+  if (slot_count == 0 || slot_size == 0) {
+    return nullptr;
+  }
+  void* addr = mmap(nullptr, slot_count * slot_size, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+  return std::unique_ptr<MemoryPool>(new MemoryPool(
+      static_cast<u8*>(addr), slot_count, slot_size, options.guard_pages));
+#else
+  return nullptr;
+#endif
+}
+
+MemoryPool::MemoryPool(u8* base, u32 slot_count, u64 slot_size, bool guarded)
+    : base_(base),
+      slot_count_(slot_count),
+      slot_size_(slot_size),
+      guarded_(guarded) {
+  free_slots_.reserve(slot_count);
+  for (u32 i = slot_count; i > 0; --i) {
+    free_slots_.push_back(Slot{base + (i - 1) * slot_size, 0});
+  }
+}
+
+MemoryPool::~MemoryPool() {
+#if WABT_INTERP_GUARD_PAGES
+  munmap(base_, slot_count_ * slot_size_);
+#endif
+}
+
+u8* MemoryPool::Acquire(u64 byte_size) {
+#if WABT_INTERP_GUARD_PAGES
+  if (free_slots_.empty() || byte_size > slot_size_) {
+    return nullptr;
+  }
+  Slot& slot = free_slots_.back();
+  // Only the pages whose protection differs from the last user's are changed.
+  if (slot.accessible_size < byte_size) {
+    if (mprotect(slot.data + slot.accessible_size,
+                 byte_size - slot.accessible_size,
+                 PROT_READ | PROT_WRITE) != 0) {
+      return nullptr;
+    }
+  } else if (slot.accessible_size > byte_size) {
+    if (mprotect(slot.data + byte_size, slot.accessible_size - byte_size,
+                 PROT_NONE) != 0) {
+      return nullptr;
+    }
+  }
+  u8* data = slot.data;
+  free_slots_.pop_back();
+  return data;
+#else
+  return nullptr;
+#endif
+}
+
+void MemoryPool::Release(u8* data, u64 used_size, bool mapped_image) {
+#if WABT_INTERP_GUARD_PAGES
+  if (used_size != 0) {
+    if (mapped_image) {
+      // MADV_DONTNEED would only drop the private copies of the image's
+      // pages, so map fresh zero pages over them instead.
+      if (mmap(data, used_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1,
+               0) == MAP_FAILED) {
+        return;
+      }
+    } else if (madvise(data, used_size, MADV_DONTNEED) != 0) {
+      // The slot can't be reset, so it is never reused.
+      return;
+    }
+  }
+  free_slots_.push_back(Slot{data, used_size});
+#endif
+}
+
 //// Memory ////
-Memory::Memory(class Store&, MemoryType type)
-    : Extern(skind), type_(type), pages_(type.limits.initial) {
-  data_.resize(pages_ * WABT_PAGE_SIZE);
+
+SharedMemoryStorage::~SharedMemoryStorage() {
+#if WABT_INTERP_GUARD_PAGES
+  if (reserved_size) {
+    munmap(data, reserved_size);
+  }
+#endif
+}
+
+Memory::Memory(class Store& store, MemoryType type)
+    : Extern(skind),
+      type_(type),
+      byte_size_(type.limits.initial * WABT_PAGE_SIZE),
+      pages_(type.limits.initial) {
+  if (type_.limits.is_shared) {
+    AllocateShared(store);
+  } else if (type_.limits.is_64 ||
+             (!AcquirePoolSlot(store) &&
+              !(store.options().guard_pages && ReserveGuardedRange()))) {
+    buffer_.resize(byte_size_);
+    data_ = buffer_.data();
+  }
+}
+
+Memory::Memory(class Store&, SharedMemory shared)
+    : Extern(skind),
+      type_(shared->type),
+      data_(shared->data),
+      reserved_size_(shared->reserved_size),
+      shared_(std::move(shared)) {
+  SyncSharedSize();
+}
+
+Memory::~Memory() {
+#if WABT_INTERP_GUARD_PAGES
+  // The storage of a shared memory unmaps itself.
+  if (pool_) {
+    pool_->Release(data_, byte_size_, mapped_image_);
+  } else if (reserved_size_ && !shared_) {
+    munmap(data_, reserved_size_);
+  }
+#endif
+}
+
+void Memory::AllocateShared(class Store& store) {
+  // Shared memories must have a maximum size, so growing the buffer up to it
+  // never reallocates.
+  assert(type_.limits.has_max);
+  shared_ = std::make_shared<SharedMemoryStorage>(type_);
+  if (!store.options().guard_pages || type_.limits.is_64 ||
+      !ReserveGuardedRange()) {
+    shared_->buffer.reserve(type_.limits.max * WABT_PAGE_SIZE);
+    shared_->buffer.resize(byte_size_);
+    data_ = shared_->buffer.data();
+  }
+  shared_->data = data_;
+  shared_->reserved_size = reserved_size_;
+  shared_->byte_size = byte_size_;
+}
+
+void Memory::SyncSharedSize() {
+  byte_size_ = shared_->byte_size.load();
+  pages_ = byte_size_ / WABT_PAGE_SIZE;
+  type_.limits.initial = pages_;
+}
+
+bool Memory::AcquirePoolSlot(class Store& store) {
+  MemoryPool* pool = store.memory_pool();
+  if (!pool) {
+    return false;
+  }
+  u8* data = pool->Acquire(byte_size_);
+  if (!data) {
+    return false;
+  }
+  data_ = data;
+  reserved_size_ = pool->slot_size();
+  pool_ = pool;
+  return true;
+}
+
+bool Memory::ReserveGuardedRange() {
+#if WABT_INTERP_GUARD_PAGES
+  void* addr = mmap(nullptr, kGuardedRangeSize, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  if (byte_size_ != 0 &&
+      mprotect(addr, byte_size_, PROT_READ | PROT_WRITE) != 0) {
+    munmap(addr, kGuardedRangeSize);
+    return false;
+  }
+  data_ = static_cast<u8*>(addr);
+  reserved_size_ = kGuardedRangeSize;
+  return true;
+#else
+  return false;
+#endif
 }
 
 void Memory::Mark(class Store&) {}
@@ -554,20 +950,58 @@ Result Memory::Match(class Store& store,
 }
 
 Result Memory::Grow(u64 count) {
+  u64 old_pages;
+  return Grow(count, &old_pages);
+}
+
+Result Memory::Grow(u64 count, u64* out_old_pages) {
+  std::unique_lock<std::mutex> lock;
+  if (shared_) {
+    lock = std::unique_lock<std::mutex>(shared_->grow_mutex);
+    SyncSharedSize();
+  }
+  *out_old_pages = pages_;
+#if WABT_BIG_ENDIAN
+  // Memory is stored back to front on big-endian hosts, so growing the buffer
+  // moves its contents, which other threads could be accessing. memory.grow
+  // is allowed to fail, so a shared memory never grows.
+  if (shared_) {
+    return Result::Error;
+  }
+#endif
+  Buffer& buffer = shared_ ? shared_->buffer : buffer_;
   u64 new_pages;
   if (CanGrow<u64>(type_.limits, pages_, count, &new_pages)) {
+    u64 old_size = byte_size_;
+    u64 new_size = new_pages * WABT_PAGE_SIZE;
+    if (reserved_size_) {
+#if WABT_INTERP_GUARD_PAGES
+      // The pages are already reserved; just make them accessible. No copy
+      // is needed, and they are zero-filled on first touch. A pool slot may
+      // be smaller than the memory's maximum.
+      if (new_size > reserved_size_ ||
+          mprotect(data_ + old_size, new_size - old_size,
+                   PROT_READ | PROT_WRITE) != 0) {
+        return Result::Error;
+      }
+#endif
+    } else {
+      buffer.resize(new_size);
+      assert(!shared_ || buffer.data() == data_);
+      data_ = buffer.data();
+#if WABT_BIG_ENDIAN
+      std::move_backward(data_, data_ + old_size, data_ + new_size);
+      std::fill(data_, data_ + new_size - old_size, 0);
+#endif
+    }
     // Grow the limits of the memory too, so that if it is used as an
     // import to another module its new size is honored.
     type_.limits.initial += count;
-#if WABT_BIG_ENDIAN
-    auto old_size = data_.size();
-#endif
     pages_ = new_pages;
-    data_.resize(new_pages * WABT_PAGE_SIZE);
-#if WABT_BIG_ENDIAN
-    std::move_backward(data_.begin(), data_.begin() + old_size, data_.end());
-    std::fill(data_.begin(), data_.end() - old_size, 0);
-#endif
+    byte_size_ = new_size;
+    if (shared_) {
+      shared_->byte_size = new_size;
+    }
     return Result::Ok;
   }
   return Result::Error;
@@ -576,9 +1010,10 @@ Result Memory::Grow(u64 count) {
 Result Memory::Fill(u64 offset, u8 value, u64 size) {
   if (IsValidAccess(offset, 0, size)) {
 #if WABT_BIG_ENDIAN
-    std::fill(data_.end() - offset - size, data_.end() - offset, value);
+    std::fill(data_ + byte_size_ - offset - size, data_ + byte_size_ - offset,
+              value);
 #else
-    std::fill(data_.begin() + offset, data_.begin() + offset + size, value);
+    std::fill(data_ + offset, data_ + offset + size, value);
 #endif
     return Result::Ok;
   }
@@ -594,9 +1029,9 @@ Result Memory::Init(u64 dst_offset,
     std::copy(src.desc().data.begin() + src_offset,
               src.desc().data.begin() + src_offset + size,
 #if WABT_BIG_ENDIAN
-              data_.rbegin() + dst_offset);
+              std::reverse_iterator<u8*>(data_ + byte_size_) + dst_offset);
 #else
-              data_.begin() + dst_offset);
+              data_ + dst_offset);
 #endif
     return Result::Ok;
   }
@@ -612,11 +1047,11 @@ Result Memory::Copy(Memory& dst,
   if (dst.IsValidAccess(dst_offset, 0, size) &&
       src.IsValidAccess(src_offset, 0, size)) {
 #if WABT_BIG_ENDIAN
-    auto src_begin = src.data_.end() - src_offset - size;
-    auto dst_begin = dst.data_.end() - dst_offset - size;
+    auto src_begin = src.data_ + src.byte_size_ - src_offset - size;
+    auto dst_begin = dst.data_ + dst.byte_size_ - dst_offset - size;
 #else
-    auto src_begin = src.data_.begin() + src_offset;
-    auto dst_begin = dst.data_.begin() + dst_offset;
+    auto src_begin = src.data_ + src_offset;
+    auto dst_begin = dst.data_ + dst_offset;
 #endif
     auto src_end = src_begin + size;
     auto dst_end = dst_begin + size;
@@ -630,6 +1065,172 @@ Result Memory::Copy(Memory& dst,
   return Result::Error;
 }
 
+const u32 Memory::kWaitInterrupted;
+
+template <typename T>
+Result Memory::AtomicWaitImpl(u64 offset,
+                              u64 addend,
+                              T expect,
+                              s64 timeout,
+                              u32* out,
+                              const std::atomic<bool>* interrupt) {
+  if (!shared_ || !IsValidAtomicAccess(offset, addend, sizeof(T))) {
+    return Result::Error;
+  }
+  // The value is checked with wait_mutex held, and AtomicNotify takes it too,
+  // so a notify after the value changes can't be missed.
+  std::unique_lock<std::mutex> lock(shared_->wait_mutex);
+  if (AtomicAddress<T>(offset, addend)->load() != expect) {
+    *out = 1;
+    return Result::Ok;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  SharedMemoryStorage::Waiter waiter;
+  auto iter = shared_->waiters.emplace(offset + addend, &waiter);
+  Clock::time_point now = Clock::now();
+  Clock::time_point deadline = Clock::time_point::max();
+  if (timeout >= 0 &&
+      std::chrono::nanoseconds(timeout) < Clock::time_point::max() - now) {
+    deadline = now + std::chrono::nanoseconds(timeout);
+  }
+
+  // Nothing notifies the condition variable when `interrupt` is set, so wake
+  // up to poll it.
+  const auto kInterruptPollInterval = std::chrono::milliseconds(10);
+  while (!waiter.notified) {
+    if (interrupt && interrupt->load(std::memory_order_relaxed)) {
+      shared_->waiters.erase(iter);
+      *out = kWaitInterrupted;
+      return Result::Ok;
+    }
+    now = Clock::now();
+    if (now >= deadline) {
+      shared_->waiters.erase(iter);
+      *out = 2;
+      return Result::Ok;
+    }
+    if (interrupt && deadline - now > kInterruptPollInterval) {
+      waiter.cond.wait_for(lock, kInterruptPollInterval);
+    } else if (deadline == Clock::time_point::max()) {
+      waiter.cond.wait(lock);
+    } else {
+      waiter.cond.wait_until(lock, deadline);
+    }
+  }
+  // AtomicNotify removes the waiters it wakes.
+  *out = 0;
+  return Result::Ok;
+}
+
+Result Memory::AtomicWait(u64 offset,
+                          u64 addend,
+                          u32 expect,
+                          s64 timeout,
+                          u32* out,
+                          const std::atomic<bool>* interrupt) {
+  return AtomicWaitImpl(offset, addend, expect, timeout, out, interrupt);
+}
+
+Result Memory::AtomicWait(u64 offset,
+                          u64 addend,
+                          u64 expect,
+                          s64 timeout,
+                          u32* out,
+                          const std::atomic<bool>* interrupt) {
+  return AtomicWaitImpl(offset, addend, expect, timeout, out, interrupt);
+}
+
+Result Memory::AtomicNotify(u64 offset, u64 addend, u32 count, u32* out) {
+  if (!IsValidAtomicAccess(offset, addend, sizeof(u32))) {
+    return Result::Error;
+  }
+  *out = 0;
+  if (!shared_) {
+    return Result::Ok;
+  }
+  std::lock_guard<std::mutex> lock(shared_->wait_mutex);
+  auto range = shared_->waiters.equal_range(offset + addend);
+  for (auto iter = range.first; iter != range.second && *out < count;
+       ++*out) {
+    iter->second->notified = true;
+    iter->second->cond.notify_one();
+    iter = shared_->waiters.erase(iter);
+  }
+  return Result::Ok;
+}
+
+#if WABT_INTERP_GUARD_PAGES && defined(MFD_CLOEXEC)
+// Writes `data` to a new anonymous file. Zero pages are skipped, so they are
+// holes in the file and take no space.
+static int WriteImageFile(const u8* data, u64 size) {
+  int fd = memfd_create("wabt-memory-image", MFD_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return -1;
+  }
+  const u64 kChunkSize = 4096;
+  for (u64 offset = 0; offset < size; offset += kChunkSize) {
+    const u8* chunk = data + offset;
+    u64 chunk_size = std::min(kChunkSize, size - offset);
+    if (std::all_of(chunk, chunk + chunk_size, [](u8 x) { return x == 0; })) {
+      continue;
+    }
+    for (u64 written = 0; written < chunk_size;) {
+      ssize_t count = pwrite(fd, chunk + written, chunk_size - written,
+                             offset + written);
+      if (count <= 0) {
+        close(fd);
+        return -1;
+      }
+      written += count;
+    }
+  }
+  return fd;
+}
+#endif
+
+void Memory::SaveImage(Buffer* out_data, int* out_fd) const {
+  *out_fd = -1;
+#if WABT_INTERP_GUARD_PAGES && defined(MFD_CLOEXEC)
+  if (reserved_size_) {
+    *out_fd = WriteImageFile(data_, byte_size_);
+    if (*out_fd >= 0) {
+      return;
+    }
+  }
+#endif
+  out_data->assign(data_, data_ + byte_size_);
+}
+
+void Memory::RestoreImage(const Buffer& data, int fd) {
+  if (fd < 0) {
+    assert(data.size() == byte_size_);
+    std::copy(data.begin(), data.end(), data_);
+    return;
+  }
+#if WABT_INTERP_GUARD_PAGES
+  // Map the image over the start of the reserved range. Pages that are only
+  // read are shared with the image (and every other memory restored from it).
+  if (reserved_size_ && byte_size_ != 0 &&
+      mmap(data_, byte_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+           fd, 0) != MAP_FAILED) {
+    mapped_image_ = true;
+    return;
+  }
+  for (u64 offset = 0; offset < byte_size_;) {
+    ssize_t count = pread(fd, data_ + offset, byte_size_ - offset, offset);
+    if (count <= 0) {
+      break;
+    }
+    offset += count;
+  }
+#endif
+}
+
 Value Instance::ResolveInitExpr(Store& store, InitExpr init) {
   Value result;
   switch (init.kind) {
@@ -657,6 +1258,21 @@ Value Instance::ResolveInitExpr(Store& store, InitExpr init) {
   return result;
 }
 
+void Instance::ResolvePtrs(Store& store) {
+  for (auto ref : funcs_) {
+    func_ptrs_.push_back(store.UnsafeGetRaw<Func>(ref));
+  }
+  for (auto ref : tables_) {
+    table_ptrs_.push_back(store.UnsafeGetRaw<Table>(ref));
+  }
+  for (auto ref : memories_) {
+    memory_ptrs_.push_back(store.UnsafeGetRaw<Memory>(ref));
+  }
+  for (auto ref : globals_) {
+    global_ptrs_.push_back(store.UnsafeGetRaw<Global>(ref));
+  }
+}
+
 //// Global ////
 Global::Global(Store& store, GlobalType type, Value value)
     : Extern(skind), type_(type), value_(value) {}
@@ -676,13 +1292,17 @@ Result Global::Match(Store& store,
 Result Global::Set(Store& store, Ref ref) {
   if (store.HasValueType(ref, type_.type)) {
     value_.Set(ref);
+    store.RecordWrite(this);
     return Result::Ok;
   }
   return Result::Error;
 }
 
-void Global::UnsafeSet(Value value) {
+void Global::UnsafeSet(Store& store, Value value) {
   value_ = value;
+  if (IsReference(type_.type)) {
+    store.RecordWrite(this);
+  }
 }
 
 //// Tag ////
@@ -728,19 +1348,43 @@ bool DataSegment::IsValidRange(u64 offset, u64 size) const {
 }
 
 //// Module ////
-Module::Module(Store&, ModuleDesc desc)
+Module::Module(Store&, SharedModuleDesc desc)
     : Object(skind), desc_(std::move(desc)) {
-  for (auto&& import : desc_.imports) {
+  for (auto&& import : desc_->imports) {
     import_types_.emplace_back(import.type);
   }
 
-  for (auto&& export_ : desc_.exports) {
+  for (auto&& export_ : desc_->exports) {
     export_types_.emplace_back(export_.type);
   }
 }
 
 void Module::Mark(Store&) {}
 
+Module::JitFunc& Module::GetJitFunc(const FuncDesc& func) {
+  if (jit_funcs_.empty()) {
+    jit_funcs_.resize(desc_->funcs.size());
+  }
+  return jit_funcs_[&func - desc_->funcs.data()];
+}
+
+std::unique_ptr<ThreadedCode>& Module::GetThreadedCode(const FuncDesc& func) {
+  if (threaded_funcs_.empty()) {
+    threaded_funcs_.resize(desc_->funcs.size());
+  }
+  return threaded_funcs_[&func - desc_->funcs.data()];
+}
+
+Result Module::CompileFunc(const FuncDesc& func, std::string* out_message) {
+  if (func.code_offset != Istream::kInvalidOffset) {
+    return Result::Ok;
+  }
+  assert(desc_->lazy_compiler);
+  Index func_index = &func - desc_->funcs.data();
+  return desc_->lazy_compiler->CompileFunc(desc_.get(), func_index,
+                                           out_message);
+}
+
 //// ElemSegment ////
 void ElemSegment::Mark(Store& store) {
   store.Mark(elements_);
@@ -781,20 +1425,17 @@ Instance::Ptr Instance::Instantiate(Store& store,
       return {};
     }
 
-    inst->imports_.push_back(extern_ref);
+    inst->AddImport(import_desc.type.type->kind, extern_ref);
+  }
 
-    switch (import_desc.type.type->kind) {
-      case ExternKind::Func:   inst->funcs_.push_back(extern_ref); break;
-      case ExternKind::Table:  inst->tables_.push_back(extern_ref); break;
-      case ExternKind::Memory: inst->memories_.push_back(extern_ref); break;
-      case ExternKind::Global: inst->globals_.push_back(extern_ref); break;
-      case ExternKind::Tag:    inst->tags_.push_back(extern_ref); break;
-    }
+  // Function types.
+  for (auto&& func_type : mod->desc().func_types) {
+    inst->func_type_ids_.push_back(store.InternFuncType(func_type));
   }
 
   // Funcs.
   for (auto&& desc : mod->desc().funcs) {
-    inst->funcs_.push_back(DefinedFunc::New(store, inst.ref(), desc).ref());
+    inst->funcs_.push_back(DefinedFunc::New(store, inst.ref(), &desc).ref());
   }
 
   // Tables.
@@ -819,18 +1460,8 @@ Instance::Ptr Instance::Instantiate(Store& store,
     inst->tags_.push_back(Tag::New(store, desc.type).ref());
   }
 
-  // Exports.
-  for (auto&& desc : mod->desc().exports) {
-    Ref ref;
-    switch (desc.type.type->kind) {
-      case ExternKind::Func:   ref = inst->funcs_[desc.index]; break;
-      case ExternKind::Table:  ref = inst->tables_[desc.index]; break;
-      case ExternKind::Memory: ref = inst->memories_[desc.index]; break;
-      case ExternKind::Global: ref = inst->globals_[desc.index]; break;
-      case ExternKind::Tag:    ref = inst->tags_[desc.index]; break;
-    }
-    inst->exports_.push_back(ref);
-  }
+  inst->ResolvePtrs(store);
+  inst->ResolveExports(mod->desc());
 
   // Elems.
   for (auto&& desc : mod->desc().elems) {
@@ -919,6 +1550,31 @@ Instance::Ptr Instance::Instantiate(Store& store,
   return inst;
 }
 
+void Instance::AddImport(ExternKind kind, Ref ref) {
+  imports_.push_back(ref);
+  switch (kind) {
+    case ExternKind::Func:   funcs_.push_back(ref); break;
+    case ExternKind::Table:  tables_.push_back(ref); break;
+    case ExternKind::Memory: memories_.push_back(ref); break;
+    case ExternKind::Global: globals_.push_back(ref); break;
+    case ExternKind::Tag:    tags_.push_back(ref); break;
+  }
+}
+
+void Instance::ResolveExports(const ModuleDesc& desc) {
+  for (auto&& export_ : desc.exports) {
+    Ref ref;
+    switch (export_.type.type->kind) {
+      case ExternKind::Func:   ref = funcs_[export_.index]; break;
+      case ExternKind::Table:  ref = tables_[export_.index]; break;
+      case ExternKind::Memory: ref = memories_[export_.index]; break;
+      case ExternKind::Global: ref = globals_[export_.index]; break;
+      case ExternKind::Tag:    ref = tags_[export_.index]; break;
+    }
+    exports_.push_back(ref);
+  }
+}
+
 void Instance::Mark(Store& store) {
   store.Mark(module_);
   store.Mark(imports_);
@@ -933,173 +1589,1070 @@ void Instance::Mark(Store& store) {
   }
 }
 
-//// Thread ////
-Thread::Thread(Store& store, const Options& options)
-    : Object(skind), store_(store) {
-  frames_.reserve(options.call_stack_size);
-  values_.reserve(options.value_stack_size);
-  trace_stream_ = options.trace_stream;
-  if (options.trace_stream) {
-    trace_source_ = MakeUnique<TraceSource>(this);
+//// InstanceSnapshot ////
+InstanceSnapshot::InstanceSnapshot(Store& store, Ref module)
+    : Object(skind), module_(module) {
+  assert(store.Is<Module>(module));
+}
+
+InstanceSnapshot::~InstanceSnapshot() {
+#if WABT_INTERP_GUARD_PAGES
+  for (auto&& image : memories_) {
+    if (image.fd >= 0) {
+      close(image.fd);
+    }
+  }
+#endif
+}
+
+// static
+InstanceSnapshot::Ptr InstanceSnapshot::New(Store& store,
+                                            Ref instance,
+                                            Trap::Ptr* out_trap) {
+  Instance::Ptr inst{store, instance};
+  Module::Ptr mod{store, inst->module()};
+  auto&& mod_desc = mod->desc();
+
+  for (auto&& import_desc : mod_desc.imports) {
+    auto&& type = *import_desc.type.type;
+    if (type.kind == ExternKind::Table || type.kind == ExternKind::Memory ||
+        (type.kind == ExternKind::Global &&
+         cast<GlobalType>(&type)->mut == Mutability::Var)) {
+      *out_trap = Trap::New(
+          store, StringPrintf("can't snapshot an instance that imports a "
+                              "%s: \"%s.%s\"",
+                              GetName(type.kind),
+                              import_desc.type.module.c_str(),
+                              import_desc.type.name.c_str()));
+      return {};
+    }
+  }
+
+  InstanceSnapshot::Ptr snapshot =
+      store.Alloc<InstanceSnapshot>(store, inst->module());
+  snapshot->imports_ = inst->imports_;
+
+  std::unordered_map<size_t, Index> func_indexes;
+  for (Index i = 0; i < inst->funcs_.size(); ++i) {
+    func_indexes.emplace(inst->funcs_[i].index, i);
+  }
+  auto save_ref = [&](Ref ref) -> SavedRef {
+    auto iter = func_indexes.find(ref.index);
+    if (iter != func_indexes.end()) {
+      return {Ref::Null, iter->second};
+    }
+    return {ref, kInvalidIndex};
+  };
+
+  for (Ref ref : inst->tables_) {
+    Table::Ptr table{store, ref};
+    TableImage image{table->type(), {}};
+    image.elements.reserve(table->size());
+    for (Ref element : table->elements()) {
+      image.elements.push_back(save_ref(element));
+    }
+    snapshot->tables_.push_back(std::move(image));
+  }
+
+  for (Ref ref : inst->memories_) {
+    Memory::Ptr memory{store, ref};
+    MemoryImage image{memory->type(), {}, -1};
+    memory->SaveImage(&image.data, &image.fd);
+    snapshot->memories_.push_back(std::move(image));
+  }
+
+  // Imported globals are immutable, so only the defined ones are saved.
+  for (size_t i = inst->globals_.size() - mod_desc.globals.size();
+       i < inst->globals_.size(); ++i) {
+    Global::Ptr global{store, inst->globals_[i]};
+    GlobalImage image{global->type(), global->Get(),
+                      {Ref::Null, kInvalidIndex}};
+    if (IsReference(image.type.type)) {
+      image.ref = save_ref(image.value.Get<Ref>());
+    }
+    snapshot->globals_.push_back(image);
+  }
+
+  for (auto&& segment : inst->elems_) {
+    snapshot->elem_dropped_.push_back(segment.size() == 0);
+  }
+  for (auto&& segment : inst->datas_) {
+    snapshot->data_dropped_.push_back(segment.size() == 0);
+  }
+
+  return snapshot;
+}
+
+Instance::Ptr InstanceSnapshot::Instantiate(Store& store) const {
+  Module::Ptr mod{store, module_};
+  auto&& mod_desc = mod->desc();
+  Instance::Ptr inst = store.Alloc<Instance>(store, module_);
+
+  for (size_t i = 0; i < imports_.size(); ++i) {
+    inst->AddImport(mod_desc.imports[i].type.type->kind, imports_[i]);
+  }
+
+  for (auto&& func_type : mod_desc.func_types) {
+    inst->func_type_ids_.push_back(store.InternFuncType(func_type));
+  }
+
+  for (auto&& desc : mod_desc.funcs) {
+    inst->funcs_.push_back(DefinedFunc::New(store, inst.ref(), &desc).ref());
+  }
+
+  auto load_ref = [&](const SavedRef& saved) {
+    return saved.func_index != kInvalidIndex ? inst->funcs_[saved.func_index]
+                                             : saved.ref;
+  };
+
+  for (auto&& image : tables_) {
+    Table::Ptr table = Table::New(store, image.type);
+    for (u32 i = 0; i < image.elements.size(); ++i) {
+      table->Set(store, i, load_ref(image.elements[i]));
+    }
+    inst->tables_.push_back(table.ref());
+  }
+
+  for (auto&& image : memories_) {
+    Memory::Ptr memory = Memory::New(store, image.type);
+    memory->RestoreImage(image.data, image.fd);
+    inst->memories_.push_back(memory.ref());
+  }
+
+  for (auto&& image : globals_) {
+    Value value = image.value;
+    if (IsReference(image.type.type)) {
+      value.Set(load_ref(image.ref));
+    }
+    inst->globals_.push_back(Global::New(store, image.type, value).ref());
+  }
+
+  for (auto&& desc : mod_desc.tags) {
+    inst->tags_.push_back(Tag::New(store, desc.type).ref());
+  }
+
+  inst->ResolvePtrs(store);
+  inst->ResolveExports(mod_desc);
+
+  for (size_t i = 0; i < mod_desc.elems.size(); ++i) {
+    inst->elems_.emplace_back(&mod_desc.elems[i], inst);
+    if (elem_dropped_[i]) {
+      inst->elems_.back().Drop();
+    }
+  }
+
+  for (size_t i = 0; i < mod_desc.datas.size(); ++i) {
+    inst->datas_.emplace_back(&mod_desc.datas[i]);
+    if (data_dropped_[i]) {
+      inst->datas_.back().Drop();
+    }
+  }
+
+  return inst;
+}
+
+void InstanceSnapshot::Mark(Store& store) {
+  store.Mark(module_);
+  store.Mark(imports_);
+  for (auto&& image : tables_) {
+    for (auto&& element : image.elements) {
+      store.Mark(element.ref);
+    }
+  }
+  for (auto&& image : globals_) {
+    store.Mark(image.ref.ref);
+  }
+}
+
+//// StackSlot ////
+// Values are stored on the value stack as raw bytes, starting at their lowest
+// slot. Narrow integers (e.g. SIMD lanes) are stored as i32, as in Value.
+template <typename T>
+using SlotType =
+    typename std::conditional<(sizeof(T) < sizeof(u32)), u32, T>::type;
+
+template <typename T>
+struct SlotCount
+    : std::integral_constant<Index,
+                             (sizeof(SlotType<T>) + sizeof(StackSlot) - 1) /
+                                 sizeof(StackSlot)> {};
+
+template <typename T>
+T ReadSlots(const StackSlot* slots) {
+  SlotType<T> value;
+  memcpy(&value, slots, sizeof(value));
+  return static_cast<T>(value);
+}
+
+template <typename T>
+void WriteSlots(StackSlot* slots, T value) {
+  SlotType<T> stored = value;
+  memcpy(slots, &stored, sizeof(stored));
+}
+
+//// Thread ////
+Thread::Thread(Store& store, const Options& options)
+    : Object(skind), store_(store) {
+  frames_.reserve(options.call_stack_size);
+  values_.reserve(options.value_stack_size);
+  trace_stream_ = options.trace_stream;
+  if (options.trace_stream) {
+    trace_source_ = MakeUnique<TraceSource>(this);
+  }
+  profiler_ = options.profiler;
+  fuel_ = options.fuel;
+  interrupt_ = options.interrupt;
+  simd_kernels_ = options.native_simd ? &GetNativeSimdKernels()
+                                      : &GetPortableSimdKernels();
+  jit_ = WABT_INTERP_JIT && store.options().jit && !trace_stream_ &&
+         !profiler_;
+  threaded_ = WABT_INTERP_THREADED && store.options().threaded &&
+              !trace_stream_ && !jit_;
+}
+
+void Thread::Reset() {
+  frames_.clear();
+  values_.clear();
+  exceptions_.clear();
+  inst_ = nullptr;
+  mod_ = nullptr;
+  fuel_ = Options().fuel;
+}
+
+void Thread::Mark(Store& store) {
+  for (size_t i = 0; i < frames_.size(); ++i) {
+    frames_[i].Mark(store);
+    MarkValues(store, frames_[i], i + 1 == frames_.size());
+  }
+  store.Mark(exceptions_);
+  if (async_func_ != Ref::Null) {
+    store.Mark(async_func_);
+  }
+}
+
+void Thread::MarkValues(Store& store,
+                        const Frame& frame,
+                        bool is_top_frame) {
+  Func* func_object = store.UnsafeGetRaw<Func>(frame.func);
+  if (auto* host_func = dyn_cast<HostFunc>(func_object)) {
+    // The parameters and results of a host call are just below its frame;
+    // results that haven't been set yet are null.
+    u32 slot = frame.values - host_func->result_slot_count_ -
+               host_func->param_slot_count_;
+    for (const ValueTypes* types :
+         {&host_func->type().params, &host_func->type().results}) {
+      for (auto type : *types) {
+        if (IsReference(type)) {
+          store.Mark(ReadSlots<Ref>(&values_[slot]));
+        }
+        slot += GetSlotCount(type);
+      }
+    }
+    return;
+  }
+
+  auto* func = cast<DefinedFunc>(func_object);
+
+  // Parameters and locals. Locals are only allocated by the function's first
+  // instruction, and a frame reused by return_call to an import may have
+  // given up its own, so check that each slot is still on the stack.
+  const FuncDesc& desc = func->desc();
+  u32 slot = frame.values - GetSlotCount(desc.type.params);
+  for (auto type : desc.type.params) {
+    if (IsReference(type) && slot < values_.size()) {
+      store.Mark(ReadSlots<Ref>(&values_[slot]));
+    }
+    slot += GetSlotCount(type);
+  }
+  for (auto&& local : desc.locals) {
+    if (!IsReference(local.type)) {
+      slot += local.count * GetSlotCount(local.type);
+      continue;
+    }
+    for (u32 i = 0; i < local.count && slot < values_.size(); ++i, ++slot) {
+      store.Mark(ReadSlots<Ref>(&values_[slot]));
+    }
+  }
+
+  if (is_top_frame) {
+    // A thread paused between instructions by Run(int) or Step isn't at a
+    // call, so there is no stack map for it. Scan its operand stack
+    // conservatively instead; a number that happens to look like a live
+    // object only keeps that object alive a little longer.
+    for (; slot < values_.size(); ++slot) {
+      Ref ref = ReadSlots<Ref>(&values_[slot]);
+      if (store.IsValid(ref)) {
+        store.Mark(ref);
+      }
+    }
+    return;
+  }
+
+  auto iter = std::lower_bound(
+      desc.stack_maps.begin(), desc.stack_maps.end(), frame.offset,
+      [](const StackMapDesc& lhs, u32 rhs) { return lhs.offset < rhs; });
+  if (iter != desc.stack_maps.end() && iter->offset == frame.offset) {
+    for (auto map_slot : iter->slots) {
+      store.Mark(ReadSlots<Ref>(&values_[frame.values + map_slot]));
+    }
+  }
+}
+
+void Thread::PushValues(const ValueTypes& types, const Values& values) {
+  assert(types.size() == values.size());
+  PushValues(types, values.data());
+}
+
+void Thread::PushValues(const ValueTypes& types, const Value* values) {
+  for (size_t i = 0; i < types.size(); ++i) {
+    PushValue(types[i], values[i]);
+  }
+}
+
+void Thread::PushValue(ValueType type, Value value) {
+  switch (type) {
+    case ValueType::I32:       Push(value.Get<u32>()); break;
+    case ValueType::I64:       Push(value.Get<u64>()); break;
+    case ValueType::F32:       Push(value.Get<f32>()); break;
+    case ValueType::F64:       Push(value.Get<f64>()); break;
+    case ValueType::V128:      Push(value.Get<v128>()); break;
+    case ValueType::FuncRef:
+    case ValueType::ExternRef: Push(value.Get<Ref>()); break;
+    default:                   WABT_UNREACHABLE;
+  }
+}
+
+#define TRAP(msg) *out_trap = Trap::New(store_, (msg), frames_), RunResult::Trap
+#define TRAP_IF(cond, msg)     \
+  if (WABT_UNLIKELY((cond))) { \
+    return TRAP(msg);          \
+  }
+#define TRAP_UNLESS(cond, msg) TRAP_IF(!(cond), msg)
+
+Instance* Thread::GetCallerInstance() {
+  if (frames_.size() < 2)
+    return nullptr;
+  return frames_[frames_.size() - 2].inst;
+}
+
+RunResult Thread::CompileFunc(const DefinedFunc& func, Trap::Ptr* out_trap) {
+  Instance* inst = store_.UnsafeGet<Instance>(func.instance()).get();
+  Module* mod = store_.UnsafeGet<Module>(inst->module()).get();
+  std::string message;
+  TRAP_IF(Failed(mod->CompileFunc(func.desc(), &message)), message);
+  return RunResult::Ok;
+}
+
+RunResult Thread::PushCall(Ref func, u32 offset, Trap::Ptr* out_trap) {
+  TRAP_IF(frames_.size() == frames_.capacity(), "call stack exhausted");
+  frames_.emplace_back(func, values_.size(), exceptions_.size(), offset, inst_,
+                       mod_);
+  return RunResult::Ok;
+}
+
+RunResult Thread::PushCall(const DefinedFunc& func, Trap::Ptr* out_trap) {
+  TRAP_IF(frames_.size() == frames_.capacity(), "call stack exhausted");
+  if (WABT_UNLIKELY(func.desc().code_offset == Istream::kInvalidOffset) &&
+      CompileFunc(func, out_trap) == RunResult::Trap) {
+    return RunResult::Trap;
+  }
+  inst_ = store_.UnsafeGet<Instance>(func.instance()).get();
+  mod_ = store_.UnsafeGet<Module>(inst_->module()).get();
+  frames_.emplace_back(func.self(), values_.size(), exceptions_.size(),
+                       func.desc().code_offset, inst_, mod_);
+  return RunResult::Ok;
+}
+
+RunResult Thread::PushCall(const HostFunc& func, Trap::Ptr* out_trap) {
+  TRAP_IF(frames_.size() == frames_.capacity(), "call stack exhausted");
+  inst_ = nullptr;
+  mod_ = nullptr;
+  frames_.emplace_back(func.self(), values_.size(), exceptions_.size(), 0,
+                       inst_, mod_);
+  return RunResult::Ok;
+}
+
+RunResult Thread::PopCall() {
+  // Sanity check that the exception stack was popped correctly.
+  assert(frames_.back().exceptions == exceptions_.size());
+
+  frames_.pop_back();
+  if (frames_.empty()) {
+    return RunResult::Return;
+  }
+
+  auto& frame = frames_.back();
+  if (!frame.inst) {
+    // Returning to a HostFunc called on this thread.
+    return RunResult::Return;
+  }
+
+  inst_ = frame.inst;
+  mod_ = frame.mod;
+  return RunResult::Ok;
+}
+
+RunResult Thread::DoReturnCall(Func* func, Trap::Ptr* out_trap) {
+  PopCall();
+  RunResult result = DoCall(func, out_trap);
+  if (result != RunResult::Ok) {
+    return result;
+  }
+  return frames_.empty() ? RunResult::Return : RunResult::Ok;
+}
+
+void Thread::PopValues(const ValueTypes& types, Values* out_values) {
+  out_values->resize(types.size());
+  PopValues(types, out_values->data());
+}
+
+void Thread::PopValues(const ValueTypes& types, Value* out_values) {
+  assert(values_.size() >= GetSlotCount(types));
+  for (size_t i = types.size(); i > 0; --i) {
+    out_values[i - 1] = PopValue(types[i - 1]);
+  }
+}
+
+Value Thread::PopValue(ValueType type) {
+  switch (type) {
+    case ValueType::I32:       return Value::Make(Pop<u32>());
+    case ValueType::I64:       return Value::Make(Pop<u64>());
+    case ValueType::F32:       return Value::Make(Pop<f32>());
+    case ValueType::F64:       return Value::Make(Pop<f64>());
+    case ValueType::V128:      return Value::Make(Pop<v128>());
+    case ValueType::FuncRef:
+    case ValueType::ExternRef: return Value::Make(Pop<Ref>());
+    default:                   WABT_UNREACHABLE;
+  }
+}
+
+RunResult Thread::Run(Trap::Ptr* out_trap) {
+  const int kDefaultInstructionCount = 1000;
+  RunResult result;
+  do {
+    result = Run(kDefaultInstructionCount, out_trap);
+  } while (result == RunResult::Ok);
+  return result;
+}
+
+RunResult Thread::Run(int num_instructions, Trap::Ptr* out_trap) {
+  if (interrupt_ &&
+      WABT_UNLIKELY(interrupt_->load(std::memory_order_relaxed))) {
+    return RunResult::Interrupted;
+  }
+  DefinedFunc::Ptr func{store_, frames_.back().func};
+  if (store_.options().guard_pages) {
+    return RunWithGuardPages(num_instructions, out_trap);
+  }
+  return RunInstructions(num_instructions, out_trap);
+}
+
+RunResult Thread::Step(Trap::Ptr* out_trap) {
+  DefinedFunc::Ptr func{store_, frames_.back().func};
+  if (store_.options().guard_pages) {
+    return RunWithGuardPages(1, out_trap);
+  }
+  return TraceAndStepInternal(out_trap);
+}
+
+RunResult Thread::RunInstructions(int num_instructions, Trap::Ptr* out_trap) {
+  if (WABT_UNLIKELY(profiler_)) {
+    // Run up to each sample point in one go, so the step loop is the same as
+    // without profiling. The instructions after a sample are attributed to
+    // the sampled call stack.
+    while (num_instructions > 0) {
+      if (sample_countdown_ == 0) {
+        profiler_->Sample(frames_);
+        sample_countdown_ = profiler_->sample_interval();
+      }
+      int count = std::min<u32>(num_instructions, sample_countdown_);
+      num_instructions -= count;
+      sample_countdown_ -= count;
+      auto result = StepInstructions(count, out_trap);
+      if (result != RunResult::Ok) {
+        return result;
+      }
+    }
+    return RunResult::Ok;
+  }
+  return StepInstructions(num_instructions, out_trap);
+}
+
+RunResult Thread::StepInstructions(int num_instructions, Trap::Ptr* out_trap) {
+  if (WABT_UNLIKELY(trace_stream_)) {
+    for (; num_instructions > 0; --num_instructions) {
+      auto result = TraceAndStepInternal(out_trap);
+      if (result != RunResult::Ok) {
+        return result;
+      }
+    }
+    return RunResult::Ok;
+  }
+  if (jit_) {
+    return JitInstructions(num_instructions, out_trap);
+  }
+  if (threaded_) {
+    return ThreadedInstructions(num_instructions, out_trap);
+  }
+  // Keep the untraced loop free of anything but dispatch; the trace check
+  // above is hoisted out so it isn't paid on every instruction.
+  for (; num_instructions > 0; --num_instructions) {
+    auto result = StepInternal(out_trap);
+    if (result != RunResult::Ok) {
+      return result;
+    }
+  }
+  return RunResult::Ok;
+}
+
+RunResult Thread::JitInstructions(int num_instructions, Trap::Ptr* out_trap) {
+  // A host call in the previous slice may have collected the function.
+  jit_func_ref_ = Ref::Null;
+  u32 threshold = store_.options().jit_threshold;
+  for (; num_instructions > 0; --num_instructions) {
+    Frame& frame = frames_.back();
+    if (frame.func != jit_func_ref_) {
+      auto* func = store_.UnsafeGetRaw<DefinedFunc>(frame.func);
+      jit_func_ref_ = frame.func;
+      jit_func_ = &mod_->GetJitFunc(func->desc());
+    }
+    Module::JitFunc& jit_func = *jit_func_;
+    if (WABT_UNLIKELY(!jit_func.compiled) && jit_func.count++ >= threshold) {
+      jit_func.compiled = true;
+      auto* func = store_.UnsafeGetRaw<DefinedFunc>(frame.func);
+      jit_func.code =
+          JitCode::Compile(mod_->desc().istream, func->desc().code_offset);
+    }
+    if (jit_func.code) {
+      if (const void* entry = jit_func.code->GetEntry(frame.offset)) {
+        if (!RunJit(*jit_func.code, entry)) {
+          return RunResult::Ok;
+        }
+      }
+    }
+    // Either the code exited before this instruction, or there is no code
+    // for it.
+    auto result = StepInternal(out_trap);
+    if (result != RunResult::Ok) {
+      return result;
+    }
+  }
+  return RunResult::Ok;
+}
+
+bool Thread::RunJit(const JitCode& code, const void* entry) {
+  // Room for the code to push values before it has to exit; the interpreter
+  // runs whatever needs more.
+  const size_t kHeadroom = 64;
+  // Loop iterations between checks of the interrupt flag.
+  const u32 kLoopBudget = 10000;
+
+  size_t height = values_.size();
+  values_.resize(height + kHeadroom);
+  JitContext context;
+  context.sp = values_.data() + height;
+  context.limit = values_.data() + values_.size();
+  context.memory_data = nullptr;
+  context.memory_size = 0;
+  if (!inst_->memories().empty()) {
+    Memory* memory = inst_->memory_ptr(0);
+    if (!memory->type().limits.is_64) {
+      context.memory_data = memory->UnsafeData();
+      context.memory_size = memory->ByteSize();
+    }
+  }
+  context.fuel = fuel_;
+  context.budget = kLoopBudget;
+
+  frames_.back().offset = code.Run(&context, entry);
+  values_.resize(context.sp - values_.data());
+  fuel_ = context.fuel;
+  return context.budget != 0;
+}
+
+RunResult Thread::ThreadedInstructions(int num_instructions,
+                                       Trap::Ptr* out_trap) {
+#if WABT_INTERP_THREADED
+  static const void* const kHandlers[] = {
+      &&op_Generic,
+#define WABT_THREADED_OP(name) &&op_##name,
+      WABT_FOREACH_THREADED_OPCODE(WABT_THREADED_OP)
+#undef WABT_THREADED_OP
+  };
+  static_assert(WABT_ARRAY_SIZE(kHandlers) ==
+                    static_cast<size_t>(ThreadedOp::Count),
+                "a ThreadedOp has no handler");
+
+  // The handlers keep the current instruction in `ip`, and only store its
+  // offset in the frame before something that may read it: a trap, a call
+  // or the end of the slice.
+  Ref func_ref = Ref::Null;
+  const ThreadedCode* code = nullptr;
+  Frame* frame = nullptr;
+  const ThreadedInstr* ip = nullptr;
+
+#define DISPATCH()                              \
+  if (WABT_UNLIKELY(--num_instructions == 0)) { \
+    frame->offset = ip->offset;                 \
+    return RunResult::Ok;                       \
+  }                                             \
+  goto* ip->handler
+#define NEXT() \
+  ++ip;        \
+  DISPATCH()
+#define JUMP()     \
+  ip = ip->target; \
+  DISPATCH()
+#define MEMORY_OP(call)                         \
+  frame->offset = ip->next;                     \
+  if (WABT_UNLIKELY(call == RunResult::Trap)) { \
+    return RunResult::Trap;                     \
+  }                                             \
+  NEXT()
+
+  if (num_instructions <= 0) {
+    return RunResult::Ok;
+  }
+
+resync:
+  // Find the current instruction after the top frame changed, or the
+  // interpreter ran an instruction that may have branched.
+  frame = &frames_.back();
+  if (frame->func != func_ref) {
+    auto* func = store_.UnsafeGetRaw<DefinedFunc>(frame->func);
+    std::unique_ptr<ThreadedCode>& func_code =
+        mod_->GetThreadedCode(func->desc());
+    if (!func_code) {
+      func_code = ThreadedCode::Decode(mod_->desc().istream,
+                                       func->desc().code_offset, kHandlers);
+    }
+    func_ref = frame->func;
+    code = func_code.get();
+  }
+  ip = code->Find(frame->offset);
+  if (WABT_UNLIKELY(!ip)) {
+    // A catch handler, which isn't decoded.
+    auto result = StepInternal(out_trap);
+    if (result != RunResult::Ok) {
+      return result;
+    }
+    if (--num_instructions == 0) {
+      return RunResult::Ok;
+    }
+    goto resync;
+  }
+  goto* ip->handler;
+
+op_Generic: {
+  frame->offset = ip->offset;
+  auto result = StepInternal(out_trap);
+  if (result != RunResult::Ok) {
+    return result;
+  }
+  if (--num_instructions == 0) {
+    return RunResult::Ok;
+  }
+  // The instruction after this one in the istream may not have been
+  // decoded, if this one never falls through to it.
+  if (&frames_.back() != frame || frame->func != func_ref ||
+      frame->offset != ip->next || ip[1].offset != ip->next) {
+    goto resync;
+  }
+  ++ip;
+  goto* ip->handler;
+}
+
+op_Br:
+  JUMP();
+
+op_BrIf:
+  if (Pop<u32>()) {
+    JUMP();
+  }
+  NEXT();
+
+op_BrTable: {
+  auto key = Pop<u32>();
+  if (key >= ip->instr.imm_u32) {
+    key = ip->instr.imm_u32;
   }
+  // Each entry is three instructions.
+  ip = ip->target + 3 * key;
+  DISPATCH();
 }
 
-void Thread::Mark(Store& store) {
-  for (auto&& frame : frames_) {
-    frame.Mark(store);
+op_InterpBrUnless:
+  if (!Pop<u32>()) {
+    JUMP();
   }
-  for (auto index : refs_) {
-    store.Mark(values_[index].Get<Ref>());
+  NEXT();
+
+op_InterpI32LtSBrUnless: {
+  auto rhs = Pop<s32>();
+  auto lhs = Pop<s32>();
+  if (!(lhs < rhs)) {
+    JUMP();
   }
-  store.Mark(exceptions_);
+  NEXT();
 }
 
-void Thread::PushValues(const ValueTypes& types, const Values& values) {
-  assert(types.size() == values.size());
-  for (size_t i = 0; i < types.size(); ++i) {
-    if (IsReference(types[i])) {
-      refs_.push_back(values_.size());
-    }
-    values_.push_back(values[i]);
+op_InterpI32LtUBrUnless: {
+  auto rhs = Pop<u32>();
+  auto lhs = Pop<u32>();
+  if (!(lhs < rhs)) {
+    JUMP();
   }
+  NEXT();
 }
 
-#define TRAP(msg) *out_trap = Trap::New(store_, (msg), frames_), RunResult::Trap
-#define TRAP_IF(cond, msg)     \
-  if (WABT_UNLIKELY((cond))) { \
-    return TRAP(msg);          \
+op_InterpConsumeFuel:
+  if (WABT_UNLIKELY(ip->instr.imm_u32 > fuel_)) {
+    // Leave the frame at this instruction, so it runs again after set_fuel.
+    frame->offset = ip->offset;
+    return RunResult::OutOfFuel;
   }
-#define TRAP_UNLESS(cond, msg) TRAP_IF(!(cond), msg)
-
-Instance* Thread::GetCallerInstance() {
-  if (frames_.size() < 2)
-    return nullptr;
-  return frames_[frames_.size() - 2].inst;
+  fuel_ -= ip->instr.imm_u32;
+  NEXT();
+
+op_InterpAlloca:
+  // Locals are zeroed, which makes reference locals null.
+  values_.resize(values_.size() + ip->instr.imm_u32);
+  NEXT();
+
+op_InterpDropKeep: {
+  auto drop = ip->instr.imm_u32x2.fst;
+  auto keep = ip->instr.imm_u32x2.snd;
+  std::move(values_.end() - keep, values_.end(), values_.end() - drop - keep);
+  values_.resize(values_.size() - drop);
+  NEXT();
+}
+
+op_Drop:
+  DropSlots(1);
+  NEXT();
+
+op_Select: {
+  auto cond = Pop<u32>();
+  StackSlot false_ = Pick(1);
+  StackSlot true_ = Pick(2);
+  DropSlots(2);
+  PushSlot(cond ? true_ : false_);
+  NEXT();
+}
+
+op_LocalGet:
+  PushSlot(Pick(ip->instr.imm_u32));
+  NEXT();
+
+op_LocalSet:
+  Pick(ip->instr.imm_u32) = Pick(1);
+  DropSlots(1);
+  NEXT();
+
+op_LocalTee:
+  Pick(ip->instr.imm_u32) = Pick(1);
+  NEXT();
+
+op_GlobalGet: {
+  Global* global = inst_->global_ptr(ip->instr.imm_u32);
+  PushValue(global->type().type, global->Get());
+  NEXT();
+}
+
+op_GlobalSet: {
+  Global* global = inst_->global_ptr(ip->instr.imm_u32);
+  global->UnsafeSet(store_, PopValue(global->type().type));
+  NEXT();
+}
+
+op_InterpLocalGetLocalGet:
+  PushSlot(Pick(ip->instr.imm_u32x2.fst));
+  PushSlot(Pick(ip->instr.imm_u32x2.snd));
+  NEXT();
+
+op_InterpI32AddImm:
+  Push<u32>(Pop<u32>() + ip->instr.imm_u32);
+  NEXT();
+
+op_InterpI32LocalAddImm:
+  WriteSlots(&Pick(ip->instr.imm_u32x3.snd),
+             ReadSlots<u32>(&Pick(ip->instr.imm_u32x3.fst)) +
+                 ip->instr.imm_u32x3.thd);
+  NEXT();
+
+op_InterpLocalGetI32Load:
+  PushSlot(Pick(ip->instr.imm_u32x3.thd));
+  MEMORY_OP(DoLoad<u32>(ip->instr, out_trap));
+
+op_I32Load:    MEMORY_OP(DoLoad<u32>(ip->instr, out_trap));
+op_I64Load:    MEMORY_OP(DoLoad<u64>(ip->instr, out_trap));
+op_F32Load:    MEMORY_OP(DoLoad<f32>(ip->instr, out_trap));
+op_F64Load:    MEMORY_OP(DoLoad<f64>(ip->instr, out_trap));
+op_I32Load8S:  MEMORY_OP((DoLoad<s32, s8>(ip->instr, out_trap)));
+op_I32Load8U:  MEMORY_OP((DoLoad<u32, u8>(ip->instr, out_trap)));
+op_I32Load16S: MEMORY_OP((DoLoad<s32, s16>(ip->instr, out_trap)));
+op_I32Load16U: MEMORY_OP((DoLoad<u32, u16>(ip->instr, out_trap)));
+op_I64Load8S:  MEMORY_OP((DoLoad<s64, s8>(ip->instr, out_trap)));
+op_I64Load8U:  MEMORY_OP((DoLoad<u64, u8>(ip->instr, out_trap)));
+op_I64Load16S: MEMORY_OP((DoLoad<s64, s16>(ip->instr, out_trap)));
+op_I64Load16U: MEMORY_OP((DoLoad<u64, u16>(ip->instr, out_trap)));
+op_I64Load32S: MEMORY_OP((DoLoad<s64, s32>(ip->instr, out_trap)));
+op_I64Load32U: MEMORY_OP((DoLoad<u64, u32>(ip->instr, out_trap)));
+
+op_I32Store:   MEMORY_OP(DoStore<u32>(ip->instr, out_trap));
+op_I64Store:   MEMORY_OP(DoStore<u64>(ip->instr, out_trap));
+op_F32Store:   MEMORY_OP(DoStore<f32>(ip->instr, out_trap));
+op_F64Store:   MEMORY_OP(DoStore<f64>(ip->instr, out_trap));
+op_I32Store8:  MEMORY_OP((DoStore<u32, u8>(ip->instr, out_trap)));
+op_I32Store16: MEMORY_OP((DoStore<u32, u16>(ip->instr, out_trap)));
+op_I64Store8:  MEMORY_OP((DoStore<u64, u8>(ip->instr, out_trap)));
+op_I64Store16: MEMORY_OP((DoStore<u64, u16>(ip->instr, out_trap)));
+op_I64Store32: MEMORY_OP((DoStore<u64, u32>(ip->instr, out_trap)));
+
+op_I32Const: Push(ip->instr.imm_u32); NEXT();
+op_F32Const: Push(ip->instr.imm_f32); NEXT();
+op_I64Const: Push(ip->instr.imm_u64); NEXT();
+op_F64Const: Push(ip->instr.imm_f64); NEXT();
+
+op_I32Eqz: DoUnop(IntEqz<u32>); NEXT();
+op_I32Eq:  DoBinop(Eq<u32>); NEXT();
+op_I32Ne:  DoBinop(Ne<u32>); NEXT();
+op_I32LtS: DoBinop(Lt<s32>); NEXT();
+op_I32LtU: DoBinop(Lt<u32>); NEXT();
+op_I32GtS: DoBinop(Gt<s32>); NEXT();
+op_I32GtU: DoBinop(Gt<u32>); NEXT();
+op_I32LeS: DoBinop(Le<s32>); NEXT();
+op_I32LeU: DoBinop(Le<u32>); NEXT();
+op_I32GeS: DoBinop(Ge<s32>); NEXT();
+op_I32GeU: DoBinop(Ge<u32>); NEXT();
+
+op_I64Eqz: DoUnop(IntEqz<u64>); NEXT();
+op_I64Eq:  DoBinop(Eq<u64>); NEXT();
+op_I64Ne:  DoBinop(Ne<u64>); NEXT();
+op_I64LtS: DoBinop(Lt<s64>); NEXT();
+op_I64LtU: DoBinop(Lt<u64>); NEXT();
+op_I64GtS: DoBinop(Gt<s64>); NEXT();
+op_I64GtU: DoBinop(Gt<u64>); NEXT();
+op_I64LeS: DoBinop(Le<s64>); NEXT();
+op_I64LeU: DoBinop(Le<u64>); NEXT();
+op_I64GeS: DoBinop(Ge<s64>); NEXT();
+op_I64GeU: DoBinop(Ge<u64>); NEXT();
+
+op_F32Eq: DoBinop(Eq<f32>); NEXT();
+op_F32Ne: DoBinop(Ne<f32>); NEXT();
+op_F32Lt: DoBinop(Lt<f32>); NEXT();
+op_F32Gt: DoBinop(Gt<f32>); NEXT();
+op_F32Le: DoBinop(Le<f32>); NEXT();
+op_F32Ge: DoBinop(Ge<f32>); NEXT();
+
+op_F64Eq: DoBinop(Eq<f64>); NEXT();
+op_F64Ne: DoBinop(Ne<f64>); NEXT();
+op_F64Lt: DoBinop(Lt<f64>); NEXT();
+op_F64Gt: DoBinop(Gt<f64>); NEXT();
+op_F64Le: DoBinop(Le<f64>); NEXT();
+op_F64Ge: DoBinop(Ge<f64>); NEXT();
+
+op_I32Add:  DoBinop(Add<u32>); NEXT();
+op_I32Sub:  DoBinop(Sub<u32>); NEXT();
+op_I32Mul:  DoBinop(Mul<u32>); NEXT();
+op_I32And:  DoBinop(IntAnd<u32>); NEXT();
+op_I32Or:   DoBinop(IntOr<u32>); NEXT();
+op_I32Xor:  DoBinop(IntXor<u32>); NEXT();
+op_I32Shl:  DoBinop(IntShl<u32>); NEXT();
+op_I32ShrS: DoBinop(IntShr<s32>); NEXT();
+op_I32ShrU: DoBinop(IntShr<u32>); NEXT();
+
+op_I64Add:  DoBinop(Add<u64>); NEXT();
+op_I64Sub:  DoBinop(Sub<u64>); NEXT();
+op_I64Mul:  DoBinop(Mul<u64>); NEXT();
+op_I64And:  DoBinop(IntAnd<u64>); NEXT();
+op_I64Or:   DoBinop(IntOr<u64>); NEXT();
+op_I64Xor:  DoBinop(IntXor<u64>); NEXT();
+op_I64Shl:  DoBinop(IntShl<u64>); NEXT();
+op_I64ShrS: DoBinop(IntShr<s64>); NEXT();
+op_I64ShrU: DoBinop(IntShr<u64>); NEXT();
+
+op_F32Add: DoBinop(Add<f32>); NEXT();
+op_F32Sub: DoBinop(Sub<f32>); NEXT();
+op_F32Mul: DoBinop(Mul<f32>); NEXT();
+op_F32Div: DoBinop(FloatDiv<f32>); NEXT();
+
+op_F64Add: DoBinop(Add<f64>); NEXT();
+op_F64Sub: DoBinop(Sub<f64>); NEXT();
+op_F64Mul: DoBinop(Mul<f64>); NEXT();
+op_F64Div: DoBinop(FloatDiv<f64>); NEXT();
+
+op_I32WrapI64:    DoConvert<u32, u64>(out_trap); NEXT();
+op_I64ExtendI32S: DoConvert<s64, s32>(out_trap); NEXT();
+op_I64ExtendI32U: DoConvert<u64, u32>(out_trap); NEXT();
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef MEMORY_OP
+#else
+  WABT_UNREACHABLE;
+#endif
 }
 
-RunResult Thread::PushCall(Ref func, u32 offset, Trap::Ptr* out_trap) {
-  TRAP_IF(frames_.size() == frames_.capacity(), "call stack exhausted");
-  frames_.emplace_back(func, values_.size(), exceptions_.size(), offset, inst_,
-                       mod_);
-  return RunResult::Ok;
-}
+#if WABT_INTERP_GUARD_PAGES
+struct Thread::GuardPageScope {
+  explicit GuardPageScope(const Thread* thread)
+      : thread(thread), prev(current) {
+    current = this;
+  }
+  ~GuardPageScope() { current = prev; }
 
-RunResult Thread::PushCall(const DefinedFunc& func, Trap::Ptr* out_trap) {
-  TRAP_IF(frames_.size() == frames_.capacity(), "call stack exhausted");
-  inst_ = store_.UnsafeGet<Instance>(func.instance()).get();
-  mod_ = store_.UnsafeGet<Module>(inst_->module()).get();
-  frames_.emplace_back(func.self(), values_.size(), exceptions_.size(),
-                       func.desc().code_offset, inst_, mod_);
-  return RunResult::Ok;
-}
+  static void OnSignal(int signum, siginfo_t* info, void* context);
 
-RunResult Thread::PushCall(const HostFunc& func, Trap::Ptr* out_trap) {
-  TRAP_IF(frames_.size() == frames_.capacity(), "call stack exhausted");
-  inst_ = nullptr;
-  mod_ = nullptr;
-  frames_.emplace_back(func.self(), values_.size(), exceptions_.size(), 0,
-                       inst_, mod_);
-  return RunResult::Ok;
-}
+  const Thread* thread;
+  GuardPageScope* prev;
+  sigjmp_buf env;
 
-RunResult Thread::PopCall() {
-  // Sanity check that the exception stack was popped correctly.
-  assert(frames_.back().exceptions == exceptions_.size());
+  // The innermost running Thread on this OS thread; a host function may
+  // call back into the interpreter.
+  static thread_local GuardPageScope* current;
+  static struct sigaction prev_segv_action;
+  static struct sigaction prev_bus_action;
+};
 
-  frames_.pop_back();
-  if (frames_.empty()) {
-    return RunResult::Return;
-  }
+thread_local Thread::GuardPageScope* Thread::GuardPageScope::current;
+struct sigaction Thread::GuardPageScope::prev_segv_action;
+struct sigaction Thread::GuardPageScope::prev_bus_action;
 
-  auto& frame = frames_.back();
-  if (!frame.inst) {
-    // Returning to a HostFunc called on this thread.
-    return RunResult::Return;
+// static
+void Thread::GuardPageScope::OnSignal(int signum,
+                                      siginfo_t* info,
+                                      void* context) {
+  GuardPageScope* scope = current;
+  if (scope && scope->thread->IsGuardPageFault(info->si_addr)) {
+    siglongjmp(scope->env, 1);
+  }
+  // Not ours, so pass it on to the handler that was installed before ours.
+  // Ours stays installed, since InstallGuardPageHandler only runs once.
+  const struct sigaction& prev =
+      signum == SIGSEGV ? prev_segv_action : prev_bus_action;
+  if (prev.sa_flags & SA_SIGINFO) {
+    prev.sa_sigaction(signum, info, context);
+  } else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN) {
+    prev.sa_handler(signum);
+  } else if (prev.sa_handler == SIG_IGN && info->si_code <= 0) {
+    // Sent with kill() or similar, and ignored.
+  } else {
+    // The default action, which the kernel also takes for a real fault when
+    // the signal is ignored: reset the handler and raise the signal again,
+    // which kills the process.
+    signal(signum, SIG_DFL);
+    raise(signum);
   }
-
-  inst_ = frame.inst;
-  mod_ = frame.mod;
-  return RunResult::Ok;
 }
 
-RunResult Thread::DoReturnCall(const Func::Ptr& func, Trap::Ptr* out_trap) {
-  PopCall();
-  DoCall(func, out_trap);
-  return frames_.empty() ? RunResult::Return : RunResult::Ok;
+// static
+bool Thread::InstallGuardPageHandler() {
+  static const bool installed = []() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    // SA_NODEFER, since we jump out of the handler without restoring the
+    // signal mask (see RunWithGuardPages).
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = GuardPageScope::OnSignal;
+    return sigaction(SIGSEGV, &sa, &GuardPageScope::prev_segv_action) == 0 &&
+           sigaction(SIGBUS, &sa, &GuardPageScope::prev_bus_action) == 0;
+  }();
+  return installed;
+}
+
+RunResult Thread::RunWithGuardPages(int num_instructions,
+                                    Trap::Ptr* out_trap) {
+  GuardPageScope scope(this);
+  // The signal handler jumps back here when a load or store hits a guard
+  // page. The frames in between (StepInternal down to Memory::GuardedLoad or
+  // GuardedStore) only have trivially destructible locals, so skipping them
+  // is safe. Not saving the signal mask keeps sigsetjmp cheap.
+  if (sigsetjmp(scope.env, 0) != 0) {
+    return TRAP("out of bounds memory access");
+  }
+  return RunInstructions(num_instructions, out_trap);
 }
 
-void Thread::PopValues(const ValueTypes& types, Values* out_values) {
-  assert(values_.size() >= types.size());
-  out_values->resize(types.size());
-  std::copy(values_.end() - types.size(), values_.end(), out_values->begin());
-  values_.resize(values_.size() - types.size());
+bool Thread::IsGuardPageFault(const void* addr) const {
+  auto* byte = static_cast<const u8*>(addr);
+  for (Index i = 0; i < inst_->memories().size(); ++i) {
+    const Memory* memory = inst_->memory_ptr(i);
+    if (memory->has_guard_pages() && byte >= memory->data_ &&
+        byte < memory->data_ + memory->reserved_size_) {
+      return true;
+    }
+  }
+  return false;
+}
+#else
+// static
+bool Thread::InstallGuardPageHandler() {
+  return false;
 }
 
-RunResult Thread::Run(Trap::Ptr* out_trap) {
-  const int kDefaultInstructionCount = 1000;
-  RunResult result;
-  do {
-    result = Run(kDefaultInstructionCount, out_trap);
-  } while (result == RunResult::Ok);
-  return result;
+RunResult Thread::RunWithGuardPages(int num_instructions,
+                                    Trap::Ptr* out_trap) {
+  WABT_UNREACHABLE;
 }
 
-RunResult Thread::Run(int num_instructions, Trap::Ptr* out_trap) {
-  DefinedFunc::Ptr func{store_, frames_.back().func};
-  for (; num_instructions > 0; --num_instructions) {
-    auto result = StepInternal(out_trap);
-    if (result != RunResult::Ok) {
-      return result;
-    }
-  }
-  return RunResult::Ok;
+bool Thread::IsGuardPageFault(const void* addr) const {
+  return false;
 }
+#endif
 
-RunResult Thread::Step(Trap::Ptr* out_trap) {
-  DefinedFunc::Ptr func{store_, frames_.back().func};
+RunResult Thread::TraceAndStepInternal(Trap::Ptr* out_trap) {
+  if (trace_stream_) {
+    mod_->desc().istream.Trace(trace_stream_, frames_.back().offset,
+                               trace_source_.get());
+  }
   return StepInternal(out_trap);
 }
 
-Value& Thread::Pick(Index index) {
+StackSlot& Thread::Pick(Index index) {
   assert(index > 0 && index <= values_.size());
   return values_[values_.size() - index];
 }
 
 template <typename T>
 T WABT_VECTORCALL Thread::Pop() {
-  return Pop().Get<T>();
+  const Index count = SlotCount<T>::value;
+  assert(values_.size() >= count);
+  T value = ReadSlots<T>(&values_[values_.size() - count]);
+  DropSlots(count);
+  return value;
 }
 
-Value Thread::Pop() {
-  if (!refs_.empty() && refs_.back() >= values_.size()) {
-    refs_.pop_back();
+void Thread::DropSlots(Index count) {
+  if (count == 1) {
+    values_.pop_back();
+  } else {
+    values_.resize(values_.size() - count);
   }
-  auto value = values_.back();
-  values_.pop_back();
-  return value;
 }
 
-u64 Thread::PopPtr(const Memory::Ptr& memory) {
+u64 Thread::PopPtr(const Memory* memory) {
   return memory->type().limits.is_64 ? Pop<u64>() : Pop<u32>();
 }
 
 template <typename T>
 void WABT_VECTORCALL Thread::Push(T value) {
-  Push(Value::Make(value));
+  StackSlot slots[SlotCount<T>::value] = {};
+  WriteSlots(slots, value);
+  for (auto slot : slots) {
+    values_.push_back(slot);
+  }
 }
 
 template <>
 void Thread::Push<bool>(bool value) {
-  Push(Value::Make(static_cast<u32>(value ? 1 : 0)));
-}
-
-void Thread::Push(Value value) {
-  values_.push_back(value);
+  Push(static_cast<u32>(value ? 1 : 0));
 }
 
-void Thread::Push(Ref ref) {
-  refs_.push_back(values_.size());
-  values_.push_back(Value::Make(ref));
+void Thread::PushSlot(StackSlot slot) {
+  values_.push_back(slot);
 }
 
 RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
@@ -1108,10 +2661,6 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
   u32& pc = frames_.back().offset;
   auto& istream = mod_->desc().istream;
 
-  if (trace_stream_) {
-    istream.Trace(trace_stream_, pc, trace_source_.get());
-  }
-
   auto instr = istream.Read(&pc);
   switch (instr.op) {
     case O::Unreachable:
@@ -1140,9 +2689,13 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
       return PopCall();
 
     case O::Call: {
-      Ref new_func_ref = inst_->funcs()[instr.imm_u32];
-      DefinedFunc::Ptr new_func{store_, new_func_ref};
-      if (PushCall(new_func_ref, new_func->desc().code_offset, out_trap) ==
+      auto* new_func = cast<DefinedFunc>(inst_->func_ptr(instr.imm_u32));
+      if (WABT_UNLIKELY(new_func->desc().code_offset ==
+                        Istream::kInvalidOffset) &&
+          CompileFunc(*new_func, out_trap) == RunResult::Trap) {
+        return RunResult::Trap;
+      }
+      if (PushCall(new_func->self(), new_func->desc().code_offset, out_trap) ==
           RunResult::Trap) {
         return RunResult::Trap;
       }
@@ -1151,16 +2704,15 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
 
     case O::CallIndirect:
     case O::ReturnCallIndirect: {
-      Table::Ptr table{store_, inst_->tables()[instr.imm_u32x2.fst]};
-      auto&& func_type = mod_->desc().func_types[instr.imm_u32x2.snd];
+      Table* table = inst_->table_ptr(instr.imm_u32x2.fst);
+      Index func_type_id = inst_->func_type_id(instr.imm_u32x2.snd);
       auto entry = Pop<u32>();
       TRAP_IF(entry >= table->elements().size(), "undefined table index");
       auto new_func_ref = table->elements()[entry];
       TRAP_IF(new_func_ref == Ref::Null, "uninitialized table element");
-      Func::Ptr new_func{store_, new_func_ref};
-      TRAP_IF(
-          Failed(Match(new_func->type(), func_type, nullptr)),
-          "indirect call signature mismatch");  // TODO: don't use "signature"
+      auto* new_func = store_.UnsafeGetRaw<Func>(new_func_ref);
+      TRAP_IF(new_func->type_id() != func_type_id,
+              "indirect call signature mismatch");  // TODO: don't use "signature"
       if (instr.op == O::ReturnCallIndirect) {
         return DoReturnCall(new_func, out_trap);
       } else {
@@ -1169,26 +2721,28 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     }
 
     case O::Drop:
-      Pop();
+      DropSlots(1);
       break;
 
     case O::Select: {
       // TODO: need to mark whether this is a ref.
+      // BinaryReaderInterp only emits this for values that take one slot.
       auto cond = Pop<u32>();
-      Value false_ = Pop();
-      Value true_ = Pop();
-      Push(cond ? true_ : false_);
+      StackSlot false_ = Pick(1);
+      StackSlot true_ = Pick(2);
+      DropSlots(2);
+      PushSlot(cond ? true_ : false_);
       break;
     }
 
     case O::LocalGet:
       // TODO: need to mark whether this is a ref.
-      Push(Pick(instr.imm_u32));
+      PushSlot(Pick(instr.imm_u32));
       break;
 
     case O::LocalSet: {
       Pick(instr.imm_u32) = Pick(1);
-      Pop();
+      DropSlots(1);
       break;
     }
 
@@ -1198,14 +2752,14 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
 
     case O::GlobalGet: {
       // TODO: need to mark whether this is a ref.
-      Global::Ptr global{store_, inst_->globals()[instr.imm_u32]};
-      Push(global->Get());
+      Global* global = inst_->global_ptr(instr.imm_u32);
+      PushValue(global->type().type, global->Get());
       break;
     }
 
     case O::GlobalSet: {
-      Global::Ptr global{store_, inst_->globals()[instr.imm_u32]};
-      global->UnsafeSet(Pop());
+      Global* global = inst_->global_ptr(instr.imm_u32);
+      global->UnsafeSet(store_, PopValue(global->type().type));
       break;
     }
 
@@ -1235,7 +2789,7 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     case O::I64Store32: return DoStore<u64, u32>(instr, out_trap);
 
     case O::MemorySize: {
-      Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32]};
+      Memory* memory = inst_->memory_ptr(instr.imm_u32);
       if (memory->type().limits.is_64) {
         Push<u64>(memory->PageSize());
       } else {
@@ -1245,16 +2799,16 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     }
 
     case O::MemoryGrow: {
-      Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32]};
-      u64 old_size = memory->PageSize();
+      Memory* memory = inst_->memory_ptr(instr.imm_u32);
+      u64 old_size;
       if (memory->type().limits.is_64) {
-        if (Failed(memory->Grow(Pop<u64>()))) {
+        if (Failed(memory->Grow(Pop<u64>(), &old_size))) {
           Push<s64>(-1);
         } else {
           Push<u64>(old_size);
         }
       } else {
-        if (Failed(memory->Grow(Pop<u32>()))) {
+        if (Failed(memory->Grow(Pop<u32>(), &old_size))) {
           Push<s32>(-1);
         } else {
           Push<u32>(old_size);
@@ -1407,11 +2961,18 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     case O::I64Extend16S:  return DoUnop(IntExtend<u64, 15>);
     case O::I64Extend32S:  return DoUnop(IntExtend<u64, 31>);
 
+    case O::InterpConsumeFuel:
+      if (WABT_UNLIKELY(instr.imm_u32 > fuel_)) {
+        // Leave pc at this instruction, so it runs again after set_fuel.
+        pc -= sizeof(Istream::SerializedOpcode) + sizeof(u32);
+        return RunResult::OutOfFuel;
+      }
+      fuel_ -= instr.imm_u32;
+      break;
+
     case O::InterpAlloca:
+      // Locals are zeroed, which makes reference locals null.
       values_.resize(values_.size() + instr.imm_u32);
-      // refs_ doesn't need to be updated; We may be allocating space for
-      // references, but they will be initialized to null, so it is OK if we
-      // don't mark them.
       break;
 
     case O::InterpBrUnless:
@@ -1421,22 +2982,12 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
       break;
 
     case O::InterpCallImport: {
-      Ref new_func_ref = inst_->funcs()[instr.imm_u32];
-      Func::Ptr new_func{store_, new_func_ref};
-      return DoCall(new_func, out_trap);
+      return DoCall(inst_->func_ptr(instr.imm_u32), out_trap);
     }
 
     case O::InterpDropKeep: {
       auto drop = instr.imm_u32x2.fst;
       auto keep = instr.imm_u32x2.snd;
-      // Shift kept refs down.
-      for (auto iter = refs_.rbegin(); iter != refs_.rend(); ++iter) {
-        if (*iter >= values_.size() - keep) {
-          *iter -= drop;
-        } else {
-          break;
-        }
-      }
       std::move(values_.end() - keep, values_.end(),
                 values_.end() - drop - keep);
       values_.resize(values_.size() - drop);
@@ -1454,13 +3005,71 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     // This operation adjusts the function reference of the reused frame
     // after a return_call. This ensures the correct exception handlers are
     // used for the call.
+    // Only emitted for modules read with CompileOptions::lazy; otherwise
+    // return_call is an InterpAdjustFrameForReturnCall and a Br to the callee.
+    case O::ReturnCall: {
+      auto* new_func = cast<DefinedFunc>(inst_->func_ptr(instr.imm_u32));
+      if (WABT_UNLIKELY(new_func->desc().code_offset ==
+                        Istream::kInvalidOffset) &&
+          CompileFunc(*new_func, out_trap) == RunResult::Trap) {
+        return RunResult::Trap;
+      }
+      Frame& current_frame = frames_.back();
+      current_frame.func = new_func->self();
+      current_frame.values = values_.size();
+      pc = new_func->desc().code_offset;
+      break;
+    }
+
     case O::InterpAdjustFrameForReturnCall: {
       Ref new_func_ref = inst_->funcs()[instr.imm_u32];
       Frame& current_frame = frames_.back();
       current_frame.func = new_func_ref;
+      // The preceding drop_keep left only the new function's parameters
+      // above the frame, so this is where its locals will start.
+      current_frame.values = values_.size();
+      break;
+    }
+
+    // Superinstructions emitted by BinaryReaderInterp in place of common
+    // instruction sequences.
+    case O::InterpLocalGetLocalGet:
+      PushSlot(Pick(instr.imm_u32x2.fst));
+      PushSlot(Pick(instr.imm_u32x2.snd));
+      break;
+
+    case O::InterpI32AddImm:
+      Push<u32>(Pop<u32>() + instr.imm_u32);
+      break;
+
+    case O::InterpI32LocalAddImm:
+      WriteSlots(&Pick(instr.imm_u32x3.snd),
+                 ReadSlots<u32>(&Pick(instr.imm_u32x3.fst)) +
+                     instr.imm_u32x3.thd);
+      break;
+
+    case O::InterpI32LtSBrUnless: {
+      auto rhs = Pop<s32>();
+      auto lhs = Pop<s32>();
+      if (!(lhs < rhs)) {
+        pc = instr.imm_u32;
+      }
+      break;
+    }
+
+    case O::InterpI32LtUBrUnless: {
+      auto rhs = Pop<u32>();
+      auto lhs = Pop<u32>();
+      if (!(lhs < rhs)) {
+        pc = instr.imm_u32;
+      }
       break;
     }
 
+    case O::InterpLocalGetI32Load:
+      PushSlot(Pick(instr.imm_u32x3.thd));
+      return DoLoad<u32>(instr, out_trap);
+
     case O::I32TruncSatF32S: return DoUnop(IntTruncSat<s32, f32>);
     case O::I32TruncSatF32U: return DoUnop(IntTruncSat<u32, f32>);
     case O::I32TruncSatF64S: return DoUnop(IntTruncSat<s32, f64>);
@@ -1524,167 +3133,167 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     case O::F64X2ExtractLane:  return DoSimdExtract<f64x2, f64>(instr);
     case O::F64X2ReplaceLane:  return DoSimdReplace<f64x2, f64>(instr);
 
-    case O::I8X16Eq:  return DoSimdBinop(EqMask<u8>);
-    case O::I8X16Ne:  return DoSimdBinop(NeMask<u8>);
-    case O::I8X16LtS: return DoSimdBinop(LtMask<s8>);
-    case O::I8X16LtU: return DoSimdBinop(LtMask<u8>);
-    case O::I8X16GtS: return DoSimdBinop(GtMask<s8>);
-    case O::I8X16GtU: return DoSimdBinop(GtMask<u8>);
-    case O::I8X16LeS: return DoSimdBinop(LeMask<s8>);
-    case O::I8X16LeU: return DoSimdBinop(LeMask<u8>);
-    case O::I8X16GeS: return DoSimdBinop(GeMask<s8>);
-    case O::I8X16GeU: return DoSimdBinop(GeMask<u8>);
-    case O::I16X8Eq:  return DoSimdBinop(EqMask<u16>);
-    case O::I16X8Ne:  return DoSimdBinop(NeMask<u16>);
-    case O::I16X8LtS: return DoSimdBinop(LtMask<s16>);
-    case O::I16X8LtU: return DoSimdBinop(LtMask<u16>);
-    case O::I16X8GtS: return DoSimdBinop(GtMask<s16>);
-    case O::I16X8GtU: return DoSimdBinop(GtMask<u16>);
-    case O::I16X8LeS: return DoSimdBinop(LeMask<s16>);
-    case O::I16X8LeU: return DoSimdBinop(LeMask<u16>);
-    case O::I16X8GeS: return DoSimdBinop(GeMask<s16>);
-    case O::I16X8GeU: return DoSimdBinop(GeMask<u16>);
-    case O::I32X4Eq:  return DoSimdBinop(EqMask<u32>);
-    case O::I32X4Ne:  return DoSimdBinop(NeMask<u32>);
-    case O::I32X4LtS: return DoSimdBinop(LtMask<s32>);
-    case O::I32X4LtU: return DoSimdBinop(LtMask<u32>);
-    case O::I32X4GtS: return DoSimdBinop(GtMask<s32>);
-    case O::I32X4GtU: return DoSimdBinop(GtMask<u32>);
-    case O::I32X4LeS: return DoSimdBinop(LeMask<s32>);
-    case O::I32X4LeU: return DoSimdBinop(LeMask<u32>);
-    case O::I32X4GeS: return DoSimdBinop(GeMask<s32>);
-    case O::I32X4GeU: return DoSimdBinop(GeMask<u32>);
-    case O::I64X2Eq:  return DoSimdBinop(EqMask<u64>);
-    case O::I64X2Ne:  return DoSimdBinop(NeMask<u64>);
-    case O::I64X2LtS: return DoSimdBinop(LtMask<s64>);
-    case O::I64X2GtS: return DoSimdBinop(GtMask<s64>);
-    case O::I64X2LeS: return DoSimdBinop(LeMask<s64>);
-    case O::I64X2GeS: return DoSimdBinop(GeMask<s64>);
-    case O::F32X4Eq:  return DoSimdBinop(EqMask<f32>);
-    case O::F32X4Ne:  return DoSimdBinop(NeMask<f32>);
-    case O::F32X4Lt:  return DoSimdBinop(LtMask<f32>);
-    case O::F32X4Gt:  return DoSimdBinop(GtMask<f32>);
-    case O::F32X4Le:  return DoSimdBinop(LeMask<f32>);
-    case O::F32X4Ge:  return DoSimdBinop(GeMask<f32>);
-    case O::F64X2Eq:  return DoSimdBinop(EqMask<f64>);
-    case O::F64X2Ne:  return DoSimdBinop(NeMask<f64>);
-    case O::F64X2Lt:  return DoSimdBinop(LtMask<f64>);
-    case O::F64X2Gt:  return DoSimdBinop(GtMask<f64>);
-    case O::F64X2Le:  return DoSimdBinop(LeMask<f64>);
-    case O::F64X2Ge:  return DoSimdBinop(GeMask<f64>);
-
-    case O::V128Not:       return DoSimdUnop(IntNot<u64>);
-    case O::V128And:       return DoSimdBinop(IntAnd<u64>);
-    case O::V128Or:        return DoSimdBinop(IntOr<u64>);
-    case O::V128Xor:       return DoSimdBinop(IntXor<u64>);
-    case O::V128BitSelect: return DoSimdBitSelect();
-    case O::V128AnyTrue:      return DoSimdIsTrue<u8x16, 1>();
-
-    case O::I8X16Neg:          return DoSimdUnop(IntNeg<u8>);
-    case O::I8X16Bitmask:      return DoSimdBitmask<s8x16>();
-    case O::I8X16AllTrue:      return DoSimdIsTrue<u8x16, 16>();
-    case O::I8X16Shl:          return DoSimdShift(IntShl<u8>);
-    case O::I8X16ShrS:         return DoSimdShift(IntShr<s8>);
-    case O::I8X16ShrU:         return DoSimdShift(IntShr<u8>);
-    case O::I8X16Add:          return DoSimdBinop(Add<u8>);
-    case O::I8X16AddSatS:      return DoSimdBinop(IntAddSat<s8>);
-    case O::I8X16AddSatU:      return DoSimdBinop(IntAddSat<u8>);
-    case O::I8X16Sub:          return DoSimdBinop(Sub<u8>);
-    case O::I8X16SubSatS:      return DoSimdBinop(IntSubSat<s8>);
-    case O::I8X16SubSatU:      return DoSimdBinop(IntSubSat<u8>);
-    case O::I8X16MinS:         return DoSimdBinop(IntMin<s8>);
-    case O::I8X16MinU:         return DoSimdBinop(IntMin<u8>);
-    case O::I8X16MaxS:         return DoSimdBinop(IntMax<s8>);
-    case O::I8X16MaxU:         return DoSimdBinop(IntMax<u8>);
-
-    case O::I16X8Neg:          return DoSimdUnop(IntNeg<u16>);
-    case O::I16X8Bitmask:      return DoSimdBitmask<s16x8>();
-    case O::I16X8AllTrue:      return DoSimdIsTrue<u16x8, 8>();
-    case O::I16X8Shl:          return DoSimdShift(IntShl<u16>);
-    case O::I16X8ShrS:         return DoSimdShift(IntShr<s16>);
-    case O::I16X8ShrU:         return DoSimdShift(IntShr<u16>);
-    case O::I16X8Add:          return DoSimdBinop(Add<u16>);
-    case O::I16X8AddSatS:      return DoSimdBinop(IntAddSat<s16>);
-    case O::I16X8AddSatU:      return DoSimdBinop(IntAddSat<u16>);
-    case O::I16X8Sub:          return DoSimdBinop(Sub<u16>);
-    case O::I16X8SubSatS:      return DoSimdBinop(IntSubSat<s16>);
-    case O::I16X8SubSatU:      return DoSimdBinop(IntSubSat<u16>);
-    case O::I16X8Mul:          return DoSimdBinop(Mul<u16>);
-    case O::I16X8MinS:         return DoSimdBinop(IntMin<s16>);
-    case O::I16X8MinU:         return DoSimdBinop(IntMin<u16>);
-    case O::I16X8MaxS:         return DoSimdBinop(IntMax<s16>);
-    case O::I16X8MaxU:         return DoSimdBinop(IntMax<u16>);
-
-    case O::I32X4Neg:          return DoSimdUnop(IntNeg<u32>);
-    case O::I32X4Bitmask:      return DoSimdBitmask<s32x4>();
-    case O::I32X4AllTrue:      return DoSimdIsTrue<u32x4, 4>();
-    case O::I32X4Shl:          return DoSimdShift(IntShl<u32>);
-    case O::I32X4ShrS:         return DoSimdShift(IntShr<s32>);
-    case O::I32X4ShrU:         return DoSimdShift(IntShr<u32>);
-    case O::I32X4Add:          return DoSimdBinop(Add<u32>);
-    case O::I32X4Sub:          return DoSimdBinop(Sub<u32>);
-    case O::I32X4Mul:          return DoSimdBinop(Mul<u32>);
-    case O::I32X4MinS:         return DoSimdBinop(IntMin<s32>);
-    case O::I32X4MinU:         return DoSimdBinop(IntMin<u32>);
-    case O::I32X4MaxS:         return DoSimdBinop(IntMax<s32>);
-    case O::I32X4MaxU:         return DoSimdBinop(IntMax<u32>);
-
-    case O::I64X2Neg:          return DoSimdUnop(IntNeg<u64>);
-    case O::I64X2Bitmask:      return DoSimdBitmask<s64x2>();
-    case O::I64X2AllTrue:      return DoSimdIsTrue<u64x2, 2>();
-    case O::I64X2Shl:          return DoSimdShift(IntShl<u64>);
-    case O::I64X2ShrS:         return DoSimdShift(IntShr<s64>);
-    case O::I64X2ShrU:         return DoSimdShift(IntShr<u64>);
-    case O::I64X2Add:          return DoSimdBinop(Add<u64>);
-    case O::I64X2Sub:          return DoSimdBinop(Sub<u64>);
-    case O::I64X2Mul:          return DoSimdBinop(Mul<u64>);
-
-    case O::F32X4Ceil:         return DoSimdUnop(FloatCeil<f32>);
-    case O::F32X4Floor:        return DoSimdUnop(FloatFloor<f32>);
-    case O::F32X4Trunc:        return DoSimdUnop(FloatTrunc<f32>);
-    case O::F32X4Nearest:      return DoSimdUnop(FloatNearest<f32>);
-
-    case O::F64X2Ceil:         return DoSimdUnop(FloatCeil<f64>);
-    case O::F64X2Floor:        return DoSimdUnop(FloatFloor<f64>);
-    case O::F64X2Trunc:        return DoSimdUnop(FloatTrunc<f64>);
-    case O::F64X2Nearest:      return DoSimdUnop(FloatNearest<f64>);
-
-    case O::F32X4Abs:          return DoSimdUnop(FloatAbs<f32>);
-    case O::F32X4Neg:          return DoSimdUnop(FloatNeg<f32>);
-    case O::F32X4Sqrt:         return DoSimdUnop(FloatSqrt<f32>);
-    case O::F32X4Add:          return DoSimdBinop(Add<f32>);
-    case O::F32X4Sub:          return DoSimdBinop(Sub<f32>);
-    case O::F32X4Mul:          return DoSimdBinop(Mul<f32>);
-    case O::F32X4Div:          return DoSimdBinop(FloatDiv<f32>);
-    case O::F32X4Min:          return DoSimdBinop(FloatMin<f32>);
-    case O::F32X4Max:          return DoSimdBinop(FloatMax<f32>);
-    case O::F32X4PMin:         return DoSimdBinop(FloatPMin<f32>);
-    case O::F32X4PMax:         return DoSimdBinop(FloatPMax<f32>);
-
-    case O::F64X2Abs:          return DoSimdUnop(FloatAbs<f64>);
-    case O::F64X2Neg:          return DoSimdUnop(FloatNeg<f64>);
-    case O::F64X2Sqrt:         return DoSimdUnop(FloatSqrt<f64>);
-    case O::F64X2Add:          return DoSimdBinop(Add<f64>);
-    case O::F64X2Sub:          return DoSimdBinop(Sub<f64>);
-    case O::F64X2Mul:          return DoSimdBinop(Mul<f64>);
-    case O::F64X2Div:          return DoSimdBinop(FloatDiv<f64>);
-    case O::F64X2Min:          return DoSimdBinop(FloatMin<f64>);
-    case O::F64X2Max:          return DoSimdBinop(FloatMax<f64>);
-    case O::F64X2PMin:         return DoSimdBinop(FloatPMin<f64>);
-    case O::F64X2PMax:         return DoSimdBinop(FloatPMax<f64>);
-
-    case O::I32X4TruncSatF32X4S: return DoSimdUnop(IntTruncSat<s32, f32>);
-    case O::I32X4TruncSatF32X4U: return DoSimdUnop(IntTruncSat<u32, f32>);
-    case O::F32X4ConvertI32X4S:  return DoSimdUnop(Convert<f32, s32>);
-    case O::F32X4ConvertI32X4U:  return DoSimdUnop(Convert<f32, u32>);
-    case O::F32X4DemoteF64X2Zero: return DoSimdUnopZero(Convert<f32, f64>);
-    case O::F64X2PromoteLowF32X4: return DoSimdConvert<f64x2, f32x4, true>();
-    case O::I32X4TruncSatF64X2SZero: return DoSimdUnopZero(IntTruncSat<s32, f64>);
-    case O::I32X4TruncSatF64X2UZero: return DoSimdUnopZero(IntTruncSat<u32, f64>);
-    case O::F64X2ConvertLowI32X4S: return DoSimdConvert<f64x2, s32x4, true>();
-    case O::F64X2ConvertLowI32X4U: return DoSimdConvert<f64x2, u32x4, true>();
-
-    case O::I8X16Swizzle:     return DoSimdSwizzle();
+    case O::I8X16Eq:  return DoSimdBinop(instr.op, EqMask<u8>);
+    case O::I8X16Ne:  return DoSimdBinop(instr.op, NeMask<u8>);
+    case O::I8X16LtS: return DoSimdBinop(instr.op, LtMask<s8>);
+    case O::I8X16LtU: return DoSimdBinop(instr.op, LtMask<u8>);
+    case O::I8X16GtS: return DoSimdBinop(instr.op, GtMask<s8>);
+    case O::I8X16GtU: return DoSimdBinop(instr.op, GtMask<u8>);
+    case O::I8X16LeS: return DoSimdBinop(instr.op, LeMask<s8>);
+    case O::I8X16LeU: return DoSimdBinop(instr.op, LeMask<u8>);
+    case O::I8X16GeS: return DoSimdBinop(instr.op, GeMask<s8>);
+    case O::I8X16GeU: return DoSimdBinop(instr.op, GeMask<u8>);
+    case O::I16X8Eq:  return DoSimdBinop(instr.op, EqMask<u16>);
+    case O::I16X8Ne:  return DoSimdBinop(instr.op, NeMask<u16>);
+    case O::I16X8LtS: return DoSimdBinop(instr.op, LtMask<s16>);
+    case O::I16X8LtU: return DoSimdBinop(instr.op, LtMask<u16>);
+    case O::I16X8GtS: return DoSimdBinop(instr.op, GtMask<s16>);
+    case O::I16X8GtU: return DoSimdBinop(instr.op, GtMask<u16>);
+    case O::I16X8LeS: return DoSimdBinop(instr.op, LeMask<s16>);
+    case O::I16X8LeU: return DoSimdBinop(instr.op, LeMask<u16>);
+    case O::I16X8GeS: return DoSimdBinop(instr.op, GeMask<s16>);
+    case O::I16X8GeU: return DoSimdBinop(instr.op, GeMask<u16>);
+    case O::I32X4Eq:  return DoSimdBinop(instr.op, EqMask<u32>);
+    case O::I32X4Ne:  return DoSimdBinop(instr.op, NeMask<u32>);
+    case O::I32X4LtS: return DoSimdBinop(instr.op, LtMask<s32>);
+    case O::I32X4LtU: return DoSimdBinop(instr.op, LtMask<u32>);
+    case O::I32X4GtS: return DoSimdBinop(instr.op, GtMask<s32>);
+    case O::I32X4GtU: return DoSimdBinop(instr.op, GtMask<u32>);
+    case O::I32X4LeS: return DoSimdBinop(instr.op, LeMask<s32>);
+    case O::I32X4LeU: return DoSimdBinop(instr.op, LeMask<u32>);
+    case O::I32X4GeS: return DoSimdBinop(instr.op, GeMask<s32>);
+    case O::I32X4GeU: return DoSimdBinop(instr.op, GeMask<u32>);
+    case O::I64X2Eq:  return DoSimdBinop(instr.op, EqMask<u64>);
+    case O::I64X2Ne:  return DoSimdBinop(instr.op, NeMask<u64>);
+    case O::I64X2LtS: return DoSimdBinop(instr.op, LtMask<s64>);
+    case O::I64X2GtS: return DoSimdBinop(instr.op, GtMask<s64>);
+    case O::I64X2LeS: return DoSimdBinop(instr.op, LeMask<s64>);
+    case O::I64X2GeS: return DoSimdBinop(instr.op, GeMask<s64>);
+    case O::F32X4Eq:  return DoSimdBinop(instr.op, EqMask<f32>);
+    case O::F32X4Ne:  return DoSimdBinop(instr.op, NeMask<f32>);
+    case O::F32X4Lt:  return DoSimdBinop(instr.op, LtMask<f32>);
+    case O::F32X4Gt:  return DoSimdBinop(instr.op, GtMask<f32>);
+    case O::F32X4Le:  return DoSimdBinop(instr.op, LeMask<f32>);
+    case O::F32X4Ge:  return DoSimdBinop(instr.op, GeMask<f32>);
+    case O::F64X2Eq:  return DoSimdBinop(instr.op, EqMask<f64>);
+    case O::F64X2Ne:  return DoSimdBinop(instr.op, NeMask<f64>);
+    case O::F64X2Lt:  return DoSimdBinop(instr.op, LtMask<f64>);
+    case O::F64X2Gt:  return DoSimdBinop(instr.op, GtMask<f64>);
+    case O::F64X2Le:  return DoSimdBinop(instr.op, LeMask<f64>);
+    case O::F64X2Ge:  return DoSimdBinop(instr.op, GeMask<f64>);
+
+    case O::V128Not:       return DoSimdUnop(instr.op, IntNot<u64>);
+    case O::V128And:       return DoSimdBinop(instr.op, IntAnd<u64>);
+    case O::V128Or:        return DoSimdBinop(instr.op, IntOr<u64>);
+    case O::V128Xor:       return DoSimdBinop(instr.op, IntXor<u64>);
+    case O::V128BitSelect: return DoSimdBitSelect(instr.op);
+    case O::V128AnyTrue:      return DoSimdIsTrue<u8x16, 1>(instr.op);
+
+    case O::I8X16Neg:          return DoSimdUnop(instr.op, IntNeg<u8>);
+    case O::I8X16Bitmask:      return DoSimdBitmask<s8x16>(instr.op);
+    case O::I8X16AllTrue:      return DoSimdIsTrue<u8x16, 16>(instr.op);
+    case O::I8X16Shl:          return DoSimdShift(instr.op, IntShl<u8>);
+    case O::I8X16ShrS:         return DoSimdShift(instr.op, IntShr<s8>);
+    case O::I8X16ShrU:         return DoSimdShift(instr.op, IntShr<u8>);
+    case O::I8X16Add:          return DoSimdBinop(instr.op, Add<u8>);
+    case O::I8X16AddSatS:      return DoSimdBinop(instr.op, IntAddSat<s8>);
+    case O::I8X16AddSatU:      return DoSimdBinop(instr.op, IntAddSat<u8>);
+    case O::I8X16Sub:          return DoSimdBinop(instr.op, Sub<u8>);
+    case O::I8X16SubSatS:      return DoSimdBinop(instr.op, IntSubSat<s8>);
+    case O::I8X16SubSatU:      return DoSimdBinop(instr.op, IntSubSat<u8>);
+    case O::I8X16MinS:         return DoSimdBinop(instr.op, IntMin<s8>);
+    case O::I8X16MinU:         return DoSimdBinop(instr.op, IntMin<u8>);
+    case O::I8X16MaxS:         return DoSimdBinop(instr.op, IntMax<s8>);
+    case O::I8X16MaxU:         return DoSimdBinop(instr.op, IntMax<u8>);
+
+    case O::I16X8Neg:          return DoSimdUnop(instr.op, IntNeg<u16>);
+    case O::I16X8Bitmask:      return DoSimdBitmask<s16x8>(instr.op);
+    case O::I16X8AllTrue:      return DoSimdIsTrue<u16x8, 8>(instr.op);
+    case O::I16X8Shl:          return DoSimdShift(instr.op, IntShl<u16>);
+    case O::I16X8ShrS:         return DoSimdShift(instr.op, IntShr<s16>);
+    case O::I16X8ShrU:         return DoSimdShift(instr.op, IntShr<u16>);
+    case O::I16X8Add:          return DoSimdBinop(instr.op, Add<u16>);
+    case O::I16X8AddSatS:      return DoSimdBinop(instr.op, IntAddSat<s16>);
+    case O::I16X8AddSatU:      return DoSimdBinop(instr.op, IntAddSat<u16>);
+    case O::I16X8Sub:          return DoSimdBinop(instr.op, Sub<u16>);
+    case O::I16X8SubSatS:      return DoSimdBinop(instr.op, IntSubSat<s16>);
+    case O::I16X8SubSatU:      return DoSimdBinop(instr.op, IntSubSat<u16>);
+    case O::I16X8Mul:          return DoSimdBinop(instr.op, Mul<u16>);
+    case O::I16X8MinS:         return DoSimdBinop(instr.op, IntMin<s16>);
+    case O::I16X8MinU:         return DoSimdBinop(instr.op, IntMin<u16>);
+    case O::I16X8MaxS:         return DoSimdBinop(instr.op, IntMax<s16>);
+    case O::I16X8MaxU:         return DoSimdBinop(instr.op, IntMax<u16>);
+
+    case O::I32X4Neg:          return DoSimdUnop(instr.op, IntNeg<u32>);
+    case O::I32X4Bitmask:      return DoSimdBitmask<s32x4>(instr.op);
+    case O::I32X4AllTrue:      return DoSimdIsTrue<u32x4, 4>(instr.op);
+    case O::I32X4Shl:          return DoSimdShift(instr.op, IntShl<u32>);
+    case O::I32X4ShrS:         return DoSimdShift(instr.op, IntShr<s32>);
+    case O::I32X4ShrU:         return DoSimdShift(instr.op, IntShr<u32>);
+    case O::I32X4Add:          return DoSimdBinop(instr.op, Add<u32>);
+    case O::I32X4Sub:          return DoSimdBinop(instr.op, Sub<u32>);
+    case O::I32X4Mul:          return DoSimdBinop(instr.op, Mul<u32>);
+    case O::I32X4MinS:         return DoSimdBinop(instr.op, IntMin<s32>);
+    case O::I32X4MinU:         return DoSimdBinop(instr.op, IntMin<u32>);
+    case O::I32X4MaxS:         return DoSimdBinop(instr.op, IntMax<s32>);
+    case O::I32X4MaxU:         return DoSimdBinop(instr.op, IntMax<u32>);
+
+    case O::I64X2Neg:          return DoSimdUnop(instr.op, IntNeg<u64>);
+    case O::I64X2Bitmask:      return DoSimdBitmask<s64x2>(instr.op);
+    case O::I64X2AllTrue:      return DoSimdIsTrue<u64x2, 2>(instr.op);
+    case O::I64X2Shl:          return DoSimdShift(instr.op, IntShl<u64>);
+    case O::I64X2ShrS:         return DoSimdShift(instr.op, IntShr<s64>);
+    case O::I64X2ShrU:         return DoSimdShift(instr.op, IntShr<u64>);
+    case O::I64X2Add:          return DoSimdBinop(instr.op, Add<u64>);
+    case O::I64X2Sub:          return DoSimdBinop(instr.op, Sub<u64>);
+    case O::I64X2Mul:          return DoSimdBinop(instr.op, Mul<u64>);
+
+    case O::F32X4Ceil:         return DoSimdUnop(instr.op, FloatCeil<f32>);
+    case O::F32X4Floor:        return DoSimdUnop(instr.op, FloatFloor<f32>);
+    case O::F32X4Trunc:        return DoSimdUnop(instr.op, FloatTrunc<f32>);
+    case O::F32X4Nearest:      return DoSimdUnop(instr.op, FloatNearest<f32>);
+
+    case O::F64X2Ceil:         return DoSimdUnop(instr.op, FloatCeil<f64>);
+    case O::F64X2Floor:        return DoSimdUnop(instr.op, FloatFloor<f64>);
+    case O::F64X2Trunc:        return DoSimdUnop(instr.op, FloatTrunc<f64>);
+    case O::F64X2Nearest:      return DoSimdUnop(instr.op, FloatNearest<f64>);
+
+    case O::F32X4Abs:          return DoSimdUnop(instr.op, FloatAbs<f32>);
+    case O::F32X4Neg:          return DoSimdUnop(instr.op, FloatNeg<f32>);
+    case O::F32X4Sqrt:         return DoSimdUnop(instr.op, FloatSqrt<f32>);
+    case O::F32X4Add:          return DoSimdBinop(instr.op, Add<f32>);
+    case O::F32X4Sub:          return DoSimdBinop(instr.op, Sub<f32>);
+    case O::F32X4Mul:          return DoSimdBinop(instr.op, Mul<f32>);
+    case O::F32X4Div:          return DoSimdBinop(instr.op, FloatDiv<f32>);
+    case O::F32X4Min:          return DoSimdBinop(instr.op, FloatMin<f32>);
+    case O::F32X4Max:          return DoSimdBinop(instr.op, FloatMax<f32>);
+    case O::F32X4PMin:         return DoSimdBinop(instr.op, FloatPMin<f32>);
+    case O::F32X4PMax:         return DoSimdBinop(instr.op, FloatPMax<f32>);
+
+    case O::F64X2Abs:          return DoSimdUnop(instr.op, FloatAbs<f64>);
+    case O::F64X2Neg:          return DoSimdUnop(instr.op, FloatNeg<f64>);
+    case O::F64X2Sqrt:         return DoSimdUnop(instr.op, FloatSqrt<f64>);
+    case O::F64X2Add:          return DoSimdBinop(instr.op, Add<f64>);
+    case O::F64X2Sub:          return DoSimdBinop(instr.op, Sub<f64>);
+    case O::F64X2Mul:          return DoSimdBinop(instr.op, Mul<f64>);
+    case O::F64X2Div:          return DoSimdBinop(instr.op, FloatDiv<f64>);
+    case O::F64X2Min:          return DoSimdBinop(instr.op, FloatMin<f64>);
+    case O::F64X2Max:          return DoSimdBinop(instr.op, FloatMax<f64>);
+    case O::F64X2PMin:         return DoSimdBinop(instr.op, FloatPMin<f64>);
+    case O::F64X2PMax:         return DoSimdBinop(instr.op, FloatPMax<f64>);
+
+    case O::I32X4TruncSatF32X4S: return DoSimdUnop(instr.op, IntTruncSat<s32, f32>);
+    case O::I32X4TruncSatF32X4U: return DoSimdUnop(instr.op, IntTruncSat<u32, f32>);
+    case O::F32X4ConvertI32X4S:  return DoSimdUnop(instr.op, Convert<f32, s32>);
+    case O::F32X4ConvertI32X4U:  return DoSimdUnop(instr.op, Convert<f32, u32>);
+    case O::F32X4DemoteF64X2Zero: return DoSimdUnopZero(instr.op, Convert<f32, f64>);
+    case O::F64X2PromoteLowF32X4: return DoSimdConvert<f64x2, f32x4, true>(instr.op);
+    case O::I32X4TruncSatF64X2SZero: return DoSimdUnopZero(instr.op, IntTruncSat<s32, f64>);
+    case O::I32X4TruncSatF64X2UZero: return DoSimdUnopZero(instr.op, IntTruncSat<u32, f64>);
+    case O::F64X2ConvertLowI32X4S: return DoSimdConvert<f64x2, s32x4, true>(instr.op);
+    case O::F64X2ConvertLowI32X4U: return DoSimdConvert<f64x2, u32x4, true>(instr.op);
+
+    case O::I8X16Swizzle:     return DoSimdSwizzle(instr.op);
     case O::I8X16Shuffle:     return DoSimdShuffle(instr);
 
     case O::V128Load8Splat:    return DoSimdLoadSplat<u8x16>(instr, out_trap);
@@ -1705,22 +3314,22 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     case O::V128Load32Zero: return DoSimdLoadZero<u32x4, u32>(instr, out_trap);
     case O::V128Load64Zero: return DoSimdLoadZero<u64x2, u64>(instr, out_trap);
 
-    case O::I8X16NarrowI16X8S:    return DoSimdNarrow<s8x16, s16x8>();
-    case O::I8X16NarrowI16X8U:    return DoSimdNarrow<u8x16, s16x8>();
-    case O::I16X8NarrowI32X4S:    return DoSimdNarrow<s16x8, s32x4>();
-    case O::I16X8NarrowI32X4U:    return DoSimdNarrow<u16x8, s32x4>();
-    case O::I16X8ExtendLowI8X16S:  return DoSimdConvert<s16x8, s8x16, true>();
-    case O::I16X8ExtendHighI8X16S: return DoSimdConvert<s16x8, s8x16, false>();
-    case O::I16X8ExtendLowI8X16U:  return DoSimdConvert<u16x8, u8x16, true>();
-    case O::I16X8ExtendHighI8X16U: return DoSimdConvert<u16x8, u8x16, false>();
-    case O::I32X4ExtendLowI16X8S:  return DoSimdConvert<s32x4, s16x8, true>();
-    case O::I32X4ExtendHighI16X8S: return DoSimdConvert<s32x4, s16x8, false>();
-    case O::I32X4ExtendLowI16X8U:  return DoSimdConvert<u32x4, u16x8, true>();
-    case O::I32X4ExtendHighI16X8U: return DoSimdConvert<u32x4, u16x8, false>();
-    case O::I64X2ExtendLowI32X4S:  return DoSimdConvert<s64x2, s32x4, true>();
-    case O::I64X2ExtendHighI32X4S: return DoSimdConvert<s64x2, s32x4, false>();
-    case O::I64X2ExtendLowI32X4U:  return DoSimdConvert<u64x2, u32x4, true>();
-    case O::I64X2ExtendHighI32X4U: return DoSimdConvert<u64x2, u32x4, false>();
+    case O::I8X16NarrowI16X8S:    return DoSimdNarrow<s8x16, s16x8>(instr.op);
+    case O::I8X16NarrowI16X8U:    return DoSimdNarrow<u8x16, s16x8>(instr.op);
+    case O::I16X8NarrowI32X4S:    return DoSimdNarrow<s16x8, s32x4>(instr.op);
+    case O::I16X8NarrowI32X4U:    return DoSimdNarrow<u16x8, s32x4>(instr.op);
+    case O::I16X8ExtendLowI8X16S:  return DoSimdConvert<s16x8, s8x16, true>(instr.op);
+    case O::I16X8ExtendHighI8X16S: return DoSimdConvert<s16x8, s8x16, false>(instr.op);
+    case O::I16X8ExtendLowI8X16U:  return DoSimdConvert<u16x8, u8x16, true>(instr.op);
+    case O::I16X8ExtendHighI8X16U: return DoSimdConvert<u16x8, u8x16, false>(instr.op);
+    case O::I32X4ExtendLowI16X8S:  return DoSimdConvert<s32x4, s16x8, true>(instr.op);
+    case O::I32X4ExtendHighI16X8S: return DoSimdConvert<s32x4, s16x8, false>(instr.op);
+    case O::I32X4ExtendLowI16X8U:  return DoSimdConvert<u32x4, u16x8, true>(instr.op);
+    case O::I32X4ExtendHighI16X8U: return DoSimdConvert<u32x4, u16x8, false>(instr.op);
+    case O::I64X2ExtendLowI32X4S:  return DoSimdConvert<s64x2, s32x4, true>(instr.op);
+    case O::I64X2ExtendHighI32X4S: return DoSimdConvert<s64x2, s32x4, false>(instr.op);
+    case O::I64X2ExtendLowI32X4U:  return DoSimdConvert<u64x2, u32x4, true>(instr.op);
+    case O::I64X2ExtendHighI32X4U: return DoSimdConvert<u64x2, u32x4, false>(instr.op);
 
     case O::V128Load8X8S:  return DoSimdLoadExtend<s16x8, s8x8>(instr, out_trap);
     case O::V128Load8X8U:  return DoSimdLoadExtend<u16x8, u8x8>(instr, out_trap);
@@ -1729,44 +3338,46 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     case O::V128Load32X2S: return DoSimdLoadExtend<s64x2, s32x2>(instr, out_trap);
     case O::V128Load32X2U: return DoSimdLoadExtend<u64x2, u32x2>(instr, out_trap);
 
-    case O::V128Andnot: return DoSimdBinop(IntAndNot<u64>);
-    case O::I8X16AvgrU: return DoSimdBinop(IntAvgr<u8>);
-    case O::I16X8AvgrU: return DoSimdBinop(IntAvgr<u16>);
+    case O::V128Andnot: return DoSimdBinop(instr.op, IntAndNot<u64>);
+    case O::I8X16AvgrU: return DoSimdBinop(instr.op, IntAvgr<u8>);
+    case O::I16X8AvgrU: return DoSimdBinop(instr.op, IntAvgr<u16>);
 
-    case O::I8X16Abs: return DoSimdUnop(IntAbs<u8>);
-    case O::I16X8Abs: return DoSimdUnop(IntAbs<u16>);
-    case O::I32X4Abs: return DoSimdUnop(IntAbs<u32>);
-    case O::I64X2Abs: return DoSimdUnop(IntAbs<u64>);
+    case O::I8X16Abs: return DoSimdUnop(instr.op, IntAbs<u8>);
+    case O::I16X8Abs: return DoSimdUnop(instr.op, IntAbs<u16>);
+    case O::I32X4Abs: return DoSimdUnop(instr.op, IntAbs<u32>);
+    case O::I64X2Abs: return DoSimdUnop(instr.op, IntAbs<u64>);
 
-    case O::I8X16Popcnt: return DoSimdUnop(IntPopcnt<u8>);
+    case O::I8X16Popcnt: return DoSimdUnop(instr.op, IntPopcnt<u8>);
 
-    case O::I16X8ExtaddPairwiseI8X16S: return DoSimdExtaddPairwise<s16x8, s8x16>();
-    case O::I16X8ExtaddPairwiseI8X16U: return DoSimdExtaddPairwise<u16x8, u8x16>();
-    case O::I32X4ExtaddPairwiseI16X8S: return DoSimdExtaddPairwise<s32x4, s16x8>();
-    case O::I32X4ExtaddPairwiseI16X8U: return DoSimdExtaddPairwise<u32x4, u16x8>();
+    case O::I16X8ExtaddPairwiseI8X16S: return DoSimdExtaddPairwise<s16x8, s8x16>(instr.op);
+    case O::I16X8ExtaddPairwiseI8X16U: return DoSimdExtaddPairwise<u16x8, u8x16>(instr.op);
+    case O::I32X4ExtaddPairwiseI16X8S: return DoSimdExtaddPairwise<s32x4, s16x8>(instr.op);
+    case O::I32X4ExtaddPairwiseI16X8U: return DoSimdExtaddPairwise<u32x4, u16x8>(instr.op);
 
-    case O::I16X8ExtmulLowI8X16S: return DoSimdExtmul<s16x8, s8x16, true>();
-    case O::I16X8ExtmulHighI8X16S: return DoSimdExtmul<s16x8, s8x16, false>();
-    case O::I16X8ExtmulLowI8X16U: return DoSimdExtmul<u16x8, u8x16, true>();
-    case O::I16X8ExtmulHighI8X16U: return DoSimdExtmul<u16x8, u8x16, false>();
-    case O::I32X4ExtmulLowI16X8S: return DoSimdExtmul<s32x4, s16x8, true>();
-    case O::I32X4ExtmulHighI16X8S: return DoSimdExtmul<s32x4, s16x8, false>();
-    case O::I32X4ExtmulLowI16X8U: return DoSimdExtmul<u32x4, u16x8, true>();
-    case O::I32X4ExtmulHighI16X8U: return DoSimdExtmul<u32x4, u16x8, false>();
-    case O::I64X2ExtmulLowI32X4S: return DoSimdExtmul<s64x2, s32x4, true>();
-    case O::I64X2ExtmulHighI32X4S: return DoSimdExtmul<s64x2, s32x4, false>();
-    case O::I64X2ExtmulLowI32X4U: return DoSimdExtmul<u64x2, u32x4, true>();
-    case O::I64X2ExtmulHighI32X4U: return DoSimdExtmul<u64x2, u32x4, false>();
+    case O::I16X8ExtmulLowI8X16S: return DoSimdExtmul<s16x8, s8x16, true>(instr.op);
+    case O::I16X8ExtmulHighI8X16S: return DoSimdExtmul<s16x8, s8x16, false>(instr.op);
+    case O::I16X8ExtmulLowI8X16U: return DoSimdExtmul<u16x8, u8x16, true>(instr.op);
+    case O::I16X8ExtmulHighI8X16U: return DoSimdExtmul<u16x8, u8x16, false>(instr.op);
+    case O::I32X4ExtmulLowI16X8S: return DoSimdExtmul<s32x4, s16x8, true>(instr.op);
+    case O::I32X4ExtmulHighI16X8S: return DoSimdExtmul<s32x4, s16x8, false>(instr.op);
+    case O::I32X4ExtmulLowI16X8U: return DoSimdExtmul<u32x4, u16x8, true>(instr.op);
+    case O::I32X4ExtmulHighI16X8U: return DoSimdExtmul<u32x4, u16x8, false>(instr.op);
+    case O::I64X2ExtmulLowI32X4S: return DoSimdExtmul<s64x2, s32x4, true>(instr.op);
+    case O::I64X2ExtmulHighI32X4S: return DoSimdExtmul<s64x2, s32x4, false>(instr.op);
+    case O::I64X2ExtmulLowI32X4U: return DoSimdExtmul<u64x2, u32x4, true>(instr.op);
+    case O::I64X2ExtmulHighI32X4U: return DoSimdExtmul<u64x2, u32x4, false>(instr.op);
 
-    case O::I16X8Q15mulrSatS: return DoSimdBinop(SaturatingRoundingQMul<s16>);
+    case O::I16X8Q15mulrSatS: return DoSimdBinop(instr.op, SaturatingRoundingQMul<s16>);
 
-    case O::I32X4DotI16X8S: return DoSimdDot<u32x4, s16x8>();
+    case O::I32X4DotI16X8S: return DoSimdDot<u32x4, s16x8>(instr.op);
 
     case O::AtomicFence:
-    case O::MemoryAtomicNotify:
-    case O::MemoryAtomicWait32:
-    case O::MemoryAtomicWait64:
-      return TRAP("not implemented");
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      break;
+
+    case O::MemoryAtomicNotify: return DoAtomicNotify(instr, out_trap);
+    case O::MemoryAtomicWait32: return DoAtomicWait<u32>(instr, out_trap);
+    case O::MemoryAtomicWait64: return DoAtomicWait<u64>(instr, out_trap);
 
     case O::I32AtomicLoad:       return DoAtomicLoad<u32>(instr, out_trap);
     case O::I64AtomicLoad:       return DoAtomicLoad<u64>(instr, out_trap);
@@ -1857,7 +3468,6 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
     case O::If:
     case O::Else:
     case O::End:
-    case O::ReturnCall:
     case O::SelectT:
 
     case O::CallRef:
@@ -1874,35 +3484,113 @@ RunResult Thread::StepInternal(Trap::Ptr* out_trap) {
   return RunResult::Ok;
 }
 
-RunResult Thread::DoCall(const Func::Ptr& func, Trap::Ptr* out_trap) {
-  if (auto* host_func = dyn_cast<HostFunc>(func.get())) {
-    auto& func_type = host_func->type();
-
-    Values params;
-    PopValues(func_type.params, &params);
-    if (PushCall(*host_func, out_trap) == RunResult::Trap) {
+RunResult Thread::DoCall(Func* func, Trap::Ptr* out_trap) {
+  if (auto* host_func = dyn_cast<HostFunc>(func)) {
+    return CallHost(*host_func, out_trap);
+  } else {
+    if (PushCall(*cast<DefinedFunc>(func), out_trap) == RunResult::Trap) {
       return RunResult::Trap;
     }
+  }
+  return RunResult::Ok;
+}
 
-    Values results(func_type.results.size());
-    if (Failed(host_func->Call(*this, params, results, out_trap))) {
-      return RunResult::Trap;
-    }
+// The parameters are on top of the value stack, and are replaced by the
+// results. The results are written above the parameters, and only moved
+// down once the callback has returned.
+RunResult Thread::CallHost(const HostFunc& func, Trap::Ptr* out_trap) {
+  assert(values_.size() >= func.param_slot_count_);
+  u32 params = values_.size() - func.param_slot_count_;
+  u32 results = values_.size();
+  // Zeroed, so reference results are null until they are set.
+  values_.resize(results + func.result_slot_count_);
+  if (PushCall(func, out_trap) == RunResult::Trap) {
+    return RunResult::Trap;
+  }
 
-    PopCall();
-    PushValues(func_type.results, results);
-  } else {
-    if (PushCall(*cast<DefinedFunc>(func.get()), out_trap) == RunResult::Trap) {
-      return RunResult::Ok;
+  HostCallArgs args(values_, func, params, results);
+  ++host_calls_;
+  Result result = func.callback_(*this, args, out_trap);
+  --host_calls_;
+  if (WABT_UNLIKELY(suspend_requested_)) {
+    suspend_requested_ = false;
+    if (Succeeded(result)) {
+      // Leave the call's frame and slots in place for Resume.
+      suspended_ = true;
+      return RunResult::Suspended;
     }
   }
+  if (Failed(result)) {
+    return RunResult::Trap;
+  }
+
+  FinishHostCall(func, params, results);
   return RunResult::Ok;
 }
 
+void Thread::FinishHostCall(const HostFunc& func, u32 params, u32 results) {
+  PopCall();
+  assert(values_.size() == results + func.result_slot_count_);
+  std::copy(values_.begin() + results, values_.end(), values_.begin() + params);
+  values_.resize(params + func.result_slot_count_);
+}
+
+RunResult Thread::BeginCall(const DefinedFunc& func,
+                            const Values& params,
+                            Trap::Ptr* out_trap) {
+  assert(params.size() == func.type().params.size());
+  assert(host_calls_ == 0);
+  frames_.clear();
+  values_.clear();
+  exceptions_.clear();
+  suspended_ = false;
+  async_func_ = func.self();
+  PushValues(func.type().params, params);
+  return PushCall(func, out_trap);
+}
+
+void Thread::EndCall(Values* out_results) {
+  assert(frames_.empty() && async_func_ != Ref::Null);
+  auto* func = store_.UnsafeGetRaw<DefinedFunc>(async_func_);
+  PopValues(func->type().results, out_results);
+  async_func_ = Ref::Null;
+}
+
+Result Thread::Suspend() {
+  // The callbacks of the other host functions on the stack are still on the
+  // native stack, so they can't be parked.
+  if (async_func_ == Ref::Null || host_calls_ != 1) {
+    return Result::Error;
+  }
+  suspend_requested_ = true;
+  return Result::Ok;
+}
+
+RunResult Thread::Resume(const Values& results) {
+  assert(suspended_);
+  suspended_ = false;
+  auto* func = store_.UnsafeGetRaw<HostFunc>(frames_.back().func);
+  assert(results.size() == func->type().results.size());
+  u32 result_slots = frames_.back().values - func->result_slot_count_;
+  u32 param_slots = result_slots - func->param_slot_count_;
+  HostCallArgs args(values_, *func, param_slots, result_slots);
+  for (Index i = 0; i < results.size(); ++i) {
+    args.set_result_value(i, results[i]);
+  }
+  FinishHostCall(*func, param_slots, result_slots);
+  return frames_.empty() ? RunResult::Return : RunResult::Ok;
+}
+
 template <typename T>
 RunResult Thread::Load(Instr instr, T* out, Trap::Ptr* out_trap) {
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32x2.fst]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
   u64 offset = PopPtr(memory);
+  if (memory->has_guard_pages()) {
+    // A 32-bit address plus offset always lands in the reserved range; an
+    // out of bounds access faults and RunWithGuardPages turns it into a trap.
+    *out = memory->GuardedLoad<T>(offset, instr.imm_u32x2.snd);
+    return RunResult::Ok;
+  }
   TRAP_IF(Failed(memory->Load(offset, instr.imm_u32x2.snd, out)),
           StringPrintf("out of bounds memory access: access at %" PRIu64
                        "+%" PRIzd " >= max value %" PRIu64,
@@ -1923,9 +3611,13 @@ RunResult Thread::DoLoad(Instr instr, Trap::Ptr* out_trap) {
 
 template <typename T, typename V>
 RunResult Thread::DoStore(Instr instr, Trap::Ptr* out_trap) {
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32x2.fst]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
   V val = static_cast<V>(Pop<T>());
   u64 offset = PopPtr(memory);
+  if (memory->has_guard_pages()) {
+    memory->GuardedStore(offset, instr.imm_u32x2.snd, val);
+    return RunResult::Ok;
+  }
   TRAP_IF(Failed(memory->Store(offset, instr.imm_u32x2.snd, val)),
           StringPrintf("out of bounds memory access: access at %" PRIu64
                        "+%" PRIzd " >= max value %" PRIu64,
@@ -1987,7 +3679,7 @@ RunResult Thread::DoReinterpret() {
 }
 
 RunResult Thread::DoMemoryInit(Instr instr, Trap::Ptr* out_trap) {
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32x2.fst]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
   auto&& data = inst_->datas()[instr.imm_u32x2.snd];
   auto size = Pop<u32>();
   auto src = Pop<u32>();
@@ -2003,8 +3695,8 @@ RunResult Thread::DoDataDrop(Instr instr) {
 }
 
 RunResult Thread::DoMemoryCopy(Instr instr, Trap::Ptr* out_trap) {
-  Memory::Ptr mem_dst{store_, inst_->memories()[instr.imm_u32x2.fst]};
-  Memory::Ptr mem_src{store_, inst_->memories()[instr.imm_u32x2.snd]};
+  Memory* mem_dst = inst_->memory_ptr(instr.imm_u32x2.fst);
+  Memory* mem_src = inst_->memory_ptr(instr.imm_u32x2.snd);
   auto size = PopPtr(mem_src);
   auto src = PopPtr(mem_src);
   auto dst = PopPtr(mem_dst);
@@ -2015,7 +3707,7 @@ RunResult Thread::DoMemoryCopy(Instr instr, Trap::Ptr* out_trap) {
 }
 
 RunResult Thread::DoMemoryFill(Instr instr, Trap::Ptr* out_trap) {
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32);
   auto size = PopPtr(memory);
   auto value = Pop<u32>();
   auto dst = PopPtr(memory);
@@ -2025,7 +3717,7 @@ RunResult Thread::DoMemoryFill(Instr instr, Trap::Ptr* out_trap) {
 }
 
 RunResult Thread::DoTableInit(Instr instr, Trap::Ptr* out_trap) {
-  Table::Ptr table{store_, inst_->tables()[instr.imm_u32x2.fst]};
+  Table* table = inst_->table_ptr(instr.imm_u32x2.fst);
   auto&& elem = inst_->elems()[instr.imm_u32x2.snd];
   auto size = Pop<u32>();
   auto src = Pop<u32>();
@@ -2041,8 +3733,8 @@ RunResult Thread::DoElemDrop(Instr instr) {
 }
 
 RunResult Thread::DoTableCopy(Instr instr, Trap::Ptr* out_trap) {
-  Table::Ptr table_dst{store_, inst_->tables()[instr.imm_u32x2.fst]};
-  Table::Ptr table_src{store_, inst_->tables()[instr.imm_u32x2.snd]};
+  Table* table_dst = inst_->table_ptr(instr.imm_u32x2.fst);
+  Table* table_src = inst_->table_ptr(instr.imm_u32x2.snd);
   auto size = Pop<u32>();
   auto src = Pop<u32>();
   auto dst = Pop<u32>();
@@ -2052,7 +3744,7 @@ RunResult Thread::DoTableCopy(Instr instr, Trap::Ptr* out_trap) {
 }
 
 RunResult Thread::DoTableGet(Instr instr, Trap::Ptr* out_trap) {
-  Table::Ptr table{store_, inst_->tables()[instr.imm_u32]};
+  Table* table = inst_->table_ptr(instr.imm_u32);
   auto index = Pop<u32>();
   Ref ref;
   TRAP_IF(Failed(table->Get(index, &ref)),
@@ -2064,7 +3756,7 @@ RunResult Thread::DoTableGet(Instr instr, Trap::Ptr* out_trap) {
 }
 
 RunResult Thread::DoTableSet(Instr instr, Trap::Ptr* out_trap) {
-  Table::Ptr table{store_, inst_->tables()[instr.imm_u32]};
+  Table* table = inst_->table_ptr(instr.imm_u32);
   auto ref = Pop<Ref>();
   auto index = Pop<u32>();
   TRAP_IF(Failed(table->Set(store_, index, ref)),
@@ -2075,7 +3767,7 @@ RunResult Thread::DoTableSet(Instr instr, Trap::Ptr* out_trap) {
 }
 
 RunResult Thread::DoTableGrow(Instr instr, Trap::Ptr* out_trap) {
-  Table::Ptr table{store_, inst_->tables()[instr.imm_u32]};
+  Table* table = inst_->table_ptr(instr.imm_u32);
   u32 old_size = table->size();
   auto delta = Pop<u32>();
   auto ref = Pop<Ref>();
@@ -2088,13 +3780,13 @@ RunResult Thread::DoTableGrow(Instr instr, Trap::Ptr* out_trap) {
 }
 
 RunResult Thread::DoTableSize(Instr instr) {
-  Table::Ptr table{store_, inst_->tables()[instr.imm_u32]};
+  Table* table = inst_->table_ptr(instr.imm_u32);
   Push<u32>(table->size());
   return RunResult::Ok;
 }
 
 RunResult Thread::DoTableFill(Instr instr, Trap::Ptr* out_trap) {
-  Table::Ptr table{store_, inst_->tables()[instr.imm_u32]};
+  Table* table = inst_->table_ptr(instr.imm_u32);
   auto size = Pop<u32>();
   auto value = Pop<Ref>();
   auto dst = Pop<u32>();
@@ -2139,8 +3831,43 @@ template <> struct Simd128<u64> { using Type = u64x2; };
 template <> struct Simd128<f32> { using Type = f32x4; };
 template <> struct Simd128<f64> { using Type = f64x2; };
 
+RunResult Thread::DoSimdKernel(SimdKernels::Unop kernel) {
+  Push(kernel(Pop<v128>()));
+  return RunResult::Ok;
+}
+
+RunResult Thread::DoSimdKernel(SimdKernels::Binop kernel) {
+  auto rhs = Pop<v128>();
+  auto lhs = Pop<v128>();
+  Push(kernel(lhs, rhs));
+  return RunResult::Ok;
+}
+
+RunResult Thread::DoSimdKernel(SimdKernels::Ternop kernel) {
+  auto c = Pop<v128>();
+  auto rhs = Pop<v128>();
+  auto lhs = Pop<v128>();
+  Push(kernel(lhs, rhs, c));
+  return RunResult::Ok;
+}
+
+RunResult Thread::DoSimdKernel(SimdKernels::Shift kernel) {
+  auto amount = Pop<u32>();
+  auto lhs = Pop<v128>();
+  Push(kernel(lhs, amount));
+  return RunResult::Ok;
+}
+
+RunResult Thread::DoSimdKernel(SimdKernels::Test kernel) {
+  Push(kernel(Pop<v128>()));
+  return RunResult::Ok;
+}
+
 template <typename R, typename T>
-RunResult Thread::DoSimdUnop(UnopFunc<R, T> f) {
+RunResult Thread::DoSimdUnop(Opcode op, UnopFunc<R, T> f) {
+  if (auto kernel = simd_kernels_->unop[op]) {
+    return DoSimdKernel(kernel);
+  }
   using ST = typename Simd128<T>::Type;
   using SR = typename Simd128<R>::Type;
   auto val = Pop<ST>();
@@ -2151,7 +3878,10 @@ RunResult Thread::DoSimdUnop(UnopFunc<R, T> f) {
 }
 
 template <typename R, typename T>
-RunResult Thread::DoSimdUnopZero(UnopFunc<R, T> f) {
+RunResult Thread::DoSimdUnopZero(Opcode op, UnopFunc<R, T> f) {
+  if (auto kernel = simd_kernels_->unop[op]) {
+    return DoSimdKernel(kernel);
+  }
   using ST = typename Simd128<T>::Type;
   using SR = typename Simd128<R>::Type;
   auto val = Pop<ST>();
@@ -2167,7 +3897,10 @@ RunResult Thread::DoSimdUnopZero(UnopFunc<R, T> f) {
 }
 
 template <typename R, typename T>
-RunResult Thread::DoSimdBinop(BinopFunc<R, T> f) {
+RunResult Thread::DoSimdBinop(Opcode op, BinopFunc<R, T> f) {
+  if (auto kernel = simd_kernels_->binop[op]) {
+    return DoSimdKernel(kernel);
+  }
   using ST = typename Simd128<T>::Type;
   using SR = typename Simd128<R>::Type;
   static_assert(ST::lanes == SR::lanes, "SIMD lanes don't match");
@@ -2181,7 +3914,10 @@ RunResult Thread::DoSimdBinop(BinopFunc<R, T> f) {
   return RunResult::Ok;
 }
 
-RunResult Thread::DoSimdBitSelect() {
+RunResult Thread::DoSimdBitSelect(Opcode op) {
+  if (auto kernel = simd_kernels_->ternop[op]) {
+    return DoSimdKernel(kernel);
+  }
   using S = u64x2;
   auto c = Pop<S>();
   auto rhs = Pop<S>();
@@ -2195,7 +3931,10 @@ RunResult Thread::DoSimdBitSelect() {
 }
 
 template <typename S, u8 count>
-RunResult Thread::DoSimdIsTrue() {
+RunResult Thread::DoSimdIsTrue(Opcode op) {
+  if (auto kernel = simd_kernels_->test[op]) {
+    return DoSimdKernel(kernel);
+  }
   using L = typename S::LaneType;
   auto val = Pop<S>();
   Push(std::count_if(std::begin(val.v), std::end(val.v),
@@ -2204,7 +3943,10 @@ RunResult Thread::DoSimdIsTrue() {
 }
 
 template <typename S>
-RunResult Thread::DoSimdBitmask() {
+RunResult Thread::DoSimdBitmask(Opcode op) {
+  if (auto kernel = simd_kernels_->test[op]) {
+    return DoSimdKernel(kernel);
+  }
   auto val = Pop<S>();
   u32 result = 0;
   for (u8 i = 0; i < S::lanes; ++i) {
@@ -2217,7 +3959,10 @@ RunResult Thread::DoSimdBitmask() {
 }
 
 template <typename R, typename T>
-RunResult Thread::DoSimdShift(BinopFunc<R, T> f) {
+RunResult Thread::DoSimdShift(Opcode op, BinopFunc<R, T> f) {
+  if (auto kernel = simd_kernels_->shift[op]) {
+    return DoSimdKernel(kernel);
+  }
   using ST = typename Simd128<T>::Type;
   using SR = typename Simd128<R>::Type;
   static_assert(ST::lanes == SR::lanes, "SIMD lanes don't match");
@@ -2260,7 +4005,7 @@ RunResult Thread::DoSimdLoadLane(Instr instr, Trap::Ptr* out_trap) {
 template <typename S>
 RunResult Thread::DoSimdStoreLane(Instr instr, Trap::Ptr* out_trap) {
   using T = typename S::LaneType;
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32x2_u8.fst]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2_u8.fst);
   auto result = Pop<S>();
   T val = result[instr.imm_u32x2_u8.idx];
   u64 offset = PopPtr(memory);
@@ -2286,7 +4031,10 @@ RunResult Thread::DoSimdLoadZero(Instr instr, Trap::Ptr* out_trap) {
   return RunResult::Ok;
 }
 
-RunResult Thread::DoSimdSwizzle() {
+RunResult Thread::DoSimdSwizzle(Opcode op) {
+  if (auto kernel = simd_kernels_->binop[op]) {
+    return DoSimdKernel(kernel);
+  }
   using S = u8x16;
   auto rhs = Pop<S>();
   auto lhs = Pop<S>();
@@ -2299,6 +4047,12 @@ RunResult Thread::DoSimdSwizzle() {
 }
 
 RunResult Thread::DoSimdShuffle(Instr instr) {
+  if (auto kernel = simd_kernels_->ternop[instr.op]) {
+    auto rhs = Pop<v128>();
+    auto lhs = Pop<v128>();
+    Push(kernel(lhs, rhs, instr.imm_v128));
+    return RunResult::Ok;
+  }
   using S = u8x16;
   auto sel = Bitcast<S>(instr.imm_v128);
   auto rhs = Pop<S>();
@@ -2312,7 +4066,10 @@ RunResult Thread::DoSimdShuffle(Instr instr) {
 }
 
 template <typename S, typename T>
-RunResult Thread::DoSimdNarrow() {
+RunResult Thread::DoSimdNarrow(Opcode op) {
+  if (auto kernel = simd_kernels_->binop[op]) {
+    return DoSimdKernel(kernel);
+  }
   using SL = typename S::LaneType;
   using TL = typename T::LaneType;
   auto rhs = Pop<T>();
@@ -2329,7 +4086,10 @@ RunResult Thread::DoSimdNarrow() {
 }
 
 template <typename S, typename T, bool low>
-RunResult Thread::DoSimdConvert() {
+RunResult Thread::DoSimdConvert(Opcode op) {
+  if (auto kernel = simd_kernels_->unop[op]) {
+    return DoSimdKernel(kernel);
+  }
   using SL = typename S::LaneType;
   auto val = Pop<T>();
   S result;
@@ -2341,7 +4101,10 @@ RunResult Thread::DoSimdConvert() {
 }
 
 template <typename S, typename T, bool low>
-RunResult Thread::DoSimdExtmul() {
+RunResult Thread::DoSimdExtmul(Opcode op) {
+  if (auto kernel = simd_kernels_->binop[op]) {
+    return DoSimdKernel(kernel);
+  }
   auto rhs = Pop<T>();
   auto lhs = Pop<T>();
   S result;
@@ -2369,7 +4132,10 @@ RunResult Thread::DoSimdLoadExtend(Instr instr, Trap::Ptr* out_trap) {
 }
 
 template <typename S, typename T>
-RunResult Thread::DoSimdExtaddPairwise() {
+RunResult Thread::DoSimdExtaddPairwise(Opcode op) {
+  if (auto kernel = simd_kernels_->unop[op]) {
+    return DoSimdKernel(kernel);
+  }
   auto val = Pop<T>();
   S result;
   using U = typename S::LaneType;
@@ -2382,7 +4148,10 @@ RunResult Thread::DoSimdExtaddPairwise() {
 }
 
 template <typename S, typename T>
-RunResult Thread::DoSimdDot() {
+RunResult Thread::DoSimdDot(Opcode op) {
+  if (auto kernel = simd_kernels_->binop[op]) {
+    return DoSimdKernel(kernel);
+  }
   using SL = typename S::LaneType;
   auto rhs = Pop<T>();
   auto lhs = Pop<T>();
@@ -2399,7 +4168,7 @@ RunResult Thread::DoSimdDot() {
 
 template <typename T, typename V>
 RunResult Thread::DoAtomicLoad(Instr instr, Trap::Ptr* out_trap) {
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32x2.fst]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
   u64 offset = PopPtr(memory);
   V val;
   TRAP_IF(Failed(memory->AtomicLoad(offset, instr.imm_u32x2.snd, &val)),
@@ -2411,7 +4180,7 @@ RunResult Thread::DoAtomicLoad(Instr instr, Trap::Ptr* out_trap) {
 
 template <typename T, typename V>
 RunResult Thread::DoAtomicStore(Instr instr, Trap::Ptr* out_trap) {
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32x2.fst]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
   V val = static_cast<V>(Pop<T>());
   u64 offset = PopPtr(memory);
   TRAP_IF(Failed(memory->AtomicStore(offset, instr.imm_u32x2.snd, val)),
@@ -2424,7 +4193,7 @@ template <typename R, typename T>
 RunResult Thread::DoAtomicRmw(BinopFunc<T, T> f,
                               Instr instr,
                               Trap::Ptr* out_trap) {
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32x2.fst]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
   T val = static_cast<T>(Pop<R>());
   u64 offset = PopPtr(memory);
   T old;
@@ -2437,7 +4206,7 @@ RunResult Thread::DoAtomicRmw(BinopFunc<T, T> f,
 
 template <typename T, typename V>
 RunResult Thread::DoAtomicRmwCmpxchg(Instr instr, Trap::Ptr* out_trap) {
-  Memory::Ptr memory{store_, inst_->memories()[instr.imm_u32x2.fst]};
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
   V replace = static_cast<V>(Pop<T>());
   V expect = static_cast<V>(Pop<T>());
   V old;
@@ -2450,6 +4219,49 @@ RunResult Thread::DoAtomicRmwCmpxchg(Instr instr, Trap::Ptr* out_trap) {
   return RunResult::Ok;
 }
 
+template <typename T>
+RunResult Thread::DoAtomicWait(Instr instr, Trap::Ptr* out_trap) {
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
+  s64 timeout = Pop<s64>();
+  T expect = Pop<T>();
+  u64 offset = PopPtr(memory);
+  TRAP_IF(!memory->shared(), "expected shared memory");
+  u32 result;
+  TRAP_IF(Failed(memory->AtomicWait(offset, instr.imm_u32x2.snd, expect,
+                                    timeout, &result, interrupt_)),
+          StringPrintf("invalid atomic access at %" PRIaddress "+%u", offset,
+                       instr.imm_u32x2.snd));
+  if (result == Memory::kWaitInterrupted) {
+    // Restore the operands and leave pc at this instruction, as if the
+    // interrupt had been seen before it, so the wait starts again on resume.
+    if (memory->type().limits.is_64) {
+      Push<u64>(offset);
+    } else {
+      Push<u32>(offset);
+    }
+    Push(expect);
+    Push(timeout);
+    frames_.back().offset -=
+        sizeof(Istream::SerializedOpcode) + 2 * sizeof(u32);
+    return RunResult::Interrupted;
+  }
+  Push(result);
+  return RunResult::Ok;
+}
+
+RunResult Thread::DoAtomicNotify(Instr instr, Trap::Ptr* out_trap) {
+  Memory* memory = inst_->memory_ptr(instr.imm_u32x2.fst);
+  u32 count = Pop<u32>();
+  u64 offset = PopPtr(memory);
+  u32 result;
+  TRAP_IF(Failed(memory->AtomicNotify(offset, instr.imm_u32x2.snd, count,
+                                      &result)),
+          StringPrintf("invalid atomic access at %" PRIaddress "+%u", offset,
+                       instr.imm_u32x2.snd));
+  Push(result);
+  return RunResult::Ok;
+}
+
 RunResult Thread::DoThrow(Exception::Ptr exn) {
   Istream::Offset target_offset = Istream::kInvalidOffset;
   u32 target_values, target_exceptions;
@@ -2549,8 +4361,39 @@ std::string Thread::TraceSource::Header(Istream::Offset offset) {
 }
 
 std::string Thread::TraceSource::Pick(Index index, Instr instr) {
-  Value val = thread_->Pick(index);
+  // The operands above this one may take more than one slot each.
+  Index slot = 0;
+  for (Index i = 1; i <= index; ++i) {
+    slot += GetSlotCount(GetOperandType(i, instr));
+  }
+  const StackSlot* slots = &thread_->Pick(slot);
   const char* reftype;
+  switch (GetOperandType(index, instr)) {
+    case ValueType::I32: return StringPrintf("%u", ReadSlots<u32>(slots));
+    case ValueType::I64: return StringPrintf("%" PRIu64, ReadSlots<u64>(slots));
+    case ValueType::F32: return StringPrintf("%g", ReadSlots<f32>(slots));
+    case ValueType::F64: return StringPrintf("%g", ReadSlots<f64>(slots));
+    case ValueType::V128: {
+      auto v = ReadSlots<v128>(slots);
+      return StringPrintf("0x%08x 0x%08x 0x%08x 0x%08x", v.u32(0), v.u32(1),
+                          v.u32(2), v.u32(3));
+    }
+
+    case ValueType::FuncRef:    reftype = "funcref"; break;
+    case ValueType::ExternRef:  reftype = "externref"; break;
+
+    case ValueType::Void:       return "?";
+
+    default:
+      WABT_UNREACHABLE;
+      break;
+  }
+
+  // Handle ref types.
+  return StringPrintf("%s:%" PRIzd, reftype, ReadSlots<Ref>(slots).index);
+}
+
+ValueType Thread::TraceSource::GetOperandType(Index index, Instr instr) {
   // Estimate number of operands.
   // TODO: Instead, record this accurately in opcode.def.
   Index num_operands = 3;
@@ -2575,31 +4418,10 @@ std::string Thread::TraceSource::Pick(Index index, Instr instr) {
       case Opcode::TableSet:
       case Opcode::TableGrow:
       case Opcode::TableFill: type = GetTableElementType(instr.imm_u32); break;
-      default: return "?";
-    }
-  }
-
-  switch (type) {
-    case ValueType::I32: return StringPrintf("%u", val.Get<u32>());
-    case ValueType::I64: return StringPrintf("%" PRIu64, val.Get<u64>());
-    case ValueType::F32: return StringPrintf("%g", val.Get<f32>());
-    case ValueType::F64: return StringPrintf("%g", val.Get<f64>());
-    case ValueType::V128: {
-      auto v = val.Get<v128>();
-      return StringPrintf("0x%08x 0x%08x 0x%08x 0x%08x", v.u32(0), v.u32(1),
-                          v.u32(2), v.u32(3));
+      default: break;
     }
-
-    case ValueType::FuncRef:    reftype = "funcref"; break;
-    case ValueType::ExternRef:  reftype = "externref"; break;
-
-    default:
-      WABT_UNREACHABLE;
-      break;
   }
-
-  // Handle ref types.
-  return StringPrintf("%s:%" PRIzd, reftype, val.Get<Ref>().index);
+  return type;
 }
 
 ValueType Thread::TraceSource::GetLocalType(Index stack_slot) {
@@ -2616,21 +4438,41 @@ ValueType Thread::TraceSource::GetLocalType(Index stack_slot) {
   //   param1 param2 | local1 ..........
   //
   // When the instruction stream is generated, all local variable access is
-  // translated into a value relative to the top of the stack, counting up from
+  // translated into a slot relative to the top of the stack, counting up from
   // 1. So in the previous example, if there are three values above the local
   // variable, the stack looks like:
   //
   //              param1 param2 | local1 value1 value2 value3
   // stack slot:    6      5        4      3      2      1
-  // local index:   0      1        2
+  // local slot:    0      1        2
   //
   // local1 can be accessed with stack_slot 4, and param1 can be accessed with
   // stack_slot 6. The formula below takes these values into account to convert
-  // the stack_slot into a local index.
-  Index local_index =
-      (thread_->values_.size() - frame.values + func->type().params.size()) -
-      stack_slot;
-  return func->desc().GetLocalType(local_index);
+  // the stack_slot into a slot relative to the first parameter; v128 values
+  // take two slots, so that is then mapped back to a local.
+  const FuncDesc& desc = func->desc();
+  Index local_slot = (thread_->values_.size() - frame.values +
+                      GetSlotCount(desc.type.params)) -
+                     stack_slot;
+  ValueType type = ValueType::Void;
+  for (auto param : desc.type.params) {
+    if (local_slot < GetSlotCount(param)) {
+      type = param;
+      break;
+    }
+    local_slot -= GetSlotCount(param);
+  }
+  for (auto iter = desc.locals.begin();
+       type == ValueType::Void && iter != desc.locals.end(); ++iter) {
+    if (local_slot < iter->count * GetSlotCount(iter->type)) {
+      type = iter->type;
+      break;
+    }
+    local_slot -= iter->count * GetSlotCount(iter->type);
+  }
+  assert(type != ValueType::Void);
+  // v128 locals are set one slot at a time, so show each half as an i64.
+  return type == ValueType::V128 ? ValueType(ValueType::I64) : type;
 }
 
 ValueType Thread::TraceSource::GetGlobalType(Index index) {
@@ -17,11 +17,17 @@
 #ifndef WABT_INTERP_H_
 #define WABT_INTERP_H_
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <functional>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "src/cast.h"
@@ -31,8 +37,20 @@
 #include "src/result.h"
 #include "src/string-view.h"
 
+#include "src/interp/interp-jit.h"
+#include "src/interp/interp-simd.h"
+#include "src/interp/interp-threaded.h"
 #include "src/interp/istream.h"
 
+// Guard pages need a POSIX virtual memory API and enough address space to
+// reserve 8GiB per memory. Growing a big-endian memory moves its contents, so
+// it can't be done in place either.
+#if defined(__linux__) && UINTPTR_MAX > 0xffffffffu && !WABT_BIG_ENDIAN
+#define WABT_INTERP_GUARD_PAGES 1
+#else
+#define WABT_INTERP_GUARD_PAGES 0
+#endif
+
 namespace wabt {
 namespace interp {
 
@@ -43,7 +61,10 @@ class DataSegment;
 class ElemSegment;
 class Module;
 class Instance;
+class InstanceSnapshot;
+class MemoryPool;
 class Thread;
+class Profiler;
 template <typename T>
 class RefPtr;
 
@@ -71,6 +92,12 @@ void RequireType(ValueType);
 bool IsReference(ValueType);
 bool TypesMatch(ValueType expected, ValueType actual);
 
+// A Thread's value stack is made of 8-byte slots. A v128 value takes two
+// consecutive slots (low half first); every other value takes one.
+using StackSlot = u64;
+Index GetSlotCount(ValueType);
+Index GetSlotCount(const ValueTypes&);
+
 using ExternKind = ExternalKind;
 enum class Mutability { Const, Var };
 enum class TagAttr { Exception };
@@ -90,6 +117,7 @@ enum class ObjectKind {
   Tag,
   Module,
   Instance,
+  InstanceSnapshot,
   Thread,
 };
 
@@ -335,6 +363,15 @@ struct HandlerDesc {
   u32 exceptions;
 };
 
+// The operand stack slots that hold references while a function is suspended
+// at a call. Calls are the only points where a host function, and so
+// Store::Collect, can run while the function's frame is live. Parameters and
+// locals aren't included, since their types are known from the FuncDesc.
+struct StackMapDesc {
+  u32 offset;               // Istream offset just after the call.
+  std::vector<u32> slots;   // Relative to the frame's value stack height.
+};
+
 struct FuncDesc {
   // Includes params.
   ValueType GetLocalType(Index) const;
@@ -343,6 +380,9 @@ struct FuncDesc {
   std::vector<LocalDesc> locals;
   u32 code_offset;
   std::vector<HandlerDesc> handlers;
+  // Sorted by offset. Calls without references on the stack are left out.
+  std::vector<StackMapDesc> stack_maps;
+  std::string name;  // From the name section, if any.
 };
 
 struct TableDesc {
@@ -391,6 +431,22 @@ struct ElemDesc {
   InitExpr offset;
 };
 
+struct ModuleDesc;
+
+// Translates function bodies to the istream on demand, for a module that was
+// read with CompileOptions::lazy (see binary-reader-interp.h). Until then, a
+// function's FuncDesc::code_offset is Istream::kInvalidOffset.
+class LazyCompiler {
+ public:
+  virtual ~LazyCompiler() {}
+
+  // Validates the body of the defined function `func_index` and appends its
+  // translation to `module->istream`.
+  virtual Result CompileFunc(ModuleDesc* module,
+                             Index func_index,
+                             std::string* out_message) = 0;
+};
+
 struct ModuleDesc {
   std::vector<FuncType> func_types;
   std::vector<ImportDesc> imports;
@@ -404,8 +460,16 @@ struct ModuleDesc {
   std::vector<ElemDesc> elems;
   std::vector<DataDesc> datas;
   Istream istream;
+  std::shared_ptr<LazyCompiler> lazy_compiler;  // Only for lazy compilation.
 };
 
+// A compiled module that can be shared by many Modules, in any number of
+// Stores. Nothing modifies it while it runs, so the Stores can be used on
+// different threads. The exception is a module read with
+// CompileOptions::lazy, which compiles functions into its ModuleDesc when they
+// are first called; it may only be shared by Stores used on the same thread.
+using SharedModuleDesc = std::shared_ptr<ModuleDesc>;
+
 //// Runtime ////
 
 struct Frame {
@@ -428,10 +492,54 @@ struct Frame {
   Module* mod;
 };
 
+// Describes how FreeList packs a T into one word. A free slot stores the index
+// of the next free slot with kFreeBit set, so kFreeBit must never be set in
+// the packed form of a T.
+template <typename T>
+struct FreeListTraits;
+
+// Objects are at least 2-byte aligned, so the bottom bit of the pointer is
+// always 0. The FreeList owns the objects.
+template <typename T>
+struct FreeListTraits<std::unique_ptr<T>> {
+  using Value = T*;
+  static const uintptr_t kFreeBit = 1;
+
+  static uintptr_t Pack(std::unique_ptr<T> ptr) {
+    return reinterpret_cast<uintptr_t>(ptr.release());
+  }
+  static Value Unpack(uintptr_t word) { return reinterpret_cast<T*>(word); }
+  static void Destroy(uintptr_t word) { delete Unpack(word); }
+  static uintptr_t PackFree(size_t next) { return (next << 1) | kFreeBit; }
+  static size_t UnpackFree(uintptr_t word) { return word >> 1; }
+};
+
+// Object indexes never use the top bit.
+template <>
+struct FreeListTraits<Ref> {
+  using Value = Ref;
+  static const uintptr_t kFreeBit = ~(~uintptr_t(0) >> 1);
+
+  static uintptr_t Pack(Ref ref) { return ref.index; }
+  static Value Unpack(uintptr_t word) { return Ref{word}; }
+  static void Destroy(uintptr_t) {}
+  static uintptr_t PackFree(size_t next) { return next | kFreeBit; }
+  static size_t UnpackFree(uintptr_t word) { return word & ~kFreeBit; }
+};
+
+// A vector of T where deleted slots are reused. Each slot is a single word:
+// either a packed T, or a link in the chain of free slots.
 template <typename T>
 class FreeList {
  public:
   using Index = size_t;
+  using Traits = FreeListTraits<T>;
+  using Value = typename Traits::Value;
+
+  FreeList() = default;
+  FreeList(const FreeList&) = delete;
+  FreeList& operator=(const FreeList&) = delete;
+  ~FreeList();
 
   template <typename... Args>
   Index New(Args&&...);
@@ -439,33 +547,17 @@ class FreeList {
 
   bool IsUsed(Index) const;
 
-  const T& Get(Index) const;
-  T& Get(Index);
+  Value Get(Index) const;
 
   Index size() const;   // 1 greater than the maximum index.
   Index count() const;  // The number of used elements.
 
  private:
-  // TODO: Optimize memory layout? We could probably store all of this
-  // information in one uintptr_t.
-  //
-  // For example, when T is a pointer to an Object (e.g. Store::ObjectList), we
-  // can assume alignment to 4 bytes at least. Given a 32-bit pointer, we can
-  // expect the following layout:
-  //
-  //   nnnnnnnn nnnnnnnn nnnnnnnn nnnnnnn0 f
-  //
-  // where:
-  //   f: "is_free": 0 when the payload is of type T
-  //                 1 when the payload is the index of the next free object
-  //   n: the payload
-  //
-  // When T is a Ref (see Store::RootList below), we'd need to store the
-  // "is_free" bit in most-significant bit instead.
-  //
-  std::vector<T> list_;
-  std::vector<size_t> free_;
-  std::vector<bool> is_free_;
+  static const Index kNoFree = ~Index(0) >> 1;
+
+  std::vector<uintptr_t> list_;
+  Index free_head_ = kNoFree;
+  Index free_count_ = 0;
 };
 
 class Store {
@@ -473,7 +565,44 @@ class Store {
   using ObjectList = FreeList<std::unique_ptr<Object>>;
   using RootList = FreeList<Ref>;
 
+  struct Options {
+    // Back each 32-bit memory with a reserved address range that is large
+    // enough for any 32-bit address plus offset, and make everything past the
+    // memory's current size inaccessible. Loads and stores then skip the
+    // explicit bounds check, and the fault from an out of bounds access is
+    // turned into a trap. Growing the memory never copies it. Ignored unless
+    // WABT_INTERP_GUARD_PAGES is set.
+    bool guard_pages = false;
+
+    // Compile hot functions to x86-64 machine code (see JitCode). A function
+    // is hot once the interpreter has run jit_threshold of its instructions;
+    // 0 compiles each function before its first instruction. Ignored unless
+    // WABT_INTERP_JIT is set, and by Threads that trace or profile.
+    bool jit = false;
+    u32 jit_threshold = 1000;
+
+    // Run each function from a copy of its instructions that is decoded once
+    // (see ThreadedCode), and dispatch to the code for the next instruction
+    // with a computed goto, instead of decoding it from the istream and
+    // switching on its opcode. Ignored unless WABT_INTERP_THREADED is set, by
+    // Threads that trace, and when jit is set.
+    bool threaded = false;
+
+    // Keep the address ranges of up to memory_pool_size 32-bit memories
+    // reserved, and give them to new memories instead of reserving (or
+    // allocating and zeroing) new ones. When a memory is deleted, only the
+    // pages it made accessible are returned to the system, so its range reads
+    // as zero again. Each range has room for memory_pool_max_pages pages, or
+    // with guard_pages, is a whole guarded range; a memory that uses one
+    // can't grow past it. Memories that don't fit, or are created while every
+    // range is in use, are allocated as usual. Ignored unless
+    // WABT_INTERP_GUARD_PAGES is set.
+    u32 memory_pool_size = 0;
+    u32 memory_pool_max_pages = 256;
+  };
+
   explicit Store(const Features& = Features{});
+  Store(const Features&, const Options&);
 
   bool IsValid(Ref) const;
   bool HasValueType(Ref, ValueType) const;
@@ -486,28 +615,84 @@ class Store {
   Result Get(Ref, RefPtr<T>* out);
   template <typename T>
   RefPtr<T> UnsafeGet(Ref);
+  // Like UnsafeGet, but doesn't root the object. The caller must make sure the
+  // object stays reachable for as long as the pointer is used.
+  template <typename T>
+  T* UnsafeGetRaw(Ref);
 
   RootList::Index NewRoot(Ref);
   RootList::Index CopyRoot(RootList::Index);
   void DeleteRoot(RootList::Index);
 
+  // Objects are either young (allocated since the last collection) or old.
+  // Collect is a full collection: it traces everything reachable from the
+  // roots and deletes every unreachable object. CollectYoung only traces and
+  // sweeps young objects, treating every old object as live, so its cost
+  // depends on the number of young objects rather than the whole heap.
+  // Survivors of either collection become old.
   void Collect();
+  void CollectYoung();
   void Mark(Ref);
   void Mark(const RefVec&);
 
+  // Write barrier. Must be called after storing a reference into an existing
+  // object, so CollectYoung can find young objects that are only reachable
+  // from an old one.
+  void RecordWrite(Object*);
+
   ObjectList::Index object_count() const;
 
+  // Returns the canonical id of a function type. Two types get the same id if
+  // and only if they match, so call_indirect can check a signature with a
+  // single compare. Ids are only meaningful within this store.
+  Index InternFuncType(const FuncType&);
+
+  // Func::Call(Store&, ...) takes its Thread from a cache of idle ones, so
+  // that a short call doesn't allocate a Thread and reserve its stacks each
+  // time. AcquireThread returns an idle Thread with the default options, or a
+  // new one if there are none. ReleaseThread clears the Thread's stacks and
+  // keeps it for the next call, until the next Collect.
+  RefPtr<Thread> AcquireThread();
+  void ReleaseThread(RefPtr<Thread>);
+
   const Features& features() const;
   void setFeatures(const Features& features) { features_ = features; }
+  const Options& options() const;
+  // Null if the options don't enable a pool, or it couldn't be reserved.
+  MemoryPool* memory_pool() const { return memory_pool_.get(); }
 
  private:
   template <typename T>
   friend class RefPtr;
 
+  // Params and results of an interned function type, as a single list of type
+  // codes prefixed with the param count.
+  using FuncTypeKey = std::vector<s32>;
+  struct FuncTypeKeyHash {
+    size_t operator()(const FuncTypeKey& key) const;
+  };
+
+  void ProcessMarkStack();
+  void Remember(Ref);
+
   Features features_;
+  Options options_;
+  // Declared before objects_, so that it outlives the memories that use it.
+  std::unique_ptr<MemoryPool> memory_pool_;
   ObjectList objects_;
   RootList roots_;
+  // Between collections, an object is marked if and only if it is old.
   std::vector<bool> marks_;
+  std::vector<ObjectList::Index> mark_stack_;
+  RefVec young_;
+  // Old objects that may reference young objects; traced by CollectYoung.
+  // Threads are always remembered, since their stacks change without write
+  // barriers.
+  RefVec remembered_;
+  std::vector<bool> is_remembered_;
+  std::unordered_map<FuncTypeKey, Index, FuncTypeKeyHash> func_type_ids_;
+  // Not rooted; CollectYoung marks them, and Collect deletes them.
+  RefVec idle_threads_;
 };
 
 template <typename T>
@@ -735,24 +920,39 @@ class Func : public Extern {
               Values& results,
               Trap::Ptr* out_trap);
 
-  // Convenience function that creates new Thread.
+  // Convenience function that runs the call on a Thread from the Store's
+  // cache (see Store::AcquireThread), or on a new Thread when tracing.
   Result Call(Store&,
               const Values& params,
               Values& results,
               Trap::Ptr* out_trap,
               Stream* = nullptr);
 
+  // As above, but without allocating: `params` has one value per parameter
+  // of type(), and `results` has room for one value per result.
+  Result Call(Thread& thread,
+              const Value* params,
+              Value* results,
+              Trap::Ptr* out_trap);
+  Result Call(Store&,
+              const Value* params,
+              Value* results,
+              Trap::Ptr* out_trap);
+
   const ExternType& extern_type() override;
   const FuncType& type() const;
+  // The canonical id of type(), see Store::InternFuncType.
+  Index type_id() const;
 
  protected:
-  explicit Func(ObjectKind, FuncType);
+  explicit Func(ObjectKind, FuncType, Index type_id);
   virtual Result DoCall(Thread& thread,
-                        const Values& params,
-                        Values& results,
+                        const Value* params,
+                        Value* results,
                         Trap::Ptr* out_trap) = 0;
 
   FuncType type_;
+  Index type_id_;
 };
 
 class DefinedFunc : public Func {
@@ -762,7 +962,7 @@ class DefinedFunc : public Func {
   static const char* GetTypeName() { return "DefinedFunc"; }
   using Ptr = RefPtr<DefinedFunc>;
 
-  static DefinedFunc::Ptr New(Store&, Ref instance, FuncDesc);
+  static DefinedFunc::Ptr New(Store&, Ref instance, const FuncDesc*);
 
   Result Match(Store&, const ImportType&, Trap::Ptr* out_trap) override;
 
@@ -771,17 +971,58 @@ class DefinedFunc : public Func {
 
  protected:
   Result DoCall(Thread& thread,
-                const Values& params,
-                Values& results,
+                const Value* params,
+                Value* results,
                 Trap::Ptr* out_trap) override;
 
  private:
   friend Store;
-  explicit DefinedFunc(Store&, Ref instance, FuncDesc);
+  explicit DefinedFunc(Store&, Ref instance, const FuncDesc*);
   void Mark(Store&) override;
 
   Ref instance_;
-  FuncDesc desc_;
+  const FuncDesc* desc_;  // Borrowed from the Module.
+};
+
+class HostFunc;
+
+// The parameters and results of a HostFunc call, in place on the calling
+// thread's value stack. The results have slots of their own, so parameters
+// can still be read after a result is set. Every result must be set before
+// the callback returns.
+//
+// Values are found by their slot index rather than by pointer, since a
+// callback that calls back into the thread may grow the stack and move it.
+class HostCallArgs {
+ public:
+  Index param_count() const;
+  Index result_count() const;
+
+  template <typename T>
+  T WABT_VECTORCALL param(Index) const;
+  template <typename T>
+  T WABT_VECTORCALL result(Index) const;
+  template <typename T>
+  void WABT_VECTORCALL set_result(Index, T);
+
+  // As above, using the function's type to convert to or from a Value.
+  Value param_value(Index) const;
+  void set_result_value(Index, Value);
+
+ private:
+  friend Thread;
+  HostCallArgs(std::vector<StackSlot>& values,
+               const HostFunc& func,
+               u32 params,
+               u32 results);
+
+  template <typename T>
+  T WABT_VECTORCALL Read(u32 slot) const;
+
+  std::vector<StackSlot>& values_;
+  const HostFunc& func_;
+  u32 params_;   // Index in values_ of the first parameter slot.
+  u32 results_;  // Index in values_ of the first result slot.
 };
 
 class HostFunc : public Func {
@@ -791,28 +1032,42 @@ class HostFunc : public Func {
   static const char* GetTypeName() { return "HostFunc"; }
   using Ptr = RefPtr<HostFunc>;
 
+  // Receives copies of the parameters, and fills in `results`, which has one
+  // element per result.
   using Callback = std::function<Result(Thread& thread,
                                         const Values& params,
                                         Values& results,
                                         Trap::Ptr* out_trap)>;
+  // Reads the parameters and writes the results in place. This avoids the
+  // allocations and copies of Callback, so calls from wasm take a small,
+  // constant time.
+  using ArgsCallback = std::function<
+      Result(Thread& thread, HostCallArgs& args, Trap::Ptr* out_trap)>;
 
   static HostFunc::Ptr New(Store&, FuncType, Callback);
+  static HostFunc::Ptr New(Store&, FuncType, ArgsCallback);
 
   Result Match(Store&, const ImportType&, Trap::Ptr* out_trap) override;
 
  protected:
   Result DoCall(Thread& thread,
-                const Values& params,
-                Values& results,
+                const Value* params,
+                Value* results,
                 Trap::Ptr* out_trap) override;
 
  private:
   friend Store;
   friend Thread;
-  explicit HostFunc(Store&, FuncType, Callback);
+  friend HostCallArgs;
+  explicit HostFunc(Store&, FuncType, ArgsCallback);
   void Mark(Store&) override;
 
-  Callback callback_;
+  ArgsCallback callback_;
+  // The offset of each parameter and result in its part of the stack.
+  std::vector<u32> param_slots_;
+  std::vector<u32> result_slots_;
+  u32 param_slot_count_;
+  u32 result_slot_count_;
 };
 
 class Table : public Extern {
@@ -861,6 +1116,76 @@ class Table : public Extern {
   RefVec elements_;
 };
 
+// The storage of a shared memory. Each Memory belongs to a single Store, so
+// to run threads in parallel on the same memory, each thread has its own Store
+// with its own Memory, and all of those Memories use the same storage. The
+// storage never moves: the largest size the memory can grow to is reserved up
+// front.
+struct SharedMemoryStorage {
+  explicit SharedMemoryStorage(MemoryType type) : type(type) {}
+  SharedMemoryStorage(const SharedMemoryStorage&) = delete;
+  SharedMemoryStorage& operator=(const SharedMemoryStorage&) = delete;
+  ~SharedMemoryStorage();
+
+  // A thread blocked in memory.atomic.wait.
+  struct Waiter {
+    std::condition_variable cond;
+    bool notified = false;
+  };
+
+  MemoryType type;
+  u8* data = nullptr;
+  std::atomic<u64> byte_size{0};
+  Buffer buffer;           // Only used if reserved_size is 0.
+  u64 reserved_size = 0;   // See Memory::reserved_size_.
+  std::mutex grow_mutex;
+
+  // The waiters on each address, in the order they started waiting.
+  std::mutex wait_mutex;
+  std::multimap<u64, Waiter*> waiters;
+};
+using SharedMemory = std::shared_ptr<SharedMemoryStorage>;
+
+// The address ranges that a Store keeps reserved for its memories; see
+// Store::Options::memory_pool_size. Every range ("slot") is part of a single
+// reservation.
+class MemoryPool {
+ public:
+  // Returns null if the pool is disabled or can't be reserved.
+  static std::unique_ptr<MemoryPool> New(const Store::Options&);
+
+  MemoryPool(const MemoryPool&) = delete;
+  MemoryPool& operator=(const MemoryPool&) = delete;
+  ~MemoryPool();
+
+  u64 slot_size() const { return slot_size_; }
+  bool guarded() const { return guarded_; }
+  u32 free_slot_count() const { return free_slots_.size(); }
+
+  // Returns a slot whose first `byte_size` bytes are zero and accessible, and
+  // the rest inaccessible, or null if there are no free slots.
+  u8* Acquire(u64 byte_size);
+  // Returns a slot to the pool. `used_size` bytes at the start were
+  // accessible; `mapped_image` is set if a snapshot image was mapped over
+  // them (see Memory::RestoreImage).
+  void Release(u8* data, u64 used_size, bool mapped_image);
+
+ private:
+  struct Slot {
+    u8* data;
+    u64 accessible_size;
+  };
+
+  MemoryPool(u8* base, u32 slot_count, u64 slot_size, bool guarded);
+
+  u8* base_;
+  u32 slot_count_;
+  u64 slot_size_;
+  bool guarded_;
+  // The most recently released slot is reused first.
+  std::vector<Slot> free_slots_;
+};
+
 class Memory : public Extern {
  public:
   static bool classof(const Object* obj);
@@ -869,6 +1194,9 @@ class Memory : public Extern {
   using Ptr = RefPtr<Memory>;
 
   static Memory::Ptr New(Store&, MemoryType);
+  // Returns a Memory that uses the same storage as a shared memory created in
+  // another Store; see shared().
+  static Memory::Ptr New(Store&, SharedMemory);
 
   Result Match(Store&, const ImportType&, Trap::Ptr* out_trap) override;
 
@@ -880,6 +1208,7 @@ class Memory : public Extern {
   template <typename T>
   Result WABT_VECTORCALL Store(u64 offset, u64 addend, T);
   Result Grow(u64 pages);
+  Result Grow(u64 pages, u64* out_old_pages);
   Result Fill(u64 offset, u8 value, u64 size);
   Result Init(u64 dst_offset, const DataSegment&, u64 src_offset, u64 size);
   static Result Copy(Memory& dst,
@@ -888,7 +1217,6 @@ class Memory : public Extern {
                      u64 src_offset,
                      u64 size);
 
-  // Fake atomics; just checks alignment.
   template <typename T>
   Result AtomicLoad(u64 offset, u64 addend, T* out) const;
   template <typename T>
@@ -898,6 +1226,31 @@ class Memory : public Extern {
   template <typename T>
   Result AtomicRmwCmpxchg(u64 offset, u64 addend, T expect, T replace, T* out);
 
+  // memory.atomic.wait32 and memory.atomic.wait64. `out` is set to 0 if the
+  // thread was woken by AtomicNotify, 1 if the value at the address is not
+  // `expect`, or 2 if `timeout` nanoseconds passed first. A negative timeout
+  // waits forever. Fails if the memory is not shared.
+  //
+  // If `interrupt` is given, it is polled while waiting, and once it is set
+  // the wait ends early with `out` set to kWaitInterrupted, which is not a
+  // result wasm can see.
+  static const u32 kWaitInterrupted = 3;
+  Result AtomicWait(u64 offset,
+                    u64 addend,
+                    u32 expect,
+                    s64 timeout,
+                    u32* out,
+                    const std::atomic<bool>* interrupt = nullptr);
+  Result AtomicWait(u64 offset,
+                    u64 addend,
+                    u64 expect,
+                    s64 timeout,
+                    u32* out,
+                    const std::atomic<bool>* interrupt = nullptr);
+  // memory.atomic.notify. Wakes up to `count` waiters on the address, and sets
+  // `out` to the number woken.
+  Result AtomicNotify(u64 offset, u64 addend, u32 count, u32* out);
+
   u64 ByteSize() const;
   u64 PageSize() const;
 
@@ -908,15 +1261,65 @@ class Memory : public Extern {
 
   const ExternType& extern_type() override;
   const MemoryType& type() const;
+  bool has_guard_pages() const;
+  // The storage of a shared memory, or null if the memory is not shared.
+  const SharedMemory& shared() const;
+
+  ~Memory() override;
 
  private:
   friend class Store;
+  friend class Thread;
+  friend InstanceSnapshot;
   explicit Memory(class Store&, MemoryType);
+  explicit Memory(class Store&, SharedMemory);
   void Mark(class Store&) override;
+  bool AcquirePoolSlot(class Store&);
+  bool ReserveGuardedRange();
+  void AllocateShared(class Store&);
+  // Updates the size of a shared memory, which another thread may have grown.
+  void SyncSharedSize();
+
+  template <typename T>
+  std::atomic<T>* AtomicAddress(u64 offset, u64 addend) const;
+  template <typename T>
+  Result AtomicWaitImpl(u64 offset,
+                        u64 addend,
+                        T expect,
+                        s64 timeout,
+                        u32*,
+                        const std::atomic<bool>* interrupt);
+
+  // Saves the contents of the memory for a snapshot, either to `out_data` or
+  // to a file returned in `out_fd`. A file is used for memories with guard
+  // pages, so RestoreImage can map it copy-on-write instead of copying it.
+  void SaveImage(Buffer* out_data, int* out_fd) const;
+  void RestoreImage(const Buffer& data, int fd);
+
+  // Load/Store without a bounds check, for memories with guard pages. An out
+  // of bounds access faults, so these may only be used by a running Thread,
+  // which turns the fault into a trap.
+  template <typename T>
+  T WABT_VECTORCALL GuardedLoad(u64 offset, u64 addend) const;
+  template <typename T>
+  void WABT_VECTORCALL GuardedStore(u64 offset, u64 addend, T);
 
   MemoryType type_;
-  Buffer data_;
+  u8* data_ = nullptr;
+  u64 byte_size_ = 0;
   u64 pages_;
+  // Backing storage for memories without guard pages.
+  Buffer buffer_;
+  // Size of the address range reserved at data_, or 0 if the memory doesn't
+  // use guard pages or a pool slot.
+  u64 reserved_size_ = 0;
+  // The pool that the range at data_ belongs to, if any.
+  MemoryPool* pool_ = nullptr;
+  // Set if RestoreImage mapped a snapshot image over the range.
+  bool mapped_image_ = false;
+  // For shared memories, the storage at data_. byte_size_ and pages_ may be
+  // smaller than its size, if another thread has grown it since.
+  SharedMemory shared_;
 };
 
 class Global : public Extern {
@@ -939,7 +1342,7 @@ class Global : public Extern {
 
   template <typename T>
   T WABT_VECTORCALL UnsafeGet() const;
-  void UnsafeSet(Value);
+  void UnsafeSet(Store&, Value);
 
   const ExternType& extern_type() override;
   const GlobalType& type() const;
@@ -1017,20 +1420,43 @@ class Module : public Object {
   using Ptr = RefPtr<Module>;
 
   static Module::Ptr New(Store&, ModuleDesc);
+  // Creates a Module that refers to `desc` instead of copying it.
+  static Module::Ptr New(Store&, SharedModuleDesc desc);
 
   const ModuleDesc& desc() const;
+  const SharedModuleDesc& shared_desc() const;
   const std::vector<ImportType>& import_types() const;
   const std::vector<ExportType>& export_types() const;
 
+  // Compiles one of this module's functions, if it was read with
+  // CompileOptions::lazy and hasn't been compiled yet.
+  Result CompileFunc(const FuncDesc&, std::string* out_message);
+
  private:
   friend Store;
   friend Instance;
-  explicit Module(Store&, ModuleDesc);
+  friend Thread;
+
+  // JIT state of one of the module's functions; see Store::Options::jit.
+  struct JitFunc {
+    u32 count = 0;  // Instructions interpreted before it was compiled.
+    bool compiled = false;
+    std::unique_ptr<JitCode> code;  // Null if it couldn't be compiled.
+  };
+
+  explicit Module(Store&, SharedModuleDesc);
   void Mark(Store&) override;
+  JitFunc& GetJitFunc(const FuncDesc&);
+  // Null until a Thread decodes it; see Store::Options::threaded.
+  std::unique_ptr<ThreadedCode>& GetThreadedCode(const FuncDesc&);
 
-  ModuleDesc desc_;
+  SharedModuleDesc desc_;
   std::vector<ImportType> import_types_;
   std::vector<ExportType> export_types_;
+  // Per Module rather than in the ModuleDesc, since a Store is only used by
+  // one OS thread at a time.
+  std::vector<JitFunc> jit_funcs_;
+  std::vector<std::unique_ptr<ThreadedCode>> threaded_funcs_;
 };
 
 class Instance : public Object {
@@ -1058,14 +1484,29 @@ class Instance : public Object {
   const std::vector<DataSegment>& datas() const;
   std::vector<DataSegment>& datas();
 
+  // Unrooted access to the objects in funcs(), tables(), memories() and
+  // globals(), for use by the interpreter. They are kept alive by the instance
+  // itself, which is reachable from any thread executing its code.
+  Func* func_ptr(Index) const;
+  Table* table_ptr(Index) const;
+  Memory* memory_ptr(Index) const;
+  Global* global_ptr(Index) const;
+
+  // The canonical id of the module's function type at the given index.
+  Index func_type_id(Index) const;
+
  private:
   friend Store;
   friend ElemSegment;
   friend DataSegment;
+  friend InstanceSnapshot;
   explicit Instance(Store&, Ref module);
   void Mark(Store&) override;
 
+  void AddImport(ExternKind, Ref);
   Value ResolveInitExpr(Store&, InitExpr);
+  void ResolvePtrs(Store&);
+  void ResolveExports(const ModuleDesc&);
 
   Ref module_;
   RefVec imports_;
@@ -1077,6 +1518,75 @@ class Instance : public Object {
   RefVec exports_;
   std::vector<ElemSegment> elems_;
   std::vector<DataSegment> datas_;
+
+  std::vector<Func*> func_ptrs_;
+  std::vector<Table*> table_ptrs_;
+  std::vector<Memory*> memory_ptrs_;
+  std::vector<Global*> global_ptrs_;
+  std::vector<Index> func_type_ids_;
+};
+
+// The state of an instance at some point after it was instantiated: the
+// contents of its memories, tables and globals, and which of its segments have
+// been dropped. Instantiating the snapshot creates a new instance of the same
+// module in that state, without running the segment initializers or the start
+// function again. Memories with guard pages are mapped copy-on-write from the
+// snapshot, so their contents are only copied when they are written.
+//
+// The new instance uses the same imports as the original. An instance that
+// imports a memory, a table or a mutable global can't be snapshotted, since
+// its state isn't owned by the instance.
+class InstanceSnapshot : public Object {
+ public:
+  static bool classof(const Object* obj);
+  static const ObjectKind skind = ObjectKind::InstanceSnapshot;
+  static const char* GetTypeName() { return "InstanceSnapshot"; }
+  using Ptr = RefPtr<InstanceSnapshot>;
+
+  static InstanceSnapshot::Ptr New(Store&, Ref instance, Trap::Ptr* out_trap);
+
+  Instance::Ptr Instantiate(Store&) const;
+
+  Ref module() const;
+
+  ~InstanceSnapshot() override;
+
+ private:
+  friend Store;
+  explicit InstanceSnapshot(Store&, Ref module);
+  void Mark(Store&) override;
+
+  // A reference to one of the instance's functions is saved as its index, so
+  // the new instance refers to its own function instead.
+  struct SavedRef {
+    Ref ref;
+    Index func_index;
+  };
+
+  struct TableImage {
+    TableType type;
+    std::vector<SavedRef> elements;
+  };
+
+  struct MemoryImage {
+    MemoryType type;
+    Buffer data;
+    int fd;
+  };
+
+  struct GlobalImage {
+    GlobalType type;
+    Value value;
+    SavedRef ref;  // Only used if the global has a reference type.
+  };
+
+  Ref module_;
+  RefVec imports_;
+  std::vector<TableImage> tables_;
+  std::vector<MemoryImage> memories_;
+  std::vector<GlobalImage> globals_;  // Only the globals the module defines.
+  std::vector<bool> elem_dropped_;
+  std::vector<bool> data_dropped_;
 };
 
 enum class RunResult {
@@ -1084,6 +1594,9 @@ enum class RunResult {
   Return,
   Trap,
   Exception,
+  OutOfFuel,    // See Thread::Options::fuel.
+  Interrupted,  // See Thread::Options::interrupt.
+  Suspended,    // See Thread::Suspend.
 };
 
 // TODO: Kinda weird to have a thread as an object, but it makes reference
@@ -1096,12 +1609,30 @@ class Thread : public Object {
   using Ptr = RefPtr<Thread>;
 
   struct Options {
-    static const u32 kDefaultValueStackSize = 64 * 1024 / sizeof(Value);
+    static const u32 kDefaultValueStackSize = 64 * 1024 / sizeof(StackSlot);
     static const u32 kDefaultCallStackSize = 64 * 1024 / sizeof(Frame);
 
     u32 value_stack_size = kDefaultValueStackSize;
     u32 call_stack_size = kDefaultCallStackSize;
     Stream* trace_stream = nullptr;
+    Profiler* profiler = nullptr;
+
+    // Only limits code compiled with CompileOptions::fuel_metering. When a
+    // consume_fuel instruction costs more than is left, Run returns
+    // RunResult::OutOfFuel without running it, and Func::Call traps. Run can
+    // continue after set_fuel.
+    u64 fuel = std::numeric_limits<u64>::max();
+
+    // Run returns RunResult::Interrupted if this is set, and Func::Call traps.
+    // It is checked about every thousand instructions, and while blocked in
+    // memory.atomic.wait, so another thread or a signal handler can set it to
+    // stop a guest that runs for too long.
+    const std::atomic<bool>* interrupt = nullptr;
+
+    // Run v128 instructions with the host's vector instructions where there
+    // is a kernel for them (see SimdKernels). The results are the same either
+    // way, so this is only turned off to compare the two.
+    bool native_simd = true;
   };
 
   static Thread::Ptr New(Store&, const Options&);
@@ -1110,40 +1641,83 @@ class Thread : public Object {
   RunResult Run(int num_instructions, Trap::Ptr* out_trap);
   RunResult Step(Trap::Ptr* out_trap);
 
+  // Asynchronous calls. BeginCall clears the thread's stacks and pushes a
+  // call to `func`; Run then runs it until it returns (RunResult::Return),
+  // traps, or is suspended by a host function. Once it has returned, EndCall
+  // pops its results.
+  RunResult BeginCall(const DefinedFunc& func,
+                      const Values& params,
+                      Trap::Ptr* out_trap);
+  void EndCall(Values* out_results);
+
+  // Called by a HostFunc callback, which then returns Result::Ok without
+  // setting its results, to park the thread in the middle of the host call:
+  // Run returns RunResult::Suspended, and the thread's state stays as it is
+  // until Resume finishes the call with its results. The host can meanwhile
+  // run other threads, and resume this one once the results are ready, e.g.
+  // when the I/O that the call waits for completes.
+  //
+  // Fails if the call can't be suspended, because it isn't part of a call
+  // started with BeginCall, or another host function is below it on the
+  // stack; the callback must then finish the call synchronously.
+  Result Suspend();
+  bool is_suspended() const { return suspended_; }
+  // Sets the results of the suspended host call, one per result of the host
+  // function, and returns to its caller. Returns RunResult::Ok if Run should
+  // continue the call started with BeginCall, or RunResult::Return if the
+  // host function was the last one on the stack.
+  RunResult Resume(const Values& results);
+
   Store& store();
+  u64 fuel() const;
+  void set_fuel(u64);
 
   Instance* GetCallerInstance();
 
  private:
   friend Store;
   friend DefinedFunc;
+  friend HostFunc;
 
   struct TraceSource;
+  struct GuardPageScope;
 
   explicit Thread(Store&, const Options&);
+  // Makes a Thread created with the default options ready for another call;
+  // see Store::ReleaseThread.
+  void Reset();
   void Mark(Store&) override;
+  void MarkValues(Store&, const Frame&, bool is_top_frame);
 
+  RunResult CompileFunc(const DefinedFunc&, Trap::Ptr* out_trap);
   RunResult PushCall(Ref func, u32 offset, Trap::Ptr* out_trap);
   RunResult PushCall(const DefinedFunc&, Trap::Ptr* out_trap);
   RunResult PushCall(const HostFunc&, Trap::Ptr* out_trap);
   RunResult PopCall();
-  RunResult DoCall(const Func::Ptr&, Trap::Ptr* out_trap);
-  RunResult DoReturnCall(const Func::Ptr&, Trap::Ptr* out_trap);
+  RunResult DoCall(Func*, Trap::Ptr* out_trap);
+  RunResult DoReturnCall(Func*, Trap::Ptr* out_trap);
+
+  RunResult CallHost(const HostFunc&, Trap::Ptr* out_trap);
+  // Replaces a host call's parameters with its results, and pops its frame.
+  void FinishHostCall(const HostFunc&, u32 params, u32 results);
 
   void PushValues(const ValueTypes&, const Values&);
   void PopValues(const ValueTypes&, Values*);
+  void PushValues(const ValueTypes&, const Value*);
+  void PopValues(const ValueTypes&, Value*);
+  void PushValue(ValueType, Value);
+  Value PopValue(ValueType);
 
-  Value& Pick(Index);
+  StackSlot& Pick(Index);
 
   template <typename T>
   T WABT_VECTORCALL Pop();
-  Value Pop();
-  u64 PopPtr(const Memory::Ptr& memory);
+  void DropSlots(Index count);
+  u64 PopPtr(const Memory* memory);
 
   template <typename T>
   void WABT_VECTORCALL Push(T);
-  void Push(Value);
-  void Push(Ref);
+  void PushSlot(StackSlot);
 
   template <typename R, typename T>
   using UnopFunc = R WABT_VECTORCALL(T);
@@ -1196,20 +1770,28 @@ class Thread : public Object {
   template <typename R, typename T>
   RunResult DoSimdReplace(Instr);
 
+  // The instructions that can have a SimdKernels entry take their opcode, and
+  // only run lane by lane when the entry is null.
+  RunResult DoSimdKernel(SimdKernels::Unop);
+  RunResult DoSimdKernel(SimdKernels::Binop);
+  RunResult DoSimdKernel(SimdKernels::Ternop);
+  RunResult DoSimdKernel(SimdKernels::Shift);
+  RunResult DoSimdKernel(SimdKernels::Test);
+
   template <typename R, typename T>
-  RunResult DoSimdUnop(UnopFunc<R, T>);
+  RunResult DoSimdUnop(Opcode, UnopFunc<R, T>);
   // Like DoSimdUnop but zeroes top half.
   template <typename R, typename T>
-  RunResult DoSimdUnopZero(UnopFunc<R, T>);
+  RunResult DoSimdUnopZero(Opcode, UnopFunc<R, T>);
   template <typename R, typename T>
-  RunResult DoSimdBinop(BinopFunc<R, T>);
-  RunResult DoSimdBitSelect();
+  RunResult DoSimdBinop(Opcode, BinopFunc<R, T>);
+  RunResult DoSimdBitSelect(Opcode);
   template <typename S, u8 count>
-  RunResult DoSimdIsTrue();
+  RunResult DoSimdIsTrue(Opcode);
   template <typename S>
-  RunResult DoSimdBitmask();
+  RunResult DoSimdBitmask(Opcode);
   template <typename R, typename T>
-  RunResult DoSimdShift(BinopFunc<R, T>);
+  RunResult DoSimdShift(Opcode, BinopFunc<R, T>);
   template <typename S>
   RunResult DoSimdLoadSplat(Instr, Trap::Ptr* out_trap);
   template <typename S>
@@ -1218,20 +1800,20 @@ class Thread : public Object {
   RunResult DoSimdStoreLane(Instr, Trap::Ptr* out_trap);
   template <typename S, typename T>
   RunResult DoSimdLoadZero(Instr, Trap::Ptr* out_trap);
-  RunResult DoSimdSwizzle();
+  RunResult DoSimdSwizzle(Opcode);
   RunResult DoSimdShuffle(Instr);
   template <typename S, typename T>
-  RunResult DoSimdNarrow();
+  RunResult DoSimdNarrow(Opcode);
   template <typename S, typename T, bool low>
-  RunResult DoSimdConvert();
+  RunResult DoSimdConvert(Opcode);
   template <typename S, typename T>
-  RunResult DoSimdDot();
+  RunResult DoSimdDot(Opcode);
   template <typename S, typename T>
   RunResult DoSimdLoadExtend(Instr, Trap::Ptr* out_trap);
   template <typename S, typename T>
-  RunResult DoSimdExtaddPairwise();
+  RunResult DoSimdExtaddPairwise(Opcode);
   template <typename S, typename T, bool low>
-  RunResult DoSimdExtmul();
+  RunResult DoSimdExtmul(Opcode);
 
   template <typename T, typename V = T>
   RunResult DoAtomicLoad(Instr, Trap::Ptr* out_trap);
@@ -1241,14 +1823,37 @@ class Thread : public Object {
   RunResult DoAtomicRmw(BinopFunc<T, T>, Instr, Trap::Ptr* out_trap);
   template <typename T, typename V = T>
   RunResult DoAtomicRmwCmpxchg(Instr, Trap::Ptr* out_trap);
+  template <typename T>
+  RunResult DoAtomicWait(Instr, Trap::Ptr* out_trap);
+  RunResult DoAtomicNotify(Instr, Trap::Ptr* out_trap);
 
   RunResult DoThrow(Exception::Ptr exn_ref);
 
+  RunResult RunInstructions(int num_instructions, Trap::Ptr* out_trap);
+  RunResult StepInstructions(int num_instructions, Trap::Ptr* out_trap);
+  RunResult TraceAndStepInternal(Trap::Ptr* out_trap);
   RunResult StepInternal(Trap::Ptr* out_trap);
 
+  // Guard pages (see Store::Options). The handler is installed once per
+  // process; while a Thread runs, it turns faults in the guard region of one
+  // of the current instance's memories into traps.
+  static bool InstallGuardPageHandler();
+  RunResult RunWithGuardPages(int num_instructions, Trap::Ptr* out_trap);
+  bool IsGuardPageFault(const void* addr) const;
+
+  // JIT tier (see Store::Options::jit). Like StepInstructions, but enters a
+  // function's machine code where it has some for the current instruction,
+  // and only steps the instructions that the code exits before.
+  RunResult JitInstructions(int num_instructions, Trap::Ptr* out_trap);
+  // Returns false if the code used up its loop budget.
+  bool RunJit(const JitCode&, const void* entry);
+
+  // Threaded mode (see Store::Options::threaded). Like StepInstructions, but
+  // runs the instructions of each function's ThreadedCode.
+  RunResult ThreadedInstructions(int num_instructions, Trap::Ptr* out_trap);
+
   std::vector<Frame> frames_;
-  std::vector<Value> values_;
-  std::vector<u32> refs_;  // Index into values_.
+  std::vector<StackSlot> values_;
 
   // Exception handling requires tracking a separate stack of caught
   // exceptions for catch blocks.
@@ -1262,6 +1867,30 @@ class Thread : public Object {
   // Tracing.
   Stream* trace_stream_;
   std::unique_ptr<TraceSource> trace_source_;
+
+  // Profiling.
+  Profiler* profiler_;
+  u32 sample_countdown_ = 0;  // Instructions until the next sample.
+
+  u64 fuel_;
+  const std::atomic<bool>* interrupt_;
+
+  const SimdKernels* simd_kernels_;
+
+  bool jit_;
+  // The top frame's function when JitInstructions last looked it up.
+  Ref jit_func_ref_ = Ref::Null;
+  Module::JitFunc* jit_func_ = nullptr;
+
+  bool threaded_;
+
+  // Suspension (see Suspend). The function that BeginCall called, or null if
+  // the thread isn't running an asynchronous call.
+  Ref async_func_ = Ref::Null;
+  // The number of host callbacks on the native stack.
+  u32 host_calls_ = 0;
+  bool suspend_requested_ = false;
+  bool suspended_ = false;
 };
 
 struct Thread::TraceSource : Istream::TraceSource {
@@ -1271,6 +1900,7 @@ struct Thread::TraceSource : Istream::TraceSource {
   std::string Pick(Index, Instr) override;
 
  private:
+  ValueType GetOperandType(Index, Instr);
   ValueType GetLocalType(Index);
   ValueType GetGlobalType(Index);
   ValueType GetTableElementType(Index);
@@ -17,13 +17,20 @@
 #include "src/interp/istream.h"
 
 #include <cinttypes>
+#include <type_traits>
 
 namespace wabt {
 namespace interp {
 
+Istream::Istream(const u8* data, Offset size) {
+  data_.reserve(size + kReadPadding);
+  data_.assign(data, data + size);
+  data_.resize(size + kReadPadding);
+}
+
 template <typename T>
 void WABT_VECTORCALL Istream::EmitAt(Offset offset, T val) {
-  u32 new_size = offset + sizeof(T);
+  u32 new_size = offset + sizeof(T) + kReadPadding;
   if (new_size > data_.size()) {
     data_.resize(new_size);
   }
@@ -35,45 +42,96 @@ void WABT_VECTORCALL Istream::EmitInternal(T val) {
   EmitAt(end(), val);
 }
 
+static_assert(Opcode::Invalid <= Istream::kShortFormBit,
+              "Opcodes must not overlap the short form bit");
+
+// Short form immediates are sign-extended, so small negative constants fit
+// too.
+template <typename T>
+static bool FitsShortForm(T val) {
+  return static_cast<T>(static_cast<s8>(val)) == val;
+}
+
+void Istream::EmitOpcode(Opcode::Enum op, bool short_form) {
+  auto serialized = static_cast<SerializedOpcode>(op);
+  if (short_form) {
+    serialized |= kShortFormBit;
+  }
+  EmitInternal(serialized);
+}
+
+template <typename T>
+void WABT_VECTORCALL Istream::EmitImm(T val, bool short_form) {
+  if (short_form) {
+    EmitInternal(static_cast<s8>(val));
+  } else {
+    EmitInternal(val);
+  }
+}
+
 void Istream::Emit(u32 val) {
   EmitInternal(val);
 }
 
 void Istream::Emit(Opcode::Enum op) {
-  EmitInternal(static_cast<SerializedOpcode>(op));
+  EmitOpcode(op, false);
 }
 
 void Istream::Emit(Opcode::Enum op, u8 val) {
-  Emit(op);
+  EmitOpcode(op, false);
   EmitInternal(val);
 }
 
 void Istream::Emit(Opcode::Enum op, u32 val) {
-  Emit(op);
-  EmitInternal(val);
+  bool short_form = FitsShortForm(val);
+  EmitOpcode(op, short_form);
+  EmitImm(val, short_form);
 }
 
 void Istream::Emit(Opcode::Enum op, u64 val) {
-  Emit(op);
-  EmitInternal(val);
+  bool short_form = FitsShortForm(val);
+  EmitOpcode(op, short_form);
+  EmitImm(val, short_form);
 }
 
 void Istream::Emit(Opcode::Enum op, v128 val) {
-  Emit(op);
+  EmitOpcode(op, false);
   EmitInternal(val);
 }
 
 void Istream::Emit(Opcode::Enum op, u32 val1, u32 val2) {
-  Emit(op);
-  EmitInternal(val1);
-  EmitInternal(val2);
+  bool short_form = FitsShortForm(val1) && FitsShortForm(val2);
+  EmitOpcode(op, short_form);
+  EmitImm(val1, short_form);
+  EmitImm(val2, short_form);
 }
 
 void Istream::Emit(Opcode::Enum op, u32 val1, u32 val2, u8 val3) {
-  Emit(op);
+  bool short_form = FitsShortForm(val1) && FitsShortForm(val2);
+  EmitOpcode(op, short_form);
+  EmitImm(val1, short_form);
+  EmitImm(val2, short_form);
+  EmitInternal(val3);
+}
+
+void Istream::Emit(Opcode::Enum op, u32 val1, u32 val2, u32 val3) {
+  bool short_form =
+      FitsShortForm(val1) && FitsShortForm(val2) && FitsShortForm(val3);
+  EmitOpcode(op, short_form);
+  EmitImm(val1, short_form);
+  EmitImm(val2, short_form);
+  EmitImm(val3, short_form);
+}
+
+void Istream::EmitWide(Opcode::Enum op, u32 val) {
+  EmitOpcode(op, false);
+  EmitInternal(val);
+}
+
+void Istream::EmitWide(Opcode::Enum op, u32 val1, u32 val2) {
+  EmitOpcode(op, false);
   EmitInternal(val1);
   EmitInternal(val2);
-  EmitInternal(val3);
 }
 
 void Istream::EmitDropKeep(u32 drop, u32 keep) {
@@ -102,22 +160,80 @@ void Istream::ResolveFixupU32(Offset fixup_offset) {
   EmitAt(fixup_offset, end());
 }
 
+void Istream::ResolveFixupU32(Offset fixup_offset, Offset target) {
+  EmitAt(fixup_offset, target);
+}
+
+void Istream::Append(const Istream& other, const std::vector<Offset>& relocs) {
+  Offset base = end();
+  data_.resize(base);
+  data_.insert(data_.end(), other.data_.begin(), other.data_.end());
+  for (Offset reloc : relocs) {
+    Offset at = base + reloc;
+    u32 value;
+    memcpy(&value, data_.data() + at, sizeof(value));
+    if (value != kInvalidOffset) {
+      EmitAt(at, value + base);
+    }
+  }
+}
+
+void Istream::Rewind(Offset offset) {
+  assert(offset <= end());
+  data_.resize(offset + kReadPadding);
+}
+
 Istream::Offset Istream::end() const {
-  return static_cast<u32>(data_.size());
+  return static_cast<u32>(data_.size() - kReadPadding);
+}
+
+const u8* Istream::data() const {
+  return data_.data();
 }
 
 template <typename T>
 T WABT_VECTORCALL Istream::ReadAt(Offset* offset) const {
-  assert(*offset + sizeof(T) <= data_.size());
+  assert(*offset + sizeof(T) <= end());
   T result;
   memcpy(&result, data_.data() + *offset, sizeof(T));
   *offset += sizeof(T);
   return result;
 }
 
+template <typename T>
+T WABT_VECTORCALL Istream::ReadImmAt(Offset* offset, bool short_form) const {
+  if (short_form) {
+    using Bits = typename std::conditional<sizeof(T) == 8, u64, u32>::type;
+    return Bitcast<T>(static_cast<Bits>(ReadAt<s8>(offset)));
+  }
+  return ReadAt<T>(offset);
+}
+
+// Most immediates are u32s, and whether a given instruction uses the short
+// form is hard to predict, so read a full u32 and sign-extend its first byte
+// with shifts instead of branching. kReadPadding makes it safe to read a u32
+// starting at the last byte.
+template <>
+u32 WABT_VECTORCALL Istream::ReadImmAt<u32>(Offset* offset,
+                                            bool short_form) const {
+  assert(*offset + (short_form ? sizeof(s8) : sizeof(u32)) <= end());
+  u32 wide;
+  memcpy(&wide, data_.data() + *offset, sizeof(wide));
+  u32 shift = short_form * 24;
+#if WABT_BIG_ENDIAN
+  u32 result = static_cast<u32>(static_cast<s32>(wide) >> shift);
+#else
+  u32 result = static_cast<u32>(static_cast<s32>(wide << shift) >> shift);
+#endif
+  *offset += sizeof(u32) - short_form * (sizeof(u32) - sizeof(s8));
+  return result;
+}
+
 Instr Istream::Read(Offset* offset) const {
   Instr instr;
-  instr.op = static_cast<Opcode::Enum>(ReadAt<SerializedOpcode>(offset));
+  auto serialized = ReadAt<SerializedOpcode>(offset);
+  bool short_form = serialized & kShortFormBit;
+  instr.op = static_cast<Opcode::Enum>(serialized & ~kShortFormBit);
 
   switch (instr.op) {
     case Opcode::Drop:
@@ -481,7 +597,7 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::Br:
       // Jump target immediate, 0 operands.
       instr.kind = InstrKind::Imm_Jump_Op_0;
-      instr.imm_u32 = ReadAt<u32>(offset);
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::BrIf:
@@ -489,7 +605,14 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::InterpBrUnless:
       // Jump target immediate, 1 operand.
       instr.kind = InstrKind::Imm_Jump_Op_1;
-      instr.imm_u32 = ReadAt<u32>(offset);
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
+      break;
+
+    case Opcode::InterpI32LtSBrUnless:
+    case Opcode::InterpI32LtUBrUnless:
+      // Jump target immediate, 2 operands.
+      instr.kind = InstrKind::Imm_Jump_Op_2;
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::GlobalGet:
@@ -503,7 +626,7 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::Rethrow:
       // Index immediate, 0 operands.
       instr.kind = InstrKind::Imm_Index_Op_0;
-      instr.imm_u32 = ReadAt<u32>(offset);
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::GlobalSet:
@@ -513,35 +636,59 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::TableGet:
       // Index immediate, 1 operand.
       instr.kind = InstrKind::Imm_Index_Op_1;
-      instr.imm_u32 = ReadAt<u32>(offset);
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::TableSet:
     case Opcode::TableGrow:
       // Index immediate, 2 operands.
       instr.kind = InstrKind::Imm_Index_Op_2;
-      instr.imm_u32 = ReadAt<u32>(offset);
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::MemoryFill:
     case Opcode::TableFill:
       // Index immediate, 3 operands.
       instr.kind = InstrKind::Imm_Index_Op_3;
-      instr.imm_u32 = ReadAt<u32>(offset);
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::Call:
     case Opcode::InterpCallImport:
+    case Opcode::ReturnCall:
       instr.kind = InstrKind::Imm_Index_Op_N;
-      instr.imm_u32 = ReadAt<u32>(offset);
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
+      break;
+
+    case Opcode::InterpLocalGetLocalGet:
+      // Index + index immediates, 0 operands.
+      instr.kind = InstrKind::Imm_Index_Index_Op_0;
+      instr.imm_u32x2.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x2.snd = ReadImmAt<u32>(offset, short_form);
+      break;
+
+    case Opcode::InterpI32LocalAddImm:
+      // Index + index + i32 immediates, 0 operands.
+      instr.kind = InstrKind::Imm_Index_Index_I32_Op_0;
+      instr.imm_u32x3.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x3.snd = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x3.thd = ReadImmAt<u32>(offset, short_form);
+      break;
+
+    case Opcode::InterpLocalGetI32Load:
+      // Memory index + offset + local index immediates, 0 operands.
+      instr.kind = InstrKind::Imm_Index_Offset_Index_Op_0;
+      instr.imm_u32x3.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x3.snd = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x3.thd = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::CallIndirect:
     case Opcode::ReturnCallIndirect:
       // Index immediate, N operands.
       instr.kind = InstrKind::Imm_Index_Index_Op_N;
-      instr.imm_u32x2.fst = ReadAt<u32>(offset);
-      instr.imm_u32x2.snd = ReadAt<u32>(offset);
+      instr.imm_u32x2.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x2.snd = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::MemoryInit:
@@ -550,8 +697,8 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::TableCopy:
       // Index + index immediates, 3 operands.
       instr.kind = InstrKind::Imm_Index_Index_Op_3;
-      instr.imm_u32x2.fst = ReadAt<u32>(offset);
-      instr.imm_u32x2.snd = ReadAt<u32>(offset);
+      instr.imm_u32x2.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x2.snd = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::F32Load:
@@ -590,8 +737,8 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::V128Load64Zero:
       // Index + memory offset immediates, 1 operand.
       instr.kind = InstrKind::Imm_Index_Offset_Op_1;
-      instr.imm_u32x2.fst = ReadAt<u32>(offset);
-      instr.imm_u32x2.snd = ReadAt<u32>(offset);
+      instr.imm_u32x2.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x2.snd = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::MemoryAtomicNotify:
@@ -656,8 +803,8 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::V128Store:
       // Index and memory offset immediates, 2 operands.
       instr.kind = InstrKind::Imm_Index_Offset_Op_2;
-      instr.imm_u32x2.fst = ReadAt<u32>(offset);
-      instr.imm_u32x2.snd = ReadAt<u32>(offset);
+      instr.imm_u32x2.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x2.snd = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::V128Load8Lane:
@@ -670,8 +817,8 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::V128Store64Lane:
       // Index, memory offset, lane index immediates, 2 operands.
       instr.kind = InstrKind::Imm_Index_Offset_Lane_Op_2;
-      instr.imm_u32x2_u8.fst = ReadAt<u32>(offset);
-      instr.imm_u32x2_u8.snd = ReadAt<u32>(offset);
+      instr.imm_u32x2_u8.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x2_u8.snd = ReadImmAt<u32>(offset, short_form);
       instr.imm_u32x2_u8.idx = ReadAt<u8>(offset);
       break;
 
@@ -686,8 +833,8 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::MemoryAtomicWait64:
       // Index and memory offset immediates, 3 operands.
       instr.kind = InstrKind::Imm_Index_Offset_Op_3;
-      instr.imm_u32x2.fst = ReadAt<u32>(offset);
-      instr.imm_u32x2.snd = ReadAt<u32>(offset);
+      instr.imm_u32x2.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x2.snd = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::AtomicFence:
@@ -695,34 +842,41 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::InterpAlloca:
     case Opcode::InterpCatchDrop:
     case Opcode::InterpAdjustFrameForReturnCall:
+    case Opcode::InterpConsumeFuel:
       // i32/f32 immediate, 0 operands.
       instr.kind = InstrKind::Imm_I32_Op_0;
-      instr.imm_u32 = ReadAt<u32>(offset);
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
+      break;
+
+    case Opcode::InterpI32AddImm:
+      // i32 immediate, 1 operand.
+      instr.kind = InstrKind::Imm_I32_Op_1;
+      instr.imm_u32 = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::I64Const:
       // i64 immediate, 0 operands.
       instr.kind = InstrKind::Imm_I64_Op_0;
-      instr.imm_u64 = ReadAt<u64>(offset);
+      instr.imm_u64 = ReadImmAt<u64>(offset, short_form);
       break;
 
     case Opcode::F32Const:
       // f32 immediate, 0 operands.
       instr.kind = InstrKind::Imm_F32_Op_0;
-      instr.imm_f32 = ReadAt<f32>(offset);
+      instr.imm_f32 = ReadImmAt<f32>(offset, short_form);
       break;
 
     case Opcode::F64Const:
       // f64 immediate, 0 operands.
       instr.kind = InstrKind::Imm_F64_Op_0;
-      instr.imm_f64 = ReadAt<f64>(offset);
+      instr.imm_f64 = ReadImmAt<f64>(offset, short_form);
       break;
 
     case Opcode::InterpDropKeep:
       // i32 and i32 immediates, 0 operands.
       instr.kind = InstrKind::Imm_I32_I32_Op_0;
-      instr.imm_u32x2.fst = ReadAt<u32>(offset);
-      instr.imm_u32x2.snd = ReadAt<u32>(offset);
+      instr.imm_u32x2.fst = ReadImmAt<u32>(offset, short_form);
+      instr.imm_u32x2.snd = ReadImmAt<u32>(offset, short_form);
       break;
 
     case Opcode::I8X16ExtractLaneS:
@@ -773,7 +927,6 @@ Instr Istream::Read(Offset* offset) const {
     case Opcode::Invalid:
     case Opcode::Loop:
     case Opcode::Try:
-    case Opcode::ReturnCall:
       // Not used.
       break;
   }
@@ -781,7 +934,7 @@ Instr Istream::Read(Offset* offset) const {
 }
 
 void Istream::Disassemble(Stream* stream) const {
-  Disassemble(stream, 0, data_.size());
+  Disassemble(stream, 0, end());
 }
 
 std::string Istream::DisassemblySource::Header(Offset offset) {
@@ -799,7 +952,7 @@ Istream::Offset Istream::Disassemble(Stream* stream, Offset offset) const {
 
 void Istream::Disassemble(Stream* stream, Offset from, Offset to) const {
   DisassemblySource source;
-  assert(from <= data_.size() && to <= data_.size() && from <= to);
+  assert(from <= end() && to <= end() && from <= to);
 
   Offset pc = from;
   while (pc < to) {
@@ -843,6 +996,12 @@ Istream::Offset Istream::Trace(Stream* stream,
                      source->Pick(1, instr).c_str());
       break;
 
+    case InstrKind::Imm_Jump_Op_2:
+      stream->Writef(" @%u, %s, %s\n", instr.imm_u32,
+                     source->Pick(2, instr).c_str(),
+                     source->Pick(1, instr).c_str());
+      break;
+
     case InstrKind::Imm_Index_Op_0:
       stream->Writef(" $%u\n", instr.imm_u32);
       break;
@@ -868,6 +1027,15 @@ Istream::Offset Istream::Trace(Stream* stream,
       stream->Writef(" $%u\n", instr.imm_u32);  // TODO param/result count?
       break;
 
+    case InstrKind::Imm_Index_Index_Op_0:
+      stream->Writef(" $%u, $%u\n", instr.imm_u32x2.fst, instr.imm_u32x2.snd);
+      break;
+
+    case InstrKind::Imm_Index_Index_I32_Op_0:
+      stream->Writef(" $%u, $%u, %u\n", instr.imm_u32x3.fst,
+                     instr.imm_u32x3.snd, instr.imm_u32x3.thd);
+      break;
+
     case InstrKind::Imm_Index_Index_Op_3:
       stream->Writef(" $%u, $%u, %s, %s, %s\n", instr.imm_u32x2.fst,
                      instr.imm_u32x2.snd, source->Pick(3, instr).c_str(),
@@ -905,10 +1073,20 @@ Istream::Offset Istream::Trace(Stream* stream,
                      instr.imm_u32x2_u8.idx);
       break;
 
+    case InstrKind::Imm_Index_Offset_Index_Op_0:
+      stream->Writef(" $%u:$%u+$%u\n", instr.imm_u32x3.fst,
+                     instr.imm_u32x3.thd, instr.imm_u32x3.snd);
+      break;
+
     case InstrKind::Imm_I32_Op_0:
       stream->Writef(" %u\n", instr.imm_u32);
       break;
 
+    case InstrKind::Imm_I32_Op_1:
+      stream->Writef(" %u, %s\n", instr.imm_u32,
+                     source->Pick(1, instr).c_str());
+      break;
+
     case InstrKind::Imm_I64_Op_0:
       stream->Writef(" %" PRIu64 "\n", instr.imm_u64);
       break;
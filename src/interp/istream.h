@@ -28,7 +28,9 @@
 namespace wabt {
 namespace interp {
 
+using s8 = int8_t;
 using u8 = uint8_t;
+using s32 = int32_t;
 using u16 = uint16_t;
 using u32 = uint32_t;
 using u64 = uint64_t;
@@ -49,18 +51,23 @@ enum class InstrKind {
   Imm_0_Op_3,                  // select
   Imm_Jump_Op_0,               // br
   Imm_Jump_Op_1,               // br_if
+  Imm_Jump_Op_2,               // i32_lt_s_br_unless
   Imm_Index_Op_0,              // global.get
   Imm_Index_Op_1,              // global.set
   Imm_Index_Op_2,              // table.set
   Imm_Index_Op_3,              // memory.fill
   Imm_Index_Op_N,              // call
+  Imm_Index_Index_Op_0,        // local_get_local_get
+  Imm_Index_Index_I32_Op_0,    // i32_local_add_imm
   Imm_Index_Index_Op_3,        // memory.init
   Imm_Index_Index_Op_N,        // call_indirect
   Imm_Index_Offset_Op_1,       // i32.load
   Imm_Index_Offset_Op_2,       // i32.store
   Imm_Index_Offset_Op_3,       // i32.atomic.rmw.cmpxchg
   Imm_Index_Offset_Lane_Op_2,  // v128.load8_lane
+  Imm_Index_Offset_Index_Op_0, // local_get_i32_load
   Imm_I32_Op_0,                // i32.const
+  Imm_I32_Op_1,                // i32_add_imm
   Imm_I64_Op_0,                // i64.const
   Imm_F32_Op_0,                // f32.const
   Imm_F64_Op_0,                // f64.const
@@ -88,24 +95,39 @@ struct Instr {
       u32 fst, snd;
       u8 idx;
     } imm_u32x2_u8;
+    struct {
+      u32 fst, snd, thd;
+    } imm_u32x3;
   };
 };
 
 class Istream {
  public:
-  using SerializedOpcode = u32;  // TODO: change to u16
+  using SerializedOpcode = u16;
   using Offset = u32;
   static const Offset kInvalidOffset = ~0;
+  // An instruction whose u32 and u64 immediates all fit in a sign-extended
+  // byte is emitted in short form: this bit is set in its serialized opcode,
+  // and each of those immediates is stored as a single byte. Jump targets are
+  // emitted separately from their opcode so they can be fixed up later, which
+  // keeps them in long form.
+  static const SerializedOpcode kShortFormBit = 0x8000;
   // Each br_table entry is made up of three instructions:
   //
   //   interp_drop_keep $drop $keep
   //   interp_catch_drop $catches
   //   br $label
   //
-  // Each opcode is a SerializedOpcode, and each immediate is a u32.
+  // Each opcode is a SerializedOpcode, and each immediate is a u32; the
+  // entries are never emitted in short form (see EmitWide).
   static const Offset kBrTableEntrySize =
       sizeof(SerializedOpcode) * 3 + 4 * sizeof(u32);
 
+  Istream() = default;
+  // Creates an istream from the end() bytes at data() of another one, e.g.
+  // when loading a serialized module.
+  Istream(const u8* data, Offset size);
+
   // Emit API.
   void Emit(u32);
   void Emit(Opcode::Enum);
@@ -115,13 +137,29 @@ class Istream {
   void Emit(Opcode::Enum, v128);
   void Emit(Opcode::Enum, u32, u32);
   void Emit(Opcode::Enum, u32, u32, u8);
+  void Emit(Opcode::Enum, u32, u32, u32);
+  // Same as Emit, but never uses the short form, so the size of the
+  // instruction doesn't depend on its immediates.
+  void EmitWide(Opcode::Enum, u32);
+  void EmitWide(Opcode::Enum, u32, u32);
   void EmitDropKeep(u32 drop, u32 keep);
   void EmitCatchDrop(u32 drop);
 
   Offset EmitFixupU32();
   void ResolveFixupU32(Offset);
+  void ResolveFixupU32(Offset, Offset target);
+
+  // Appends another istream. `relocs` are the offsets in `other` of its
+  // offset immediates (branch targets), which are adjusted to point into this
+  // istream. Immediates that are still kInvalidOffset are left alone.
+  void Append(const Istream& other, const std::vector<Offset>& relocs);
+
+  // Discard everything emitted at or after the given offset. Used to replace
+  // a short instruction sequence with a fused superinstruction.
+  void Rewind(Offset);
 
   Offset end() const;
+  const u8* data() const;
 
   // Read API.
   Instr Read(Offset*) const;
@@ -148,6 +186,9 @@ class Istream {
   Offset Trace(Stream*, Offset, TraceSource*) const;
 
  private:
+  void EmitOpcode(Opcode::Enum, bool short_form);
+  template <typename T>
+  void WABT_VECTORCALL EmitImm(T val, bool short_form);
   template <typename T>
   void WABT_VECTORCALL EmitAt(Offset, T val);
   template <typename T>
@@ -155,8 +196,14 @@ class Istream {
 
   template <typename T>
   T WABT_VECTORCALL ReadAt(Offset*) const;
+  template <typename T>
+  T WABT_VECTORCALL ReadImmAt(Offset*, bool short_form) const;
+
+  // data_ always has this many bytes past end(), so that a short form
+  // immediate can be read as if it were a u32.
+  static const Offset kReadPadding = sizeof(u32) - 1;
 
-  Buffer data_;
+  Buffer data_ = Buffer(kReadPadding);
 };
 
 }  // namespace interp
@@ -344,6 +344,13 @@ bool Opcode::IsEnabled(const Features& features) const {
     case Opcode::InterpCallImport:
     case Opcode::InterpData:
     case Opcode::InterpDropKeep:
+    case Opcode::InterpLocalGetLocalGet:
+    case Opcode::InterpI32AddImm:
+    case Opcode::InterpI32LocalAddImm:
+    case Opcode::InterpI32LtSBrUnless:
+    case Opcode::InterpI32LtUBrUnless:
+    case Opcode::InterpLocalGetI32Load:
+    case Opcode::InterpConsumeFuel:
       return false;
 
     default:
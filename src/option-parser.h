@@ -67,6 +67,10 @@ class OptionParser {
   void Parse(int argc, char* argv[]);
   void PrintHelp();
 
+  // Reports an error through the error callback, which exits by default. Can
+  // be used by option callbacks to reject an argument.
+  void WABT_PRINTF_FORMAT(2, 3) Errorf(const char* format, ...);
+
   // Helper functions.
   void AddOption(char short_name,
                  const char* long_name,
@@ -81,7 +85,6 @@ class OptionParser {
 
  private:
   static int Match(const char* s, const std::string& full, bool has_argument);
-  void WABT_PRINTF_FORMAT(2, 3) Errorf(const char* format, ...);
   void HandleArgument(size_t* arg_index, const char* arg_value);
 
   // Print the error and exit(1).
@@ -32,6 +32,27 @@ SharedValidator::SharedValidator(Errors* errors, const ValidateOptions& options)
       [this](const char* msg) { OnTypecheckerError(msg); });
 }
 
+SharedValidator::SharedValidator(const SharedValidator& other, Errors* errors)
+    : SharedValidator(errors, other.options_) {
+  num_types_ = other.num_types_;
+  func_types_ = other.func_types_;
+  struct_types_ = other.struct_types_;
+  array_types_ = other.array_types_;
+  funcs_ = other.funcs_;
+  tables_ = other.tables_;
+  memories_ = other.memories_;
+  globals_ = other.globals_;
+  tags_ = other.tags_;
+  elems_ = other.elems_;
+  starts_ = other.starts_;
+  num_imported_globals_ = other.num_imported_globals_;
+  data_segments_ = other.data_segments_;
+  export_names_ = other.export_names_;
+  declared_funcs_ = other.declared_funcs_;
+  check_declared_funcs_ = other.check_declared_funcs_;
+  module_ended_ = other.module_ended_;
+}
+
 Result WABT_PRINTF_FORMAT(3, 4) SharedValidator::PrintError(const Location& loc,
                                                             const char* format,
                                                             ...) {
@@ -314,6 +335,8 @@ Result SharedValidator::EndModule() {
   for (Var func_var : check_declared_funcs_) {
     result |= CheckDeclaredFunc(func_var);
   }
+  check_declared_funcs_.clear();
+  module_ended_ = true;
   return result;
 }
 
@@ -940,7 +963,11 @@ Result SharedValidator::OnRefFunc(const Location& loc, Var func_var) {
   Result result = CheckInstr(Opcode::RefFunc, loc);
   result |= CheckFuncIndex(func_var);
   if (Succeeded(result)) {
-    check_declared_funcs_.push_back(func_var);
+    if (module_ended_) {
+      result |= CheckDeclaredFunc(func_var);
+    } else {
+      check_declared_funcs_.push_back(func_var);
+    }
     Index func_type = GetFunctionTypeIndex(func_var.index());
     result |= typechecker_.OnRefFuncExpr(func_type);
   }
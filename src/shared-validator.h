@@ -44,10 +44,17 @@ class SharedValidator {
  public:
   WABT_DISALLOW_COPY_AND_ASSIGN(SharedValidator);
   SharedValidator(Errors*, const ValidateOptions& options);
+  // Copies the module-level state of another validator, so that function
+  // bodies can be validated on several threads at once.
+  SharedValidator(const SharedValidator&, Errors*);
 
   // TODO: Move into SharedValidator?
   using Label = TypeChecker::Label;
+  const TypeVector& type_stack() const { return typechecker_.type_stack(); }
   size_t type_stack_size() const { return typechecker_.type_stack_size(); }
+  size_t type_stack_v128_count(size_t begin = 0) const {
+    return typechecker_.type_stack_v128_count(begin);
+  }
   Result GetLabel(Index depth, Label** out_label) {
     return typechecker_.GetLabel(depth, out_label);
   }
@@ -317,6 +324,9 @@ class SharedValidator {
   std::set<std::string> export_names_;  // Used to check for duplicates.
   std::set<Index> declared_funcs_;      // TODO: optimize?
   std::vector<Var> check_declared_funcs_;
+  // Function bodies can still be validated after EndModule, if they were
+  // skipped when the module was read.
+  bool module_ended_ = false;
 };
 
 }  // namespace wabt
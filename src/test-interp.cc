@@ -16,22 +16,36 @@
 
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "src/binary-reader.h"
 #include "src/error-formatter.h"
 
 #include "src/interp/binary-reader-interp.h"
 #include "src/interp/interp.h"
+#include "src/interp/interp-profile.h"
+#include "src/interp/interp-serialize.h"
+
+#if WABT_INTERP_GUARD_PAGES
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 using namespace wabt;
 using namespace wabt::interp;
 
 class InterpTest : public ::testing::Test {
  public:
-  void ReadModule(const std::vector<u8>& data) {
+  void ReadModule(const std::vector<u8>& data,
+                  const CompileOptions& compile_options = CompileOptions()) {
     Errors errors;
     ReadBinaryOptions options;
-    Result result = ReadBinaryInterp("<internal>", data.data(), data.size(),
-                                     options, &errors, &module_desc_);
+    Result result =
+        ReadBinaryInterp("<internal>", data.data(), data.size(), options,
+                         compile_options, &errors, &module_desc_);
     ASSERT_EQ(Result::Ok, result)
         << FormatErrorsToString(errors, Location::Type::Binary);
   }
@@ -140,23 +154,49 @@ TEST_F(InterpTest, Disassemble) {
 
   ExpectBufferStrEq(*buf,
 R"(   0| alloca 1
-   8| i32.const 1
-  16| local.set $2, %[-1]
-  24| local.get $1
-  32| local.get $3
-  40| i32.eqz %[-1]
-  44| br_unless @60, %[-1]
-  52| br @116
-  60| local.get $3
-  68| i32.mul %[-2], %[-1]
-  72| local.set $2, %[-1]
-  80| local.get $2
-  88| i32.const 1
-  96| i32.sub %[-2], %[-1]
- 100| local.set $3, %[-1]
- 108| br @24
- 116| drop_keep $2 $1
- 128| return
+   3| i32.const 1
+   6| local.set $2, %[-1]
+   9| local_get_local_get $1, $3
+  13| br_if @25, %[-1]
+  19| br @44
+  25| local.get $3
+  28| i32.mul %[-2], %[-1]
+  30| local.set $2, %[-1]
+  33| i32_local_add_imm $2, $2, 4294967295
+  38| br @9
+  44| drop_keep $2 $1
+  48| return
+)");
+}
+
+TEST_F(InterpTest, Disassemble_NoFusion) {
+  CompileOptions compile_options;
+  compile_options.fuse_instructions = false;
+  ReadModule(s_fac_module, compile_options);
+
+  MemoryStream stream;
+  module_desc_.istream.Disassemble(&stream);
+  auto buf = stream.ReleaseOutputBuffer();
+
+  ExpectBufferStrEq(*buf,
+R"(   0| alloca 1
+   3| i32.const 1
+   6| local.set $2, %[-1]
+   9| local.get $1
+  12| local.get $3
+  15| i32.eqz %[-1]
+  17| br_unless @29, %[-1]
+  23| br @54
+  29| local.get $3
+  32| i32.mul %[-2], %[-1]
+  34| local.set $2, %[-1]
+  37| local.get $2
+  40| i32.const 1
+  43| i32.sub %[-2], %[-1]
+  45| local.set $3, %[-1]
+  48| br @9
+  54| drop_keep $2 $1
+  58| return
 )");
 }
 
@@ -174,6 +214,367 @@ TEST_F(InterpTest, Fac) {
   EXPECT_EQ(120u, results[0].Get<u32>());
 }
 
+TEST_F(InterpTest, Fac_ReuseThread) {
+  ReadModule(s_fac_module);
+  Instantiate();
+  auto func = GetFuncExport(0);
+
+  Values results;
+  Trap::Ptr trap;
+  ASSERT_EQ(Result::Ok,
+            func->Call(store_, {Value::Make(5)}, results, &trap));
+  auto object_count = store_.object_count();
+
+  // Later calls run on the Thread that the first one left in the Store.
+  Value params[] = {Value::Make(6)};
+  Value result;
+  ASSERT_EQ(Result::Ok, func->Call(store_, params, &result, &trap));
+  EXPECT_EQ(720u, result.Get<u32>());
+  ASSERT_EQ(Result::Ok,
+            func->Call(store_, {Value::Make(4)}, results, &trap));
+  EXPECT_EQ(24u, results[0].Get<u32>());
+  EXPECT_EQ(object_count, store_.object_count());
+
+  store_.Collect();
+  ASSERT_EQ(Result::Ok, func->Call(store_, params, &result, &trap));
+  EXPECT_EQ(720u, result.Get<u32>());
+}
+
+TEST_F(InterpTest, Fac_Serialize) {
+  ReadModule(s_fac_module);
+  std::vector<u8> data;
+  WriteModuleDesc(module_desc_, &data);
+
+  module_desc_ = ModuleDesc();
+  ASSERT_EQ(Result::Ok,
+            ReadModuleDesc(data.data(), data.size(), &module_desc_));
+  EXPECT_EQ(1u, module_desc_.funcs.size());
+  EXPECT_EQ(1u, module_desc_.exports.size());
+
+  Instantiate();
+  auto func = GetFuncExport(0);
+
+  Values results;
+  Trap::Ptr trap;
+  Result result = func->Call(store_, {Value::Make(5)}, results, &trap);
+
+  ASSERT_EQ(Result::Ok, result);
+  EXPECT_EQ(1u, results.size());
+  EXPECT_EQ(120u, results[0].Get<u32>());
+}
+
+TEST_F(InterpTest, Fac_Lazy) {
+  CompileOptions compile_options;
+  compile_options.lazy = true;
+  ReadModule(s_fac_module, compile_options);
+  EXPECT_EQ(u32{Istream::kInvalidOffset}, module_desc_.funcs[0].code_offset);
+  EXPECT_EQ(0u, module_desc_.istream.end());
+
+  Instantiate();
+  auto func = GetFuncExport(0);
+
+  Values results;
+  Trap::Ptr trap;
+  Result result = func->Call(store_, {Value::Make(5)}, results, &trap);
+
+  ASSERT_EQ(Result::Ok, result);
+  EXPECT_EQ(1u, results.size());
+  EXPECT_EQ(120u, results[0].Get<u32>());
+  EXPECT_EQ(0u, mod_->desc().funcs[0].code_offset);
+  EXPECT_NE(0u, mod_->desc().istream.end());
+}
+
+TEST_F(InterpTest, Lazy_InvalidRetry) {
+  // (func (export "f") (result i32) (i32.add (i32.const 1)))
+  std::vector<u8> data = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01,
+      0x60, 0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x05, 0x01,
+      0x01, 0x66, 0x00, 0x00, 0x0a, 0x07, 0x01, 0x05, 0x00, 0x41, 0x01,
+      0x6a, 0x0b,
+  };
+  CompileOptions compile_options;
+  compile_options.lazy = true;
+  ReadModule(data, compile_options);
+  Instantiate();
+  auto func = GetFuncExport(0);
+
+  // Each failed attempt discards the code it emitted.
+  for (int i = 0; i < 2; ++i) {
+    Values results;
+    Trap::Ptr trap;
+    Result result = func->Call(store_, {}, results, &trap);
+    ASSERT_EQ(Result::Error, result);
+    EXPECT_EQ(0u, mod_->desc().istream.end());
+    EXPECT_EQ(u32{Istream::kInvalidOffset}, mod_->desc().funcs[0].code_offset);
+  }
+}
+
+TEST_F(InterpTest, Fac_Fuel) {
+  CompileOptions compile_options;
+  compile_options.fuel_metering = true;
+  ReadModule(s_fac_module, compile_options);
+  Instantiate();
+  auto func = GetFuncExport(0);
+
+  auto get_cost = [&](u32 n) -> u64 {
+    Thread::Ptr thread = Thread::New(store_, Thread::Options());
+    u64 fuel = thread->fuel();
+    Values results;
+    Trap::Ptr trap;
+    EXPECT_EQ(Result::Ok,
+              func->Call(*thread, {Value::Make(n)}, results, &trap));
+    return fuel - thread->fuel();
+  };
+  // Each iteration of the loop costs the same.
+  u64 loop_cost = get_cost(2) - get_cost(1);
+  EXPECT_LT(0u, loop_cost);
+  EXPECT_EQ(get_cost(1) + 4 * loop_cost, get_cost(5));
+
+  Thread::Options options;
+  options.fuel = get_cost(5) - 1;
+  Thread::Ptr thread = Thread::New(store_, options);
+  Values results;
+  Trap::Ptr trap;
+  EXPECT_EQ(Result::Error,
+            func->Call(*thread, {Value::Make(5)}, results, &trap));
+  EXPECT_EQ("out of fuel", trap->message());
+}
+
+TEST_F(InterpTest, Fuel_PerBlock) {
+  // (func (export "f") (param i32) (result i32)
+  //   (loop $l
+  //     (br_if $l (local.tee 0 (i32.sub (local.get 0) (i32.const 1)))))
+  //   nop nop nop nop nop nop nop nop nop nop
+  //   (local.get 0))
+  const std::vector<u8> data = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+      0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x05, 0x01, 0x01,
+      0x66, 0x00, 0x00, 0x0a, 0x1c, 0x01, 0x1a, 0x00, 0x03, 0x40, 0x20, 0x00,
+      0x41, 0x01, 0x6b, 0x22, 0x00, 0x0d, 0x00, 0x0b, 0x01, 0x01, 0x01, 0x01,
+      0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x20, 0x00, 0x0b,
+  };
+  CompileOptions compile_options;
+  compile_options.fuel_metering = true;
+  ReadModule(data, compile_options);
+  Instantiate();
+  auto func = GetFuncExport(0);
+
+  auto get_cost = [&](u32 n) -> u64 {
+    Thread::Ptr thread = Thread::New(store_, Thread::Options());
+    u64 fuel = thread->fuel();
+    Values results;
+    Trap::Ptr trap;
+    EXPECT_EQ(Result::Ok,
+              func->Call(*thread, {Value::Make(n)}, results, &trap));
+    return fuel - thread->fuel();
+  };
+  // An iteration costs the five instructions in the loop body, not the code
+  // after the loop.
+  EXPECT_EQ(5u, get_cost(2) - get_cost(1));
+  EXPECT_EQ(get_cost(1) + 9 * 5, get_cost(10));
+}
+
+TEST_F(InterpTest, Fac_Interrupt) {
+  ReadModule(s_fac_module);
+  Instantiate();
+  auto func = GetFuncExport(0);
+
+  std::atomic<bool> interrupt{true};
+  Thread::Options options;
+  options.interrupt = &interrupt;
+  Thread::Ptr thread = Thread::New(store_, options);
+  Values results;
+  Trap::Ptr trap;
+  EXPECT_EQ(Result::Error,
+            func->Call(*thread, {Value::Make(5)}, results, &trap));
+  EXPECT_EQ("interrupted", trap->message());
+}
+
+TEST_F(InterpTest, Fac_Jit) {
+  ReadModule(s_fac_module);
+
+  // Compile before the first instruction, or only once the loop is hot.
+  for (u32 threshold : {0u, 20u}) {
+    Store::Options options;
+    options.jit = true;
+    options.jit_threshold = threshold;
+    Store store(Features{}, options);
+    auto mod = Module::New(store, module_desc_);
+    Trap::Ptr trap;
+    auto inst = Instance::Instantiate(store, mod.ref(), {}, &trap);
+    ASSERT_TRUE(inst);
+    auto func = store.UnsafeGet<Func>(inst->exports()[0]);
+
+    Values results;
+    ASSERT_EQ(Result::Ok,
+              func->Call(store, {Value::Make(5)}, results, &trap));
+    EXPECT_EQ(120u, results[0].Get<u32>());
+    ASSERT_EQ(Result::Ok,
+              func->Call(store, {Value::Make(12)}, results, &trap));
+    EXPECT_EQ(479001600u, results[0].Get<u32>());
+  }
+}
+
+TEST_F(InterpTest, Fac_Threaded) {
+  CompileOptions compile_options;
+  compile_options.fuel_metering = true;
+  ReadModule(s_fac_module, compile_options);
+
+  auto get_cost = [&](bool threaded, u32 n, u32 expected) -> u64 {
+    Store::Options options;
+    options.threaded = threaded;
+    Store store(Features{}, options);
+    auto mod = Module::New(store, module_desc_);
+    Trap::Ptr trap;
+    auto inst = Instance::Instantiate(store, mod.ref(), {}, &trap);
+    EXPECT_TRUE(inst);
+    auto func = store.UnsafeGet<Func>(inst->exports()[0]);
+
+    Thread::Ptr thread = Thread::New(store, Thread::Options());
+    u64 fuel = thread->fuel();
+    Values results;
+    EXPECT_EQ(Result::Ok,
+              func->Call(*thread, {Value::Make(n)}, results, &trap));
+    EXPECT_EQ(expected, results[0].Get<u32>());
+    return fuel - thread->fuel();
+  };
+  // The same instructions run, and consume the same fuel, as when each is
+  // decoded from the istream.
+  EXPECT_EQ(get_cost(false, 5, 120), get_cost(true, 5, 120));
+  EXPECT_EQ(get_cost(false, 12, 479001600), get_cost(true, 12, 479001600));
+}
+
+TEST_F(InterpTest, Jit_Trap) {
+  // (func (export "div") (param i32 i32) (result i32)
+  //   (i32.div_s (local.get 0) (local.get 1)))
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x07, 0x01, 0x60,
+      0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x07, 0x01,
+      0x03, 0x64, 0x69, 0x76, 0x00, 0x00, 0x0a, 0x09, 0x01, 0x07, 0x00, 0x20,
+      0x00, 0x20, 0x01, 0x6d, 0x0b,
+  });
+
+  Store::Options options;
+  options.jit = true;
+  options.jit_threshold = 0;
+  Store store(Features{}, options);
+  auto mod = Module::New(store, module_desc_);
+  Trap::Ptr trap;
+  auto inst = Instance::Instantiate(store, mod.ref(), {}, &trap);
+  ASSERT_TRUE(inst);
+  auto func = store.UnsafeGet<Func>(inst->exports()[0]);
+
+  Values results;
+  ASSERT_EQ(Result::Ok, func->Call(store, {Value::Make(-7), Value::Make(2)},
+                                   results, &trap));
+  EXPECT_EQ(-3, results[0].Get<s32>());
+
+  // The code exits before the division, and the interpreter traps.
+  ASSERT_EQ(Result::Error, func->Call(store, {Value::Make(1), Value::Make(0)},
+                                      results, &trap));
+  EXPECT_EQ("integer divide by zero", trap->message());
+  ASSERT_EQ(Result::Error,
+            func->Call(store, {Value::Make(INT32_MIN), Value::Make(-1)},
+                       results, &trap));
+  EXPECT_EQ("integer overflow", trap->message());
+}
+
+TEST_F(InterpTest, Fac_SharedModuleDesc) {
+  ReadModule(s_fac_module);
+  auto shared_desc = std::make_shared<ModuleDesc>(std::move(module_desc_));
+
+  // Each thread has its own store, and all of them run the same compiled
+  // module.
+  const int kNumThreads = 4;
+  std::vector<u32> results(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      Store store;
+      auto mod = Module::New(store, shared_desc);
+      EXPECT_EQ(shared_desc.get(), &mod->desc());
+      Trap::Ptr trap;
+      auto inst = Instance::Instantiate(store, mod.ref(), {}, &trap);
+      auto func = store.UnsafeGet<Func>(inst->exports()[0]);
+      Values func_results;
+      EXPECT_EQ(Result::Ok, func->Call(store, {Value::Make(i + 1)},
+                                       func_results, &trap));
+      results[i] = func_results[0].Get<u32>();
+    });
+  }
+  for (auto&& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(std::vector<u32>({1, 2, 6, 24}), results);
+  EXPECT_EQ(1, shared_desc.use_count());
+}
+
+TEST_F(InterpTest, CompileThreads) {
+  // (module
+  //   (import "" "f" (func $f (param i32) (result i32)))
+  //   (func $a (param i32) (result i32)
+  //     (if (result i32) (local.get 0)
+  //       (then (return_call $b (i32.sub (local.get 0) (i32.const 1))))
+  //       (else (i32.const 0))))
+  //   (func $b (param i32) (result i32)
+  //     (block
+  //       (block (br_table 0 1 (local.get 0)))
+  //       (return_call $a (local.get 0)))
+  //     (call $f (local.get 0)))
+  //   (func $c (param externref i32) (result i32)
+  //     (local.get 0)
+  //     (local.set 1 (call $a (local.get 1)))
+  //     (drop)
+  //     (local.get 1)))
+  const std::vector<u8> data = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0c, 0x02, 0x60,
+      0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x6f, 0x7f, 0x01, 0x7f, 0x02, 0x06,
+      0x01, 0x00, 0x01, 0x66, 0x00, 0x00, 0x03, 0x04, 0x03, 0x00, 0x00, 0x01,
+      0x0a, 0x38, 0x03, 0x11, 0x00, 0x20, 0x00, 0x04, 0x7f, 0x20, 0x00, 0x41,
+      0x01, 0x6b, 0x12, 0x02, 0x05, 0x41, 0x00, 0x0b, 0x0b, 0x16, 0x00, 0x02,
+      0x40, 0x02, 0x40, 0x20, 0x00, 0x0e, 0x01, 0x00, 0x01, 0x0b, 0x20, 0x00,
+      0x12, 0x01, 0x0b, 0x20, 0x00, 0x10, 0x00, 0x0b, 0x0d, 0x00, 0x20, 0x00,
+      0x20, 0x01, 0x10, 0x01, 0x21, 0x01, 0x1a, 0x20, 0x01, 0x0b,
+  };
+
+  // Compiling on several threads gives exactly the same module.
+  auto compile = [&](u32 num_threads) {
+    ReadBinaryOptions options;
+    options.features.enable_tail_call();
+    CompileOptions compile_options;
+    compile_options.num_threads = num_threads;
+    Errors errors;
+    ModuleDesc desc;
+    EXPECT_EQ(Result::Ok,
+              ReadBinaryInterp("<internal>", data.data(), data.size(), options,
+                               compile_options, &errors, &desc))
+        << FormatErrorsToString(errors, Location::Type::Binary);
+    std::vector<u8> out_data;
+    WriteModuleDesc(desc, &out_data);
+    return out_data;
+  };
+  std::vector<u8> serial = compile(1);
+  EXPECT_EQ(serial, compile(2));
+  EXPECT_EQ(serial, compile(4));
+}
+
+TEST_F(InterpTest, Serialize_Invalid) {
+  ReadModule(s_fac_module);
+  std::vector<u8> data;
+  WriteModuleDesc(module_desc_, &data);
+
+  ModuleDesc desc;
+  EXPECT_EQ(Result::Error, ReadModuleDesc(data.data(), 0, &desc));
+  EXPECT_EQ(Result::Error, ReadModuleDesc(data.data(), data.size() - 1, &desc));
+  for (size_t i = 0; i < data.size(); i += 7) {
+    std::vector<u8> corrupt = data;
+    corrupt[i] ^= 0x10;
+    EXPECT_EQ(Result::Error,
+              ReadModuleDesc(corrupt.data(), corrupt.size(), &desc));
+  }
+}
+
 TEST_F(InterpTest, Fac_Trace) {
   ReadModule(s_fac_module);
   Instantiate();
@@ -188,39 +589,27 @@ TEST_F(InterpTest, Fac_Trace) {
   auto buf = stream.ReleaseOutputBuffer();
   ExpectBufferStrEq(*buf,
 R"(#0.    0: V:1  | alloca 1
-#0.    8: V:2  | i32.const 1
-#0.   16: V:3  | local.set $2, 1
-#0.   24: V:2  | local.get $1
-#0.   32: V:3  | local.get $3
-#0.   40: V:4  | i32.eqz 2
-#0.   44: V:4  | br_unless @60, 0
-#0.   60: V:3  | local.get $3
-#0.   68: V:4  | i32.mul 1, 2
-#0.   72: V:3  | local.set $2, 2
-#0.   80: V:2  | local.get $2
-#0.   88: V:3  | i32.const 1
-#0.   96: V:4  | i32.sub 2, 1
-#0.  100: V:3  | local.set $3, 1
-#0.  108: V:2  | br @24
-#0.   24: V:2  | local.get $1
-#0.   32: V:3  | local.get $3
-#0.   40: V:4  | i32.eqz 1
-#0.   44: V:4  | br_unless @60, 0
-#0.   60: V:3  | local.get $3
-#0.   68: V:4  | i32.mul 2, 1
-#0.   72: V:3  | local.set $2, 2
-#0.   80: V:2  | local.get $2
-#0.   88: V:3  | i32.const 1
-#0.   96: V:4  | i32.sub 1, 1
-#0.  100: V:3  | local.set $3, 0
-#0.  108: V:2  | br @24
-#0.   24: V:2  | local.get $1
-#0.   32: V:3  | local.get $3
-#0.   40: V:4  | i32.eqz 0
-#0.   44: V:4  | br_unless @60, 1
-#0.   52: V:3  | br @116
-#0.  116: V:3  | drop_keep $2 $1
-#0.  128: V:1  | return
+#0.    3: V:2  | i32.const 1
+#0.    6: V:3  | local.set $2, 1
+#0.    9: V:2  | local_get_local_get $1, $3
+#0.   13: V:4  | br_if @25, 2
+#0.   25: V:3  | local.get $3
+#0.   28: V:4  | i32.mul 1, 2
+#0.   30: V:3  | local.set $2, 2
+#0.   33: V:2  | i32_local_add_imm $2, $2, 4294967295
+#0.   38: V:2  | br @9
+#0.    9: V:2  | local_get_local_get $1, $3
+#0.   13: V:4  | br_if @25, 1
+#0.   25: V:3  | local.get $3
+#0.   28: V:4  | i32.mul 2, 1
+#0.   30: V:3  | local.set $2, 2
+#0.   33: V:2  | i32_local_add_imm $2, $2, 4294967295
+#0.   38: V:2  | br @9
+#0.    9: V:2  | local_get_local_get $1, $3
+#0.   13: V:4  | br_if @25, 0
+#0.   19: V:3  | br @44
+#0.   44: V:3  | drop_keep $2 $1
+#0.   48: V:1  | return
 )");
 }
 
@@ -252,16 +641,16 @@ TEST_F(InterpTest, Local_Trace) {
   auto buf = stream.ReleaseOutputBuffer();
   ExpectBufferStrEq(*buf,
 R"(#0.    0: V:0  | alloca 4
-#0.    8: V:4  | i32.const 0
-#0.   16: V:5  | local.set $5, 0
-#0.   24: V:4  | i64.const 1
-#0.   36: V:5  | local.set $4, 1
-#0.   44: V:4  | f32.const 2
-#0.   52: V:5  | local.set $3, 2
-#0.   60: V:4  | f64.const 3
-#0.   72: V:5  | local.set $2, 3
-#0.   80: V:4  | drop_keep $4 $0
-#0.   92: V:0  | return
+#0.    3: V:4  | i32.const 0
+#0.    6: V:5  | local.set $5, 0
+#0.    9: V:4  | i64.const 1
+#0.   12: V:5  | local.set $4, 1
+#0.   15: V:4  | f32.const 2
+#0.   21: V:5  | local.set $3, 2
+#0.   24: V:4  | f64.const 3
+#0.   34: V:5  | local.set $2, 3
+#0.   37: V:4  | drop_keep $4 $0
+#0.   41: V:0  | return
 )");
 }
 
@@ -376,6 +765,149 @@ TEST_F(InterpTest, HostFunc_PingPong_SameThread) {
   EXPECT_EQ(11u, results[0].Get<u32>());
 }
 
+TEST_F(InterpTest, HostFunc_Args) {
+  // (import "" "f" (func $f (param i32 v128 i64) (result i64 i32)))
+  // (func (export "g") (result i64 i32)
+  //   (call $f (i32.const 1) (v128.const i32x4 2 3 4 5) (i64.const 6)))
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0e, 0x02, 0x60,
+      0x03, 0x7f, 0x7b, 0x7e, 0x02, 0x7e, 0x7f, 0x60, 0x00, 0x02, 0x7e, 0x7f,
+      0x02, 0x06, 0x01, 0x00, 0x01, 0x66, 0x00, 0x00, 0x03, 0x02, 0x01, 0x01,
+      0x07, 0x05, 0x01, 0x01, 0x67, 0x00, 0x01, 0x0a, 0x1c, 0x01, 0x1a, 0x00,
+      0x41, 0x01, 0xfd, 0x0c, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+      0x04, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x42, 0x06, 0x10, 0x00,
+      0x0b,
+  });
+
+  auto host_func = HostFunc::New(
+      store_,
+      FuncType{{ValueType::I32, ValueType::V128, ValueType::I64},
+               {ValueType::I64, ValueType::I32}},
+      [](Thread& thread, HostCallArgs& args, Trap::Ptr* out_trap) -> Result {
+        EXPECT_EQ(3u, args.param_count());
+        EXPECT_EQ(2u, args.result_count());
+        v128 vec = args.param<v128>(1);
+        args.set_result<u64>(0, args.param<u64>(2) * 10);
+        // Parameters can still be read after a result is set.
+        args.set_result<u32>(1, args.param<u32>(0) + vec.u32(0) + vec.u32(3));
+        return Result::Ok;
+      });
+
+  Instantiate({host_func->self()});
+
+  Values results;
+  Trap::Ptr trap;
+  Result result = GetFuncExport(0)->Call(store_, {}, results, &trap);
+
+  ASSERT_EQ(Result::Ok, result);
+  EXPECT_EQ(2u, results.size());
+  EXPECT_EQ(60u, results[0].Get<u64>());
+  EXPECT_EQ(8u, results[1].Get<u32>());
+
+  // Calling the host function directly goes through the same path.
+  result = host_func->Call(store_,
+                           {Value::Make(u32{1}), Value::Make(v128(2, 3, 4, 5)),
+                            Value::Make(u64{7})},
+                           results, &trap);
+  ASSERT_EQ(Result::Ok, result);
+  EXPECT_EQ(70u, results[0].Get<u64>());
+  EXPECT_EQ(8u, results[1].Get<u32>());
+}
+
+TEST_F(InterpTest, HostFunc_Args_PingPong_SameThread) {
+  // (import "" "f" (func $f (param i32 i32) (result i32)))
+  // (func (export "g") (param i32) (result i32)
+  //   (call $f (local.get 0) (i32.add (local.get 0) (i32.const 1))))
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0c, 0x02, 0x60,
+      0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x02, 0x06,
+      0x01, 0x00, 0x01, 0x66, 0x00, 0x00, 0x03, 0x02, 0x01, 0x01, 0x07, 0x05,
+      0x01, 0x01, 0x67, 0x00, 0x01, 0x0a, 0x0d, 0x01, 0x0b, 0x00, 0x20, 0x00,
+      0x20, 0x00, 0x41, 0x01, 0x6a, 0x10, 0x00, 0x0b,
+  });
+
+  // A small value stack, so that it has to grow (and move) while the host
+  // function's arguments are live.
+  Thread::Options options;
+  options.value_stack_size = 4;
+  auto thread = Thread::New(store_, options);
+
+  auto host_func = HostFunc::New(
+      store_, FuncType{{ValueType::I32, ValueType::I32}, {ValueType::I32}},
+      [&](Thread& t, HostCallArgs& args, Trap::Ptr* out_trap) -> Result {
+        u32 val = args.param<u32>(0);
+        if (val == 100) {
+          args.set_result<u32>(0, val);
+          return Result::Ok;
+        }
+        Values results;
+        CHECK_RESULT(GetFuncExport(0)->Call(
+            t, {Value::Make(args.param<u32>(1))}, results, out_trap));
+        args.set_result<u32>(0, results[0].Get<u32>() + args.param<u32>(0));
+        return Result::Ok;
+      });
+
+  Instantiate({host_func->self()});
+
+  // g(0) -> f(0, 1) -> g(1) -> f(1, 2) -> ... -> f(100, 101), which returns
+  // 100; each f on the way back adds its first argument.
+  Values results;
+  Trap::Ptr trap;
+  Result result =
+      GetFuncExport(0)->Call(*thread, {Value::Make(0)}, results, &trap);
+
+  ASSERT_EQ(Result::Ok, result);
+  EXPECT_EQ(1u, results.size());
+  EXPECT_EQ(5050u, results[0].Get<u32>());
+}
+
+TEST_F(InterpTest, HostFunc_PingPong_SameThread_Profile) {
+  // Same module as above.
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+      0x01, 0x7f, 0x01, 0x7f, 0x02, 0x06, 0x01, 0x00, 0x01, 0x66, 0x00, 0x00,
+      0x03, 0x02, 0x01, 0x00, 0x07, 0x05, 0x01, 0x01, 0x67, 0x00, 0x01, 0x0a,
+      0x0b, 0x01, 0x09, 0x00, 0x20, 0x00, 0x41, 0x01, 0x6a, 0x10, 0x00, 0x0b,
+  });
+
+  Profiler profiler(1);
+  Thread::Options options;
+  options.profiler = &profiler;
+  auto thread = Thread::New(store_, options);
+
+  auto host_func =
+      HostFunc::New(store_, FuncType{{ValueType::I32}, {ValueType::I32}},
+                    [&](Thread& t, const Values& params, Values& results,
+                        Trap::Ptr* out_trap) -> Result {
+                      auto val = params[0].Get<u32>();
+                      if (val < 10) {
+                        return GetFuncExport(0)->Call(t, {Value::Make(val * 2)},
+                                                      results, out_trap);
+                      }
+                      results[0] = Value::Make(val);
+                      return Result::Ok;
+                    });
+
+  Instantiate({host_func->self()});
+
+  Values results;
+  Trap::Ptr trap;
+  Result result =
+      GetFuncExport(0)->Call(*thread, {Value::Make(1)}, results, &trap);
+  ASSERT_EQ(Result::Ok, result);
+
+  // Each call to g is attributed to its own stack, with the host function
+  // frames in between.
+  MemoryStream stream;
+  profiler.WriteFoldedStacks(&stream);
+  auto buf = stream.ReleaseOutputBuffer();
+  ExpectBufferStrEq(*buf,
+R"(func[1] 5
+func[1];<host>;func[1] 5
+func[1];<host>;func[1];<host>;func[1] 5
+)");
+}
+
 TEST_F(InterpTest, HostTrap) {
   // (import "host" "a" (func $0))
   // (func $1 call $0)
@@ -403,6 +935,364 @@ TEST_F(InterpTest, HostTrap) {
   ASSERT_EQ("boom", trap->message());
 }
 
+TEST_F(InterpTest, HostFunc_Suspend) {
+  // (import "" "f" (func $f (param i32) (result i32)))
+  // (func (export "g") (param i32) (result i32)
+  //   (i32.add (call $f (local.get 0)) (call $f (i32.const 10))))
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+      0x01, 0x7f, 0x01, 0x7f, 0x02, 0x06, 0x01, 0x00, 0x01, 0x66, 0x00, 0x00,
+      0x03, 0x02, 0x01, 0x00, 0x07, 0x05, 0x01, 0x01, 0x67, 0x00, 0x01, 0x0a,
+      0x0d, 0x01, 0x0b, 0x00, 0x20, 0x00, 0x10, 0x00, 0x41, 0x0a, 0x10, 0x00,
+      0x6a, 0x0b,
+  });
+
+  // $f doubles its parameter. When it can, it parks the calling thread and
+  // queues the work, and the loop below finishes the calls one at a time.
+  std::vector<std::pair<Thread::Ptr, u32>> pending;
+  auto host_func =
+      HostFunc::New(store_, FuncType{{ValueType::I32}, {ValueType::I32}},
+                    [&](Thread& thread, const Values& params, Values& results,
+                        Trap::Ptr* out_trap) -> Result {
+                      if (Succeeded(thread.Suspend())) {
+                        pending.emplace_back(Thread::Ptr(store_, thread.self()),
+                                             params[0].Get<u32>());
+                        return Result::Ok;
+                      }
+                      results[0] = Value::Make(params[0].Get<u32>() * 2);
+                      return Result::Ok;
+                    });
+  Instantiate({host_func->self()});
+  auto func = store_.UnsafeGet<DefinedFunc>(inst_->funcs()[1]);
+
+  // A synchronous call can't be suspended.
+  Values results;
+  Trap::Ptr trap;
+  ASSERT_EQ(Result::Ok, func->Call(store_, {Value::Make(1)}, results, &trap));
+  EXPECT_EQ(22u, results[0].Get<u32>());
+  EXPECT_TRUE(pending.empty());
+
+  const u32 kNumThreads = 3;
+  std::vector<Thread::Ptr> threads;
+  for (u32 i = 0; i < kNumThreads; ++i) {
+    threads.push_back(Thread::New(store_, Thread::Options()));
+    ASSERT_EQ(RunResult::Ok,
+              threads[i]->BeginCall(*func, {Value::Make(i)}, &trap));
+    ASSERT_EQ(RunResult::Suspended, threads[i]->Run(&trap));
+    EXPECT_TRUE(threads[i]->is_suspended());
+  }
+
+  // Every thread is parked at its first call, then at its second.
+  u32 resumed = 0;
+  while (!pending.empty()) {
+    auto work = pending.front();
+    pending.erase(pending.begin());
+    store_.Collect();
+    ASSERT_EQ(RunResult::Ok,
+              work.first->Resume({Value::Make(work.second * 2)}));
+    EXPECT_FALSE(work.first->is_suspended());
+    RunResult result = work.first->Run(&trap);
+    if (++resumed <= kNumThreads) {
+      EXPECT_EQ(RunResult::Suspended, result);
+    } else {
+      EXPECT_EQ(RunResult::Return, result);
+    }
+  }
+  EXPECT_EQ(2 * kNumThreads, resumed);
+
+  for (u32 i = 0; i < kNumThreads; ++i) {
+    threads[i]->EndCall(&results);
+    EXPECT_EQ(i * 2 + 20, results[0].Get<u32>());
+  }
+}
+
+TEST_F(InterpTest, CallIndirect_HostFunc) {
+  // (type $ii (func (param i32) (result i32)))
+  // (import "" "t" (table 2 funcref))
+  // (func (export "call") (param i32) (result i32)
+  //   (call_indirect (type $ii) (i32.const 10) (local.get 0)))
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01,
+      0x60, 0x01, 0x7f, 0x01, 0x7f, 0x02, 0x08, 0x01, 0x00, 0x01, 0x74,
+      0x01, 0x70, 0x00, 0x02, 0x03, 0x02, 0x01, 0x00, 0x07, 0x08, 0x01,
+      0x04, 0x63, 0x61, 0x6c, 0x6c, 0x00, 0x00, 0x0a, 0x0b, 0x01, 0x09,
+      0x00, 0x41, 0x0a, 0x20, 0x00, 0x11, 0x00, 0x00, 0x0b,
+  });
+
+  auto inc = HostFunc::New(
+      store_, FuncType{{ValueType::I32}, {ValueType::I32}},
+      [](Thread& thread, HostCallArgs& args, Trap::Ptr* out_trap) -> Result {
+        args.set_result<u32>(0, args.param<u32>(0) + 1);
+        return Result::Ok;
+      });
+  auto zero = HostFunc::New(
+      store_, FuncType{{}, {ValueType::I32}},
+      [](Thread& thread, HostCallArgs& args, Trap::Ptr* out_trap) -> Result {
+        args.set_result<u32>(0, 0);
+        return Result::Ok;
+      });
+  EXPECT_NE(inc->type_id(), zero->type_id());
+  EXPECT_EQ(inc->type_id(), store_.InternFuncType(FuncType{
+                                {ValueType::I32}, {ValueType::I32}}));
+
+  auto table = Table::New(store_, TableType{ValueType::FuncRef, Limits{2}});
+  ASSERT_EQ(Result::Ok, table->Set(store_, 0, inc->self()));
+  ASSERT_EQ(Result::Ok, table->Set(store_, 1, zero->self()));
+  Instantiate({table->self()});
+
+  Values results;
+  Trap::Ptr trap;
+  ASSERT_EQ(Result::Ok, GetFuncExport(0)->Call(store_, {Value::Make(0)},
+                                               results, &trap));
+  EXPECT_EQ(11u, results[0].Get<u32>());
+
+  results.clear();
+  ASSERT_EQ(Result::Error, GetFuncExport(0)->Call(store_, {Value::Make(1)},
+                                                  results, &trap));
+  EXPECT_EQ("indirect call signature mismatch", trap->message());
+}
+
+TEST_F(InterpTest, InstanceSnapshot) {
+  // (type $t (func (result i32)))
+  // (global $g (mut i32) (i32.const 10))
+  // (memory 1)
+  // (data (i32.const 0) "\01")
+  // (table funcref (elem $get))
+  // (func $get (result i32)
+  //   (i32.add (global.get $g) (i32.load8_u (i32.const 0))))
+  // (func (export "inc") (result i32)
+  //   (global.set $g (i32.add (global.get $g) (i32.const 1)))
+  //   (i32.store8 (i32.const 0)
+  //     (i32.add (i32.load8_u (i32.const 0)) (i32.const 1)))
+  //   (call_indirect (type $t) (i32.const 0)))
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+      0x00, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00, 0x00, 0x04, 0x05, 0x01, 0x70,
+      0x01, 0x01, 0x01, 0x05, 0x03, 0x01, 0x00, 0x01, 0x06, 0x06, 0x01, 0x7f,
+      0x01, 0x41, 0x0a, 0x0b, 0x07, 0x07, 0x01, 0x03, 0x69, 0x6e, 0x63, 0x00,
+      0x01, 0x09, 0x07, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x01, 0x00, 0x0a, 0x28,
+      0x02, 0x0a, 0x00, 0x23, 0x00, 0x41, 0x00, 0x2d, 0x00, 0x00, 0x6a, 0x0b,
+      0x1b, 0x00, 0x23, 0x00, 0x41, 0x01, 0x6a, 0x24, 0x00, 0x41, 0x00, 0x41,
+      0x00, 0x2d, 0x00, 0x00, 0x41, 0x01, 0x6a, 0x3a, 0x00, 0x00, 0x41, 0x00,
+      0x11, 0x00, 0x00, 0x0b, 0x0b, 0x07, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x01,
+      0x01,
+  });
+
+  // With guard pages, memories are restored by mapping the snapshot.
+  for (bool guard_pages : {false, true}) {
+    Store::Options options;
+    options.guard_pages = guard_pages;
+    Store store(Features{}, options);
+    auto mod = Module::New(store, module_desc_);
+    Trap::Ptr trap;
+    auto inst = Instance::Instantiate(store, mod.ref(), {}, &trap);
+    ASSERT_TRUE(inst);
+
+    auto inc = [&](const Instance::Ptr& inst) -> u32 {
+      Values results;
+      auto func = store.UnsafeGet<Func>(inst->exports()[0]);
+      EXPECT_EQ(Result::Ok, func->Call(store, {}, results, &trap));
+      return results[0].Get<u32>();
+    };
+
+    EXPECT_EQ(13u, inc(inst));
+    auto snapshot = InstanceSnapshot::New(store, inst.ref(), &trap);
+    ASSERT_TRUE(snapshot);
+    EXPECT_EQ(15u, inc(inst));
+
+    // Each new instance starts from the snapshot, and doesn't see the changes
+    // made by the others.
+    auto clone1 = snapshot->Instantiate(store);
+    auto clone2 = snapshot->Instantiate(store);
+    EXPECT_EQ(15u, inc(clone1));
+    EXPECT_EQ(17u, inc(clone1));
+    EXPECT_EQ(15u, inc(clone2));
+    EXPECT_EQ(17u, inc(inst));
+
+    // The table refers to the new instance's own function.
+    auto table = store.UnsafeGet<Table>(clone1->tables()[0]);
+    EXPECT_EQ(clone1->funcs()[0], table->elements()[0]);
+  }
+}
+
+TEST_F(InterpTest, InstanceSnapshot_ImportedMemory) {
+  // (import "host" "mem" (memory 1))
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x02, 0x0d, 0x01, 0x04,
+      0x68, 0x6f, 0x73, 0x74, 0x03, 0x6d, 0x65, 0x6d, 0x02, 0x00, 0x01,
+  });
+
+  auto memory = Memory::New(store_, MemoryType{Limits{1}});
+  Instantiate({memory->self()});
+
+  Trap::Ptr trap;
+  EXPECT_FALSE(InstanceSnapshot::New(store_, inst_.ref(), &trap));
+  EXPECT_EQ("can't snapshot an instance that imports a memory: \"host.mem\"",
+            trap->message());
+}
+
+TEST_F(InterpTest, SharedMemory_Threads) {
+  auto memory = Memory::New(store_, MemoryType{Limits{1, 2, true}});
+  ASSERT_TRUE(memory->shared());
+
+  // Each thread has its own store, with a Memory that uses the same storage.
+  // The last thread to finish wakes the main thread.
+  const int kNumThreads = 4;
+  const u32 kNumAdds = 1000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&]() {
+      Store store;
+      auto thread_memory = Memory::New(store, memory->shared());
+      auto add = [](u32 lhs, u32 rhs) { return lhs + rhs; };
+      u32 old;
+      for (u32 j = 0; j < kNumAdds; ++j) {
+        ASSERT_EQ(Result::Ok, thread_memory->AtomicRmw(0, 4, 1u, add, &old));
+      }
+      ASSERT_EQ(Result::Ok, thread_memory->AtomicRmw(0, 0, 1u, add, &old));
+      if (old + 1 == kNumThreads) {
+        ASSERT_EQ(Result::Ok, thread_memory->Grow(1));
+        u32 count;
+        ASSERT_EQ(Result::Ok, thread_memory->AtomicNotify(0, 0, 1, &count));
+      }
+    });
+  }
+
+  u32 done;
+  while (memory->AtomicLoad(0, 0, &done), done != kNumThreads) {
+    u32 result;
+    ASSERT_EQ(Result::Ok, memory->AtomicWait(0, 0, done, -1, &result));
+  }
+  for (auto&& thread : threads) {
+    thread.join();
+  }
+
+  u32 sum;
+  ASSERT_EQ(Result::Ok, memory->AtomicLoad(0, 4, &sum));
+  EXPECT_EQ(kNumThreads * kNumAdds, sum);
+  // The memory grew on another thread.
+  EXPECT_EQ(2u, memory->PageSize());
+  EXPECT_EQ(Result::Ok, memory->Store(WABT_PAGE_SIZE, 0, u32{1}));
+}
+
+TEST_F(InterpTest, SharedMemory_InterruptWait) {
+  auto memory = Memory::New(store_, MemoryType{Limits{1, 1, true}});
+  std::atomic<bool> interrupt{false};
+  std::thread thread([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    interrupt = true;
+  });
+
+  // Nothing notifies the waiter; only the interrupt flag ends the wait.
+  u32 result;
+  ASSERT_EQ(Result::Ok,
+            memory->AtomicWait(0, 0, u32{0}, -1, &result, &interrupt));
+  EXPECT_EQ(Memory::kWaitInterrupted, result);
+  thread.join();
+
+  // A timeout still ends the wait, too.
+  interrupt = false;
+  ASSERT_EQ(Result::Ok,
+            memory->AtomicWait(0, 0, u32{0}, 1000000, &result, &interrupt));
+  EXPECT_EQ(2u, result);
+}
+
+TEST_F(InterpTest, MemoryPool) {
+  for (bool guard_pages : {false, true}) {
+    Store::Options options;
+    options.guard_pages = guard_pages;
+    options.memory_pool_size = 2;
+    options.memory_pool_max_pages = 4;
+    Store store(Features{}, options);
+    MemoryPool* pool = store.memory_pool();
+    if (!pool) {
+      // Pools need WABT_INTERP_GUARD_PAGES.
+      return;
+    }
+
+    auto memory = Memory::New(store, MemoryType{Limits{1}});
+    u8* data = memory->UnsafeData();
+    EXPECT_EQ(1u, pool->free_slot_count());
+    EXPECT_EQ(Result::Ok, memory->Grow(2));
+    EXPECT_EQ(Result::Ok, memory->Store(2 * WABT_PAGE_SIZE, 0, u32{42}));
+    EXPECT_EQ(Result::Ok, memory->Store(0, 0, u32{42}));
+    // Without guard pages, a slot only has room for memory_pool_max_pages.
+    EXPECT_EQ(guard_pages ? Result::Ok : Result::Error, memory->Grow(2));
+
+    // When every slot is in use, memories are allocated as usual.
+    auto other = Memory::New(store, MemoryType{Limits{1}});
+    auto unpooled = Memory::New(store, MemoryType{Limits{1}});
+    EXPECT_EQ(0u, pool->free_slot_count());
+    EXPECT_EQ(Result::Ok, unpooled->Grow(4));
+
+    // The most recently freed slot is reused, and reads as zero.
+    memory.reset();
+    store.Collect();
+    EXPECT_EQ(1u, pool->free_slot_count());
+    memory = Memory::New(store, MemoryType{Limits{1}});
+    EXPECT_EQ(data, memory->UnsafeData());
+    EXPECT_EQ(0u, memory->UnsafeLoad<u32>(0, 0));
+    EXPECT_FALSE(memory->IsValidAccess(WABT_PAGE_SIZE, 0, 4));
+    EXPECT_EQ(Result::Ok, memory->Grow(2));
+    EXPECT_EQ(0u, memory->UnsafeLoad<u32>(2 * WABT_PAGE_SIZE, 0));
+  }
+}
+
+#if WABT_INTERP_GUARD_PAGES
+static u8* s_foreign_page;
+static int s_foreign_fault_count;
+
+static void OnForeignFault(int signum, siginfo_t* info, void* context) {
+  ++s_foreign_fault_count;
+  mprotect(s_foreign_page, getpagesize(), PROT_READ | PROT_WRITE);
+}
+
+TEST(InterpDeathTest, GuardPages_ForeignFault) {
+  // Run in a new process, so the guard page handler is installed after ours.
+  testing::GTEST_FLAG(death_test_style) = "threadsafe";
+  EXPECT_EXIT(
+      {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_flags = SA_SIGINFO;
+        sa.sa_sigaction = OnForeignFault;
+        sigaction(SIGSEGV, &sa, nullptr);
+        sigaction(SIGBUS, &sa, nullptr);
+        Store::Options options;
+        options.guard_pages = true;
+        Store store(Features{}, options);
+
+        // A fault outside of wasm memory goes to our handler, every time.
+        s_foreign_page = static_cast<u8*>(mmap(nullptr, getpagesize(),
+                                               PROT_NONE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS,
+                                               -1, 0));
+        for (int i = 0; i < 2; ++i) {
+          *static_cast<volatile u8*>(s_foreign_page) = 1;
+          mprotect(s_foreign_page, getpagesize(), PROT_NONE);
+        }
+        sigaction(SIGSEGV, nullptr, &sa);
+        exit(s_foreign_fault_count == 2 && sa.sa_sigaction != OnForeignFault
+                 ? 0
+                 : 1);
+      },
+      testing::ExitedWithCode(0), "");
+
+  // Without a previous handler, the fault kills the process.
+  EXPECT_EXIT(
+      {
+        Store::Options options;
+        options.guard_pages = true;
+        Store store(Features{}, options);
+        u8* page = static_cast<u8*>(mmap(nullptr, getpagesize(), PROT_NONE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        *static_cast<volatile u8*>(page) = 1;
+        exit(0);
+      },
+      testing::KilledBySignal(SIGSEGV), "");
+}
+#endif
+
 TEST_F(InterpTest, Rot13) {
   // (import "host" "mem" (memory $mem 1))
   // (import "host" "fill_buf" (func $fill_buf (param i32 i32) (result i32)))
@@ -550,6 +1440,198 @@ TEST_F(InterpTest, Rot13) {
   ASSERT_EQ("Hello, WebAssembly!", string_data);
 }
 
+namespace {
+
+void WriteU32Leb(std::vector<u8>* out, u32 value) {
+  do {
+    u8 byte = value & 0x7f;
+    value >>= 7;
+    out->push_back(value ? byte | 0x80 : byte);
+  } while (value);
+}
+
+void WriteSection(std::vector<u8>* out, u8 id, const std::vector<u8>& data) {
+  out->push_back(id);
+  WriteU32Leb(out, data.size());
+  out->insert(out->end(), data.begin(), data.end());
+}
+
+const u8 kShuffleLanes[16] = {0, 17, 2, 31, 4, 16, 15, 30,
+                              8, 9,  25, 11, 3, 19, 1, 20};
+
+// Builds a module that exports one function for each opcode, which just runs
+// the opcode on its parameters.
+std::vector<u8> MakeOpcodeModule(const std::vector<Opcode>& opcodes) {
+  auto type_byte = [](Type type) { return static_cast<u8>(type) & 0x7f; };
+  std::vector<u8> types, funcs, exports, code;
+  WriteU32Leb(&types, opcodes.size());
+  WriteU32Leb(&funcs, opcodes.size());
+  WriteU32Leb(&exports, opcodes.size());
+  WriteU32Leb(&code, opcodes.size());
+  for (u32 i = 0; i < opcodes.size(); ++i) {
+    Opcode op = opcodes[i];
+    std::vector<u8> body = {0};  // No locals.
+    types.push_back(0x60);
+    u32 num_params = 0;
+    while (num_params < 3 &&
+           op.GetParamType(num_params + 1) != Type::Void) {
+      ++num_params;
+    }
+    WriteU32Leb(&types, num_params);
+    for (u32 j = 0; j < num_params; ++j) {
+      types.push_back(type_byte(op.GetParamType(j + 1)));
+      body.push_back(0x20);  // local.get
+      body.push_back(j);
+    }
+    types.push_back(1);
+    types.push_back(type_byte(op.GetResultType()));
+    for (u8 byte : op.GetBytes()) {
+      body.push_back(byte);
+    }
+    if (op == Opcode::I8X16Shuffle) {
+      body.insert(body.end(), std::begin(kShuffleLanes),
+                  std::end(kShuffleLanes));
+    }
+    body.push_back(0x0b);  // end
+
+    WriteU32Leb(&funcs, i);
+    std::string name = std::to_string(i);
+    WriteU32Leb(&exports, name.size());
+    exports.insert(exports.end(), name.begin(), name.end());
+    exports.push_back(0);  // func
+    WriteU32Leb(&exports, i);
+    WriteU32Leb(&code, body.size());
+    code.insert(code.end(), body.begin(), body.end());
+  }
+
+  std::vector<u8> module = {0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00};
+  WriteSection(&module, 1, types);
+  WriteSection(&module, 3, funcs);
+  WriteSection(&module, 7, exports);
+  WriteSection(&module, 10, code);
+  return module;
+}
+
+v128 MakeF32x4(f32 a, f32 b, f32 c, f32 d) {
+  return v128(Bitcast<u32>(a), Bitcast<u32>(b), Bitcast<u32>(c),
+              Bitcast<u32>(d));
+}
+
+v128 MakeF64x2(f64 a, f64 b) {
+  u64 x = Bitcast<u64>(a);
+  u64 y = Bitcast<u64>(b);
+  return v128(x, x >> 32, y, y >> 32);
+}
+
+// Lane values that are interesting to some instruction: zeroes, NaNs,
+// infinities, the edges of the integer ranges and the float values just
+// inside and outside them.
+std::vector<v128> MakeSimdInputs() {
+  const f32 kF32Inf = std::numeric_limits<f32>::infinity();
+  const f32 kF32Max = std::numeric_limits<f32>::max();
+  const f64 kF64Inf = std::numeric_limits<f64>::infinity();
+  const f64 kF64Max = std::numeric_limits<f64>::max();
+  std::vector<v128> inputs = {
+      v128(0, 0, 0, 0),
+      v128(~0u, ~0u, ~0u, ~0u),
+      v128(0x80808080, 0x80808080, 0x7f7f7f7f, 0x7f7f7f7f),
+      v128(0x00ff00ff, 0xff00ff00, 0x01000100, 0x00010001),
+      v128(0x80007fff, 0xffff0001, 0x80000000, 0x7fffffff),
+      v128(0, 0x80000000, ~0u, 0x7fffffff),
+      v128(1, 0, 0, 0xffffffff),
+      v128(0x00000000, 0x00ff0000, 0x01000000, 0x80000000),
+      MakeF32x4(0.f, -0.f, 1.5f, -2.5f),
+      MakeF32x4(kF32Inf, -kF32Inf, 0.5f, -0.5f),
+      v128(0x7fc00000, 0xffc00000, 0x7f800001, 0x7fa12345),
+      MakeF32x4(kF32Max, -kF32Max, 2.5f, 3.5f),
+      MakeF32x4(2147483648.f, -2147483904.f, 4294967296.f, 4294967040.f),
+      MakeF32x4(2147483520.f, -2147483648.f, 1e-45f, -1.f),
+      MakeF64x2(0., -0.),
+      MakeF64x2(kF64Inf, -kF64Inf),
+      v128(0, 0x7ff80000, 1, 0xfff00000),
+      v128(0x12345678, 0x7ff00000, 0, 0xfff80000),
+      MakeF64x2(2147483647.5, -2147483648.9),
+      MakeF64x2(4294967295.7, 4294967296.),
+      MakeF64x2(kF64Max, 3.4028235677973366e38),
+      MakeF64x2(2.5, -0.5),
+      MakeF64x2(1e-310, -1.),
+  };
+  u32 seed = 1;
+  auto random = [&]() {
+    seed = seed * 1103515245 + 12345;
+    return seed;
+  };
+  for (int i = 0; i < 12; ++i) {
+    inputs.push_back(v128(random(), random(), random(), random()));
+  }
+  return inputs;
+}
+
+}  // namespace
+
+TEST_F(InterpTest, SimdKernels) {
+  const SimdKernels& kernels = GetNativeSimdKernels();
+  std::vector<Opcode> opcodes;
+  for (u32 i = 0; i < Opcode::Invalid; ++i) {
+    if (kernels.unop[i] || kernels.binop[i] || kernels.ternop[i] ||
+        kernels.shift[i] || kernels.test[i]) {
+      opcodes.push_back(static_cast<Opcode::Enum>(i));
+    }
+  }
+  ReadModule(MakeOpcodeModule(opcodes));
+  Instantiate();
+
+  Thread::Options portable_options;
+  portable_options.native_simd = false;
+  Thread::Ptr native = Thread::New(store_, Thread::Options());
+  Thread::Ptr portable = Thread::New(store_, portable_options);
+
+  std::vector<v128> inputs = MakeSimdInputs();
+  const u32 kShifts[] = {0, 1, 7, 8, 9, 15, 16, 31, 32, 33, 63, 64, 127, ~0u};
+
+  // Runs each opcode on every combination of inputs, and checks that the
+  // kernel gives the same bits as the lane-at-a-time code.
+  for (u32 i = 0; i < opcodes.size(); ++i) {
+    Opcode op = opcodes[i];
+    auto func = GetFuncExport(i);
+    auto check = [&](const Values& params) {
+      Values expected, actual;
+      Trap::Ptr trap;
+      ASSERT_EQ(Result::Ok, func->Call(*portable, params, expected, &trap));
+      ASSERT_EQ(Result::Ok, func->Call(*native, params, actual, &trap));
+      if (op.GetResultType() == Type::V128) {
+        v128 e = expected[0].Get<v128>();
+        v128 a = actual[0].Get<v128>();
+        EXPECT_TRUE(e == a)
+            << op.GetName() << ": expected " << std::hex << e.u64(1) << ":"
+            << e.u64(0) << ", got " << a.u64(1) << ":" << a.u64(0);
+      } else {
+        EXPECT_EQ(expected[0].Get<u32>(), actual[0].Get<u32>())
+            << op.GetName();
+      }
+    };
+
+    for (v128 a : inputs) {
+      if (op.GetParamType2() == Type::Void) {
+        check({Value::Make(a)});
+      } else if (op.GetParamType2() == Type::I32) {
+        for (u32 shift : kShifts) {
+          check({Value::Make(a), Value::Make(shift)});
+        }
+      } else {
+        for (v128 b : inputs) {
+          if (op.GetParamType3() == Type::Void) {
+            check({Value::Make(a), Value::Make(b)});
+          } else {
+            check({Value::Make(a), Value::Make(b), Value::Make(inputs[0])});
+            check({Value::Make(a), Value::Make(b), Value::Make(b)});
+          }
+        }
+      }
+    }
+  }
+}
+
 class InterpGCTest : public InterpTest {
  public:
   void SetUp() override { before_new = store_.object_count(); }
@@ -576,6 +1658,17 @@ TEST_F(InterpGCTest, Collect_Basic) {
   EXPECT_EQ(after_new, store_.object_count());
 }
 
+TEST_F(InterpGCTest, Collect_FinalizerAllocates) {
+  auto foreign = Foreign::New(store_, nullptr);
+  foreign->set_finalizer([this](Object*) { Foreign::New(store_, nullptr); });
+
+  // The finalizer runs while the object's slot is being freed, and may reuse
+  // it.
+  foreign.reset();
+  store_.Collect();
+  EXPECT_EQ(before_new + 1, store_.object_count());
+}
+
 TEST_F(InterpGCTest, Collect_GlobalCycle) {
   auto gt = GlobalType{ValueType::ExternRef, Mutability::Var};
   auto g1 = Global::New(store_, gt, Value::Make(Ref::Null));
@@ -618,6 +1711,57 @@ TEST_F(InterpGCTest, Collect_TableCycle) {
   t3.reset();
 }
 
+TEST_F(InterpGCTest, CollectYoung_Basic) {
+  auto old_foreign = Foreign::New(store_, nullptr);
+  store_.Collect();
+
+  auto young_foreign = Foreign::New(store_, nullptr);
+  auto after_new = store_.object_count();
+  EXPECT_EQ(before_new + 2, after_new);
+
+  // Unreachable young objects are deleted, but old objects are treated as
+  // live until the next full collection.
+  old_foreign.reset();
+  young_foreign.reset();
+  store_.CollectYoung();
+  EXPECT_EQ(before_new + 1, store_.object_count());
+}
+
+TEST_F(InterpGCTest, CollectYoung_TableWriteBarrier) {
+  auto tt = TableType{ValueType::ExternRef, Limits{1}};
+  auto table = Table::New(store_, tt);
+  store_.Collect();
+
+  // The young object is only reachable from the old table.
+  auto foreign = Foreign::New(store_, nullptr);
+  table->Set(store_, 0, foreign->self());
+  Ref ref = foreign->self();
+  foreign.reset();
+  store_.CollectYoung();
+  EXPECT_TRUE(store_.Is<Foreign>(ref));
+
+  // It is old now, so it stays alive even after the table forgets it.
+  table->Set(store_, 0, Ref::Null);
+  store_.CollectYoung();
+  EXPECT_TRUE(store_.Is<Foreign>(ref));
+  store_.Collect();
+  EXPECT_FALSE(store_.Is<Foreign>(ref));
+}
+
+TEST_F(InterpGCTest, CollectYoung_GlobalWriteBarrier) {
+  auto gt = GlobalType{ValueType::ExternRef, Mutability::Var};
+  auto global = Global::New(store_, gt, Value::Make(Ref::Null));
+  store_.Collect();
+
+  // The young object is only reachable from the old global.
+  auto foreign = Foreign::New(store_, nullptr);
+  global->Set(store_, foreign->self());
+  Ref ref = foreign->self();
+  foreign.reset();
+  store_.CollectYoung();
+  EXPECT_TRUE(store_.Is<Foreign>(ref));
+}
+
 TEST_F(InterpGCTest, Collect_Func) {
   ReadModule(s_fac_module);
   Instantiate();
@@ -687,6 +1831,106 @@ TEST_F(InterpGCTest, Collect_InstanceExport) {
   EXPECT_EQ(after_new, store_.object_count());
 }
 
-// TODO: Test for Thread keeping references alive as locals/params/stack values.
-// This requires better tracking of references than currently exists in the
-// interpreter. (see TODOs in Select/LocalGet/GlobalGet)
+TEST_F(InterpGCTest, Collect_ThreadValues) {
+  // (import "" "collect" (func $collect))
+  // (func (export "param") (param externref) (result externref)
+  //   call $collect
+  //   local.get 0)
+  // (func (export "local") (param externref) (result externref)
+  //   (local externref)
+  //   (local.set 1 (local.get 0))
+  //   (local.set 0 (ref.null extern))
+  //   call $collect
+  //   local.get 1)
+  // (func (export "stack") (param externref) (result externref)
+  //   local.get 0
+  //   (local.set 0 (ref.null extern))
+  //   call $collect)
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02,
+      0x60, 0x00, 0x00, 0x60, 0x01, 0x6f, 0x01, 0x6f, 0x02, 0x0c, 0x01,
+      0x00, 0x07, 0x63, 0x6f, 0x6c, 0x6c, 0x65, 0x63, 0x74, 0x00, 0x00,
+      0x03, 0x04, 0x03, 0x01, 0x01, 0x01, 0x07, 0x19, 0x03, 0x05, 0x70,
+      0x61, 0x72, 0x61, 0x6d, 0x00, 0x01, 0x05, 0x6c, 0x6f, 0x63, 0x61,
+      0x6c, 0x00, 0x02, 0x05, 0x73, 0x74, 0x61, 0x63, 0x6b, 0x00, 0x03,
+      0x0a, 0x24, 0x03, 0x06, 0x00, 0x10, 0x00, 0x20, 0x00, 0x0b, 0x10,
+      0x01, 0x01, 0x6f, 0x20, 0x00, 0x21, 0x01, 0xd0, 0x6f, 0x21, 0x00,
+      0x10, 0x00, 0x20, 0x01, 0x0b, 0x0a, 0x00, 0x20, 0x00, 0xd0, 0x6f,
+      0x21, 0x00, 0x10, 0x00, 0x0b,
+  });
+  auto collect =
+      HostFunc::New(store_, FuncType{{}, {}},
+                    [](Thread& thread, const Values&, Values&,
+                       Trap::Ptr*) -> Result {
+                      thread.store().Collect();
+                      return Result::Ok;
+                    });
+  Instantiate({collect->self()});
+
+  for (interp::Index i = 0; i < 3; ++i) {
+    // While the host function runs, the object is only referenced from the
+    // wasm function's parameter, local or operand stack.
+    Ref ref = Foreign::New(store_, nullptr)->self();
+
+    Values results;
+    Trap::Ptr trap;
+    Result result =
+        GetFuncExport(i)->Call(store_, {Value::Make(ref)}, results, &trap);
+    ASSERT_EQ(Result::Ok, result);
+    ASSERT_EQ(1u, results.size());
+    EXPECT_EQ(ref, results[0].Get<Ref>());
+    EXPECT_TRUE(store_.Is<Foreign>(ref));
+  }
+}
+
+TEST_F(InterpGCTest, CollectYoung_ThreadValues) {
+  // (import "" "collect" (func $collect))
+  // (import "" "new" (func $new (result externref)))
+  // (import "" "collect_young" (func $collect_young))
+  // (func (export "f") (result externref)
+  //   call $collect
+  //   call $new
+  //   call $collect_young)
+  ReadModule({
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x08, 0x02,
+      0x60, 0x00, 0x00, 0x60, 0x00, 0x01, 0x6f, 0x02, 0x24, 0x03, 0x00,
+      0x07, 0x63, 0x6f, 0x6c, 0x6c, 0x65, 0x63, 0x74, 0x00, 0x00, 0x00,
+      0x03, 0x6e, 0x65, 0x77, 0x00, 0x01, 0x00, 0x0d, 0x63, 0x6f, 0x6c,
+      0x6c, 0x65, 0x63, 0x74, 0x5f, 0x79, 0x6f, 0x75, 0x6e, 0x67, 0x00,
+      0x00, 0x03, 0x02, 0x01, 0x01, 0x07, 0x05, 0x01, 0x01, 0x66, 0x00,
+      0x03, 0x0a, 0x0a, 0x01, 0x08, 0x00, 0x10, 0x00, 0x10, 0x01, 0x10,
+      0x02, 0x0b,
+  });
+  auto collect =
+      HostFunc::New(store_, FuncType{{}, {}},
+                    [](Thread& thread, const Values&, Values&,
+                       Trap::Ptr*) -> Result {
+                      thread.store().Collect();
+                      return Result::Ok;
+                    });
+  auto new_foreign =
+      HostFunc::New(store_, FuncType{{}, {ValueType::ExternRef}},
+                    [](Thread& thread, const Values&, Values& results,
+                       Trap::Ptr*) -> Result {
+                      results[0] = Value::Make(
+                          Foreign::New(thread.store(), nullptr)->self());
+                      return Result::Ok;
+                    });
+  auto collect_young =
+      HostFunc::New(store_, FuncType{{}, {}},
+                    [](Thread& thread, const Values&, Values&,
+                       Trap::Ptr*) -> Result {
+                      thread.store().CollectYoung();
+                      return Result::Ok;
+                    });
+  Instantiate({collect->self(), new_foreign->self(), collect_young->self()});
+
+  // The thread is old by the time the foreign object is created, and the
+  // object is only referenced from the thread's operand stack.
+  Values results;
+  Trap::Ptr trap;
+  Result result = GetFuncExport(0)->Call(store_, {}, results, &trap);
+  ASSERT_EQ(Result::Ok, result);
+  ASSERT_EQ(1u, results.size());
+  EXPECT_TRUE(store_.Is<Foreign>(results[0].Get<Ref>()));
+}
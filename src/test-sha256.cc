@@ -0,0 +1,60 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include "src/sha256.h"
+
+using namespace wabt;
+
+namespace {
+
+std::string Sha256Hex(const std::string& data) {
+  Sha256Digest digest = Sha256(data.data(), data.size());
+  std::string result;
+  for (uint8_t byte : digest) {
+    const char kHexDigits[] = "0123456789abcdef";
+    result += kHexDigits[byte >> 4];
+    result += kHexDigits[byte & 15];
+  }
+  return result;
+}
+
+}  // end anonymous namespace
+
+// Test vectors from FIPS 180-4 and NIST's example values.
+TEST(Sha256, Empty) {
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            Sha256Hex(""));
+}
+
+TEST(Sha256, OneBlock) {
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            Sha256Hex("abc"));
+}
+
+TEST(Sha256, TwoBlocks) {
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            Sha256Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnop"
+                      "nopq"));
+}
+
+TEST(Sha256, Long) {
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            Sha256Hex(std::string(1000000, 'a')));
+}
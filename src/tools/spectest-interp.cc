@@ -45,6 +45,8 @@ using namespace wabt::interp;
 static int s_verbose;
 static std::string s_infile;
 static Thread::Options s_thread_options;
+static CompileOptions s_compile_options;
+static Store::Options s_store_options;
 static Stream* s_trace_stream;
 static Features s_features;
 
@@ -73,7 +75,7 @@ static void ParseOptions(int argc, char** argv) {
   });
   s_features.AddOptions(&parser);
   parser.AddOption('V', "value-stack-size", "SIZE",
-                   "Size in elements of the value stack",
+                   "Size in 8-byte slots of the value stack",
                    [](const std::string& argument) {
                      // TODO(binji): validate.
                      s_thread_options.value_stack_size = atoi(argument.c_str());
@@ -86,6 +88,24 @@ static void ParseOptions(int argc, char** argv) {
                    });
   parser.AddOption('t', "trace", "Trace execution",
                    []() { s_trace_stream = s_stdout_stream.get(); });
+  parser.AddOption("no-fusion",
+                   "Disable fusing common instruction sequences into "
+                   "superinstructions",
+                   []() { s_compile_options.fuse_instructions = false; });
+  parser.AddOption("guard-pages",
+                   "Back 32-bit memories with guard pages instead of "
+                   "bounds-checking each access",
+                   []() { s_store_options.guard_pages = true; });
+  parser.AddOption("jit",
+                   "Compile each function to machine code before it first "
+                   "runs",
+                   []() {
+                     s_store_options.jit = true;
+                     s_store_options.jit_threshold = 0;
+                   });
+  parser.AddOption("threaded",
+                   "Run functions from pre-decoded, direct-threaded code",
+                   []() { s_store_options.threaded = true; });
 
   parser.AddArgument("filename", OptionParser::ArgumentCount::One,
                      [](const char* argument) {
@@ -1224,7 +1244,7 @@ class CommandRunner {
   std::string source_filename_;
 };
 
-CommandRunner::CommandRunner() : store_(s_features) {
+CommandRunner::CommandRunner() : store_(s_features, s_store_options) {
   auto&& spectest = registry_["spectest"];
 
   // Initialize print functions for the spec test.
@@ -1415,8 +1435,8 @@ interp::Module::Ptr CommandRunner::ReadModule(string_view module_filename,
                             kStopOnFirstError, kFailOnCustomSectionError);
   ModuleDesc module_desc;
   if (Failed(ReadBinaryInterp(module_filename, file_data.data(),
-                              file_data.size(), options, errors,
-                              &module_desc))) {
+                              file_data.size(), options, s_compile_options,
+                              errors, &module_desc))) {
     return {};
   }
 
@@ -1424,7 +1444,7 @@ interp::Module::Ptr CommandRunner::ReadModule(string_view module_filename,
     module_desc.istream.Disassemble(s_stdout_stream.get());
   }
 
-  return interp::Module::New(store_, module_desc);
+  return interp::Module::New(store_, std::move(module_desc));
 }
 
 wabt::Result CommandRunner::ReadInvalidModule(int line_number,
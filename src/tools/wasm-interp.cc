@@ -15,21 +15,34 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "src/binary-reader.h"
 #include "src/error-formatter.h"
 #include "src/feature.h"
 #include "src/interp/binary-reader-interp.h"
+#include "src/interp/interp-profile.h"
+#include "src/interp/interp-serialize.h"
 #include "src/interp/interp-util.h"
 #include "src/interp/interp-wasi.h"
 #include "src/interp/interp.h"
+#include "src/make-unique.h"
 #include "src/option-parser.h"
+#include "src/sha256.h"
 #include "src/stream.h"
 
 #ifdef WITH_WASI
@@ -42,8 +55,17 @@ using namespace wabt::interp;
 static int s_verbose;
 static const char* s_infile;
 static Thread::Options s_thread_options;
+static CompileOptions s_compile_options;
+static Store::Options s_store_options;
 static Stream* s_trace_stream;
+static bool s_profile;
+static u32 s_profile_interval = Profiler::kDefaultSampleInterval;
+static std::string s_profile_folded_filename;
+static std::string s_cache_dir;
+static u32 s_timeout_ms;
+static std::atomic<bool> s_interrupt;
 static bool s_run_all_exports;
+static bool s_snapshot;
 static bool s_host_print;
 static bool s_dummy_import_func;
 static Features s_features;
@@ -51,12 +73,44 @@ static bool s_wasi;
 static std::vector<std::string> s_wasi_env;
 static std::vector<std::string> s_wasi_argv;
 static std::vector<std::string> s_wasi_dirs;
+static u32 s_wasi_output_buffer_size;
+static bool s_wasi_line_buffered;
 
 static std::unique_ptr<FileStream> s_log_stream;
 static std::unique_ptr<FileStream> s_stdout_stream;
 static std::unique_ptr<FileStream> s_stderr_stream;
 
-static Store s_store;
+static std::unique_ptr<Store> s_store;
+static std::unique_ptr<Profiler> s_profiler;
+
+#ifdef WITH_WASI
+static uvwasi_t* s_uvwasi;
+
+static WasiOptions GetWasiOptions() {
+  WasiOptions options;
+  options.output_buffer_size = s_wasi_output_buffer_size;
+  options.line_buffered = s_wasi_line_buffered;
+  return options;
+}
+#endif
+
+// Threads started by the guest, in the style of wasi-threads: a module that
+// imports "wasi" "thread-spawn" can start a thread that calls its exported
+// "wasi_thread_start" function. Each thread runs on its own OS thread with its
+// own Store, and instantiates the module again with the same shared memories.
+//
+// As in wasi-threads, the threads are never joined: the process ends when the
+// main thread is done, and a trap in any thread ends it with an error.
+struct GuestThreads {
+  SharedModuleDesc module_desc;
+  // The imported shared memories, created for the main thread.
+  std::vector<SharedMemory> memories;
+  std::atomic<u32> next_id{1};
+};
+
+static GuestThreads s_guest_threads;
+
+static const size_t kProfileTopCount = 20;
 
 static const char s_description[] =
     R"(  read a file in the wasm binary format, and run in it a stack-based
@@ -73,10 +127,33 @@ examples:
   $ wasm-interp test.wasm --run-all-exports --trace
 
   # parse test.wasm and run all its exported functions, setting the
-  # value stack size to 100 elements
+  # value stack size to 100 slots
   $ wasm-interp test.wasm -V 100 --run-all-exports
+
+  # run a WASI program, print its hottest functions and write a flame graph
+  $ wasm-interp test.wasm --wasi --profile-folded=out.folded
+  $ flamegraph.pl out.folded > out.svg
 )";
 
+// Parses the argument of a numeric option. A value that isn't a decimal
+// number in [min_value, max_value] is reported through `parser`.
+static u64 ParseUnsignedOption(OptionParser& parser,
+                               const char* name,
+                               const std::string& argument,
+                               u64 min_value,
+                               u64 max_value) {
+  const char* str = argument.c_str();
+  char* end;
+  errno = 0;
+  u64 value = strtoull(str, &end, 10);
+  // strtoull accepts leading whitespace and a sign, so check the first char.
+  if (!isdigit(static_cast<unsigned char>(str[0])) || *end != '\0' ||
+      errno == ERANGE || value < min_value || value > max_value) {
+    parser.Errorf("invalid argument '%s' for option '--%s'", str, name);
+  }
+  return value;
+}
+
 static void ParseOptions(int argc, char** argv) {
   OptionParser parser("wasm-interp", s_description);
 
@@ -86,7 +163,7 @@ static void ParseOptions(int argc, char** argv) {
   });
   s_features.AddOptions(&parser);
   parser.AddOption('V', "value-stack-size", "SIZE",
-                   "Size in elements of the value stack",
+                   "Size in 8-byte slots of the value stack",
                    [](const std::string& argument) {
                      // TODO(binji): validate.
                      s_thread_options.value_stack_size = atoi(argument.c_str());
@@ -99,6 +176,81 @@ static void ParseOptions(int argc, char** argv) {
                    });
   parser.AddOption('t', "trace", "Trace execution",
                    []() { s_trace_stream = s_stdout_stream.get(); });
+  parser.AddOption("profile",
+                   "Sample the call stack while running, and print the "
+                   "functions that ran the most instructions to stderr",
+                   []() { s_profile = true; });
+  parser.AddOption('\0', "profile-interval", "N",
+                   "Sample the call stack every N instructions (default "
+                   "10000). Implies --profile",
+                   [&](const std::string& argument) {
+                     s_profile = true;
+                     s_profile_interval = ParseUnsignedOption(
+                         parser, "profile-interval", argument, 1, UINT32_MAX);
+                   });
+  parser.AddOption('\0', "profile-folded", "FILENAME",
+                   "Write the sampled call stacks to FILENAME in the folded "
+                   "format used by flamegraph.pl. Implies --profile",
+                   [](const std::string& argument) {
+                     s_profile = true;
+                     s_profile_folded_filename = argument;
+                   });
+  parser.AddOption('\0', "cache-dir", "DIR",
+                   "Cache compiled modules in DIR, and load them from there "
+                   "instead of compiling them again",
+                   [](const std::string& argument) { s_cache_dir = argument; });
+  parser.AddOption("no-fusion",
+                   "Disable fusing common instruction sequences into "
+                   "superinstructions",
+                   []() { s_compile_options.fuse_instructions = false; });
+  parser.AddOption("lazy-compile",
+                   "Validate and compile each function when it is first "
+                   "called, instead of when the module is loaded",
+                   []() { s_compile_options.lazy = true; });
+  parser.AddOption('\0', "compile-threads", "N",
+                   "Validate and compile function bodies on N threads",
+                   [&](const std::string& argument) {
+                     s_compile_options.num_threads = ParseUnsignedOption(
+                         parser, "compile-threads", argument, 1, UINT32_MAX);
+                   });
+  parser.AddOption('\0', "fuel", "N",
+                   "Count the instructions run by each function call, and "
+                   "trap after about N",
+                   [&](const std::string& argument) {
+                     s_compile_options.fuel_metering = true;
+                     s_thread_options.fuel = ParseUnsignedOption(
+                         parser, "fuel", argument, 0, UINT64_MAX);
+                   });
+  parser.AddOption('\0', "timeout", "MS",
+                   "Trap if the module runs for longer than MS milliseconds",
+                   [&](const std::string& argument) {
+                     s_timeout_ms = ParseUnsignedOption(
+                         parser, "timeout", argument, 1, UINT32_MAX);
+                   });
+  parser.AddOption("guard-pages",
+                   "Back 32-bit memories with guard pages instead of "
+                   "bounds-checking each access",
+                   []() { s_store_options.guard_pages = true; });
+  parser.AddOption('\0', "memory-pool-size", "N",
+                   "Keep the address ranges of up to N memories reserved "
+                   "for reuse",
+                   [&](const std::string& argument) {
+                     s_store_options.memory_pool_size = ParseUnsignedOption(
+                         parser, "memory-pool-size", argument, 0, UINT32_MAX);
+                   });
+  parser.AddOption('\0', "memory-pool-max-pages", "N",
+                   "Size of each pooled range in pages, unless "
+                   "--guard-pages is given",
+                   [&](const std::string& argument) {
+                     s_store_options.memory_pool_max_pages =
+                         ParseUnsignedOption(parser, "memory-pool-max-pages",
+                                             argument, 1, WABT_MAX_PAGES32);
+                   });
+  parser.AddOption("jit", "Compile hot functions to machine code",
+                   []() { s_store_options.jit = true; });
+  parser.AddOption("threaded",
+                   "Run functions from pre-decoded, direct-threaded code",
+                   []() { s_store_options.threaded = true; });
   parser.AddOption("wasi",
                    "Assume input module is WASI compliant (Export "
                    " WASI API the the module and invoke _start function)",
@@ -110,10 +262,25 @@ static void ParseOptions(int argc, char** argv) {
   parser.AddOption(
       'd', "dir", "DIR", "Pass the given directory the the WASI runtime",
       [](const std::string& argument) { s_wasi_dirs.push_back(argument); });
+  parser.AddOption('\0', "wasi-output-buffer", "SIZE",
+                   "Collect WASI writes to stdout and stderr in a buffer of "
+                   "SIZE bytes",
+                   [&](const std::string& argument) {
+                     s_wasi_output_buffer_size = ParseUnsignedOption(
+                         parser, "wasi-output-buffer", argument, 0, UINT32_MAX);
+                   });
+  parser.AddOption("wasi-line-buffered",
+                   "Also write out buffered WASI output at each newline",
+                   []() { s_wasi_line_buffered = true; });
   parser.AddOption(
       "run-all-exports",
       "Run all the exported functions, in order. Useful for testing",
       []() { s_run_all_exports = true; });
+  parser.AddOption("snapshot",
+                   "With --run-all-exports, run each function in a new "
+                   "instance, copied from a snapshot of the module taken "
+                   "after its start function",
+                   []() { s_snapshot = true; });
   parser.AddOption("host-print",
                    "Include an importable function named \"host.print\" for "
                    "printing to stdout",
@@ -132,10 +299,12 @@ static void ParseOptions(int argc, char** argv) {
   parser.Parse(argc, argv);
 }
 
-Result RunAllExports(const Instance::Ptr& instance, Errors* errors) {
+Result RunAllExports(const Instance::Ptr& instance,
+                     const InstanceSnapshot::Ptr& snapshot,
+                     Errors* errors) {
   Result result = Result::Ok;
 
-  auto module = s_store.UnsafeGet<Module>(instance->module());
+  auto module = s_store->UnsafeGet<Module>(instance->module());
   auto&& module_desc = module->desc();
 
   for (auto&& export_ : module_desc.exports) {
@@ -148,11 +317,15 @@ Result RunAllExports(const Instance::Ptr& instance, Errors* errors) {
         s_trace_stream->Writef(">>> running export \"%s\":\n",
                                export_.type.name.c_str());
       }
-      auto func = s_store.UnsafeGet<Func>(instance->funcs()[export_.index]);
+      Instance::Ptr export_instance =
+          snapshot ? snapshot->Instantiate(*s_store) : instance;
+      auto func =
+          s_store->UnsafeGet<Func>(export_instance->funcs()[export_.index]);
       Values params;
       Values results;
       Trap::Ptr trap;
-      result |= func->Call(s_store, params, results, &trap, s_trace_stream);
+      Thread::Ptr thread = Thread::New(*s_store, s_thread_options);
+      result |= func->Call(*thread, params, results, &trap);
       WriteCall(s_stdout_stream.get(), export_.type.name, *func_type, params,
                 results, trap);
     }
@@ -161,10 +334,86 @@ Result RunAllExports(const Instance::Ptr& instance, Errors* errors) {
   return result;
 }
 
+static void RunGuestThread(u32 id, u32 start_arg);
+
+static Result SpawnGuestThread(Thread& thread,
+                               const Values& params,
+                               Values& results,
+                               Trap::Ptr* trap) {
+  u32 id = s_guest_threads.next_id++;
+  std::thread(RunGuestThread, id, params[0].Get<u32>()).detach();
+  results[0] = Value::Make(id);
+  return Result::Ok;
+}
+
+// Binds the imports that guest threads need: the shared memories, which the
+// host provides, and "wasi" "thread-spawn". The other imports are left null.
+static void BindThreadImports(const Module::Ptr& module, RefVec& imports) {
+  Store& store = *module.store();
+  auto&& module_imports = module->desc().imports;
+  imports.resize(module_imports.size(), Ref::Null);
+
+  Index memory_index = 0;
+  for (Index i = 0; i < module_imports.size(); ++i) {
+    auto&& import = module_imports[i];
+    if (auto* memory_type = dyn_cast<MemoryType>(import.type.type.get())) {
+      if (!memory_type->limits.is_shared) {
+        continue;
+      }
+      // The main thread binds its imports before it can start other threads,
+      // so `memories` doesn't change once they run.
+      auto& memories = s_guest_threads.memories;
+      if (memory_index == memories.size()) {
+        memories.push_back(Memory::New(store, *memory_type)->shared());
+      }
+      imports[i] = Memory::New(store, memories[memory_index++]).ref();
+    } else if (import.type.module == "wasi" &&
+               import.type.name == "thread-spawn" &&
+               import.type.type->kind == ExternKind::Func) {
+      auto func_type = *cast<FuncType>(import.type.type.get());
+      if (func_type.params == ValueTypes{ValueType::I32} &&
+          func_type.results == ValueTypes{ValueType::I32}) {
+        imports[i] = HostFunc::New(store, func_type, SpawnGuestThread).ref();
+      }
+    }
+  }
+}
+
+// Guest threads share the main thread's ModuleDesc, and a lazily compiled
+// module adds to its ModuleDesc when a function is first called. So a module
+// that can start threads has all of its functions compiled before it runs.
+static Result CompileForGuestThreads(const Module::Ptr& module) {
+  auto&& desc = module->desc();
+  if (!desc.lazy_compiler ||
+      std::none_of(desc.imports.begin(), desc.imports.end(),
+                   [](const ImportDesc& import) {
+                     return import.type.module == "wasi" &&
+                            import.type.name == "thread-spawn";
+                   })) {
+    return Result::Ok;
+  }
+  for (auto&& func : desc.funcs) {
+    std::string message;
+    if (Failed(module->CompileFunc(func, &message))) {
+      s_stderr_stream->Writef("error: %s\n", message.c_str());
+      return Result::Error;
+    }
+  }
+  return Result::Ok;
+}
+
 static void BindImports(const Module::Ptr& module, RefVec& imports) {
   auto* stream = s_stdout_stream.get();
+  Store& store = *module.store();
+  auto&& module_imports = module->desc().imports;
+  imports.resize(module_imports.size(), Ref::Null);
+
+  for (Index i = 0; i < module_imports.size(); ++i) {
+    auto&& import = module_imports[i];
+    if (imports[i] != Ref::Null) {
+      continue;
+    }
 
-  for (auto&& import : module->desc().imports) {
     if (import.type.type->kind == ExternKind::Func &&
         ((s_host_print && import.type.module == "host" &&
           import.type.name == "print") ||
@@ -174,20 +423,97 @@ static void BindImports(const Module::Ptr& module, RefVec& imports) {
                                       import.type.name.c_str());
 
       auto host_func = HostFunc::New(
-          s_store, func_type,
+          store, func_type,
           [=](Thread& thread, const Values& params, Values& results,
               Trap::Ptr* trap) -> Result {
             printf("called host ");
             WriteCall(stream, import_name, func_type, params, results, *trap);
             return Result::Ok;
           });
-      imports.push_back(host_func.ref());
-      continue;
+      imports[i] = host_func.ref();
     }
 
-    // By default, just push an null reference. This won't resolve, and
+    // By default, leave a null reference. This won't resolve, and
     // instantiation will fail.
-    imports.push_back(Ref::Null);
+  }
+}
+
+// The cache key covers everything that affects the compiled module: the
+// binary, the enabled features and the compile options. It is stored at the
+// start of the cache file, and checked before the entry is used.
+struct CacheKey {
+  u64 source_size;
+  u64 options;
+  Sha256Digest digest;
+};
+
+static CacheKey GetCacheKey(const std::vector<uint8_t>& file_data) {
+  CacheKey key;
+  key.source_size = file_data.size();
+  key.options = 0;
+  int bit = 0;
+#define WABT_FEATURE(variable, flag, default_, help) \
+  key.options |= u64(s_features.variable##_enabled()) << bit++;
+#include "src/feature.def"
+#undef WABT_FEATURE
+  key.options |= u64(s_compile_options.fuse_instructions) << bit++;
+  key.options |= u64(s_compile_options.fuel_metering) << bit++;
+  key.digest = Sha256(file_data.data(), file_data.size());
+  return key;
+}
+
+static std::string GetCacheFilename(const CacheKey& key) {
+  std::string filename = s_cache_dir + "/";
+  for (uint8_t byte : key.digest) {
+    filename += StringPrintf("%02x", byte);
+  }
+  return filename + StringPrintf("-%016" PRIx64 ".wabtc", key.options);
+}
+
+static bool ReadCachedModule(const std::string& filename,
+                             const CacheKey& key,
+                             ModuleDesc* out_module_desc) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  fclose(file);
+
+  // A cache file that is stale, or was only partially written, fails to load
+  // and is replaced. The file name is only a hint; the key stored in the file
+  // must match the source exactly.
+  std::vector<uint8_t> data;
+  if (Failed(ReadFile(filename, &data)) || data.size() < sizeof(key) ||
+      memcmp(data.data(), &key, sizeof(key)) != 0) {
+    return false;
+  }
+  return Succeeded(ReadModuleDesc(data.data() + sizeof(key),
+                                  data.size() - sizeof(key), out_module_desc));
+}
+
+static void WriteCachedModule(const std::string& filename,
+                              const CacheKey& key,
+                              const ModuleDesc& module_desc) {
+  std::vector<u8> data;
+  WriteModuleDesc(module_desc, &data);
+
+  // Write to a temporary file and rename it, so a concurrent reader doesn't
+  // see the file before it is complete.
+  std::string temp_filename = filename + ".tmp";
+  Result result;
+  {
+    FileStream stream(temp_filename);
+    if (!stream.is_open()) {
+      return;
+    }
+    stream.WriteData(&key, sizeof(key));
+    stream.WriteData(data.data(), data.size());
+    result = stream.result();
+  }
+  if (Succeeded(result)) {
+    rename(temp_filename.c_str(), filename.c_str());
+  } else {
+    remove(temp_filename.c_str());
   }
 }
 
@@ -199,20 +525,35 @@ static Result ReadModule(const char* module_filename,
   CHECK_RESULT(ReadFile(module_filename, &file_data));
 
   ModuleDesc module_desc;
-  const bool kReadDebugNames = true;
-  const bool kStopOnFirstError = true;
-  const bool kFailOnCustomSectionError = true;
-  ReadBinaryOptions options(s_features, s_log_stream.get(), kReadDebugNames,
-                            kStopOnFirstError, kFailOnCustomSectionError);
-  CHECK_RESULT(ReadBinaryInterp(module_filename, file_data.data(),
-                                file_data.size(), options, errors,
-                                &module_desc));
+  CacheKey cache_key;
+  std::string cache_filename;
+  if (!s_cache_dir.empty()) {
+    cache_key = GetCacheKey(file_data);
+    cache_filename = GetCacheFilename(cache_key);
+  }
+
+  if (cache_filename.empty() ||
+      !ReadCachedModule(cache_filename, cache_key, &module_desc)) {
+    const bool kReadDebugNames = true;
+    const bool kStopOnFirstError = true;
+    const bool kFailOnCustomSectionError = true;
+    ReadBinaryOptions options(s_features, s_log_stream.get(), kReadDebugNames,
+                              kStopOnFirstError, kFailOnCustomSectionError);
+    CHECK_RESULT(ReadBinaryInterp(module_filename, file_data.data(),
+                                  file_data.size(), options, s_compile_options,
+                                  errors, &module_desc));
+    // A lazily compiled module can only be cached once all of its functions
+    // have been compiled, so it is not cached at all.
+    if (!cache_filename.empty() && !s_compile_options.lazy) {
+      WriteCachedModule(cache_filename, cache_key, module_desc);
+    }
+  }
 
   if (s_verbose) {
     module_desc.istream.Disassemble(stream);
   }
 
-  *out_module = Module::New(s_store, module_desc);
+  *out_module = Module::New(*s_store, std::move(module_desc));
   return Result::Ok;
 }
 
@@ -220,7 +561,8 @@ static Result InstantiateModule(RefVec& imports,
                                 const Module::Ptr& module,
                                 Instance::Ptr* out_instance) {
   RefPtr<Trap> trap;
-  *out_instance = Instance::Instantiate(s_store, module.ref(), imports, &trap);
+  *out_instance =
+      Instance::Instantiate(*s_store, module.ref(), imports, &trap);
   if (!*out_instance) {
     WriteTrap(s_stderr_stream.get(), "error initializing module", trap);
     return Result::Error;
@@ -228,6 +570,115 @@ static Result InstantiateModule(RefVec& imports,
   return Result::Ok;
 }
 
+// Ends the process without joining the guest threads, or destroying anything
+// that they may still be using.
+[[noreturn]] static void ExitProcess(int status) {
+  fflush(stdout);
+  fflush(stderr);
+  _Exit(status);
+}
+
+static void RunGuestThread(u32 id, u32 start_arg) {
+  Store store(s_features, s_store_options);
+  Module::Ptr module = Module::New(store, s_guest_threads.module_desc);
+  RefVec imports;
+  BindThreadImports(module, imports);
+#ifdef WITH_WASI
+  if (s_wasi) {
+    if (Failed(WasiBindImports(module, imports, s_stderr_stream.get(),
+                               nullptr))) {
+      ExitProcess(1);
+    }
+  } else
+#endif
+  {
+    BindImports(module, imports);
+  }
+
+  RefPtr<Trap> trap;
+  Instance::Ptr instance =
+      Instance::Instantiate(store, module.ref(), imports, &trap);
+  if (!instance) {
+    WriteTrap(s_stderr_stream.get(), "error initializing thread", trap);
+    ExitProcess(1);
+  }
+
+  Func::Ptr start;
+  for (auto&& export_ : module->desc().exports) {
+    if (export_.type.name == "wasi_thread_start" &&
+        export_.type.type->kind == ExternalKind::Func) {
+      start = store.UnsafeGet<Func>(instance->funcs()[export_.index]);
+    }
+  }
+  if (!start || start->type().params != ValueTypes{ValueType::I32,
+                                                    ValueType::I32}) {
+    s_stderr_stream->Writef("error: wasi_thread_start export not found\n");
+    ExitProcess(1);
+  }
+
+  // The profiler and the trace stream aren't thread-safe, so they only cover
+  // the main thread.
+  Thread::Options thread_options = s_thread_options;
+  thread_options.trace_stream = nullptr;
+  thread_options.profiler = nullptr;
+
+  Values params = {Value::Make(id), Value::Make(start_arg)};
+  Values results;
+#ifdef WITH_WASI
+  if (s_wasi) {
+    // Output isn't buffered, since it would be lost if the process ends while
+    // this thread is still running.
+    WasiOptions wasi_options = GetWasiOptions();
+    wasi_options.output_buffer_size = 0;
+    if (Failed(WasiRunFunc(instance, start, params, results, s_uvwasi,
+                           s_stderr_stream.get(), thread_options,
+                           wasi_options))) {
+      ExitProcess(1);
+    }
+    return;
+  }
+#endif
+  Thread::Ptr thread = Thread::New(store, thread_options);
+  start->Call(*thread, params, results, &trap);
+  if (trap) {
+    WriteTrap(s_stderr_stream.get(), "error in thread", trap);
+    ExitProcess(1);
+  }
+}
+
+// Sets s_interrupt after --timeout, unless the program finishes first.
+class Watchdog {
+ public:
+  explicit Watchdog(u32 timeout_ms) {
+    if (timeout_ms) {
+      thread_ = std::thread([this, timeout_ms]() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                            [this]() { return done_; })) {
+          s_interrupt = true;
+        }
+      });
+    }
+  }
+
+  ~Watchdog() {
+    if (thread_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+      }
+      cond_.notify_one();
+      thread_.join();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool done_ = false;
+  std::thread thread_;
+};
+
 static Result ReadAndRunModule(const char* module_filename) {
   Errors errors;
   Module::Ptr module;
@@ -237,10 +688,14 @@ static Result ReadAndRunModule(const char* module_filename) {
     return result;
   }
 
+  CHECK_RESULT(CompileForGuestThreads(module));
+  s_guest_threads.module_desc = module->shared_desc();
   RefVec imports;
+  BindThreadImports(module, imports);
 
 #if WITH_WASI
   uvwasi_t uvwasi;
+  s_uvwasi = &uvwasi;
 #endif
 
   if (s_wasi) {
@@ -305,17 +760,41 @@ static Result ReadAndRunModule(const char* module_filename) {
   Instance::Ptr instance;
   CHECK_RESULT(InstantiateModule(imports, module, &instance));
 
+  InstanceSnapshot::Ptr snapshot;
+  if (s_snapshot) {
+    RefPtr<Trap> trap;
+    snapshot = InstanceSnapshot::New(*s_store, instance.ref(), &trap);
+    if (!snapshot) {
+      WriteTrap(s_stderr_stream.get(), "error creating snapshot", trap);
+      return Result::Error;
+    }
+  }
+
   if (s_run_all_exports) {
-    RunAllExports(instance, &errors);
+    RunAllExports(instance, snapshot, &errors);
   }
 #ifdef WITH_WASI
   if (s_wasi) {
-    CHECK_RESULT(
-        WasiRunStart(instance, &uvwasi, s_stderr_stream.get(), s_trace_stream));
+    result = WasiRunStart(instance, &uvwasi, s_stderr_stream.get(),
+                          s_thread_options, GetWasiOptions());
   }
 #endif
 
-  return Result::Ok;
+  return result;
+}
+
+static void WriteProfile() {
+  s_stderr_stream->Writef(
+      "profile: %" PRIu64 " samples, sample interval %u\n",
+      s_profiler->sample_count(), s_profiler->sample_interval());
+  s_profiler->WriteTopFunctions(s_stderr_stream.get(), kProfileTopCount);
+
+  if (!s_profile_folded_filename.empty()) {
+    FileStream stream(s_profile_folded_filename);
+    if (stream.is_open()) {
+      s_profiler->WriteFoldedStacks(&stream);
+    }
+  }
 }
 
 int ProgramMain(int argc, char** argv) {
@@ -324,10 +803,29 @@ int ProgramMain(int argc, char** argv) {
   s_stderr_stream = FileStream::CreateStderr();
 
   ParseOptions(argc, argv);
-  s_store.setFeatures(s_features);
+  s_store = MakeUnique<Store>(s_features, s_store_options);
+
+  s_thread_options.trace_stream = s_trace_stream;
+  s_thread_options.interrupt = &s_interrupt;
+  if (s_profile) {
+    s_profiler = MakeUnique<Profiler>(s_profile_interval);
+    s_thread_options.profiler = s_profiler.get();
+  }
 
-  wabt::Result result = ReadAndRunModule(s_infile);
-  return result != wabt::Result::Ok;
+  wabt::Result result;
+  {
+    Watchdog watchdog(s_timeout_ms);
+    result = ReadAndRunModule(s_infile);
+  }
+  if (s_profiler) {
+    WriteProfile();
+  }
+  int status = result != wabt::Result::Ok;
+  if (s_guest_threads.next_id != 1) {
+    // Guest threads may still be running, or waiting forever.
+    ExitProcess(status);
+  }
+  return status;
 }
 
 int main(int argc, char** argv) {
@@ -130,8 +130,17 @@ bool TypeChecker::IsUnreachable() {
   return label->unreachable;
 }
 
+size_t TypeChecker::type_stack_v128_count(size_t begin) const {
+  if (begin >= type_stack_.size()) {
+    return 0;
+  }
+  size_t below = begin > 0 ? type_stack_v128_counts_[begin - 1] : 0;
+  return type_stack_v128_counts_.back() - below;
+}
+
 void TypeChecker::ResetTypeStackToLabel(Label* label) {
   type_stack_.resize(label->type_stack_limit);
+  type_stack_v128_counts_.resize(label->type_stack_limit);
 }
 
 Result TypeChecker::SetUnreachable() {
@@ -196,12 +205,16 @@ Result TypeChecker::DropTypes(size_t drop_count) {
     return label->unreachable ? Result::Ok : Result::Error;
   }
   type_stack_.erase(type_stack_.end() - drop_count, type_stack_.end());
+  type_stack_v128_counts_.resize(type_stack_.size());
   return Result::Ok;
 }
 
 void TypeChecker::PushType(Type type) {
   if (type != Type::Void) {
+    size_t v128_count =
+        type_stack_v128_counts_.empty() ? 0 : type_stack_v128_counts_.back();
     type_stack_.push_back(type);
+    type_stack_v128_counts_.push_back(v128_count + (type == Type::V128));
   }
 }
 
@@ -411,6 +424,7 @@ void TypeChecker::PrintStackIfFailedV(Result result,
 
 Result TypeChecker::BeginFunction(const TypeVector& sig) {
   type_stack_.clear();
+  type_stack_v128_counts_.clear();
   label_stack_.clear();
   PushLabel(LabelType::Func, TypeVector(), sig);
   return Result::Ok;
@@ -851,6 +865,7 @@ Result TypeChecker::OnSelect(const TypeVector& expected) {
     assert(expected.size() == 1);
     result |= CheckType(type1, expected[0]);
     result |= CheckType(type2, expected[0]);
+    result_type = expected[0];
   }
   PrintStackIfFailed(result, "select", result_type, result_type, Type::I32);
   result |= DropTypes(3);
@@ -970,6 +985,7 @@ Result TypeChecker::EndFunction() {
 
 Result TypeChecker::BeginInitExpr(Type type) {
   type_stack_.clear();
+  type_stack_v128_counts_.clear();
   label_stack_.clear();
   PushLabel(LabelType::InitExpr, TypeVector(), {type});
   return Result::Ok;
@@ -53,7 +53,10 @@ class TypeChecker {
     error_callback_ = error_callback;
   }
 
+  const TypeVector& type_stack() const { return type_stack_; }
   size_t type_stack_size() const { return type_stack_.size(); }
+  // Returns the number of v128 values on the type stack at or above `begin`.
+  size_t type_stack_v128_count(size_t begin = 0) const;
 
   bool IsUnreachable();
   Result GetLabel(Index depth, Label** out_label);
@@ -197,6 +200,9 @@ class TypeChecker {
 
   ErrorCallback error_callback_;
   TypeVector type_stack_;
+  // type_stack_v128_counts_[i] is the number of v128 values in
+  // type_stack_[0, i].
+  std::vector<size_t> type_stack_v128_counts_;
   std::vector<Label> label_stack_;
   // Cache the expected br_table signature. It will be initialized to `nullptr`
   // to represent "any".
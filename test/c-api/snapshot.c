@@ -0,0 +1,158 @@
+/*
+ * Copyright 2020 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests wasm_instance_snapshot_new and wasm_instance_new_from_snapshot.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wasm.h"
+#include "src/interp/interp-wasm-c-api.h"
+
+// (module
+//   (memory (export "memory") 1)
+//   (global $count (mut i32) (i32.const 0))
+//   (func (export "bump") (result i32)
+//     (global.set $count (i32.add (global.get $count) (i32.const 1)))
+//     (i32.store (i32.const 0)
+//                (i32.add (i32.load (i32.const 0)) (i32.const 10)))
+//     (global.get $count))
+//   (data (i32.const 0) "\05"))
+static const char kModule[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x05, 0x03, 0x01, 0x00, 0x01,
+    0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x11, 0x02, 0x06,
+    0x6d, 0x65, 0x6d, 0x6f, 0x72, 0x79, 0x02, 0x00, 0x04, 0x62, 0x75, 0x6d,
+    0x70, 0x00, 0x00, 0x0a, 0x1a, 0x01, 0x18, 0x00, 0x23, 0x00, 0x41, 0x01,
+    0x6a, 0x24, 0x00, 0x41, 0x00, 0x41, 0x00, 0x28, 0x02, 0x00, 0x41, 0x0a,
+    0x6a, 0x36, 0x02, 0x00, 0x23, 0x00, 0x0b, 0x0b, 0x07, 0x01, 0x00, 0x41,
+    0x00, 0x0b, 0x01, 0x05,
+};
+
+static int s_failures = 0;
+
+#define CHECK(cond)                                                    \
+  do {                                                                 \
+    if (!(cond)) {                                                     \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      s_failures++;                                                    \
+    }                                                                  \
+  } while (0)
+
+// Calls the exported "bump" function and returns its result, or -1 on a
+// trap.
+static int32_t bump(const wasm_instance_t* instance) {
+  wasm_extern_vec_t exports;
+  wasm_instance_exports(instance, &exports);
+  const wasm_func_t* func = wasm_extern_as_func(exports.data[1]);
+  wasm_val_t results[1];
+  wasm_trap_t* trap = wasm_func_call(func, NULL, results);
+  wasm_extern_vec_delete(&exports);
+  if (trap) {
+    wasm_trap_delete(trap);
+    return -1;
+  }
+  return results[0].of.i32;
+}
+
+// Returns the i32 at address 0 of the exported memory.
+static int32_t load(const wasm_instance_t* instance) {
+  wasm_extern_vec_t exports;
+  wasm_instance_exports(instance, &exports);
+  wasm_memory_t* memory = wasm_extern_as_memory(exports.data[0]);
+  int32_t value;
+  memcpy(&value, wasm_memory_data(memory), sizeof(value));
+  wasm_extern_vec_delete(&exports);
+  return value;
+}
+
+int main(int argc, const char* argv[]) {
+  printf("Initializing...\n");
+  wasm_engine_t* engine = wasm_engine_new();
+  wasm_store_t* store = wasm_store_new(engine);
+
+  printf("Compiling module...\n");
+  wasm_byte_vec_t binary;
+  wasm_byte_vec_new(&binary, sizeof(kModule), kModule);
+  wasm_module_t* module = wasm_module_new(store, &binary);
+  wasm_byte_vec_delete(&binary);
+  if (!module) {
+    printf("> Error compiling module!\n");
+    return 1;
+  }
+
+  printf("Instantiating module...\n");
+  wasm_trap_t* trap = NULL;
+  wasm_instance_t* original = wasm_instance_new(store, module, NULL, &trap);
+  if (!original) {
+    printf("> Error instantiating module!\n");
+    return 1;
+  }
+  CHECK(load(original) == 5);
+  CHECK(bump(original) == 1);
+  CHECK(bump(original) == 2);
+  CHECK(load(original) == 25);
+
+  printf("Taking snapshot...\n");
+  wasm_instance_snapshot_t* snapshot =
+      wasm_instance_snapshot_new(store, original, &trap);
+  if (!snapshot) {
+    printf("> Error taking snapshot!\n");
+    return 1;
+  }
+
+  // Changes to the original after the snapshot must not be visible in the
+  // snapshot.
+  CHECK(bump(original) == 3);
+  CHECK(load(original) == 35);
+
+  printf("Instantiating from snapshot...\n");
+  wasm_instance_t* first = wasm_instance_new_from_snapshot(store, snapshot);
+  wasm_instance_t* second = wasm_instance_new_from_snapshot(store, snapshot);
+  if (!first || !second) {
+    printf("> Error instantiating from snapshot!\n");
+    return 1;
+  }
+
+  // Each new instance starts in the snapshot's state, without running the
+  // data segment again, and owns its memory and globals.
+  CHECK(load(first) == 25);
+  CHECK(bump(first) == 3);
+  CHECK(bump(first) == 4);
+  CHECK(load(first) == 45);
+  CHECK(load(second) == 25);
+  CHECK(bump(second) == 3);
+  CHECK(load(second) == 35);
+  CHECK(bump(original) == 4);
+  CHECK(load(original) == 45);
+
+  printf("Shutting down...\n");
+  wasm_instance_delete(second);
+  wasm_instance_delete(first);
+  wasm_instance_snapshot_delete(snapshot);
+  wasm_instance_delete(original);
+  wasm_module_delete(module);
+  wasm_store_delete(store);
+  wasm_engine_delete(engine);
+
+  if (s_failures) {
+    printf("> %d checks failed!\n", s_failures);
+    return 1;
+  }
+  printf("Done.\n");
+  return 0;
+}
@@ -45,6 +45,12 @@ SKIP_EXAMPLES = [
     'hostref',  # The wasm module is currently invalid (needs subtyping changes)
 ]
 
+# Tests of wabt's own C API extensions, in test/c-api. These are run in
+# addition to the upstream examples.
+WABT_TESTS = [
+    'snapshot',
+]
+
 IS_WINDOWS = sys.platform == 'win32'
 
 
@@ -97,6 +103,7 @@ def main(args):
         return any(e.startswith(skip) for skip in SKIP_EXAMPLES)
 
     to_run = [e for e in upstream_examples if not should_skip(e)]
+    to_run += WABT_TESTS
 
     os.chdir(options.bindir)
     count = 0
@@ -40,6 +40,9 @@ DEFAULT_TIMEOUT = 120    # seconds
 SLOW_TIMEOUT_MULTIPLIER = 3
 
 
+# The commands that --interp-arg applies to.
+INTERP_EXES = ('%(wasm-interp)s', '%(spectest-interp)s')
+
 # default configurations for tests
 TOOLS = {
     'wat2wasm': [
@@ -749,7 +752,10 @@ def RunTest(info, options, variables, verbose_level=0):
     test_result = TestResult()
 
     for cmd_template in info.cmds:
-        cmd = cmd_template.GetCommand(variables, options.arg, verbose_level)
+        extra_args = options.arg
+        if options.interp_arg and cmd_template.args[0] in INTERP_EXES:
+            extra_args = (extra_args or []) + options.interp_arg
+        cmd = cmd_template.GetCommand(variables, extra_args, verbose_level)
         if options.print_cmd:
             print(cmd)
 
@@ -891,6 +897,10 @@ def main(args):
     parser.add_argument('-a', '--arg',
                         help='additional args to pass to executable',
                         action='append')
+    parser.add_argument('--interp-arg',
+                        help='additional args to pass to wasm-interp and '
+                        'spectest-interp',
+                        action='append')
     parser.add_argument('--bindir', metavar='PATH',
                         default=find_exe.GetDefaultPath(),
                         help='directory to search for all executables.')